@@ -1,5 +1,6 @@
 #include "engine.hpp"
 #include "ioxml.hpp"
+#include "coord.hpp"
 #include "dbhandler.hpp"
 
 #include <iostream>
@@ -210,8 +211,8 @@ void MapQueryGen::outputNode( const nodeData_t &nodeData )
     
     m_out << xml::indent << "<node " << xml::attrs (nodeAttrNames, boost::make_tuple(
         nodeData.get<0>(),
-        nodeData.get<1>() / 10000000.0,
-        nodeData.get<2>() / 10000000.0,
+        formatFixed( coord_t( nodeData.get<1>() ) ),
+        formatFixed( coord_t( nodeData.get<2>() ) ),
         nodeData.get<3>(),
         boost::posix_time::to_iso_extended_string( nodeData.get<4>() ) + "+00:00" ) );
     
@@ -337,10 +338,11 @@ MapQueryGen::~MapQueryGen()
 
 void MapQueryGen::setupTemporaryTables( double minLat, double maxLat, double minLon, double maxLon )
 {
-    boost::int64_t minLatInt = (minLat * 10000000.0);
-    boost::int64_t maxLatInt = (maxLat * 10000000.0);
-    boost::int64_t minLonInt = (minLon * 10000000.0);
-    boost::int64_t maxLonInt = (maxLon * 10000000.0);
+    // The database holds locations as coord_t
+    boost::int64_t minLatInt = toFixed( minLat );
+    boost::int64_t maxLatInt = toFixed( maxLat );
+    boost::int64_t minLonInt = toFixed( minLon );
+    boost::int64_t maxLonInt = toFixed( maxLon );
     
     std::string setup [] =
     {
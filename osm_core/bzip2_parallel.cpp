@@ -0,0 +1,560 @@
+#include <istream>
+#include <stdexcept>
+#include <cstring>
+
+#include <boost/bind.hpp>
+
+#include <bzlib.h>
+
+#include "bzip2_parallel.hpp"
+
+namespace
+{
+    const boost::uint64_t magicMask  = 0xFFFFFFFFFFFFULL;
+    const boost::uint64_t blockMagic = 0x314159265359ULL;
+    const boost::uint64_t endMagic   = 0x177245385090ULL;
+
+    const size_t readChunkSize = 1 << 20;
+
+    // Append srcBits bits (MSB first) to a bit string. Unused trailing bits of
+    // both strings are kept zero.
+    void appendBits( std::vector<char> &dst, size_t &dstBits, const char *src, size_t srcBits )
+    {
+        if ( srcBits == 0 )
+        {
+            return;
+        }
+
+        size_t shift    = dstBits & 7;
+        size_t srcBytes = (srcBits + 7) / 8;
+        size_t newBits  = dstBits + srcBits;
+        dst.resize( (newBits + 7) / 8, 0 );
+
+        unsigned char *out = reinterpret_cast<unsigned char *>( &dst[dstBits >> 3] );
+        const unsigned char *in = reinterpret_cast<const unsigned char *>( src );
+        size_t outAvail = dst.size() - (dstBits >> 3);
+
+        if ( shift == 0 )
+        {
+            memcpy( out, in, srcBytes );
+        }
+        else
+        {
+            for ( size_t i = 0; i < srcBytes; i++ )
+            {
+                out[i] |= in[i] >> shift;
+                if ( i + 1 < outAvail )
+                {
+                    out[i + 1] = static_cast<unsigned char>( in[i] << (8 - shift) );
+                }
+            }
+        }
+
+        dstBits = newBits;
+        if ( dstBits & 7 )
+        {
+            dst.back() &= static_cast<char>( 0xFF << (8 - (dstBits & 7)) );
+        }
+    }
+
+    void appendValue( std::vector<char> &dst, size_t &dstBits, boost::uint64_t value, size_t bits )
+    {
+        char bytes[8];
+        value <<= 64 - bits;
+        for ( size_t i = 0; i < 8; i++ )
+        {
+            bytes[i] = static_cast<char>( value >> (56 - 8 * i) );
+        }
+        appendBits( dst, dstBits, bytes, bits );
+    }
+
+    // Copy bitCount bits starting at startBit of src into dst, left aligned
+    void extractBits( const std::vector<char> &src, size_t startBit, size_t bitCount, std::vector<char> &dst )
+    {
+        const unsigned char *in = reinterpret_cast<const unsigned char *>( &src[startBit >> 3] );
+        size_t shift = startBit & 7;
+        size_t available = src.size() - (startBit >> 3);
+
+        dst.resize( (bitCount + 7) / 8 );
+        for ( size_t i = 0; i < dst.size(); i++ )
+        {
+            unsigned char byte = static_cast<unsigned char>( in[i] << shift );
+            if ( shift != 0 && i + 1 < available )
+            {
+                byte |= in[i + 1] >> (8 - shift);
+            }
+            dst[i] = static_cast<char>( byte );
+        }
+
+        if ( bitCount & 7 )
+        {
+            dst.back() &= static_cast<char>( 0xFF << (8 - (bitCount & 7)) );
+        }
+    }
+
+    // Where the stream trailer starting with an end magic at endStart ends:
+    // the magic, the 32 bit stream CRC and padding to a whole byte
+    boost::uint64_t trailerEnd( boost::uint64_t endStart )
+    {
+        return (endStart + 80 + 7) / 8 * 8;
+    }
+
+    boost::uint32_t readBits32( const std::vector<char> &src, size_t bitPos )
+    {
+        boost::uint32_t value = 0;
+        for ( size_t i = 0; i < 32; i++, bitPos++ )
+        {
+            unsigned char byte = static_cast<unsigned char>( src[bitPos >> 3] );
+            value = (value << 1) | ((byte >> (7 - (bitPos & 7))) & 1);
+        }
+        return value;
+    }
+}
+
+
+ParallelBzip2Decompressor::ParallelBzip2Decompressor( std::istream &is, size_t numThreads, boost::uint64_t startBitOffset ) :
+    m_is( is ),
+    m_maxInFlight( 2 * numThreads + 2 ),
+    m_startBitOffset( startBitOffset ),
+    m_inputDone( false ),
+    m_stopping( false ),
+    m_currentPos( 0 ),
+    m_outputOffset( 0 )
+{
+    if ( m_startBitOffset != 0 )
+    {
+        m_is.seekg( m_startBitOffset / 8 );
+        if ( !m_is )
+        {
+            throw std::runtime_error( "Unable to seek in bzip2 input" );
+        }
+    }
+
+    if ( numThreads == 0 )
+    {
+        numThreads = 1;
+    }
+
+    m_threads.create_thread( boost::bind( &ParallelBzip2Decompressor::scanInput, this ) );
+    for ( size_t i = 0; i < numThreads; i++ )
+    {
+        m_threads.create_thread( boost::bind( &ParallelBzip2Decompressor::decompressBlocks, this ) );
+    }
+}
+
+ParallelBzip2Decompressor::~ParallelBzip2Decompressor()
+{
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    m_spaceAvailable.notify_all();
+
+    m_threads.join_all();
+}
+
+void ParallelBzip2Decompressor::queueBlock( blockPtr_t block )
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+
+    // Back-pressure: don't run further ahead of the consumer than the window allows
+    while ( m_blocks.size() >= m_maxInFlight && !m_stopping )
+    {
+        m_spaceAvailable.wait( lock );
+    }
+
+    m_blocks.push_back( block );
+    m_work.push_back( block );
+    m_workAvailable.notify_one();
+}
+
+ParallelBzip2Decompressor::blockPtr_t ParallelBzip2Decompressor::makeBlock(
+    const std::vector<char> &raw, size_t startBit, size_t bitLength, boost::uint64_t bitOffset )
+{
+    blockPtr_t block( new Block() );
+    block->m_bitOffset = bitOffset;
+    block->m_bitLength = bitLength;
+    block->m_state     = Block::BLOCK_PENDING;
+    extractBits( raw, startBit, bitLength, block->m_bits );
+
+    return block;
+}
+
+void ParallelBzip2Decompressor::scanInput()
+{
+    try
+    {
+        // Raw input bytes from the start of the current block onwards
+        std::vector<char> raw;
+        boost::uint64_t   rawBase = 0;
+        boost::uint64_t   startByte = m_startBitOffset / 8;
+        boost::uint64_t   totalBytes = startByte;
+
+        boost::uint64_t   window = 0;
+        bool              inBlock = false;
+        boost::uint64_t   blockStart = 0;
+        // An end of stream magic seen in the current block. The pattern can
+        // also occur inside compressed data, so it only ends the block once
+        // what follows it is a stream trailer (see trailerEnd).
+        bool              endPending = false;
+        boost::uint64_t   endStart = 0;
+        // The end magic of the last of any empty streams (a header straight
+        // followed by an end) after the pending end; the next header follows
+        // its trailer
+        boost::uint64_t   lastEndStart = 0;
+
+        std::vector<char> chunk( readChunkSize );
+
+        while ( true )
+        {
+            {
+                boost::mutex::scoped_lock lock( m_mutex );
+                if ( m_stopping )
+                {
+                    return;
+                }
+            }
+
+            m_is.read( &chunk[0], chunk.size() );
+            size_t readCount = m_is.gcount();
+            if ( readCount == 0 )
+            {
+                break;
+            }
+
+            for ( size_t i = 0; i < readCount; i++ )
+            {
+                window = (window << 8) | static_cast<unsigned char>( chunk[i] );
+                totalBytes++;
+
+                if ( inBlock )
+                {
+                    raw.push_back( chunk[i] );
+                }
+
+                if ( totalBytes - startByte < 7 )
+                {
+                    continue;
+                }
+
+                // Check each of the 8 possible bit alignments of a magic ending in this byte
+                for ( int shift = 7; shift >= 0; shift-- )
+                {
+                    boost::uint64_t candidate = (window >> shift) & magicMask;
+                    if ( candidate != blockMagic && candidate != endMagic )
+                    {
+                        continue;
+                    }
+
+                    boost::uint64_t magicStart = totalBytes * 8 - shift - 48;
+                    if ( magicStart < m_startBitOffset )
+                    {
+                        continue;
+                    }
+
+                    if ( candidate == endMagic )
+                    {
+                        // One inside the trailer of an earlier candidate is
+                        // only its CRC or padding, if that one is real
+                        if ( !inBlock || (endPending && magicStart < lastEndStart + 80) )
+                        {
+                            continue;
+                        }
+
+                        boost::uint64_t headerByte = trailerEnd( lastEndStart ) / 8;
+                        if ( endPending && magicStart == headerByte * 8 + 32 &&
+                            memcmp( &raw[headerByte - rawBase], "BZh", 3 ) == 0 )
+                        {
+                            // An empty stream: the block still ends at endStart
+                            lastEndStart = magicStart;
+                        }
+                        else
+                        {
+                            endPending = true;
+                            endStart = magicStart;
+                            lastEndStart = magicStart;
+                        }
+                        continue;
+                    }
+
+                    if ( inBlock )
+                    {
+                        // A real end is followed by the next stream's header
+                        // ("BZh" and a digit) and then this block magic
+                        boost::uint64_t headerByte = trailerEnd( lastEndStart ) / 8;
+                        bool streamEnded = endPending &&
+                            magicStart == headerByte * 8 + 32 &&
+                            memcmp( &raw[headerByte - rawBase], "BZh", 3 ) == 0;
+                        boost::uint64_t blockEnd = streamEnded ? endStart : magicStart;
+                        queueBlock( makeBlock( raw, blockStart - rawBase * 8, blockEnd - blockStart, blockStart ) );
+                    }
+
+                    inBlock = true;
+                    endPending = false;
+                    blockStart = magicStart;
+
+                    // Only keep input from the byte holding the new block magic
+                    raw.clear();
+                    rawBase = magicStart / 8;
+                    for ( boost::uint64_t b = rawBase; b < totalBytes; b++ )
+                    {
+                        raw.push_back( static_cast<char>( window >> (8 * (totalBytes - 1 - b)) ) );
+                    }
+                }
+            }
+        }
+
+        if ( inBlock && endPending && totalBytes * 8 >= trailerEnd( lastEndStart ) )
+        {
+            queueBlock( makeBlock( raw, blockStart - rawBase * 8, endStart - blockStart, blockStart ) );
+        }
+        else if ( inBlock )
+        {
+            // Truncated input: queue what there is and let the decode fail
+            size_t skip = blockStart - rawBase * 8;
+            queueBlock( makeBlock( raw, skip, raw.size() * 8 - skip, blockStart ) );
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        m_error = std::string( "Error reading bzip2 input: " ) + e.what();
+    }
+
+    boost::mutex::scoped_lock lock( m_mutex );
+    m_inputDone = true;
+    m_workAvailable.notify_all();
+    m_blockDone.notify_all();
+}
+
+void ParallelBzip2Decompressor::decompressBlocks()
+{
+    while ( true )
+    {
+        blockPtr_t block;
+        {
+            boost::mutex::scoped_lock lock( m_mutex );
+            while ( m_work.empty() && !m_inputDone && !m_stopping )
+            {
+                m_workAvailable.wait( lock );
+            }
+
+            if ( m_stopping || m_work.empty() )
+            {
+                return;
+            }
+
+            block = m_work.front();
+            m_work.pop_front();
+        }
+
+        // An exception would end the process from this thread: report it
+        // to the consumer instead, as scanInput does
+        bool success = false;
+        try
+        {
+            success = decompress( *block );
+        }
+        catch ( const std::exception &e )
+        {
+            boost::mutex::scoped_lock lock( m_mutex );
+            if ( m_error.empty() )
+            {
+                m_error = std::string( "Error decompressing bzip2 block: " ) + e.what();
+            }
+        }
+
+        boost::mutex::scoped_lock lock( m_mutex );
+        block->m_state = success ? Block::BLOCK_DONE : Block::BLOCK_FAILED;
+        m_blockDone.notify_all();
+    }
+}
+
+void ParallelBzip2Decompressor::wrapBlock( const std::vector<char> &bits, size_t bitLength, std::vector<char> &stream )
+{
+    // Stream header, the block itself, then the end of stream marker. With only one
+    // block the combined stream CRC is just the block CRC, which follows the block magic.
+    size_t streamBits = 0;
+    stream.clear();
+    stream.reserve( bits.size() + 16 );
+
+    appendBits( stream, streamBits, "BZh9", 32 );
+    appendBits( stream, streamBits, &bits[0], bitLength );
+    appendValue( stream, streamBits, endMagic, 48 );
+    appendValue( stream, streamBits, readBits32( bits, 48 ), 32 );
+}
+
+bool ParallelBzip2Decompressor::decompress( Block &block )
+{
+    if ( block.m_bitLength < 80 )
+    {
+        return false;
+    }
+
+    std::vector<char> stream;
+    wrapBlock( block.m_bits, block.m_bitLength, stream );
+
+    bz_stream strm;
+    memset( &strm, 0, sizeof( strm ) );
+    if ( BZ2_bzDecompressInit( &strm, 0, 0 ) != BZ_OK )
+    {
+        return false;
+    }
+
+    strm.next_in  = &stream[0];
+    strm.avail_in = stream.size();
+
+    block.m_output.resize( std::max<size_t>( stream.size() * 6, 1 << 20 ) );
+    size_t produced = 0;
+    bool success = false;
+    while ( true )
+    {
+        strm.next_out  = &block.m_output[produced];
+        strm.avail_out = block.m_output.size() - produced;
+
+        int ret = BZ2_bzDecompress( &strm );
+        produced = block.m_output.size() - strm.avail_out;
+
+        if ( ret == BZ_STREAM_END )
+        {
+            success = true;
+            break;
+        }
+        if ( ret != BZ_OK || (strm.avail_in == 0 && strm.avail_out != 0) )
+        {
+            break;
+        }
+        if ( strm.avail_out == 0 )
+        {
+            block.m_output.resize( block.m_output.size() * 2 );
+        }
+    }
+
+    BZ2_bzDecompressEnd( &strm );
+    block.m_output.resize( success ? produced : 0 );
+
+    return success;
+}
+
+ParallelBzip2Decompressor::blockPtr_t ParallelBzip2Decompressor::nextBlock()
+{
+    blockPtr_t block;
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        while ( true )
+        {
+            if ( !m_error.empty() )
+            {
+                throw std::runtime_error( m_error );
+            }
+            if ( !m_blocks.empty() && m_blocks.front()->m_state != Block::BLOCK_PENDING )
+            {
+                break;
+            }
+            if ( m_blocks.empty() && m_inputDone )
+            {
+                return blockPtr_t();
+            }
+            m_blockDone.wait( lock );
+        }
+
+        block = m_blocks.front();
+        m_blocks.pop_front();
+        m_spaceAvailable.notify_one();
+    }
+
+    if ( block->m_state == Block::BLOCK_FAILED )
+    {
+        block = recoverBlock( block );
+    }
+
+    return block;
+}
+
+ParallelBzip2Decompressor::blockPtr_t ParallelBzip2Decompressor::recoverBlock( blockPtr_t failed )
+{
+    // The block magic is not byte aligned and can, very rarely, also occur inside
+    // compressed data, splitting a real block in two. Join the failed block with
+    // the ones that follow until it decodes.
+    const size_t maxJoin = 3;
+
+    blockPtr_t merged( new Block( *failed ) );
+    for ( size_t i = 0; i < maxJoin; i++ )
+    {
+        blockPtr_t next;
+        {
+            boost::mutex::scoped_lock lock( m_mutex );
+            while ( m_blocks.empty() && !m_inputDone )
+            {
+                m_blockDone.wait( lock );
+            }
+            if ( m_blocks.empty() )
+            {
+                break;
+            }
+            next = m_blocks.front();
+            m_blocks.pop_front();
+            m_spaceAvailable.notify_one();
+        }
+
+        appendBits( merged->m_bits, merged->m_bitLength, &next->m_bits[0], next->m_bitLength );
+        if ( decompress( *merged ) )
+        {
+            merged->m_state = Block::BLOCK_DONE;
+            return merged;
+        }
+    }
+
+    throw std::runtime_error( "Corrupt bzip2 block in input" );
+}
+
+std::streamsize ParallelBzip2Decompressor::read( char *s, std::streamsize n )
+{
+    std::streamsize copied = 0;
+    while ( copied < n )
+    {
+        if ( m_current && m_currentPos < m_current->m_output.size() )
+        {
+            size_t count = std::min<size_t>( n - copied, m_current->m_output.size() - m_currentPos );
+            memcpy( s + copied, &m_current->m_output[m_currentPos], count );
+            m_currentPos += count;
+            copied += count;
+            continue;
+        }
+
+        if ( m_current )
+        {
+            m_outputOffset += m_current->m_output.size();
+        }
+
+        m_current = nextBlock();
+        m_currentPos = 0;
+        if ( !m_current )
+        {
+            break;
+        }
+
+        m_blockStarts.push_back( std::make_pair( m_outputOffset, m_current->m_bitOffset ) );
+    }
+
+    return copied == 0 && n > 0 ? -1 : copied;
+}
+
+bool ParallelBzip2Decompressor::findBlock( boost::uint64_t outputOffset, boost::uint64_t &bitOffset, boost::uint64_t &skip )
+{
+    while ( m_blockStarts.size() > 1 && m_blockStarts[1].first <= outputOffset )
+    {
+        m_blockStarts.pop_front();
+    }
+
+    boost::uint64_t readTo = m_outputOffset + (m_current ? m_current->m_output.size() : 0);
+    if ( m_blockStarts.empty() || outputOffset < m_blockStarts.front().first || outputOffset >= readTo )
+    {
+        return false;
+    }
+
+    bitOffset = m_blockStarts.front().second;
+    skip      = outputOffset - m_blockStarts.front().first;
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef BZIP2_PARALLEL_HPP
+#define BZIP2_PARALLEL_HPP
+
+#include <iosfwd>
+#include <deque>
+#include <vector>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/iostreams/categories.hpp>
+
+// Decompresses a bzip2 file on several threads. bzip2 compresses in independent
+// blocks, each starting with a 48 bit magic number (not byte aligned). A scanner
+// thread finds the block boundaries, re-wraps each block as a standalone single
+// block bzip2 stream and queues it; worker threads inflate the blocks and the
+// consumer reads the output back in the original order.
+class ParallelBzip2Decompressor
+{
+private:
+    struct Block
+    {
+        enum state_t
+        {
+            BLOCK_PENDING,
+            BLOCK_DONE,
+            BLOCK_FAILED
+        };
+
+        // Bit offset of the block magic in the compressed input
+        boost::uint64_t   m_bitOffset;
+        // The block bits, less any stream header/trailer
+        std::vector<char> m_bits;
+        size_t            m_bitLength;
+        std::vector<char> m_output;
+        state_t           m_state;
+    };
+    typedef boost::shared_ptr<Block> blockPtr_t;
+
+    std::istream                    &m_is;
+    size_t                           m_maxInFlight;
+    boost::uint64_t                  m_startBitOffset;
+
+    boost::mutex                     m_mutex;
+    boost::condition_variable        m_workAvailable;
+    boost::condition_variable        m_blockDone;
+    boost::condition_variable        m_spaceAvailable;
+
+    // Blocks in stream order that have not been handed to the consumer yet
+    std::deque<blockPtr_t>           m_blocks;
+    // Blocks waiting for a worker
+    std::deque<blockPtr_t>           m_work;
+    bool                             m_inputDone;
+    bool                             m_stopping;
+    std::string                      m_error;
+
+    boost::thread_group              m_threads;
+
+    // Consumer side
+    blockPtr_t                       m_current;
+    size_t                           m_currentPos;
+    // Output offset and input bit offset of each block handed out, from the
+    // last one findBlock returned
+    std::deque<std::pair<boost::uint64_t, boost::uint64_t> > m_blockStarts;
+    boost::uint64_t                  m_outputOffset;
+
+public:
+    // startBitOffset: the bit offset of a block magic to start from, as
+    // returned by findBlock, e.g. to resume an interrupted read. The input is
+    // seeked to it.
+    ParallelBzip2Decompressor( std::istream &is, size_t numThreads, boost::uint64_t startBitOffset = 0 );
+    ~ParallelBzip2Decompressor();
+
+    std::streamsize read( char *s, std::streamsize n );
+
+    // The block holding byte outputOffset of the output read so far: its bit
+    // offset in the input and where outputOffset falls in its output. Offsets
+    // before the last one found are forgotten. False if the byte hasn't been
+    // read.
+    bool findBlock( boost::uint64_t outputOffset, boost::uint64_t &bitOffset, boost::uint64_t &skip );
+
+private:
+    void scanInput();
+    void decompressBlocks();
+    void queueBlock( blockPtr_t block );
+    blockPtr_t makeBlock( const std::vector<char> &raw, size_t startBit, size_t bitLength, boost::uint64_t bitOffset );
+    blockPtr_t nextBlock();
+    blockPtr_t recoverBlock( blockPtr_t failed );
+
+    static bool decompress( Block &block );
+    static void wrapBlock( const std::vector<char> &bits, size_t bitLength, std::vector<char> &stream );
+};
+
+
+// boost::iostreams source wrapping the decompressor, so it can be pushed
+// onto a filtering_istream in place of bzip2_decompressor + file
+class ParallelBzip2Source
+{
+private:
+    boost::shared_ptr<ParallelBzip2Decompressor> m_impl;
+
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    ParallelBzip2Source( std::istream &is, size_t numThreads, boost::uint64_t startBitOffset = 0 ) :
+        m_impl( new ParallelBzip2Decompressor( is, numThreads, startBitOffset ) )
+    {
+    }
+
+    std::streamsize read( char *s, std::streamsize n )
+    {
+        return m_impl->read( s, n );
+    }
+
+    // Copies of a source share the decompressor, so one kept aside can
+    // look up blocks for the copy pushed onto a stream
+    bool findBlock( boost::uint64_t outputOffset, boost::uint64_t &bitOffset, boost::uint64_t &skip )
+    {
+        return m_impl->findBlock( outputOffset, bitOffset, skip );
+    }
+};
+
+#endif // BZIP2_PARALLEL_HPP
@@ -0,0 +1,133 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "coord.hpp"
+#include "utils.hpp"
+#include "xml_schema.hpp"
+
+namespace
+{
+    const int fixedDecimals = 7;
+
+    // Largest magnitude coord_t holds: a little over 214 degrees
+    const boost::uint64_t maxMagnitude = 2147483647;
+}
+
+coord_t toFixed( double degrees )
+{
+    double scaled = degrees * fixedPerDegree;
+    return static_cast<coord_t>( scaled < 0.0 ? -floor( -scaled + 0.5 ) : floor( scaled + 0.5 ) );
+}
+
+bool parseFixed( const char *begin, const char *end, coord_t &value )
+{
+    const char *p = begin;
+    bool negative = false;
+    if ( p != end && (*p == '-' || *p == '+') )
+    {
+        negative = *p == '-';
+        ++p;
+    }
+
+    boost::uint64_t magnitude = 0;
+    int  decimals = 0;
+    bool roundUp = false;
+    bool anyDigits = false;
+    bool seenPoint = false;
+
+    for ( ; p != end; ++p )
+    {
+        if ( *p >= '0' && *p <= '9' )
+        {
+            anyDigits = true;
+            int digit = *p - '0';
+            if ( !seenPoint )
+            {
+                magnitude = magnitude * 10 + digit;
+                if ( magnitude > maxMagnitude )
+                {
+                    return false;
+                }
+            }
+            else if ( decimals < fixedDecimals )
+            {
+                magnitude = magnitude * 10 + digit;
+                decimals++;
+            }
+            else if ( decimals == fixedDecimals )
+            {
+                // Only the first digit dropped decides the rounding
+                roundUp = digit >= 5;
+                decimals++;
+            }
+        }
+        else if ( *p == '.' && !seenPoint )
+        {
+            seenPoint = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if ( !anyDigits )
+    {
+        return false;
+    }
+
+    if ( p != end )
+    {
+        // Exponents: not written by any OSM tool, so take the slow way
+        double degrees;
+        if ( !parseDecimal( begin, end, degrees ) || fabs( degrees ) * fixedPerDegree > maxMagnitude )
+        {
+            return false;
+        }
+        value = toFixed( degrees );
+        return true;
+    }
+
+    for ( ; decimals < fixedDecimals; decimals++ )
+    {
+        magnitude *= 10;
+    }
+    magnitude += roundUp ? 1 : 0;
+
+    if ( magnitude > maxMagnitude )
+    {
+        return false;
+    }
+
+    value = negative ? -coord_t( magnitude ) : coord_t( magnitude );
+    return true;
+}
+
+std::string formatFixed( coord_t fixed )
+{
+    boost::uint32_t magnitude = fixed < 0 ? 0u - boost::uint32_t( fixed ) : boost::uint32_t( fixed );
+
+    char buffer[32];
+    int length = snprintf( buffer, sizeof( buffer ), "%s%u.%07u",
+        fixed < 0 ? "-" : "",
+        magnitude / fixedPerDegree,
+        magnitude % fixedPerDegree );
+
+    // Trailing zeros, then the point if no decimals are left
+    while ( buffer[length - 1] == '0' )
+    {
+        length--;
+    }
+    if ( buffer[length - 1] == '.' )
+    {
+        length--;
+    }
+
+    return std::string( buffer, length );
+}
+
+double fixedDistBetween( coord_t lat1, coord_t lon1, coord_t lat2, coord_t lon2 )
+{
+    return distBetween( fromFixed( lat1 ), fromFixed( lon1 ), fromFixed( lat2 ), fromFixed( lon2 ) );
+}
@@ -0,0 +1,30 @@
+#ifndef COORD_HPP
+#define COORD_HPP
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+// A latitude or longitude in integer 1e-7 degrees, as the OSM database and
+// PBF files hold them. Exact, half the size of a double, and compared and
+// subtracted as a plain integer; doubles are only made at the edges, for
+// trigonometry and for callers that want degrees.
+typedef boost::int32_t coord_t;
+
+const coord_t fixedPerDegree = 10000000;
+
+// Both round half away from zero
+coord_t toFixed( double degrees );
+inline double fromFixed( coord_t fixed ) { return fixed / double( fixedPerDegree ); }
+
+// Decimal degrees as written in a file, e.g. "51.7829936", to fixed point
+// without going through a double. Digits past the 7th decimal place are
+// rounded. False if malformed or out of the range of coord_t.
+bool parseFixed( const char *begin, const char *end, coord_t &value );
+// The shortest decimal that parses back to the same value, e.g. "-1.5"
+std::string formatFixed( coord_t fixed );
+
+// Great circle distance in km, as distBetween
+double fixedDistBetween( coord_t lat1, coord_t lon1, coord_t lat2, coord_t lon2 );
+
+#endif // COORD_HPP
@@ -0,0 +1,121 @@
+#ifndef ID_MAP_HPP
+#define ID_MAP_HPP
+
+#include <map>
+#include <deque>
+#include <utility>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+
+// Map from object id, with the std::map operations OSMFragment's users rely
+// on. OSM files are sorted by id within each object type, so ids normally
+// arrive in increasing order: those are appended to a deque (O(1), and 24
+// bytes or so an entry for a shared_ptr value against a std::map node's 48)
+// and found by binary search. An id that arrives out of order goes into an
+// overflow std::map instead, as everything did before; finalise() merges the
+// overflow back into the deque. Iteration is in id order either way.
+//
+// As with std::map::insert, inserting an id already present does nothing.
+template<typename T>
+class IdMap
+{
+public:
+    typedef boost::uint64_t                  key_type;
+    typedef T                                mapped_type;
+    typedef std::pair<const key_type, T>     value_type;
+
+private:
+    typedef std::deque<value_type>           sorted_t;
+    typedef std::map<key_type, T>            overflow_t;
+
+    sorted_t   m_sorted;
+    overflow_t m_overflow;
+    bool       m_assertSorted;
+
+public:
+    // Walks the deque and the overflow side by side
+    class const_iterator :
+        public boost::iterator_facade<const_iterator, const value_type, boost::forward_traversal_tag>
+    {
+    private:
+        typename sorted_t::const_iterator   m_sortedIt;
+        typename sorted_t::const_iterator   m_sortedEnd;
+        typename overflow_t::const_iterator m_overflowIt;
+        typename overflow_t::const_iterator m_overflowEnd;
+
+    public:
+        const_iterator() {}
+        const_iterator(
+            typename sorted_t::const_iterator sortedIt, typename sorted_t::const_iterator sortedEnd,
+            typename overflow_t::const_iterator overflowIt, typename overflow_t::const_iterator overflowEnd ) :
+            m_sortedIt( sortedIt ), m_sortedEnd( sortedEnd ),
+            m_overflowIt( overflowIt ), m_overflowEnd( overflowEnd )
+        {
+        }
+
+    private:
+        friend class boost::iterator_core_access;
+
+        bool inOverflow() const
+        {
+            return m_sortedIt == m_sortedEnd ||
+                (m_overflowIt != m_overflowEnd && m_overflowIt->first < m_sortedIt->first);
+        }
+
+        const value_type &dereference() const { return inOverflow() ? *m_overflowIt : *m_sortedIt; }
+        bool equal( const const_iterator &other ) const
+        {
+            return m_sortedIt == other.m_sortedIt && m_overflowIt == other.m_overflowIt;
+        }
+        void increment()
+        {
+            if ( inOverflow() )
+            {
+                ++m_overflowIt;
+            }
+            else
+            {
+                ++m_sortedIt;
+            }
+        }
+    };
+    typedef const_iterator iterator;
+
+    IdMap() : m_assertSorted( false ) {}
+
+    // Ids out of order are an error (std::logic_error) rather than going to
+    // the overflow, for input known to be sorted where a mistake should show
+    void setAssertSorted( bool assertSorted ) { m_assertSorted = assertSorted; }
+    // Merge the overflow into the sorted ids
+    void finalise();
+    // Ids so far in increasing order, with nothing in the overflow
+    bool isSorted() const { return m_overflow.empty(); }
+
+    bool insert( const value_type &value );
+    template<typename InputIterator>
+    void insert( InputIterator first, InputIterator last )
+    {
+        for ( ; first != last; ++first )
+        {
+            insert( *first );
+        }
+    }
+
+    const_iterator find( key_type id ) const;
+    size_t count( key_type id ) const { return find( id ) != end() ? 1 : 0; }
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const { return m_sorted.size() + m_overflow.size(); }
+    bool empty() const { return m_sorted.empty() && m_overflow.empty(); }
+    void clear();
+
+private:
+    typename sorted_t::const_iterator findSorted( key_type id ) const;
+};
+
+#include "id_map.ipp"
+
+#endif // ID_MAP_HPP
@@ -0,0 +1,110 @@
+
+#include <algorithm>
+
+#include "id_search.hpp"
+
+namespace idmap_detail
+{
+    struct KeyOf
+    {
+        template<typename Value>
+        boost::uint64_t operator()( const Value &value ) const { return value.first; }
+    };
+}
+
+template<typename T>
+typename IdMap<T>::sorted_t::const_iterator IdMap<T>::findSorted( key_type id ) const
+{
+    return interpolationLowerBound( m_sorted.begin(), m_sorted.end(), id, idmap_detail::KeyOf() );
+}
+
+template<typename T>
+bool IdMap<T>::insert( const value_type &value )
+{
+    // Everything in the overflow is below the last sorted id
+    if ( m_sorted.empty() || m_sorted.back().first < value.first )
+    {
+        m_sorted.push_back( value );
+        return true;
+    }
+
+    typename sorted_t::const_iterator findIt = findSorted( value.first );
+    if ( findIt != m_sorted.end() && findIt->first == value.first )
+    {
+        return false;
+    }
+
+    if ( m_assertSorted )
+    {
+        throw std::logic_error( "Object ids not in increasing order" );
+    }
+
+    return m_overflow.insert( value ).second;
+}
+
+template<typename T>
+void IdMap<T>::finalise()
+{
+    if ( m_overflow.empty() )
+    {
+        return;
+    }
+
+    sorted_t merged;
+    typename sorted_t::const_iterator sortedIt = m_sorted.begin();
+    typename overflow_t::const_iterator overflowIt = m_overflow.begin();
+    while ( sortedIt != m_sorted.end() || overflowIt != m_overflow.end() )
+    {
+        if ( sortedIt == m_sorted.end() || (overflowIt != m_overflow.end() && overflowIt->first < sortedIt->first) )
+        {
+            merged.push_back( *overflowIt++ );
+        }
+        else
+        {
+            merged.push_back( *sortedIt++ );
+        }
+    }
+
+    m_sorted.swap( merged );
+    m_overflow.clear();
+}
+
+template<typename T>
+typename IdMap<T>::const_iterator IdMap<T>::find( key_type id ) const
+{
+    typename sorted_t::const_iterator sortedIt = findSorted( id );
+    if ( sortedIt != m_sorted.end() && sortedIt->first == id )
+    {
+        return const_iterator( sortedIt, m_sorted.end(), m_overflow.lower_bound( id ), m_overflow.end() );
+    }
+
+    if ( !m_overflow.empty() )
+    {
+        typename overflow_t::const_iterator overflowIt = m_overflow.find( id );
+        if ( overflowIt != m_overflow.end() )
+        {
+            return const_iterator( sortedIt, m_sorted.end(), overflowIt, m_overflow.end() );
+        }
+    }
+
+    return end();
+}
+
+template<typename T>
+typename IdMap<T>::const_iterator IdMap<T>::begin() const
+{
+    return const_iterator( m_sorted.begin(), m_sorted.end(), m_overflow.begin(), m_overflow.end() );
+}
+
+template<typename T>
+typename IdMap<T>::const_iterator IdMap<T>::end() const
+{
+    return const_iterator( m_sorted.end(), m_sorted.end(), m_overflow.end(), m_overflow.end() );
+}
+
+template<typename T>
+void IdMap<T>::clear()
+{
+    sorted_t().swap( m_sorted );
+    m_overflow.clear();
+}
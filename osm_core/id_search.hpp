@@ -0,0 +1,82 @@
+#ifndef ID_SEARCH_HPP
+#define ID_SEARCH_HPP
+
+#include <cstddef>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+
+namespace id_search_detail
+{
+    // Below this a scan is quicker than another probe
+    const std::ptrdiff_t scanLength = 16;
+
+    struct PlainId
+    {
+        boost::uint64_t operator()( boost::uint64_t id ) const { return id; }
+    };
+}
+
+// std::lower_bound for OSM ids, which are spread fairly evenly over their
+// range: each probe is placed where the id would be if they were exactly
+// even, which finds most ids in two or three probes against the twenty or
+// more of a binary search over millions. A probe that fails to halve the
+// range is followed by a bisection, so clustered ids are no worse than
+// twice the binary search. KeyOf gives the id of an element.
+template<typename RandomIterator, typename KeyOf>
+RandomIterator interpolationLowerBound( RandomIterator first, RandomIterator last, boost::uint64_t id, KeyOf keyOf )
+{
+    while ( last - first > id_search_detail::scanLength )
+    {
+        boost::uint64_t low  = keyOf( *first );
+        boost::uint64_t high = keyOf( *(last - 1) );
+        if ( id <= low )
+        {
+            return first;
+        }
+        if ( id > high )
+        {
+            return last;
+        }
+
+        std::ptrdiff_t length = last - first;
+        std::ptrdiff_t guess  = std::ptrdiff_t( double( id - low ) / double( high - low ) * (length - 1) );
+        RandomIterator probe  = first + std::min( std::max<std::ptrdiff_t>( guess, 0 ), length - 1 );
+        if ( keyOf( *probe ) < id )
+        {
+            first = probe + 1;
+        }
+        else
+        {
+            last = probe;
+        }
+
+        if ( (last - first) * 2 > length )
+        {
+            RandomIterator middle = first + (last - first) / 2;
+            if ( keyOf( *middle ) < id )
+            {
+                first = middle + 1;
+            }
+            else
+            {
+                last = middle;
+            }
+        }
+    }
+
+    while ( first != last && keyOf( *first ) < id )
+    {
+        ++first;
+    }
+    return first;
+}
+
+// Over a plain array of ids
+template<typename RandomIterator>
+RandomIterator interpolationLowerBound( RandomIterator first, RandomIterator last, boost::uint64_t id )
+{
+    return interpolationLowerBound( first, last, id, id_search_detail::PlainId() );
+}
+
+#endif // ID_SEARCH_HPP
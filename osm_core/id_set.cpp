@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "id_set.hpp"
+
+namespace
+{
+    // Below this the duplicates aren't worth sorting out early
+    const size_t minCompactSize = 1 << 20;
+}
+
+IdSet::IdSet() : m_compactSize( 0 ), m_final( false )
+{
+}
+
+void IdSet::add( dbId_t id )
+{
+    if ( m_final )
+    {
+        throw std::logic_error( "IdSet: add after finalise" );
+    }
+
+    m_ids.push_back( id );
+    if ( m_ids.size() >= std::max( m_compactSize * 2, minCompactSize ) )
+    {
+        compact();
+    }
+}
+
+void IdSet::finalise()
+{
+    if ( !m_final )
+    {
+        compact();
+        std::vector<dbId_t>( m_ids ).swap( m_ids );
+        m_final = true;
+    }
+}
+
+bool IdSet::contains( dbId_t id ) const
+{
+    if ( !m_final )
+    {
+        throw std::logic_error( "IdSet: lookup before finalise" );
+    }
+
+    return std::binary_search( m_ids.begin(), m_ids.end(), id );
+}
+
+void IdSet::compact()
+{
+    std::sort( m_ids.begin(), m_ids.end() );
+    m_ids.erase( std::unique( m_ids.begin(), m_ids.end() ), m_ids.end() );
+    m_compactSize = m_ids.size();
+}
@@ -0,0 +1,33 @@
+#ifndef ID_SET_HPP
+#define ID_SET_HPP
+
+#include <vector>
+
+#include "osm_data.hpp"
+
+// A set of object ids held as a sorted array: 8 bytes an id, against the 40
+// or so of a std::set node. Ids can be added in any order and repeated;
+// duplicates are squeezed out whenever the array has doubled since the last
+// time, so it never grows far beyond the number of distinct ids. Call
+// finalise() before looking anything up.
+class IdSet
+{
+private:
+    std::vector<dbId_t> m_ids;
+    size_t              m_compactSize;
+    bool                m_final;
+
+public:
+    IdSet();
+
+    void add( dbId_t id );
+    void finalise();
+
+    bool contains( dbId_t id ) const;
+    size_t size() const { return m_ids.size(); }
+
+private:
+    void compact();
+};
+
+#endif // ID_SET_HPP
@@ -0,0 +1,670 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "ingest_checkpoint.hpp"
+#include "bzip2_parallel.hpp"
+#include "xml_tokenizer.hpp"
+#include "osm_stream.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    // 2: journal locations are fixed point
+    const char *const checkpointMagic = "osm-checkpoint 2";
+
+    const char *const sectionNames[] = { "none", "nodes", "ways", "relations" };
+
+    // Journal record types
+    const char RECORD_USER     = 'u';
+    const char RECORD_NODE     = 'n';
+    const char RECORD_LOCATION = 'l';
+    const char RECORD_WAY      = 'w';
+    const char RECORD_RELATION = 'r';
+
+
+    // The journal is only read back on the machine that wrote it, so values
+    // are written in native byte order
+    class JournalWriter
+    {
+    private:
+        std::ofstream m_os;
+
+    public:
+        JournalWriter( const std::string &fileName, bool append ) :
+            m_os( fileName.c_str(), std::ios_base::out | std::ios_base::binary | (append ? std::ios_base::app : std::ios_base::trunc) )
+        {
+            if ( !m_os )
+            {
+                throw std::runtime_error( "Unable to open journal: " + fileName );
+            }
+        }
+
+        boost::uint64_t flush()
+        {
+            m_os.flush();
+            if ( !m_os )
+            {
+                throw std::runtime_error( "Error writing journal" );
+            }
+            return m_os.tellp();
+        }
+
+        void writeUser( dbId_t userId, const std::string &userName )
+        {
+            m_os.put( RECORD_USER );
+            write( userId );
+            writeString( userName );
+        }
+
+        void writeNode( const OSMNode &node )
+        {
+            m_os.put( RECORD_NODE );
+            writeBase( node );
+            write( node.getFixedLat() );
+            write( node.getFixedLon() );
+            writeTags( node.getTags() );
+        }
+
+        void writeLocation( const OSMNode &node )
+        {
+            m_os.put( RECORD_LOCATION );
+            write( node.getId() );
+            write( node.getFixedLat() );
+            write( node.getFixedLon() );
+        }
+
+        void writeWay( const OSMWay &way )
+        {
+            m_os.put( RECORD_WAY );
+            writeBase( way );
+            m_os.put( way.getVisible() ? 1 : 0 );
+            write( boost::uint64_t( way.getNodes().size() ) );
+            BOOST_FOREACH( dbId_t nodeId, way.getNodes() )
+            {
+                write( nodeId );
+            }
+            writeTags( way.getTags() );
+        }
+
+        void writeRelation( const OSMRelation &relation )
+        {
+            m_os.put( RECORD_RELATION );
+            writeBase( relation );
+            write( boost::uint64_t( relation.getMembers().size() ) );
+            BOOST_FOREACH( const member_t &member, relation.getMembers() )
+            {
+                writeString( member.get<0>() );
+                write( member.get<1>() );
+                writeString( member.get<2>() );
+            }
+            writeTags( relation.getTags() );
+        }
+
+    private:
+        template<typename T>
+        void write( const T &value )
+        {
+            m_os.write( reinterpret_cast<const char *>( &value ), sizeof( value ) );
+        }
+
+        void writeString( const std::string &value )
+        {
+            write( boost::uint32_t( value.size() ) );
+            m_os.write( value.data(), value.size() );
+        }
+
+        void writeBase( const OSMBase &object )
+        {
+            write( object.getId() );
+            write( object.getEpochTimeStamp() );
+            writeString( object.getUser() );
+            write( object.getUserId() );
+        }
+
+        void writeTags( const TagList &tags )
+        {
+            write( boost::uint64_t( tags.size() ) );
+            BOOST_FOREACH( const tag_t &tag, tags )
+            {
+                writeString( tag.first.toString() );
+                writeString( tag.second.toString() );
+            }
+        }
+    };
+
+
+    class JournalReader
+    {
+    private:
+        std::ifstream m_is;
+
+    public:
+        JournalReader( const std::string &fileName ) :
+            m_is( fileName.c_str(), std::ios_base::in | std::ios_base::binary )
+        {
+            if ( !m_is )
+            {
+                throw std::runtime_error( "Unable to open journal: " + fileName );
+            }
+        }
+
+        // Back into the fragment, through its filter as the first time
+        size_t replay( OSMFragment &frag )
+        {
+            size_t records = 0;
+            for ( int type = m_is.get(); type != EOF; type = m_is.get(), records++ )
+            {
+                switch ( type )
+                {
+                case RECORD_USER:
+                {
+                    dbId_t userId = read<dbId_t>();
+                    frag.addUser( userId, readString() );
+                    break;
+                }
+                case RECORD_NODE:
+                {
+                    OSMNode node;
+                    readBase( node );
+                    coord_t lat = read<coord_t>();
+                    coord_t lon = read<coord_t>();
+                    node.setFixedLocation( lat, lon );
+                    readTags( node );
+                    frag.addNode( node );
+                    break;
+                }
+                case RECORD_LOCATION:
+                {
+                    dbId_t nodeId = read<dbId_t>();
+                    coord_t lat = read<coord_t>();
+                    coord_t lon = read<coord_t>();
+                    frag.addNodeLocation( nodeId, lat, lon );
+                    break;
+                }
+                case RECORD_WAY:
+                {
+                    OSMWay way;
+                    readBase( way );
+                    way.setVisible( readByte() != 0 );
+                    for ( boost::uint64_t count = read<boost::uint64_t>(); count > 0; count-- )
+                    {
+                        way.addNode( read<dbId_t>() );
+                    }
+                    readTags( way );
+                    frag.addWay( way );
+                    break;
+                }
+                case RECORD_RELATION:
+                {
+                    OSMRelation relation;
+                    readBase( relation );
+                    for ( boost::uint64_t count = read<boost::uint64_t>(); count > 0; count-- )
+                    {
+                        std::string type = readString();
+                        dbId_t ref = read<dbId_t>();
+                        relation.addMember( boost::make_tuple( type, ref, readString() ) );
+                    }
+                    readTags( relation );
+                    frag.addRelation( relation );
+                    break;
+                }
+                default:
+                    throw std::runtime_error( boost::str( boost::format( "Bad journal record type %d" ) % type ) );
+                }
+            }
+
+            return records;
+        }
+
+    private:
+        template<typename T>
+        T read()
+        {
+            T value;
+            m_is.read( reinterpret_cast<char *>( &value ), sizeof( value ) );
+            check();
+            return value;
+        }
+
+        int readByte()
+        {
+            int value = m_is.get();
+            check();
+            return value;
+        }
+
+        std::string readString()
+        {
+            std::string value( read<boost::uint32_t>(), '\0' );
+            if ( !value.empty() )
+            {
+                m_is.read( &value[0], value.size() );
+                check();
+            }
+            return value;
+        }
+
+        template<typename T>
+        void readBase( T &object )
+        {
+            dbId_t id = read<dbId_t>();
+            epochTime_t timestamp = read<epochTime_t>();
+            std::string user = readString();
+            object.setBaseData( id, timestamp, ConstTagString( user ), read<dbId_t>() );
+        }
+
+        template<typename T>
+        void readTags( T &object )
+        {
+            for ( boost::uint64_t count = read<boost::uint64_t>(); count > 0; count-- )
+            {
+                std::string k = readString();
+                object.addTag( ConstTagString( k ), ConstTagString( readString() ) );
+            }
+        }
+
+        void check()
+        {
+            if ( !m_is )
+            {
+                throw std::runtime_error( "Journal ends in the middle of a record" );
+            }
+        }
+    };
+
+
+    // Receives the objects as they are read: adds them to the fragment,
+    // journals them and saves the checkpoints
+    class CheckpointWriter : public OSMVisitor
+    {
+    private:
+        OSMFragment                             &m_frag;
+        JournalWriter                           &m_journal;
+        IngestCheckpoint                        &m_checkpoint;
+        const std::string                       &m_checkpointFile;
+        size_t                                   m_interval;
+
+        OSMStreamReader                          m_reader;
+        const RawXMLTokenizer                   *m_tokenizer;
+        boost::shared_ptr<ParallelBzip2Source>   m_source;
+        // Offset in the XML of the first byte the tokenizer sees, and of the
+        // first byte the decompressor produces
+        boost::uint64_t                          m_tokenizerBase;
+        boost::uint64_t                          m_sourceBase;
+        size_t                                   m_sinceCheckpoint;
+        bool                                     m_complete;
+
+    public:
+        CheckpointWriter(
+            OSMFragment &frag,
+            JournalWriter &journal,
+            IngestCheckpoint &checkpoint,
+            const std::string &checkpointFile,
+            size_t interval ) :
+            m_frag( frag ),
+            m_journal( journal ),
+            m_checkpoint( checkpoint ),
+            m_checkpointFile( checkpointFile ),
+            m_interval( std::max<size_t>( interval, 1 ) ),
+            m_reader( *this ),
+            m_tokenizer( 0 ),
+            m_tokenizerBase( 0 ),
+            m_sourceBase( 0 ),
+            m_sinceCheckpoint( 0 ),
+            m_complete( false )
+        {
+        }
+
+        void setInput( const RawXMLTokenizer &tokenizer, const boost::shared_ptr<ParallelBzip2Source> &source, boost::uint64_t tokenizerBase, boost::uint64_t sourceBase )
+        {
+            m_tokenizer     = &tokenizer;
+            m_source        = source;
+            m_tokenizerBase = tokenizerBase;
+            m_sourceBase    = sourceBase;
+        }
+
+        // The <osm> element
+        void build( XMLNodeData &data )
+        {
+            data.readAttributes()
+                ( "version", m_checkpoint.m_version )
+                ( "generator", m_checkpoint.m_generator );
+            m_frag.setVersion( m_checkpoint.m_version );
+            m_frag.setGenerator( m_checkpoint.m_generator );
+
+            data.registerEnd( boost::bind( &CheckpointWriter::markComplete, this ) );
+            m_reader.build( data );
+        }
+
+        // The <osm> stand-in when resuming
+        void registerObjects( XMLNodeData &data )
+        {
+            m_reader.build( data );
+        }
+
+        // At </osm>: a file cut short between two objects parses without error
+        void markComplete() { m_complete = true; }
+        bool complete() const { return m_complete; }
+
+        void onNode( const OSMNode &node )
+        {
+            if ( m_frag.addNode( node ) )
+            {
+                m_journal.writeNode( node );
+            }
+            else
+            {
+                m_journal.writeLocation( node );
+            }
+
+            m_checkpoint.m_nodes++;
+            objectDone( IngestCheckpoint::SECTION_NODES );
+        }
+
+        void onWay( const OSMWay &way )
+        {
+            if ( m_frag.addWay( way ) )
+            {
+                m_journal.writeWay( way );
+            }
+
+            m_checkpoint.m_ways++;
+            objectDone( IngestCheckpoint::SECTION_WAYS );
+        }
+
+        void onRelation( const OSMRelation &relation )
+        {
+            if ( m_frag.addRelation( relation ) )
+            {
+                m_journal.writeRelation( relation );
+            }
+
+            m_checkpoint.m_relations++;
+            objectDone( IngestCheckpoint::SECTION_RELATIONS );
+        }
+
+        void onUser( dbId_t userId, const std::string &userName )
+        {
+            m_frag.addUser( userId, userName );
+            m_journal.writeUser( userId, userName );
+        }
+
+    private:
+        void objectDone( IngestCheckpoint::section_t section )
+        {
+            m_checkpoint.m_section = section;
+
+            // If the offset can't be placed (the end of a bzip2 block not yet
+            // followed by the next), try again after the next object
+            if ( ++m_sinceCheckpoint >= m_interval && saveCheckpoint() )
+            {
+                m_sinceCheckpoint = 0;
+            }
+        }
+
+        bool saveCheckpoint()
+        {
+            boost::uint64_t offset = m_tokenizerBase + m_tokenizer->bytesConsumed();
+            if ( m_source )
+            {
+                if ( offset < m_sourceBase || !m_source->findBlock( offset - m_sourceBase, m_checkpoint.m_bitOffset, m_checkpoint.m_skip ) )
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                m_checkpoint.m_bitOffset = offset * 8;
+                m_checkpoint.m_skip      = 0;
+            }
+
+            m_checkpoint.m_offset        = offset;
+            m_checkpoint.m_journalLength = m_journal.flush();
+            m_checkpoint.save( m_checkpointFile );
+
+            std::cout << boost::format( "Checkpoint at byte %d: %d nodes, %d ways, %d relations" )
+                % offset % m_checkpoint.m_nodes % m_checkpoint.m_ways % m_checkpoint.m_relations << std::endl;
+            return true;
+        }
+    };
+
+
+    // After a resume the <osm> element is already open, so its end tag
+    // closes the stand-in for it
+    class ResumedXMLReader : public RawXMLReader
+    {
+    private:
+        boost::function<void()> m_endFn;
+
+    public:
+        ResumedXMLReader( boost::shared_ptr<XMLNodeData> startNode, const boost::function<void()> &endFn ) :
+            RawXMLReader( startNode ),
+            m_endFn( endFn )
+        {
+        }
+
+        void endElement( const RawString &name )
+        {
+            if ( depth() == 1 && name == "osm" )
+            {
+                m_endFn();
+                return;
+            }
+
+            RawXMLReader::endElement( name );
+        }
+    };
+}
+
+
+IngestCheckpoint::IngestCheckpoint() :
+    m_offset( 0 ),
+    m_bitOffset( 0 ),
+    m_skip( 0 ),
+    m_journalLength( 0 ),
+    m_section( SECTION_NONE ),
+    m_nodes( 0 ),
+    m_ways( 0 ),
+    m_relations( 0 )
+{
+}
+
+void IngestCheckpoint::save( const std::string &path ) const
+{
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream os( tempPath.c_str() );
+        os << checkpointMagic << "\n"
+           << "file " << m_fileName << "\n"
+           << "version " << m_version << "\n"
+           << "generator " << m_generator << "\n"
+           << "offset " << m_offset << "\n"
+           << "bit-offset " << m_bitOffset << "\n"
+           << "skip " << m_skip << "\n"
+           << "journal " << m_journalLength << "\n"
+           << "section " << sectionNames[m_section] << "\n"
+           << "nodes " << m_nodes << "\n"
+           << "ways " << m_ways << "\n"
+           << "relations " << m_relations << "\n";
+
+        if ( !os.flush() )
+        {
+            throw std::runtime_error( "Unable to write checkpoint: " + tempPath );
+        }
+    }
+
+    if ( rename( tempPath.c_str(), path.c_str() ) != 0 )
+    {
+        throw std::runtime_error( "Unable to replace checkpoint: " + path );
+    }
+}
+
+bool IngestCheckpoint::load( const std::string &path )
+{
+    std::ifstream is( path.c_str() );
+    if ( !is )
+    {
+        return false;
+    }
+
+    std::string line;
+    if ( !std::getline( is, line ) || line != checkpointMagic )
+    {
+        throw std::runtime_error( "Not a checkpoint file: " + path );
+    }
+
+    while ( std::getline( is, line ) )
+    {
+        std::string::size_type space = line.find( ' ' );
+        std::string key   = line.substr( 0, space );
+        std::string value = space == std::string::npos ? "" : line.substr( space + 1 );
+
+        if ( key == "file" )            m_fileName = value;
+        else if ( key == "version" )    m_version = value;
+        else if ( key == "generator" )  m_generator = value;
+        else if ( key == "offset" )     m_offset = boost::lexical_cast<boost::uint64_t>( value );
+        else if ( key == "bit-offset" ) m_bitOffset = boost::lexical_cast<boost::uint64_t>( value );
+        else if ( key == "skip" )       m_skip = boost::lexical_cast<boost::uint64_t>( value );
+        else if ( key == "journal" )    m_journalLength = boost::lexical_cast<boost::uint64_t>( value );
+        else if ( key == "nodes" )      m_nodes = boost::lexical_cast<boost::uint64_t>( value );
+        else if ( key == "ways" )       m_ways = boost::lexical_cast<boost::uint64_t>( value );
+        else if ( key == "relations" )  m_relations = boost::lexical_cast<boost::uint64_t>( value );
+        else if ( key == "section" )
+        {
+            for ( size_t i = 0; i < sizeof( sectionNames ) / sizeof( sectionNames[0] ); i++ )
+            {
+                if ( value == sectionNames[i] )
+                {
+                    m_section = section_t( i );
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+
+void readOSMXMLCheckpointed(
+    const std::string &fileName,
+    OSMFragment &frag,
+    const std::string &checkpointFile,
+    const ReadOptions &options,
+    size_t checkpointInterval )
+{
+    std::string journalFile = checkpointFile + ".journal";
+
+    IngestCheckpoint checkpoint;
+    bool resuming = checkpoint.load( checkpointFile );
+    if ( resuming && checkpoint.m_fileName != fileName )
+    {
+        throw std::runtime_error( "Checkpoint " + checkpointFile + " is for another file: " + checkpoint.m_fileName );
+    }
+    checkpoint.m_fileName = fileName;
+
+    if ( resuming )
+    {
+        // Drop whatever was journaled after the checkpoint: it will be read again
+        if ( truncate( journalFile.c_str(), checkpoint.m_journalLength ) != 0 )
+        {
+            throw std::runtime_error( "Unable to truncate journal: " + journalFile );
+        }
+
+        frag.setVersion( checkpoint.m_version );
+        frag.setGenerator( checkpoint.m_generator );
+
+        JournalReader reader( journalFile );
+        size_t records = reader.replay( frag );
+
+        std::cout << boost::format( "Resuming %s at byte %d (in %s): replayed %d journal records" )
+            % fileName % checkpoint.m_offset % sectionNames[checkpoint.m_section] % records << std::endl;
+    }
+    else
+    {
+        std::cout << "Reading XML file with checkpoints: " << fileName << std::endl;
+    }
+
+    std::ifstream is( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    if ( !is )
+    {
+        throw std::runtime_error( "Unable to open file: " + fileName );
+    }
+
+    char magic[3] = { 0, 0, 0 };
+    is.read( magic, sizeof( magic ) );
+    is.clear();
+    is.seekg( 0 );
+
+    boost::iostreams::filtering_istream in;
+    boost::shared_ptr<ParallelBzip2Source> source;
+    if ( magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h' )
+    {
+        source.reset( new ParallelBzip2Source( is, std::max<size_t>( options.m_decompressThreads, 1 ), checkpoint.m_bitOffset ) );
+        in.push( *source );
+    }
+    else
+    {
+        is.seekg( checkpoint.m_offset );
+        in.push( is );
+    }
+    in.exceptions( std::ios_base::badbit );
+
+    if ( source && checkpoint.m_skip > 0 )
+    {
+        in.ignore( checkpoint.m_skip );
+        if ( boost::uint64_t( in.gcount() ) != checkpoint.m_skip )
+        {
+            throw std::runtime_error( "Input ends before the checkpoint" );
+        }
+    }
+
+    JournalWriter journal( journalFile, resuming );
+    CheckpointWriter writer( frag, journal, checkpoint, checkpointFile, checkpointInterval );
+
+    RawXMLTokenizer tokenizer( in );
+    writer.setInput( tokenizer, source, checkpoint.m_offset, checkpoint.m_offset - checkpoint.m_skip );
+
+    if ( resuming )
+    {
+        // Stands in for the <osm> element, which is open at the checkpoint
+        boost::shared_ptr<XMLNodeData> osmNdData( new XMLNodeData() );
+        writer.registerObjects( *osmNdData );
+
+        ResumedXMLReader handler( osmNdData, boost::bind( &CheckpointWriter::markComplete, &writer ) );
+        tokenizer.parse( handler );
+    }
+    else
+    {
+        boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+        startNdData->registerMembers()( ELEM_OSM, boost::bind( &CheckpointWriter::build, &writer, _1 ) );
+
+        RawXMLReader handler( startNdData );
+        tokenizer.parse( handler );
+    }
+
+    // The checkpoint stays for another try
+    if ( !writer.complete() )
+    {
+        throw XmlParseException( "Input ends before </osm>" );
+    }
+
+    frag.endRead();
+
+    remove( checkpointFile.c_str() );
+    remove( journalFile.c_str() );
+
+    std::cout << "Done..." << std::endl;
+}
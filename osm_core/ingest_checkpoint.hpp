@@ -0,0 +1,70 @@
+#ifndef INGEST_CHECKPOINT_HPP
+#define INGEST_CHECKPOINT_HPP
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "xml_reader.hpp"
+#include "osm_data.hpp"
+
+// Where a checkpointed read can carry on from
+struct IngestCheckpoint
+{
+    enum section_t
+    {
+        SECTION_NONE,
+        SECTION_NODES,
+        SECTION_WAYS,
+        SECTION_RELATIONS
+    };
+
+    std::string     m_fileName;
+    std::string     m_version;
+    std::string     m_generator;
+
+    // In the (decompressed) XML, just after the last object read
+    boost::uint64_t m_offset;
+    // Where that is in the file: the start of the bzip2 block holding it and
+    // how far into the block's output it is. For plain XML, m_offset * 8 and 0.
+    boost::uint64_t m_bitOffset;
+    boost::uint64_t m_skip;
+    // Bytes of the journal written up to the checkpoint
+    boost::uint64_t m_journalLength;
+
+    section_t       m_section;
+    boost::uint64_t m_nodes;
+    boost::uint64_t m_ways;
+    boost::uint64_t m_relations;
+
+    IngestCheckpoint();
+
+    // Written to a temporary file and renamed over the old one, so a crash
+    // mid-write leaves the previous checkpoint
+    void save( const std::string &path ) const;
+    // False if there is no checkpoint file
+    bool load( const std::string &path );
+};
+
+// Read an OSM XML file (plain or bzip2) with the raw tokenizer, saving a
+// checkpoint every checkpointInterval objects, so that a read that fails can
+// carry on from the last checkpoint rather than the start of the file.
+//
+// Each object the fragment keeps is appended to checkpointFile + ".journal"
+// as it is read, along with the users and the locations of the nodes any
+// filter rejected (which it needs for the ways). If checkpointFile exists
+// when the read starts, the journal up to it is replayed into frag, which
+// must be set up (filter, node location store) as it was the first time,
+// and parsing resumes where the checkpoint says. Both files are removed once
+// the whole file has been read.
+//
+// bzip2 input is always inflated by ParallelBzip2Decompressor (with at least
+// one thread), as only it can start from a block in the middle of the file.
+void readOSMXMLCheckpointed(
+    const std::string &fileName,
+    OSMFragment &frag,
+    const std::string &checkpointFile,
+    const ReadOptions &options = ReadOptions(),
+    size_t checkpointInterval = 1000000 );
+
+#endif // INGEST_CHECKPOINT_HPP
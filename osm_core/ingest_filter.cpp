@@ -0,0 +1,127 @@
+#include <boost/foreach.hpp>
+
+#include "ingest_filter.hpp"
+
+IngestFilter::IngestFilter() :
+    m_useBounds( false ),
+    m_minLat( 0 ),
+    m_minLon( 0 ),
+    m_maxLat( 0 ),
+    m_maxLon( 0 ),
+    m_keepNodes( true ),
+    m_keepWays( true ),
+    m_keepRelations( true )
+{
+}
+
+IngestFilter &IngestFilter::setBounds( double minLat, double minLon, double maxLat, double maxLon )
+{
+    m_useBounds = true;
+    m_minLat = toFixed( minLat );
+    m_minLon = toFixed( minLon );
+    m_maxLat = toFixed( maxLat );
+    m_maxLon = toFixed( maxLon );
+
+    return *this;
+}
+
+IngestFilter &IngestFilter::includeTag( const std::string &key, const std::string &value )
+{
+    m_include.push_back( makeMatch( key, value ) );
+    return *this;
+}
+
+IngestFilter &IngestFilter::excludeTag( const std::string &key, const std::string &value )
+{
+    m_exclude.push_back( makeMatch( key, value ) );
+    return *this;
+}
+
+IngestFilter &IngestFilter::keepNodes( bool keep )
+{
+    m_keepNodes = keep;
+    return *this;
+}
+
+IngestFilter &IngestFilter::keepWays( bool keep )
+{
+    m_keepWays = keep;
+    return *this;
+}
+
+IngestFilter &IngestFilter::keepRelations( bool keep )
+{
+    m_keepRelations = keep;
+    return *this;
+}
+
+IngestFilter &IngestFilter::setNodeIds( const boost::shared_ptr<const IdSet> &nodeIds )
+{
+    m_nodeIds = nodeIds;
+    return *this;
+}
+
+IngestFilter IngestFilter::routableWays( const std::vector<std::string> &routableWayKeys )
+{
+    IngestFilter filter;
+    filter.keepNodes( false ).keepRelations( false );
+
+    BOOST_FOREACH( const std::string &key, routableWayKeys )
+    {
+        filter.includeTag( key );
+    }
+
+    return filter;
+}
+
+bool IngestFilter::inBounds( coord_t lat, coord_t lon ) const
+{
+    return !m_useBounds || (lat >= m_minLat && lat <= m_maxLat && lon >= m_minLon && lon <= m_maxLon);
+}
+
+bool IngestFilter::matchesTags( const TagList &tags ) const
+{
+    BOOST_FOREACH( const TagMatch &match, m_exclude )
+    {
+        if ( matches( match, tags ) )
+        {
+            return false;
+        }
+    }
+
+    if ( m_include.empty() )
+    {
+        return true;
+    }
+
+    BOOST_FOREACH( const TagMatch &match, m_include )
+    {
+        if ( matches( match, tags ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+IngestFilter::TagMatch IngestFilter::makeMatch( const std::string &key, const std::string &value )
+{
+    TagMatch match;
+    match.m_key      = ConstTagString( key );
+    match.m_value    = ConstTagString( value );
+    match.m_anyValue = value.empty();
+
+    return match;
+}
+
+bool IngestFilter::matches( const TagMatch &match, const TagList &tags )
+{
+    TagList::const_iterator findIt = tags.find( match.m_key );
+    if ( findIt == tags.end() )
+    {
+        return false;
+    }
+
+    return match.m_anyValue || findIt->second == match.m_value;
+}
@@ -0,0 +1,89 @@
+#ifndef INGEST_FILTER_HPP
+#define INGEST_FILTER_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "osm_data.hpp"
+#include "id_set.hpp"
+
+// Which objects an OSMFragment keeps while it is being read (see
+// OSMFragment::setFilter). Each object is judged as soon as its element has
+// been read, and rejected objects are never added to the fragment.
+//
+// - Nodes and ways must lie within the bounding box, if one is set. A way
+//   counts as inside if any of its nodes is; a relation if any of its members
+//   was kept.
+// - Objects must have one of the include tags (if there are any) and none of
+//   the exclude tags. An empty value matches any value of the key.
+// - Nodes referenced by a kept way are always kept, wherever they are and
+//   whatever their tags, so the way's geometry is complete.
+// - If a node id set is given, nodes are kept if and only if they are in it.
+//   This is for a second pass over a file, with the ids of the kept ways'
+//   nodes found by the first (see readOSMFileTwoPass), so nothing needs to be
+//   held back for the ways.
+class IngestFilter
+{
+private:
+    struct TagMatch
+    {
+        ConstTagString m_key;
+        ConstTagString m_value;
+        bool           m_anyValue;
+    };
+
+    bool    m_useBounds;
+    coord_t m_minLat;
+    coord_t m_minLon;
+    coord_t m_maxLat;
+    coord_t m_maxLon;
+
+    std::vector<TagMatch> m_include;
+    std::vector<TagMatch> m_exclude;
+
+    bool   m_keepNodes;
+    bool   m_keepWays;
+    bool   m_keepRelations;
+
+    boost::shared_ptr<const IdSet> m_nodeIds;
+
+public:
+    // Keeps everything
+    IngestFilter();
+
+    // In degrees
+    IngestFilter &setBounds( double minLat, double minLon, double maxLat, double maxLon );
+    IngestFilter &includeTag( const std::string &key, const std::string &value = "" );
+    IngestFilter &excludeTag( const std::string &key, const std::string &value = "" );
+
+    // Whether objects of each type are kept in their own right
+    IngestFilter &keepNodes( bool keep );
+    IngestFilter &keepWays( bool keep );
+    IngestFilter &keepRelations( bool keep );
+
+    // Finalised; shared by copies of the filter
+    IngestFilter &setNodeIds( const boost::shared_ptr<const IdSet> &nodeIds );
+
+    // Ways with any of the keys (as RoutingGraph::getRoutableWayKeys), and
+    // their nodes. Nothing else.
+    static IngestFilter routableWays( const std::vector<std::string> &routableWayKeys );
+
+    bool hasBounds() const { return m_useBounds; }
+    bool inBounds( coord_t lat, coord_t lon ) const;
+    bool matchesTags( const TagList &tags ) const;
+
+    bool keepsNodes() const { return m_keepNodes; }
+    bool keepsWays() const { return m_keepWays; }
+    bool keepsRelations() const { return m_keepRelations; }
+
+    bool hasNodeIds() const { return m_nodeIds.get() != 0; }
+    bool listsNode( dbId_t nodeId ) const { return m_nodeIds->contains( nodeId ); }
+
+private:
+    static TagMatch makeMatch( const std::string &key, const std::string &value );
+    static bool matches( const TagMatch &match, const TagList &tags );
+};
+
+#endif // INGEST_FILTER_HPP
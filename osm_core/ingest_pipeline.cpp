@@ -0,0 +1,436 @@
+#include <fstream>
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "osm_data.hpp"
+#include "xml_reader.hpp"
+#include "ingest_pipeline.hpp"
+
+namespace
+{
+    // Thrown inside a stage to unwind it when another stage has failed
+    struct PipelineAborted
+    {
+    };
+
+    const size_t spinsBeforeSleep = 256;
+
+    double seconds( const boost::posix_time::time_duration &duration )
+    {
+        return duration.total_microseconds() / 1e6;
+    }
+
+    void appendText( std::vector<char> &text, const RawString &str, size_t &offset, size_t &length )
+    {
+        offset = text.size();
+        length = str.size();
+        text.insert( text.end(), str.begin(), str.end() );
+    }
+}
+
+
+PipelineStageStats::PipelineStageStats() :
+    m_inputStalls( 0 ),
+    m_inputStallTime( 0, 0, 0 ),
+    m_outputStalls( 0 ),
+    m_outputStallTime( 0, 0, 0 )
+{
+}
+
+std::ostream &operator<<( std::ostream &s, const PipelineStats &stats )
+{
+    const char *names[] = { "decompress", "tokenize", "build" };
+    const PipelineStageStats *stages[] = { &stats.m_decompress, &stats.m_tokenize, &stats.m_build };
+
+    s << "Pipeline stalls (waits for input / free output buffers):" << std::endl;
+    for ( size_t i = 0; i < 3; i++ )
+    {
+        s << boost::format( "  %-10s  input: %8d (%8.3fs)  output: %8d (%8.3fs)" )
+            % names[i]
+            % stages[i]->m_inputStalls % seconds( stages[i]->m_inputStallTime )
+            % stages[i]->m_outputStalls % seconds( stages[i]->m_outputStallTime ) << std::endl;
+    }
+
+    return s;
+}
+
+
+void IngestPipeline::EventBatch::clear()
+{
+    m_text.clear();
+    m_events.clear();
+    m_attributes.clear();
+    m_last = false;
+}
+
+
+// Presents the decompressed chunks to the tokenizer as a stream
+class IngestPipeline::ChunkSource
+{
+private:
+    IngestPipeline *m_pipeline;
+    Chunk          *m_chunk;
+    size_t          m_pos;
+
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    ChunkSource( IngestPipeline *pipeline ) : m_pipeline( pipeline ), m_chunk( 0 ), m_pos( 0 )
+    {
+    }
+
+    std::streamsize read( char *s, std::streamsize n )
+    {
+        while ( !m_chunk || m_pos == m_chunk->m_size )
+        {
+            if ( m_chunk && m_chunk->m_last )
+            {
+                return -1;
+            }
+            m_chunk = m_pipeline->nextChunk( m_chunk );
+            m_pos = 0;
+        }
+
+        size_t count = std::min<size_t>( n, m_chunk->m_size - m_pos );
+        memcpy( s, &m_chunk->m_data[m_pos], count );
+        m_pos += count;
+
+        return count;
+    }
+};
+
+
+// Copies tokenizer events into batches for the build stage
+class IngestPipeline::BatchingHandler : public RawXMLHandler
+{
+private:
+    IngestPipeline *m_pipeline;
+    EventBatch     *m_batch;
+
+public:
+    BatchingHandler( IngestPipeline *pipeline ) : m_pipeline( pipeline ), m_batch( pipeline->nextBatch( 0 ) )
+    {
+    }
+
+    void startElement( const RawString &name, const rawAttributes_t &attributes )
+    {
+        EventBatch::Event event;
+        event.m_start          = true;
+        event.m_firstAttribute = m_batch->m_attributes.size();
+        event.m_attributeCount = attributes.size();
+        appendText( m_batch->m_text, name, event.m_nameOffset, event.m_nameLength );
+
+        BOOST_FOREACH( const RawAttribute &attribute, attributes )
+        {
+            EventBatch::Attribute copied;
+            appendText( m_batch->m_text, attribute.m_name, copied.m_nameOffset, copied.m_nameLength );
+            appendText( m_batch->m_text, attribute.m_value, copied.m_valueOffset, copied.m_valueLength );
+            m_batch->m_attributes.push_back( copied );
+        }
+
+        addEvent( event );
+    }
+
+    void endElement( const RawString &name )
+    {
+        EventBatch::Event event;
+        event.m_start          = false;
+        event.m_firstAttribute = 0;
+        event.m_attributeCount = 0;
+        appendText( m_batch->m_text, name, event.m_nameOffset, event.m_nameLength );
+
+        addEvent( event );
+    }
+
+    void finish()
+    {
+        m_batch->m_last = true;
+        m_pipeline->nextBatch( m_batch );
+        m_batch = 0;
+    }
+
+private:
+    void addEvent( const EventBatch::Event &event )
+    {
+        m_batch->m_events.push_back( event );
+        if ( m_batch->m_events.size() >= m_pipeline->m_batchEvents )
+        {
+            m_batch = m_pipeline->nextBatch( m_batch );
+        }
+    }
+};
+
+
+IngestPipeline::IngestPipeline(
+    std::istream &in,
+    RawXMLHandler &handler,
+    size_t depth,
+    size_t chunkSize,
+    size_t batchEvents ) :
+    m_in( in ),
+    m_handler( handler ),
+    m_chunkSize( chunkSize ),
+    m_batchEvents( batchEvents ),
+    m_chunkStore( depth ),
+    m_batchStore( depth ),
+    m_fullChunks( depth ),
+    m_freeChunks( depth ),
+    m_fullBatches( depth ),
+    m_freeBatches( depth ),
+    m_abort( false ),
+    m_parseError( false )
+{
+    for ( size_t i = 0; i < depth; i++ )
+    {
+        m_chunkStore[i].m_data.resize( m_chunkSize );
+        m_freeChunks.push( &m_chunkStore[i] );
+
+        m_batchStore[i].clear();
+        m_freeBatches.push( &m_batchStore[i] );
+    }
+}
+
+template<typename T>
+T *IngestPipeline::waitFor( BufferQueue<T> &queue, size_t &stalls, boost::posix_time::time_duration &stallTime )
+{
+    T *item = 0;
+    if ( queue.pop( item ) )
+    {
+        return item;
+    }
+
+    stalls++;
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    for ( size_t spins = 0; !queue.pop( item ); spins++ )
+    {
+        if ( m_abort )
+        {
+            throw PipelineAborted();
+        }
+
+        if ( spins < spinsBeforeSleep )
+        {
+            boost::this_thread::yield();
+        }
+        else
+        {
+            boost::this_thread::sleep( boost::posix_time::microseconds( 50 ) );
+        }
+    }
+    stallTime += boost::posix_time::microsec_clock::universal_time() - start;
+
+    return item;
+}
+
+template<typename T>
+void IngestPipeline::handOver( BufferQueue<T> &queue, T *item )
+{
+    // Every queue can hold all of its stage's buffers, so this never fills up
+    bool pushed = queue.push( item );
+    BOOST_ASSERT( pushed );
+    (void) pushed;
+}
+
+IngestPipeline::Chunk *IngestPipeline::nextChunk( Chunk *done )
+{
+    if ( done )
+    {
+        handOver( m_freeChunks, done );
+    }
+
+    return waitFor( m_fullChunks, m_stats.m_tokenize.m_inputStalls, m_stats.m_tokenize.m_inputStallTime );
+}
+
+IngestPipeline::EventBatch *IngestPipeline::nextBatch( EventBatch *full )
+{
+    if ( full )
+    {
+        handOver( m_fullBatches, full );
+        if ( full->m_last )
+        {
+            return 0;
+        }
+    }
+
+    return waitFor( m_freeBatches, m_stats.m_tokenize.m_outputStalls, m_stats.m_tokenize.m_outputStallTime );
+}
+
+void IngestPipeline::fail( const std::string &message, bool parseError )
+{
+    boost::mutex::scoped_lock lock( m_errorMutex );
+    if ( m_error.empty() )
+    {
+        m_error = message;
+        m_parseError = parseError;
+    }
+    m_abort = true;
+}
+
+void IngestPipeline::decompressStage()
+{
+    try
+    {
+        while ( true )
+        {
+            Chunk *chunk = waitFor( m_freeChunks, m_stats.m_decompress.m_outputStalls, m_stats.m_decompress.m_outputStallTime );
+
+            m_in.read( &chunk->m_data[0], m_chunkSize );
+            chunk->m_size = m_in.gcount();
+            chunk->m_last = chunk->m_size < m_chunkSize;
+
+            handOver( m_fullChunks, chunk );
+            if ( chunk->m_last )
+            {
+                break;
+            }
+        }
+    }
+    catch ( const PipelineAborted & )
+    {
+    }
+    catch ( const std::exception &e )
+    {
+        fail( std::string( "Error reading input: " ) + e.what(), false );
+    }
+}
+
+void IngestPipeline::tokenizeStage()
+{
+    try
+    {
+        boost::iostreams::filtering_istream in;
+        in.push( ChunkSource( this ) );
+        in.exceptions( std::ios_base::badbit );
+
+        BatchingHandler batcher( this );
+        RawXMLTokenizer tokenizer( in );
+        tokenizer.parse( batcher );
+        batcher.finish();
+    }
+    catch ( const PipelineAborted & )
+    {
+    }
+    catch ( const XmlParseException &e )
+    {
+        fail( e.what(), true );
+    }
+    catch ( const std::exception &e )
+    {
+        fail( e.what(), false );
+    }
+}
+
+void IngestPipeline::buildStage()
+{
+    rawAttributes_t attributes;
+
+    while ( true )
+    {
+        EventBatch *batch = waitFor( m_fullBatches, m_stats.m_build.m_inputStalls, m_stats.m_build.m_inputStallTime );
+        const char *text = batch->m_text.empty() ? 0 : &batch->m_text[0];
+
+        BOOST_FOREACH( const EventBatch::Event &event, batch->m_events )
+        {
+            RawString name( text + event.m_nameOffset, event.m_nameLength );
+            if ( !event.m_start )
+            {
+                m_handler.endElement( name );
+                continue;
+            }
+
+            attributes.resize( event.m_attributeCount );
+            for ( size_t i = 0; i < event.m_attributeCount; i++ )
+            {
+                const EventBatch::Attribute &copied = batch->m_attributes[event.m_firstAttribute + i];
+                attributes[i].m_name  = RawString( text + copied.m_nameOffset, copied.m_nameLength );
+                attributes[i].m_value = RawString( text + copied.m_valueOffset, copied.m_valueLength );
+            }
+            m_handler.startElement( name, attributes );
+        }
+
+        bool last = batch->m_last;
+        batch->clear();
+        handOver( m_freeBatches, batch );
+
+        if ( last )
+        {
+            break;
+        }
+    }
+}
+
+void IngestPipeline::run()
+{
+    boost::thread decompressThread( boost::bind( &IngestPipeline::decompressStage, this ) );
+    boost::thread tokenizeThread( boost::bind( &IngestPipeline::tokenizeStage, this ) );
+
+    try
+    {
+        buildStage();
+    }
+    catch ( const PipelineAborted & )
+    {
+        // The failing stage has recorded the error
+    }
+    catch ( ... )
+    {
+        m_abort = true;
+        decompressThread.join();
+        tokenizeThread.join();
+        throw;
+    }
+
+    decompressThread.join();
+    tokenizeThread.join();
+
+    if ( !m_error.empty() )
+    {
+        if ( m_parseError )
+        {
+            throw XmlParseException( m_error );
+        }
+        throw std::runtime_error( m_error );
+    }
+}
+
+
+void readOSMXMLPipelined(
+    const std::string &fileName,
+    OSMFragment &frag,
+    const ReadOptions &options,
+    PipelineStats *stats )
+{
+    std::cout << "Reading XML file (pipelined): " << fileName << std::endl;
+
+    boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+
+    startNdData->registerMembers()( "osm", boost::bind( &OSMFragment::build, &frag, _1 ) );
+
+    RawXMLReader handler( startNdData );
+
+    std::ifstream is;
+    boost::iostreams::filtering_istream in;
+    openOSMInput( fileName, is, in, options );
+
+    IngestPipeline pipeline( in, handler );
+    pipeline.run();
+
+    if ( !handler.complete() )
+    {
+        throw XmlParseException( "Input ends before </osm>" );
+    }
+
+    std::cout << pipeline.stats();
+    if ( stats )
+    {
+        *stats = pipeline.stats();
+    }
+
+    std::cout << "Done..." << std::endl;
+}
@@ -0,0 +1,163 @@
+#ifndef INGEST_PIPELINE_HPP
+#define INGEST_PIPELINE_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "xml_tokenizer.hpp"
+
+class OSMFragment;
+struct ReadOptions;
+
+// How long a stage spent waiting on its neighbours
+struct PipelineStageStats
+{
+    // Waits for work from the previous stage
+    size_t m_inputStalls;
+    boost::posix_time::time_duration m_inputStallTime;
+    // Waits for the next stage to hand back a free buffer (back-pressure)
+    size_t m_outputStalls;
+    boost::posix_time::time_duration m_outputStallTime;
+
+    PipelineStageStats();
+};
+
+struct PipelineStats
+{
+    PipelineStageStats m_decompress;
+    PipelineStageStats m_tokenize;
+    PipelineStageStats m_build;
+};
+
+std::ostream &operator<<( std::ostream &s, const PipelineStats &stats );
+
+
+// Runs ingest as three threads: decompression (pulling bytes through the input
+// stream filters), tokenizing and object building. The stages are connected by
+// bounded lock-free single producer/single consumer queues; each queue has a
+// partner queue that hands the emptied buffers back, so at most 'depth'
+// buffers are ever in flight between two stages. The build stage runs on the
+// calling thread, as the object model is not thread safe.
+class IngestPipeline
+{
+public:
+    // Decompressed input bytes
+    struct Chunk
+    {
+        std::vector<char> m_data;
+        size_t            m_size;
+        bool              m_last;
+    };
+
+    // Tokenizer events. Names and values are copied into m_text as the
+    // tokenizer buffer they point into is reused.
+    struct EventBatch
+    {
+        struct Event
+        {
+            size_t m_nameOffset;
+            size_t m_nameLength;
+            size_t m_firstAttribute;
+            size_t m_attributeCount;
+            bool   m_start;
+        };
+
+        struct Attribute
+        {
+            size_t m_nameOffset;
+            size_t m_nameLength;
+            size_t m_valueOffset;
+            size_t m_valueLength;
+        };
+
+        std::vector<char>      m_text;
+        std::vector<Event>     m_events;
+        std::vector<Attribute> m_attributes;
+        bool                   m_last;
+
+        void clear();
+    };
+
+private:
+    class ChunkSource;
+    class BatchingHandler;
+
+    template<typename T>
+    class BufferQueue
+    {
+    private:
+        boost::lockfree::spsc_queue<T *> m_queue;
+
+    public:
+        BufferQueue( size_t capacity ) : m_queue( capacity ) {}
+
+        bool push( T *item ) { return m_queue.push( item ); }
+        bool pop( T *&item ) { return m_queue.pop( item ); }
+    };
+
+    std::istream               &m_in;
+    RawXMLHandler              &m_handler;
+    size_t                      m_chunkSize;
+    size_t                      m_batchEvents;
+
+    std::vector<Chunk>          m_chunkStore;
+    std::vector<EventBatch>     m_batchStore;
+
+    BufferQueue<Chunk>          m_fullChunks;
+    BufferQueue<Chunk>          m_freeChunks;
+    BufferQueue<EventBatch>     m_fullBatches;
+    BufferQueue<EventBatch>     m_freeBatches;
+
+    // Set when any stage fails, so the others stop waiting
+    boost::atomic<bool>         m_abort;
+    boost::mutex                m_errorMutex;
+    std::string                 m_error;
+    bool                        m_parseError;
+
+    PipelineStats               m_stats;
+
+public:
+    IngestPipeline(
+        std::istream &in,
+        RawXMLHandler &handler,
+        size_t depth = 8,
+        size_t chunkSize = 1 << 20,
+        size_t batchEvents = 1 << 14 );
+
+    void run();
+
+    const PipelineStats &stats() const { return m_stats; }
+
+private:
+    void decompressStage();
+    void tokenizeStage();
+    void buildStage();
+
+    Chunk *nextChunk( Chunk *done );
+    EventBatch *nextBatch( EventBatch *full );
+
+    void fail( const std::string &message, bool parseError );
+
+    template<typename T>
+    T *waitFor( BufferQueue<T> &queue, size_t &stalls, boost::posix_time::time_duration &stallTime );
+    template<typename T>
+    void handOver( BufferQueue<T> &queue, T *item );
+};
+
+
+// Read an OSM XML file with the raw tokenizer, decompressing, tokenizing and
+// building on separate threads. Stage stall counts are written to std::cout
+// and, optionally, returned in stats.
+void readOSMXMLPipelined(
+    const std::string &fileName,
+    OSMFragment &frag,
+    const ReadOptions &options,
+    PipelineStats *stats = 0 );
+
+#endif // INGEST_PIPELINE_HPP
@@ -0,0 +1,83 @@
+#include <iostream>
+
+#include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "ingest_two_pass.hpp"
+#include "ingest_filter.hpp"
+#include "osm_stream.hpp"
+#include "id_set.hpp"
+
+namespace
+{
+    // First pass: the nodes the filter would keep, and the nodes of the ways
+    // it would keep
+    class NodeIdCollector : public OSMVisitor
+    {
+    private:
+        const IngestFilter &m_filter;
+        IdSet              &m_nodeIds;
+        size_t              m_ways;
+
+    public:
+        NodeIdCollector( const IngestFilter &filter, IdSet &nodeIds ) :
+            m_filter( filter ),
+            m_nodeIds( nodeIds ),
+            m_ways( 0 )
+        {
+        }
+
+        void onNode( const OSMNode &node )
+        {
+            if ( m_filter.keepsNodes() && m_filter.matchesTags( node.getTags() ) )
+            {
+                m_nodeIds.add( node.getId() );
+            }
+        }
+
+        void onWay( const OSMWay &way )
+        {
+            if ( m_filter.keepsWays() && m_filter.matchesTags( way.getTags() ) )
+            {
+                m_ways++;
+                BOOST_FOREACH( dbId_t nodeId, way.getNodes() )
+                {
+                    m_nodeIds.add( nodeId );
+                }
+            }
+        }
+
+        size_t ways() const { return m_ways; }
+    };
+}
+
+
+void readOSMFileTwoPass( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag, const ReadOptions &options )
+{
+    const IngestFilter *filter = frag.getFilter();
+    if ( !filter || filter->hasBounds() )
+    {
+        if ( filter )
+        {
+            std::cout << "Bounding box filter needs node locations to judge ways: reading in one pass" << std::endl;
+        }
+        readOSMFile( x, fileName, frag, options );
+        return;
+    }
+
+    std::cout << "First pass: collecting node ids" << std::endl;
+
+    boost::shared_ptr<IdSet> nodeIds( new IdSet() );
+    NodeIdCollector collector( *filter, *nodeIds );
+    streamOSMFile( fileName, collector, options );
+    nodeIds->finalise();
+
+    std::cout << boost::format( "First pass found %d ways using %d nodes" ) % collector.ways() % nodeIds->size() << std::endl;
+
+    IngestFilter secondPass( *filter );
+    secondPass.setNodeIds( nodeIds );
+    frag.setFilter( secondPass );
+
+    readOSMFile( x, fileName, frag, options );
+}
@@ -0,0 +1,19 @@
+#ifndef INGEST_TWO_PASS_HPP
+#define INGEST_TWO_PASS_HPP
+
+#include <string>
+
+#include "xml_reader.hpp"
+#include "osm_data.hpp"
+
+// Read a file with frag's filter in two passes. The first streams the file
+// and collects the ids of the nodes the filter keeps, including those of the
+// kept ways; the second reads only those nodes. A one pass filtered read has
+// to hold back a location for every node in the file until it knows which
+// the ways use, which is most of its memory on a large file.
+//
+// A filter with a bounding box needs the node locations to judge the ways,
+// so falls back to a one pass read, as does an unfiltered fragment.
+void readOSMFileTwoPass( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag, const ReadOptions &options = ReadOptions() );
+
+#endif // INGEST_TWO_PASS_HPP
@@ -0,0 +1,100 @@
+#include <algorithm>
+
+#include "node_locations.hpp"
+
+namespace
+{
+    // Keeps every valid latitude's entry above zero
+    const boost::uint32_t latOffset = 900000001;
+
+    // 8MB to start with; sparse until written
+    const dbId_t initialCapacity = 1 << 20;
+}
+
+DenseNodeLocations::DenseNodeLocations( const std::string &fileName ) :
+    m_entries( 0 ),
+    m_capacity( initialCapacity )
+{
+    boost::iostreams::mapped_file_params params( fileName );
+    params.new_file_size = m_capacity * sizeof( Entry );
+    m_file.open( params );
+
+    m_entries = reinterpret_cast<Entry *>( m_file.data() );
+}
+
+void DenseNodeLocations::set( dbId_t nodeId, coord_t lat, coord_t lon )
+{
+    if ( nodeId >= m_capacity )
+    {
+        grow( nodeId );
+    }
+
+    Entry &entry = m_entries[nodeId];
+    entry.m_lat = static_cast<boost::uint32_t>( lat + coord_t( latOffset ) );
+    entry.m_lon = lon;
+}
+
+bool DenseNodeLocations::get( dbId_t nodeId, coord_t &lat, coord_t &lon ) const
+{
+    if ( nodeId >= m_capacity || m_entries[nodeId].m_lat == 0 )
+    {
+        return false;
+    }
+
+    const Entry &entry = m_entries[nodeId];
+    lat = coord_t( entry.m_lat ) - coord_t( latOffset );
+    lon = entry.m_lon;
+    return true;
+}
+
+void DenseNodeLocations::grow( dbId_t nodeId )
+{
+    // Doubling keeps the number of remaps logarithmic in the highest id
+    dbId_t capacity = m_capacity;
+    while ( capacity <= nodeId )
+    {
+        capacity *= 2;
+    }
+
+    m_file.resize( capacity * sizeof( Entry ) );
+    m_entries  = reinterpret_cast<Entry *>( m_file.data() );
+    m_capacity = capacity;
+}
+
+
+SparseNodeLocations::SparseNodeLocations() : m_sorted( true )
+{
+}
+
+void SparseNodeLocations::set( dbId_t nodeId, coord_t lat, coord_t lon )
+{
+    if ( !m_entries.empty() && nodeId < m_entries.back().m_id )
+    {
+        m_sorted = false;
+    }
+
+    Entry entry = { nodeId, lat, lon };
+    m_entries.push_back( entry );
+}
+
+bool SparseNodeLocations::get( dbId_t nodeId, coord_t &lat, coord_t &lon ) const
+{
+    if ( !m_sorted )
+    {
+        std::stable_sort( m_entries.begin(), m_entries.end() );
+        m_sorted = true;
+    }
+
+    Entry key = { nodeId, 0, 0 };
+    std::vector<Entry>::const_iterator findIt = std::upper_bound( m_entries.begin(), m_entries.end(), key );
+    if ( findIt == m_entries.begin() || (findIt - 1)->m_id != nodeId )
+    {
+        return false;
+    }
+
+    // The last set wins, as it does for the dense store
+    --findIt;
+    lat = findIt->m_lat;
+    lon = findIt->m_lon;
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef NODE_LOCATIONS_HPP
+#define NODE_LOCATIONS_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "coord.hpp"
+#include "osm_data.hpp"
+
+// Node locations by id, without the nodes. Given to an OSMFragment (see
+// OSMFragment::setNodeLocations), every node read has its location stored,
+// kept by any filter or not, and way geometry is looked up here.
+//
+// Locations are fixed point 1e-7 degrees (see coord.hpp), as in the OSM
+// database.
+class NodeLocationStore
+{
+public:
+    virtual ~NodeLocationStore() {}
+
+    virtual void set( dbId_t nodeId, coord_t lat, coord_t lon ) = 0;
+    // False if the node was never set
+    virtual bool get( dbId_t nodeId, coord_t &lat, coord_t &lon ) const = 0;
+};
+
+// An array indexed by node id in a memory mapped file, which grows as higher
+// ids arrive. Lookups are a single read, and the file's pages rather than the
+// heap hold the data, so the page cache bounds its memory. Suited to whole
+// planets or extracts whose ids are dense; with sparse ids most of the file
+// is holes (which most filesystems don't store) but still address space.
+class DenseNodeLocations : public NodeLocationStore
+{
+private:
+    struct Entry
+    {
+        // Offset so that zero, as in a page never written, means no node
+        boost::uint32_t m_lat;
+        coord_t         m_lon;
+    };
+
+    boost::iostreams::mapped_file_sink m_file;
+    Entry                             *m_entries;
+    dbId_t                             m_capacity;
+
+public:
+    // The file is created, or truncated if it exists
+    DenseNodeLocations( const std::string &fileName );
+
+    void set( dbId_t nodeId, coord_t lat, coord_t lon );
+    bool get( dbId_t nodeId, coord_t &lat, coord_t &lon ) const;
+
+private:
+    void grow( dbId_t nodeId );
+};
+
+// Id and location records on the heap, looked up by binary search: 16 bytes
+// a node set, whatever the ids. For extracts, whose ids are scattered across
+// the whole id range.
+class SparseNodeLocations : public NodeLocationStore
+{
+private:
+    struct Entry
+    {
+        dbId_t          m_id;
+        coord_t         m_lat;
+        coord_t         m_lon;
+
+        bool operator<( const Entry &other ) const { return m_id < other.m_id; }
+    };
+
+    // Sorted on the first lookup after an out of order set. Files are
+    // normally in id order, so this is rare.
+    mutable std::vector<Entry> m_entries;
+    mutable bool               m_sorted;
+
+public:
+    SparseNodeLocations();
+
+    void set( dbId_t nodeId, coord_t lat, coord_t lon );
+    bool get( dbId_t nodeId, coord_t &lat, coord_t &lon ) const;
+};
+
+#endif // NODE_LOCATIONS_HPP
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/foreach.hpp>
+
+#include "osm_data.hpp"
+#include "node_store.hpp"
+#include "id_search.hpp"
+
+namespace
+{
+    // Orders node indices by id, for sorting the columns together
+    struct IndexIdLess
+    {
+        const std::vector<NodeStore::id_t> &m_ids;
+
+        IndexIdLess( const std::vector<NodeStore::id_t> &ids ) : m_ids( ids ) {}
+        bool operator()( boost::uint32_t lhs, boost::uint32_t rhs ) const { return m_ids[lhs] < m_ids[rhs]; }
+    };
+
+    template<typename T>
+    void freeSpare( std::vector<T> &v )
+    {
+        std::vector<T>( v ).swap( v );
+    }
+}
+
+
+const boost::uint32_t NodeStore::noMeta;
+const boost::uint32_t NodeStore::noIndex;
+
+NodeStore::tagRange_t NodeStore::Node::getTags() const
+{
+    const tag_t *tags = m_store->m_tags.empty() ? 0 : &m_store->m_tags[0];
+    return tagRange_t( tags + m_store->m_tagStartData[m_index], tags + m_store->m_tagStartData[m_index + 1] );
+}
+
+bool NodeStore::Node::findTag( const ConstTagString &key, ConstTagString &value ) const
+{
+    BOOST_FOREACH( const tag_t &tag, getTags() )
+    {
+        if ( tag.first == key )
+        {
+            value = tag.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+const boost::posix_time::ptime &NodeStore::Node::getTimeStamp() const
+{
+    static const boost::posix_time::ptime none;
+
+    boost::uint32_t meta = m_store->m_metaIndexData[m_index];
+    return meta == noMeta ? none : m_store->m_meta[meta].m_timestamp;
+}
+
+const std::string &NodeStore::Node::getUser() const
+{
+    static const std::string none;
+
+    boost::uint32_t meta = m_store->m_metaIndexData[m_index];
+    return meta == noMeta ? none : m_store->m_users[m_store->m_meta[meta].m_user].second;
+}
+
+NodeStore::id_t NodeStore::Node::getUserId() const
+{
+    boost::uint32_t meta = m_store->m_metaIndexData[m_index];
+    return meta == noMeta ? 0 : m_store->m_users[m_store->m_meta[meta].m_user].first;
+}
+
+
+NodeStore::NodeStore() : m_tagStarts( 1, 0 ), m_sorted( true )
+{
+    refresh();
+}
+
+void NodeStore::refresh() const
+{
+    if ( m_mapping )
+    {
+        return;
+    }
+
+    m_idData        = m_ids.empty() ? 0 : &m_ids[0];
+    m_latData       = m_lats.empty() ? 0 : &m_lats[0];
+    m_lonData       = m_lons.empty() ? 0 : &m_lons[0];
+    m_tagStartData  = &m_tagStarts[0];
+    m_metaIndexData = m_metaIndices.empty() ? 0 : &m_metaIndices[0];
+    m_count         = m_ids.size();
+}
+
+void NodeStore::checkWritable() const
+{
+    if ( m_mapping )
+    {
+        throw std::logic_error( "Can't add to a node store mapped from a snapshot" );
+    }
+}
+
+void NodeStore::addLocation( id_t id, coord_t lat, coord_t lon )
+{
+    checkWritable();
+
+    // An id equal to the last is a repeat, which the sort drops
+    if ( !m_ids.empty() && id <= m_ids.back() )
+    {
+        m_sorted = false;
+    }
+
+    m_ids.push_back( id );
+    m_lats.push_back( lat );
+    m_lons.push_back( lon );
+}
+
+void NodeStore::add( id_t id, coord_t lat, coord_t lon )
+{
+    addLocation( id, lat, lon );
+    m_tagStarts.push_back( m_tags.size() );
+    m_metaIndices.push_back( noMeta );
+    refresh();
+}
+
+void NodeStore::add( const OSMNode &node, bool withMeta )
+{
+    addLocation( node.getId(), node.getFixedLat(), node.getFixedLon() );
+
+    BOOST_FOREACH( const tag_t &tag, node.getTags() )
+    {
+        m_tags.push_back( tag );
+    }
+    m_tagStarts.push_back( m_tags.size() );
+
+    if ( !withMeta || !node.hasMetadata() )
+    {
+        m_metaIndices.push_back( noMeta );
+    }
+    else
+    {
+        Meta meta = { node.getTimeStamp(), userIndex( node.getUserId(), node.getUser() ) };
+        m_metaIndices.push_back( m_meta.size() );
+        m_meta.push_back( meta );
+    }
+    refresh();
+}
+
+boost::uint32_t NodeStore::userIndex( id_t userId, const std::string &userName )
+{
+    user_t user( userId, userName );
+    std::map<user_t, boost::uint32_t>::const_iterator findIt = m_userIndices.find( user );
+    if ( findIt != m_userIndices.end() )
+    {
+        return findIt->second;
+    }
+
+    boost::uint32_t index = m_users.size();
+    m_users.push_back( user );
+    m_userIndices.insert( std::make_pair( user, index ) );
+    return index;
+}
+
+void NodeStore::merge( NodeStore &other, bool withMeta )
+{
+    checkWritable();
+    other.sort();
+
+    for ( size_t i = 0; i < other.m_count; i++ )
+    {
+        addLocation( other.m_idData[i], other.m_latData[i], other.m_lonData[i] );
+
+        m_tags.insert( m_tags.end(),
+            other.m_tags.begin() + other.m_tagStartData[i],
+            other.m_tags.begin() + other.m_tagStartData[i + 1] );
+        m_tagStarts.push_back( m_tags.size() );
+
+        boost::uint32_t otherMeta = other.m_metaIndexData[i];
+        if ( otherMeta == noMeta || !withMeta )
+        {
+            m_metaIndices.push_back( noMeta );
+        }
+        else
+        {
+            const user_t &user = other.m_users[other.m_meta[otherMeta].m_user];
+            Meta meta = { other.m_meta[otherMeta].m_timestamp, userIndex( user.first, user.second ) };
+            m_metaIndices.push_back( m_meta.size() );
+            m_meta.push_back( meta );
+        }
+    }
+
+    other.clear();
+    refresh();
+}
+
+void NodeStore::sort() const
+{
+    if ( m_sorted )
+    {
+        return;
+    }
+
+    // Stable, so that of several nodes with one id the first added is kept
+    std::vector<boost::uint32_t> order( m_ids.size() );
+    for ( size_t i = 0; i < order.size(); i++ )
+    {
+        order[i] = i;
+    }
+    std::stable_sort( order.begin(), order.end(), IndexIdLess( m_ids ) );
+
+    std::vector<id_t>            ids;
+    std::vector<coord_t>         lats, lons;
+    std::vector<boost::uint32_t> tagStarts( 1, 0 );
+    std::vector<tag_t>           tags;
+    std::vector<boost::uint32_t> metaIndices;
+    std::vector<Meta>            meta;
+
+    ids.reserve( order.size() );
+    lats.reserve( order.size() );
+    lons.reserve( order.size() );
+    tagStarts.reserve( order.size() + 1 );
+    tags.reserve( m_tags.size() );
+    metaIndices.reserve( order.size() );
+    meta.reserve( m_meta.size() );
+
+    BOOST_FOREACH( boost::uint32_t i, order )
+    {
+        if ( !ids.empty() && ids.back() == m_ids[i] )
+        {
+            continue;
+        }
+
+        ids.push_back( m_ids[i] );
+        lats.push_back( m_lats[i] );
+        lons.push_back( m_lons[i] );
+        tags.insert( tags.end(), m_tags.begin() + m_tagStarts[i], m_tags.begin() + m_tagStarts[i + 1] );
+        tagStarts.push_back( tags.size() );
+        if ( m_metaIndices[i] == noMeta )
+        {
+            metaIndices.push_back( noMeta );
+        }
+        else
+        {
+            metaIndices.push_back( meta.size() );
+            meta.push_back( m_meta[m_metaIndices[i]] );
+        }
+    }
+
+    m_ids.swap( ids );
+    m_lats.swap( lats );
+    m_lons.swap( lons );
+    m_tagStarts.swap( tagStarts );
+    m_tags.swap( tags );
+    m_metaIndices.swap( metaIndices );
+    m_meta.swap( meta );
+    m_sorted = true;
+    refresh();
+}
+
+void NodeStore::finalise()
+{
+    if ( m_mapping )
+    {
+        return;
+    }
+
+    sort();
+
+    freeSpare( m_ids );
+    freeSpare( m_lats );
+    freeSpare( m_lons );
+    freeSpare( m_tagStarts );
+    freeSpare( m_tags );
+    freeSpare( m_metaIndices );
+    freeSpare( m_meta );
+    refresh();
+}
+
+NodeStore::const_iterator NodeStore::find( id_t id ) const
+{
+    sort();
+
+    const id_t *idsEnd = m_idData + m_count;
+    const id_t *findIt = interpolationLowerBound( m_idData, idsEnd, id );
+    if ( findIt == idsEnd || *findIt != id )
+    {
+        return end();
+    }
+    return const_iterator( this, findIt - m_idData );
+}
+
+boost::uint32_t NodeStore::indexOf( id_t id ) const
+{
+    const_iterator findIt = find( id );
+    if ( m_count >= noIndex )
+    {
+        throw std::logic_error( "Too many nodes to index in 32 bits" );
+    }
+    return findIt == end() ? noIndex : boost::uint32_t( findIt->getIndex() );
+}
+
+std::pair<NodeStore::const_iterator, NodeStore::const_iterator> NodeStore::range( id_t firstId, id_t lastId ) const
+{
+    sort();
+
+    const id_t *idsEnd = m_idData + m_count;
+    const id_t *first  = interpolationLowerBound( m_idData, idsEnd, firstId );
+    const id_t *last   = std::upper_bound( first, idsEnd, lastId );
+    return std::make_pair(
+        const_iterator( this, first - m_idData ),
+        const_iterator( this, std::max( first, last ) - m_idData ) );
+}
+
+NodeStore::const_iterator NodeStore::begin() const
+{
+    sort();
+    return const_iterator( this, 0 );
+}
+
+NodeStore::const_iterator NodeStore::end() const
+{
+    sort();
+    return const_iterator( this, m_count );
+}
+
+size_t NodeStore::size() const
+{
+    sort();
+    return m_count;
+}
+
+void NodeStore::clear()
+{
+    m_mapping.reset();
+    std::vector<id_t>().swap( m_ids );
+    std::vector<coord_t>().swap( m_lats );
+    std::vector<coord_t>().swap( m_lons );
+    std::vector<boost::uint32_t>( 1, 0 ).swap( m_tagStarts );
+    std::vector<tag_t>().swap( m_tags );
+    std::vector<boost::uint32_t>().swap( m_metaIndices );
+    std::vector<Meta>().swap( m_meta );
+    m_users.clear();
+    m_userIndices.clear();
+    m_sorted = true;
+    refresh();
+}
+
+size_t NodeStore::bytes() const
+{
+    size_t total =
+        m_ids.capacity() * sizeof( id_t ) +
+        m_lats.capacity() * sizeof( coord_t ) +
+        m_lons.capacity() * sizeof( coord_t ) +
+        m_tagStarts.capacity() * sizeof( boost::uint32_t ) +
+        m_tags.capacity() * sizeof( tag_t ) +
+        m_metaIndices.capacity() * sizeof( boost::uint32_t ) +
+        m_meta.capacity() * sizeof( Meta );
+
+    for ( size_t i = 0; i < m_users.size(); i++ )
+    {
+        total += sizeof( m_users[i] ) + m_users[i].second.capacity();
+    }
+    return total;
+}
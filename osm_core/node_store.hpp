@@ -0,0 +1,172 @@
+#ifndef NODE_STORE_HPP
+#define NODE_STORE_HPP
+
+#include <map>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "utils.hpp"
+#include "tag_list.hpp"
+#include "coord.hpp"
+
+class OSMNode;
+
+// Nodes as columns rather than objects: ids, latitudes and longitudes in
+// parallel arrays sorted by id, with offsets into side tables for each
+// node's tags and metadata (timestamp and user). A bare location costs 24
+// bytes, against 150 and more for an OSMNode in a map.
+//
+// Nodes can be added in any order. Like IdMap, adding an id already present
+// does nothing; the columns are sorted (and any repeats dropped) on the first
+// lookup after an add out of order, or by finalise().
+class NodeStore : boost::noncopyable
+{
+public:
+    typedef boost::uint64_t                              id_t;
+    typedef ::tag_t                                      tag_t;
+    typedef boost::iterator_range<const tag_t *>         tagRange_t;
+
+    // indexOf() of an id not in the store
+    static const boost::uint32_t noIndex = 0xFFFFFFFF;
+
+    // A node in the store, by value. Valid until the store is next changed.
+    class Node
+    {
+    private:
+        const NodeStore *m_store;
+        size_t           m_index;
+
+    public:
+        Node() : m_store( 0 ), m_index( 0 ) {}
+        Node( const NodeStore *store, size_t index ) : m_store( store ), m_index( index ) {}
+
+        id_t getId() const { return m_store->m_idData[m_index]; }
+        coord_t getFixedLat() const { return m_store->m_latData[m_index]; }
+        coord_t getFixedLon() const { return m_store->m_lonData[m_index]; }
+        // In degrees
+        double getLat() const { return fromFixed( getFixedLat() ); }
+        double getLon() const { return fromFixed( getFixedLon() ); }
+
+        // In TagList order
+        tagRange_t getTags() const;
+        bool findTag( const ConstTagString &key, ConstTagString &value ) const;
+
+        // Nodes read just for their location have no metadata: these are
+        // then the defaults of an OSMNode
+        const boost::posix_time::ptime &getTimeStamp() const;
+        const std::string &getUser() const;
+        id_t getUserId() const;
+
+        size_t getIndex() const { return m_index; }
+    };
+
+    class const_iterator :
+        public boost::iterator_facade<const_iterator, Node, boost::random_access_traversal_tag, Node>
+    {
+    private:
+        const NodeStore *m_store;
+        size_t           m_index;
+
+    public:
+        const_iterator() : m_store( 0 ), m_index( 0 ) {}
+        const_iterator( const NodeStore *store, size_t index ) : m_store( store ), m_index( index ) {}
+
+    private:
+        friend class boost::iterator_core_access;
+
+        Node dereference() const { return Node( m_store, m_index ); }
+        bool equal( const const_iterator &other ) const { return m_index == other.m_index; }
+        void increment() { m_index++; }
+        void decrement() { m_index--; }
+        void advance( std::ptrdiff_t n ) { m_index += n; }
+        std::ptrdiff_t distance_to( const const_iterator &other ) const { return std::ptrdiff_t( other.m_index ) - std::ptrdiff_t( m_index ); }
+    };
+    typedef const_iterator iterator;
+
+private:
+    struct Meta
+    {
+        boost::posix_time::ptime m_timestamp;
+        boost::uint32_t          m_user;
+    };
+
+    static const boost::uint32_t noMeta = 0xFFFFFFFF;
+
+    mutable std::vector<id_t>            m_ids;
+    mutable std::vector<coord_t>         m_lats;
+    mutable std::vector<coord_t>         m_lons;
+    // Node i's tags are m_tags[m_tagStarts[i], m_tagStarts[i + 1])
+    mutable std::vector<boost::uint32_t> m_tagStarts;
+    mutable std::vector<tag_t>           m_tags;
+    mutable std::vector<boost::uint32_t> m_metaIndices;
+    mutable std::vector<Meta>            m_meta;
+    mutable bool                         m_sorted;
+
+    // User id and name, with the index of each. 0.5 files have names but
+    // no ids, so the pair is the key.
+    typedef std::pair<id_t, std::string> user_t;
+    std::vector<user_t>                  m_users;
+    std::map<user_t, boost::uint32_t>    m_userIndices;
+
+    // Where lookups read the columns: the vectors above, or for a store
+    // loaded from a snapshot the mapped file, which m_mapping keeps open.
+    // A mapped store can't be added to.
+    mutable const id_t                  *m_idData;
+    mutable const coord_t               *m_latData;
+    mutable const coord_t               *m_lonData;
+    mutable const boost::uint32_t       *m_tagStartData;
+    mutable const boost::uint32_t       *m_metaIndexData;
+    mutable size_t                       m_count;
+    boost::shared_ptr<const void>        m_mapping;
+
+    friend class SnapshotLoader;
+
+public:
+    NodeStore();
+
+    // Without withMeta the node's timestamp and user are left out
+    void add( const OSMNode &node, bool withMeta = true );
+    // Location only
+    void add( id_t id, coord_t lat, coord_t lon );
+    // Move all of other's nodes into this store. Nodes already here win.
+    void merge( NodeStore &other, bool withMeta = true );
+    // Sort now rather than on the next lookup, and free spare capacity
+    void finalise();
+
+    const_iterator find( id_t id ) const;
+    size_t count( id_t id ) const { return find( id ) != end() ? 1 : 0; }
+    // Nodes are numbered densely from 0 in id order, so a structure over
+    // the nodes can refer to one with 32 bits and reach it with at(), with
+    // no search. The numbers hold until the store is next changed. Throws
+    // std::logic_error for a store of noIndex nodes or more.
+    boost::uint32_t indexOf( id_t id ) const;
+    Node at( size_t index ) const { return Node( this, index ); }
+    // The nodes with ids in [firstId, lastId]
+    std::pair<const_iterator, const_iterator> range( id_t firstId, id_t lastId ) const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const;
+    bool empty() const { return m_count == 0; }
+    void clear();
+
+    // Memory held by the columns and side tables
+    size_t bytes() const;
+
+private:
+    void addLocation( id_t id, coord_t lat, coord_t lon );
+    boost::uint32_t userIndex( id_t userId, const std::string &userName );
+    void sort() const;
+    void refresh() const;
+    void checkWritable() const;
+};
+
+#endif // NODE_STORE_HPP
@@ -0,0 +1,48 @@
+#ifndef OBJECT_ARENA_HPP
+#define OBJECT_ARENA_HPP
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Owns objects of one type, made in blocks of a few thousand at a time
+// rather than one heap allocation (and shared_ptr control block) each.
+// Objects stay where they were made, so plain pointers to them are valid
+// until the arena is destroyed, when they all go together: their destructors
+// are run block by block and each block is freed in one call.
+template<typename T>
+class ObjectArena : boost::noncopyable
+{
+private:
+    struct Block
+    {
+        T      *m_objects;
+        size_t  m_used;
+    };
+
+    std::vector<Block> m_blocks;
+    size_t             m_size;
+
+public:
+    ObjectArena() : m_size( 0 ) {}
+    ~ObjectArena() { clear(); }
+
+    // Default constructed, or a copy
+    T *create();
+    T *create( const T &other );
+
+    // Take over all of other's objects, e.g. merging fragments. Pointers to
+    // them stay valid, now for the life of this arena.
+    void splice( ObjectArena &other );
+
+    size_t size() const { return m_size; }
+    size_t bytes() const;
+    void clear();
+
+private:
+    void *allocate();
+};
+
+#include "object_arena.ipp"
+
+#endif // OBJECT_ARENA_HPP
@@ -0,0 +1,78 @@
+
+#include <new>
+
+
+namespace arena_detail
+{
+    // Objects a block holds: about 64KB of them
+    template<typename T>
+    size_t blockObjects()
+    {
+        return sizeof( T ) >= 65536 ? 1 : 65536 / sizeof( T );
+    }
+}
+
+template<typename T>
+void *ObjectArena<T>::allocate()
+{
+    if ( m_blocks.empty() || m_blocks.back().m_used == arena_detail::blockObjects<T>() )
+    {
+        Block block = { static_cast<T *>( ::operator new( arena_detail::blockObjects<T>() * sizeof( T ) ) ), 0 };
+        m_blocks.push_back( block );
+    }
+
+    return m_blocks.back().m_objects + m_blocks.back().m_used;
+}
+
+template<typename T>
+T *ObjectArena<T>::create()
+{
+    // Counted only once constructed, so a constructor that throws leaves the
+    // slot free
+    T *object = new( allocate() ) T();
+    m_blocks.back().m_used++;
+    m_size++;
+    return object;
+}
+
+template<typename T>
+T *ObjectArena<T>::create( const T &other )
+{
+    T *object = new( allocate() ) T( other );
+    m_blocks.back().m_used++;
+    m_size++;
+    return object;
+}
+
+template<typename T>
+void ObjectArena<T>::splice( ObjectArena &other )
+{
+    // In front, so new objects still go in this arena's part-full last block
+    m_blocks.insert( m_blocks.begin(), other.m_blocks.begin(), other.m_blocks.end() );
+    m_size += other.m_size;
+
+    other.m_blocks.clear();
+    other.m_size = 0;
+}
+
+template<typename T>
+size_t ObjectArena<T>::bytes() const
+{
+    return m_blocks.size() * arena_detail::blockObjects<T>() * sizeof( T ) + m_blocks.capacity() * sizeof( Block );
+}
+
+template<typename T>
+void ObjectArena<T>::clear()
+{
+    for ( typename std::vector<Block>::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it )
+    {
+        for ( size_t i = 0; i < it->m_used; i++ )
+        {
+            it->m_objects[i].~T();
+        }
+        ::operator delete( it->m_objects );
+    }
+
+    m_blocks.clear();
+    m_size = 0;
+}
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
@@ -7,11 +9,13 @@
 
 #include "osm_data.hpp"
 #include "xml_reader.hpp"
+#include "ingest_filter.hpp"
+#include "node_locations.hpp"
 
-const static double minLat = -180.0;
-const static double maxLat = +180.0;
-const static double minLon = -90.0;
-const static double maxLon = +90.0;
+const static coord_t minLat = -90 * fixedPerDegree;
+const static coord_t maxLat = +90 * fixedPerDegree;
+const static coord_t minLon = -180 * fixedPerDegree;
+const static coord_t maxLon = +180 * fixedPerDegree;
 
 
 // Cache tile filenames of form tile_<lat>_<lon>.cache
@@ -24,136 +28,853 @@ const static double maxLon = +90.0;
 
 const static size_t cacheTileDivisions = 128;
 
-void OSMBase::readBaseData( OSMFragment &frag, XMLNodeData &data )
+static void readTagAttributes( XMLNodeData &data, string_t &k, string_t &v )
 {
-    data.readAttributes()
-        ( "id", m_id )
-        ( "timestamp", m_timestamp )
-        ( "user", m_user, true, std::string( "none" ) )
-        ( "uid", m_userId, true, dbId_t( 0 ) );
+    if ( const SchemaAttributes *attributes = data.schemaAttributes() )
+    {
+        (*attributes)( ATTR_K, k )( ATTR_V, v );
+    }
+    else
+    {
+        data.readAttributes()( "k", k )( "v", v );
+    }
+}
 
-    if ( m_user != "none" && m_userId != 0 )
+// Straight from the text to fixed point, so no double ever rounds a location
+static void readLocationAttributes( XMLNodeData &data, coord_t &lat, coord_t &lon )
+{
+    if ( const SchemaAttributes *attributes = data.schemaAttributes() )
     {
-        frag.addUser( m_userId, m_user );
+        const attributeId_t ids[] = { ATTR_LAT, ATTR_LON };
+        coord_t *values[] = { &lat, &lon };
+        for ( size_t i = 0; i < 2; i++ )
+        {
+            if ( !attributes->has( ids[i] ) )
+            {
+                throwMissingAttribute( ids[i] );
+            }
+
+            const RawString &text = attributes->get( ids[i] );
+            if ( !parseFixed( text.begin(), text.end(), *values[i] ) )
+            {
+                throwBadAttribute( ids[i], text );
+            }
+        }
     }
+    else
+    {
+        std::string latText, lonText;
+        data.readAttributes()
+            ( "lat", latText )
+            ( "lon", lonText );
+
+        if ( !parseFixed( latText.data(), latText.data() + latText.size(), lat ) ||
+             !parseFixed( lonText.data(), lonText.data() + lonText.size(), lon ) )
+        {
+            throw XmlParseException( "Error: bad node location: " + latText + ", " + lonText );
+        }
+    }
+}
 
+// What readBaseData gives objects whose files leave the user out
+static const ConstTagString &noUserName()
+{
+    static const ConstTagString none( "none" );
+    return none;
 }
 
-OSMNode::OSMNode( OSMFragment &frag, XMLNodeData &data )
+static const ConstTagString &emptyUserName()
 {
-    readBaseData( frag, data );
+    static const ConstTagString empty;
+    return empty;
+}
 
-    data.readAttributes()
-        ( "lat", m_lat )
-        ( "lon", m_lon );
+static boost::uint32_t compactTimestamp( epochTime_t epoch )
+{
+    return boost::uint32_t( std::min( std::max( epoch, epochTime_t( 0 ) ), epochTime_t( 0xFFFFFFFF ) ) );
+}
+
+static boost::uint32_t compactTimestamp( const boost::posix_time::ptime &timestamp )
+{
+    return timestamp.is_special() ? 0 : compactTimestamp( ptimeToEpoch( timestamp ) );
+}
+
+void OSMBase::readBaseData( XMLNodeData &data, bool withMetadata )
+{
+    if ( !withMetadata )
+    {
+        if ( const SchemaAttributes *attributes = data.schemaAttributes() )
+        {
+            (*attributes)( ATTR_ID, m_id );
+        }
+        else
+        {
+            data.readAttributes()( "id", m_id );
+        }
+
+        clearMetadata();
+        return;
+    }
+
+    boost::posix_time::ptime timestamp;
+    std::string user;
+
+    if ( const SchemaAttributes *attributes = data.schemaAttributes() )
+    {
+        (*attributes)
+            ( ATTR_ID, m_id )
+            ( ATTR_TIMESTAMP, timestamp )
+            ( ATTR_USER, user, true, std::string( "none" ) )
+            ( ATTR_UID, m_userId, true, dbId_t( 0 ) );
+    }
+    else
+    {
+        data.readAttributes()
+            ( "id", m_id )
+            ( "timestamp", timestamp )
+            ( "user", user, true, std::string( "none" ) )
+            ( "uid", m_userId, true, dbId_t( 0 ) );
+    }
+
+    m_timestamp = compactTimestamp( timestamp );
+    m_user      = user;
+}
+
+bool OSMBase::hasUser() const
+{
+    return m_userId != 0 && m_user != noUserName();
+}
+
+bool OSMBase::hasMetadata() const
+{
+    return m_timestamp != 0 || m_userId != 0 || m_user != emptyUserName();
+}
+
+void OSMBase::setBaseData( dbId_t id, const boost::posix_time::ptime &timestamp, const string_t &user, dbId_t userId )
+{
+    m_id        = id;
+    m_timestamp = compactTimestamp( timestamp );
+    m_user      = user;
+    m_userId    = userId;
+}
+
+void OSMBase::setBaseData( dbId_t id, epochTime_t timestamp, const ConstTagString &user, dbId_t userId )
+{
+    m_id        = id;
+    m_timestamp = compactTimestamp( timestamp );
+    m_user      = user;
+    m_userId    = userId;
+}
 
-    data.registerMembers()("tag", boost::bind( &OSMNode::readTag, this, _1 ) );
+void OSMBase::clearMetadata()
+{
+    m_timestamp = 0;
+    m_user      = emptyUserName();
+    m_userId    = 0;
+}
+
+boost::posix_time::ptime OSMBase::getTimeStamp() const
+{
+    return m_timestamp == 0 ? boost::posix_time::ptime() : epochToPtime( m_timestamp );
+}
+
+OSMNode::OSMNode() : m_lat( 0 ), m_lon( 0 )
+{
+}
+
+OSMNode::OSMNode( dbId_t id, coord_t lat, coord_t lon ) : m_lat( lat ), m_lon( lon )
+{
+    m_id = id;
+}
+
+OSMNode::OSMNode( XMLNodeData &data )
+{
+    read( data );
+}
+
+void OSMNode::read( XMLNodeData &data, bool withMetadata )
+{
+    clear();
+    readBaseData( data, withMetadata );
+
+    readLocationAttributes( data, m_lat, m_lon );
+
+    data.registerMembers()( ELEM_TAG, boost::bind( &OSMNode::readTag, this, _1 ) );
 }
 
 void OSMNode::readTag( XMLNodeData &data )
 {
     string_t k, v;
-    data.readAttributes()( "k", k )( "v", v );
+    readTagAttributes( data, k, v );
 
     m_tags.insert( tag_t( ConstTagString( k ), ConstTagString( v ) ) );
 }
 
 
-OSMWay::OSMWay( OSMFragment &frag, XMLNodeData &data )
+OSMWay::OSMWay() : m_visible( true )
 {
-    readBaseData( frag, data );
+}
 
-    data.readAttributes()
-      ( "visible", m_visible, true, true );
+OSMWay::OSMWay( XMLNodeData &data )
+{
+    read( data );
+}
+
+void OSMWay::read( XMLNodeData &data, bool withMetadata )
+{
+    clear();
+    readBaseData( data, withMetadata );
+
+    if ( const SchemaAttributes *attributes = data.schemaAttributes() )
+    {
+        (*attributes)( ATTR_VISIBLE, m_visible, true, true );
+    }
+    else
+    {
+        data.readAttributes()
+          ( "visible", m_visible, true, true );
+    }
 
     data.registerMembers()
-        ( "nd", boost::bind( &OSMWay::readNd, this, _1 ) )
-        ( "tag", boost::bind( &OSMWay::readTag, this, _1 ) );
+        ( ELEM_ND, boost::bind( &OSMWay::readNd, this, _1 ) )
+        ( ELEM_TAG, boost::bind( &OSMWay::readTag, this, _1 ) );
 }
 
 void OSMWay::readTag( XMLNodeData &data )
 {
     string_t k, v;
-    data.readAttributes()( "k", k )( "v", v );
+    readTagAttributes( data, k, v );
     m_tags.insert( tag_t( k, v ) );
 }
 
 void OSMWay::readNd( XMLNodeData &data )
 {
     dbId_t ndId;
-    data.readAttributes()( "ref", ndId );
+    if ( const SchemaAttributes *attributes = data.schemaAttributes() )
+    {
+        (*attributes)( ATTR_REF, ndId );
+    }
+    else
+    {
+        data.readAttributes()( "ref", ndId );
+    }
     m_nodes.push_back( ndId );
 }
 
 
-OSMRelation::OSMRelation( OSMFragment &frag, XMLNodeData &data )
+OSMRelation::OSMRelation()
+{
+}
+
+OSMRelation::OSMRelation( XMLNodeData &data )
+{
+    read( data );
+}
+
+void OSMRelation::read( XMLNodeData &data, bool withMetadata )
 {
-    readBaseData( frag, data );
+    clear();
+    readBaseData( data, withMetadata );
 
     data.registerMembers()
-        ( "member", boost::bind( &OSMRelation::readMember, this, _1 ) )
-        ( "tag", boost::bind( &OSMRelation::readTag, this, _1 ) );
+        ( ELEM_MEMBER, boost::bind( &OSMRelation::readMember, this, _1 ) )
+        ( ELEM_TAG, boost::bind( &OSMRelation::readTag, this, _1 ) );
 }
 
 void OSMRelation::readMember( XMLNodeData &data )
 {
     member_t theMember;
-    data.readAttributes()
-        ( "type", theMember.get<0>() )
-        ( "ref", theMember.get<1>() )
-        ( "role", theMember.get<2>() );
+    if ( const SchemaAttributes *attributes = data.schemaAttributes() )
+    {
+        (*attributes)
+            ( ATTR_TYPE, theMember.get<0>() )
+            ( ATTR_REF, theMember.get<1>() )
+            ( ATTR_ROLE, theMember.get<2>() );
+    }
+    else
+    {
+        data.readAttributes()
+            ( "type", theMember.get<0>() )
+            ( "ref", theMember.get<1>() )
+            ( "role", theMember.get<2>() );
+    }
     m_members.insert( theMember );
 }
 
 void OSMRelation::readTag( XMLNodeData &data )
 {
     std::string k, v;
-
-    data.readAttributes()
-        ( "k", k )
-        ( "v", v );
+    readTagAttributes( data, k, v );
     m_tags.insert( tag_t( k, v ) );
 }
 
 
+OSMFragment::OSMFragment() :
+    m_deferredSorted( true ),
+    m_seenNodes( 0 ),
+    m_seenWays( 0 ),
+    m_seenRelations( 0 ),
+    m_tagPool( new TagPool() ),
+    m_wayNodePool( new WayNodePool() ),
+    m_columnar( false ),
+    m_dropMetadata( false )
+{
+}
+
+void OSMFragment::setFilter( const IngestFilter &filter )
+{
+    m_filter.reset( new IngestFilter( filter ) );
+}
+
+void OSMFragment::setNodeLocations( const boost::shared_ptr<NodeLocationStore> &nodeLocations )
+{
+    m_nodeLocations = nodeLocations;
+}
+
+void OSMFragment::setSortedInput( bool sorted )
+{
+    m_nodes.setAssertSorted( sorted );
+    m_ways.setAssertSorted( sorted );
+    m_relations.setAssertSorted( sorted );
+}
+
 void OSMFragment::build( XMLNodeData &data )
 {
     data.readAttributes()
         ( "version", m_version )
         ( "generator", m_generator );
 
+    data.registerEnd( boost::bind( &OSMFragment::endRead, this ) );
+
+    registerObjects( data );
+}
+
+void OSMFragment::registerObjects( XMLNodeData &data )
+{
     data.registerMembers()
-        ( "node", boost::bind( &OSMFragment::readNode, this, _1 ) )
-        ( "way", boost::bind( &OSMFragment::readWay, this, _1 ) )
-        ( "relation", boost::bind( &OSMFragment::readRelation, this, _1 ) )
-        ( "bounds", boost::bind( &OSMFragment::readBounds, this, _1 ) );
+        ( ELEM_NODE, boost::bind( &OSMFragment::readNode, this, _1 ) )
+        ( ELEM_WAY, boost::bind( &OSMFragment::readWay, this, _1 ) )
+        ( ELEM_RELATION, boost::bind( &OSMFragment::readRelation, this, _1 ) )
+        ( ELEM_BOUNDS, boost::bind( &OSMFragment::readBounds, this, _1 ) );
 }
 
 void OSMFragment::readNode( XMLNodeData &data )
 {
-    boost::shared_ptr<OSMNode> newNode( new OSMNode( *this, data ) );
+    // A node store copies the scratch node, so it can be read into again
+    if ( m_filter || m_columnar )
+    {
+        if ( !m_scratchNode )
+        {
+            m_scratchNode.reset( new OSMNode() );
+        }
+        m_scratchNode->read( data, !m_dropMetadata );
+        addUserOf( *m_scratchNode );
+        data.registerEnd( boost::bind( &OSMFragment::endNode, this ) );
+        return;
+    }
+
+    OSMNode *newNode = m_nodeArena.create();
+    newNode->read( data, !m_dropMetadata );
+    addUserOf( *newNode );
+    storeLocation( *newNode );
     m_nodes.insert( std::make_pair( newNode->getId(), newNode ) );
 }
 
 void OSMFragment::readWay( XMLNodeData &data )
 {
-    boost::shared_ptr<OSMWay> newWay( new OSMWay( *this, data ) );
+    if ( m_filter )
+    {
+        if ( !m_scratchWay )
+        {
+            m_scratchWay.reset( new OSMWay() );
+        }
+        m_scratchWay->read( data, !m_dropMetadata );
+        addUserOf( *m_scratchWay );
+        data.registerEnd( boost::bind( &OSMFragment::endWay, this ) );
+        return;
+    }
+
+    OSMWay *newWay = m_wayArena.create();
+    newWay->read( data, !m_dropMetadata );
+    addUserOf( *newWay );
     m_ways.insert( std::make_pair( newWay->getId(), newWay ) );
 }
 
 void OSMFragment::readRelation( XMLNodeData &data )
 {
-    boost::shared_ptr<OSMRelation> newRelation( new OSMRelation( *this, data ) );
+    if ( m_filter )
+    {
+        if ( !m_scratchRelation )
+        {
+            m_scratchRelation.reset( new OSMRelation() );
+        }
+        m_scratchRelation->read( data, !m_dropMetadata );
+        addUserOf( *m_scratchRelation );
+        data.registerEnd( boost::bind( &OSMFragment::endRelation, this ) );
+        return;
+    }
+
+    OSMRelation *newRelation = m_relationArena.create();
+    newRelation->read( data, !m_dropMetadata );
+    addUserOf( *newRelation );
     m_relations.insert( std::make_pair( newRelation->getId(), newRelation ) );
 }
 
+void OSMFragment::endNode()
+{
+    addNode( *m_scratchNode );
+}
+
+void OSMFragment::endWay()
+{
+    addWay( *m_scratchWay );
+}
+
+void OSMFragment::endRelation()
+{
+    addRelation( *m_scratchRelation );
+}
+
+bool OSMFragment::addNode( const OSMNode &node )
+{
+    m_seenNodes++;
+
+    storeLocation( node );
+
+    if ( m_filter && m_filter->hasNodeIds() )
+    {
+        if ( !m_filter->listsNode( node.getId() ) )
+        {
+            return false;
+        }
+
+        keepNode( node );
+        return true;
+    }
+
+    if ( !m_filter ||
+         (m_filter->keepsNodes() &&
+          m_filter->inBounds( node.getFixedLat(), node.getFixedLon() ) &&
+          m_filter->matchesTags( node.getTags() )) )
+    {
+        keepNode( node );
+        return true;
+    }
+
+    deferLocation( node.getId(), node.getFixedLat(), node.getFixedLon() );
+    return false;
+}
+
+void OSMFragment::keepNode( const OSMNode &node )
+{
+    if ( m_columnar )
+    {
+        m_nodeStore.add( node, !m_dropMetadata );
+    }
+    else
+    {
+        // A repeated id leaves its copy unused in the arena: rare enough
+        // not to look the id up first
+        OSMNode *newNode = m_nodeArena.create( node );
+        dropMetadataOf( *newNode );
+        m_nodes.insert( std::make_pair( node.getId(), newNode ) );
+    }
+}
+
+bool OSMFragment::hasNode( dbId_t nodeId ) const
+{
+    return m_columnar ? m_nodeStore.count( nodeId ) == 1 : m_nodes.find( nodeId ) != m_nodes.end();
+}
+
+void OSMFragment::addNodeLocation( dbId_t nodeId, coord_t lat, coord_t lon )
+{
+    m_seenNodes++;
+
+    if ( m_nodeLocations )
+    {
+        m_nodeLocations->set( nodeId, lat, lon );
+    }
+
+    if ( m_filter && !m_filter->hasNodeIds() )
+    {
+        deferLocation( nodeId, lat, lon );
+    }
+}
+
+void OSMFragment::deferLocation( dbId_t nodeId, coord_t lat, coord_t lon )
+{
+    if ( m_filter->keepsWays() && !m_nodeLocations )
+    {
+        if ( !m_deferredNodes.empty() && nodeId < m_deferredNodes.back().m_id )
+        {
+            m_deferredSorted = false;
+        }
+
+        DeferredNode deferred = { nodeId, lat, lon };
+        m_deferredNodes.push_back( deferred );
+    }
+}
+
+bool OSMFragment::addWay( const OSMWay &way )
+{
+    m_seenWays++;
+
+    if ( !m_filter )
+    {
+        keepWay( way );
+        return true;
+    }
+
+    if ( !m_filter->keepsWays() || !m_filter->matchesTags( way.getTags() ) )
+    {
+        return false;
+    }
+
+    if ( m_filter->hasBounds() )
+    {
+        bool inside = false;
+        BOOST_FOREACH( dbId_t nodeId, way.getNodes() )
+        {
+            coord_t lat, lon;
+            if ( findNodeLocation( nodeId, lat, lon ) && m_filter->inBounds( lat, lon ) )
+            {
+                inside = true;
+                break;
+            }
+        }
+
+        if ( !inside )
+        {
+            return false;
+        }
+    }
+
+    keepWay( way );
+    return true;
+}
+
+void OSMFragment::keepWay( const OSMWay &way )
+{
+    OSMWay *newWay = m_wayArena.create( way );
+    dropMetadataOf( *newWay );
+    m_ways.insert( std::make_pair( way.getId(), newWay ) );
+}
+
+bool OSMFragment::addRelation( const OSMRelation &relation )
+{
+    m_seenRelations++;
+
+    if ( !m_filter )
+    {
+        keepRelation( relation );
+        return true;
+    }
+
+    if ( !m_filter->keepsRelations() || !m_filter->matchesTags( relation.getTags() ) )
+    {
+        return false;
+    }
+
+    if ( m_filter->hasBounds() )
+    {
+        bool inside = false;
+        BOOST_FOREACH( const member_t &member, relation.getMembers() )
+        {
+            if ( isKept( member ) )
+            {
+                inside = true;
+                break;
+            }
+        }
+
+        if ( !inside )
+        {
+            return false;
+        }
+    }
+
+    keepRelation( relation );
+    return true;
+}
+
+void OSMFragment::keepRelation( const OSMRelation &relation )
+{
+    OSMRelation *newRelation = m_relationArena.create( relation );
+    dropMetadataOf( *newRelation );
+    m_relations.insert( std::make_pair( relation.getId(), newRelation ) );
+}
+
+void OSMFragment::merge( OSMFragment &other )
+{
+    if ( m_columnar )
+    {
+        BOOST_FOREACH( const nodeMap_t::value_type &v, other.m_nodes )
+        {
+            m_nodeStore.add( *v.second, !m_dropMetadata );
+        }
+        m_nodeStore.merge( other.m_nodeStore, !m_dropMetadata );
+    }
+    else if ( !other.m_nodeStore.empty() )
+    {
+        throw std::logic_error( "Can't merge columnar nodes into a node map" );
+    }
+    else
+    {
+        m_nodes.insert( other.m_nodes.begin(), other.m_nodes.end() );
+    }
+    m_ways.insert( other.m_ways.begin(), other.m_ways.end() );
+    m_relations.insert( other.m_relations.begin(), other.m_relations.end() );
+
+    // Partial fragments may not have been told to drop metadata
+    if ( m_dropMetadata && !other.m_dropMetadata )
+    {
+        BOOST_FOREACH( const nodeMap_t::value_type &v, other.m_nodes )
+        {
+            v.second->clearMetadata();
+        }
+        BOOST_FOREACH( const wayMap_t::value_type &v, other.m_ways )
+        {
+            v.second->clearMetadata();
+        }
+        BOOST_FOREACH( const relationMap_t::value_type &v, other.m_relations )
+        {
+            v.second->clearMetadata();
+        }
+    }
+    else
+    {
+        m_userDetails.insert( other.m_userDetails.begin(), other.m_userDetails.end() );
+    }
+
+    other.m_nodes.clear();
+    other.m_ways.clear();
+    other.m_relations.clear();
+    other.m_userDetails.clear();
+
+    // The objects now in this fragment's maps live as long as it does
+    m_nodeArena.splice( other.m_nodeArena );
+    m_wayArena.splice( other.m_wayArena );
+    m_relationArena.splice( other.m_relationArena );
+
+    if ( !other.m_deferredNodes.empty() )
+    {
+        m_deferredSorted = m_deferredSorted && other.m_deferredSorted &&
+            (m_deferredNodes.empty() || m_deferredNodes.back().m_id < other.m_deferredNodes.front().m_id);
+        m_deferredNodes.insert( m_deferredNodes.end(), other.m_deferredNodes.begin(), other.m_deferredNodes.end() );
+        std::vector<DeferredNode>().swap( other.m_deferredNodes );
+    }
+
+    m_seenNodes     += other.m_seenNodes;
+    m_seenWays      += other.m_seenWays;
+    m_seenRelations += other.m_seenRelations;
+}
+
+void OSMFragment::endRead()
+{
+    poolArrays();
+
+    m_ways.finalise();
+    m_relations.finalise();
+    m_nodeStore.finalise();
+    if ( !m_filter )
+    {
+        m_nodes.finalise();
+        return;
+    }
+
+    // Complete the geometry of every kept way. The locations are gathered
+    // first, as the node store can't be searched while it is added to out
+    // of order.
+    std::vector<DeferredNode> wayNodes;
+    BOOST_FOREACH( const wayMap_t::value_type &v, m_ways )
+    {
+        BOOST_FOREACH( dbId_t nodeId, v.second->getNodes() )
+        {
+            DeferredNode wayNode = { nodeId, 0, 0 };
+            if ( !hasNode( nodeId ) && findNodeLocation( nodeId, wayNode.m_lat, wayNode.m_lon ) )
+            {
+                wayNodes.push_back( wayNode );
+            }
+        }
+    }
+
+    // They are in way order; those on several ways appear more than once
+    std::sort( wayNodes.begin(), wayNodes.end() );
+    for ( size_t i = 0; i < wayNodes.size(); i++ )
+    {
+        const DeferredNode &wayNode = wayNodes[i];
+        if ( i > 0 && wayNodes[i - 1].m_id == wayNode.m_id )
+        {
+            continue;
+        }
+
+        if ( m_columnar )
+        {
+            m_nodeStore.add( wayNode.m_id, wayNode.m_lat, wayNode.m_lon );
+        }
+        else
+        {
+            OSMNode *newNode = m_nodeArena.create( OSMNode( wayNode.m_id, wayNode.m_lat, wayNode.m_lon ) );
+            m_nodes.insert( std::make_pair( wayNode.m_id, newNode ) );
+        }
+    }
+
+    m_nodes.finalise();
+    m_nodeStore.finalise();
+
+    std::vector<DeferredNode>().swap( m_deferredNodes );
+    m_deferredSorted = true;
+    m_scratchNode.reset();
+    m_scratchWay.reset();
+    m_scratchRelation.reset();
+
+    std::cout << boost::format( "Filtered read kept %d of %d nodes, %d of %d ways, %d of %d relations" )
+        % (m_nodes.size() + m_nodeStore.size()) % m_seenNodes
+        % m_ways.size() % m_seenWays
+        % m_relations.size() % m_seenRelations << std::endl;
+}
+
+namespace
+{
+    template<typename MapType>
+    void moveTags( const MapType &objects, const boost::shared_ptr<TagPool> &pool )
+    {
+        BOOST_FOREACH( const typename MapType::value_type &v, objects )
+        {
+            v.second->poolTags( pool );
+        }
+    }
+}
+
+void OSMFragment::poolArrays()
+{
+    // Objects merged in from fragments that had already pooled their tags
+    // are moved too, so the other pools can be freed
+    moveTags( m_nodes, m_tagPool );
+    moveTags( m_ways, m_tagPool );
+    moveTags( m_relations, m_tagPool );
+
+    BOOST_FOREACH( const wayMap_t::value_type &v, m_ways )
+    {
+        v.second->poolNodes( m_wayNodePool );
+    }
+}
+
+const OSMFragment::DeferredNode *OSMFragment::findDeferredNode( dbId_t nodeId )
+{
+    // Planet files are in id order so this is normally a no-op
+    if ( !m_deferredSorted )
+    {
+        std::sort( m_deferredNodes.begin(), m_deferredNodes.end() );
+        m_deferredSorted = true;
+    }
+
+    DeferredNode key = { nodeId, 0, 0 };
+    std::vector<DeferredNode>::const_iterator findIt = std::lower_bound( m_deferredNodes.begin(), m_deferredNodes.end(), key );
+    if ( findIt == m_deferredNodes.end() || findIt->m_id != nodeId )
+    {
+        return 0;
+    }
+
+    return &*findIt;
+}
+
+bool OSMFragment::getNodeLocation( dbId_t nodeId, coord_t &lat, coord_t &lon ) const
+{
+    nodeMap_t::const_iterator findIt = m_nodes.find( nodeId );
+    if ( findIt != m_nodes.end() )
+    {
+        lat = findIt->second->getFixedLat();
+        lon = findIt->second->getFixedLon();
+        return true;
+    }
+
+    NodeStore::const_iterator storeIt = m_nodeStore.find( nodeId );
+    if ( storeIt != m_nodeStore.end() )
+    {
+        lat = storeIt->getFixedLat();
+        lon = storeIt->getFixedLon();
+        return true;
+    }
+
+    return m_nodeLocations && m_nodeLocations->get( nodeId, lat, lon );
+}
+
+bool OSMFragment::findNodeLocation( dbId_t nodeId, coord_t &lat, coord_t &lon )
+{
+    if ( getNodeLocation( nodeId, lat, lon ) )
+    {
+        return true;
+    }
+
+    if ( const DeferredNode *deferred = findDeferredNode( nodeId ) )
+    {
+        lat = deferred->m_lat;
+        lon = deferred->m_lon;
+        return true;
+    }
+
+    return false;
+}
+
+bool OSMFragment::isKept( const member_t &member ) const
+{
+    const std::string &type = member.get<0>();
+    dbId_t ref = member.get<1>();
+
+    if ( type == "node" )
+    {
+        return hasNode( ref );
+    }
+    else if ( type == "way" )
+    {
+        return m_ways.find( ref ) != m_ways.end();
+    }
+    else if ( type == "relation" )
+    {
+        return m_relations.find( ref ) != m_relations.end();
+    }
+
+    return false;
+}
+
+void OSMFragment::storeLocation( const OSMNode &node )
+{
+    if ( m_nodeLocations )
+    {
+        m_nodeLocations->set( node.getId(), node.getFixedLat(), node.getFixedLon() );
+    }
+}
+
 void OSMFragment::readBounds( XMLNodeData &data )
 {
     // Ignore for now
 }
 
+void OSMFragment::addUserOf( const OSMBase &object )
+{
+    // The name is only looked up for users not seen before
+    if ( !m_dropMetadata && object.hasUser() && m_userDetails.find( object.getUserId() ) == m_userDetails.end() )
+    {
+        m_userDetails.insert( std::make_pair( object.getUserId(), object.getUser() ) );
+    }
+}
+
+void OSMFragment::dropMetadataOf( OSMBase &object ) const
+{
+    if ( m_dropMetadata )
+    {
+        object.clearMetadata();
+    }
+}
+
 void OSMFragment::addUser( dbId_t userId, const std::string &userName )
 {
+    if ( m_dropMetadata )
+    {
+        return;
+    }
+
     if ( m_userDetails.find( userId ) == m_userDetails.end() )
     {
         m_userDetails.insert( std::make_pair( userId, userName ) );
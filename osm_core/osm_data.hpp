@@ -16,51 +16,94 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "utils.hpp"
+#include "timestamp.hpp"
+#include "coord.hpp"
+#include "tag_list.hpp"
+#include "way_nodes.hpp"
+#include "id_map.hpp"
+#include "object_arena.hpp"
+#include "node_store.hpp"
 
 typedef boost::uint64_t dbId_t;
 typedef std::string string_t;
-typedef std::pair<ConstTagString, ConstTagString> tag_t;
-typedef std::map<ConstTagString, ConstTagString> tagMap_t;
 typedef boost::tuple<string_t, dbId_t, string_t> member_t;
 
 #include "xml_reader.hpp"
 #include "../testing/equality_tester.hpp"
 
 class OSMFragment;
+class IngestFilter;
+class NodeLocationStore;
 
 class OSMBase
 {
 protected:
-    dbId_t   m_id;
-    boost::posix_time::ptime m_timestamp;
-    string_t m_user;
-    dbId_t   m_userId;
+    dbId_t          m_id;
+    dbId_t          m_userId;
+    // Seconds since the epoch, or 0 for none: OSM timestamps are whole
+    // seconds, so 32 bits (to 2106) hold them in half a ptime
+    boost::uint32_t m_timestamp;
+    // Interned, so each name is held once however many objects carry it
+    ConstTagString  m_user;
 
-    void readBaseData( OSMFragment &frag, XMLNodeData &data );
+    OSMBase() : m_id( 0 ), m_userId( 0 ), m_timestamp( 0 ) {}
+    // Without withMetadata the timestamp and user aren't parsed at all
+    void readBaseData( XMLNodeData &data, bool withMetadata );
 
 public:
+    // User details, if the object has any
+    bool hasUser() const;
+    // Any timestamp or user; false for OSMNode( id, lat, lon ) nodes and
+    // objects read with metadata dropped
+    bool hasMetadata() const;
+
+    // For readers that don't go through XMLNodeData. A timestamp outside
+    // 1970 to 2106 is clamped to that range; one before 1970 is then none.
+    void setBaseData( dbId_t id, const boost::posix_time::ptime &timestamp, const string_t &user, dbId_t userId );
+    void setBaseData( dbId_t id, epochTime_t timestamp, const ConstTagString &user, dbId_t userId );
+    // Leaves the id alone
+    void clearMetadata();
+
     dbId_t getId() const { return m_id; }
-    const boost::posix_time::ptime &getTimeStamp() const { return m_timestamp; }
-    const string_t &getUser() const { return m_user; }
+    // not_a_date_time if there is none
+    boost::posix_time::ptime getTimeStamp() const;
+    // 0 if there is none
+    epochTime_t getEpochTimeStamp() const { return m_timestamp; }
+    string_t getUser() const { return m_user.toString(); }
     dbId_t getUserId() const { return m_userId; }
 };
 
 class OSMNode : public OSMBase
 {
 private:
-    double             m_lat;
-    double             m_lon;
+    coord_t            m_lat;
+    coord_t            m_lon;
 
-    tagMap_t           m_tags;
+    TagList            m_tags;
 
 public:
-    OSMNode( OSMFragment &frag, XMLNodeData &data );
+    OSMNode();
+    // Location only, for nodes kept just because a way uses them
+    OSMNode( dbId_t id, coord_t lat, coord_t lon );
+    OSMNode( XMLNodeData &data );
+
+    // Replaces the whole contents, so one object can be read into
+    // repeatedly. Without withMetadata the object has no timestamp or user.
+    void read( XMLNodeData &data, bool withMetadata = true );
 
     void readTag( XMLNodeData &data );
 
-    double getLat() const { return m_lat; }
-    double getLon() const { return m_lon; }
-    const tagMap_t &getTags() const { return m_tags; }
+    void setFixedLocation( coord_t lat, coord_t lon ) { m_lat = lat; m_lon = lon; }
+    void clear() { m_tags.clear(); }
+    void addTag( const ConstTagString &k, const ConstTagString &v ) { m_tags.insert( tag_t( k, v ) ); }
+    void poolTags( const boost::shared_ptr<TagPool> &pool ) { m_tags.moveTo( pool ); }
+
+    coord_t getFixedLat() const { return m_lat; }
+    coord_t getFixedLon() const { return m_lon; }
+    // In degrees
+    double getLat() const { return fromFixed( m_lat ); }
+    double getLon() const { return fromFixed( m_lon ); }
+    const TagList &getTags() const { return m_tags; }
 };
 
 class OSMWay : public OSMBase
@@ -68,62 +111,176 @@ class OSMWay : public OSMBase
 private:
     bool                m_visible;
 
-    std::vector<dbId_t> m_nodes;
-    tagMap_t            m_tags;
+    WayNodeList         m_nodes;
+    TagList             m_tags;
 
 public:
-    OSMWay( OSMFragment &frag, XMLNodeData &data );
+    OSMWay();
+    OSMWay( XMLNodeData &data );
+    void read( XMLNodeData &data, bool withMetadata = true );
     void readTag( XMLNodeData &data );
     void readNd( XMLNodeData &data );
 
+    void setVisible( bool visible ) { m_visible = visible; }
+    void clear() { m_nodes.clear(); m_tags.clear(); }
+    void addNode( dbId_t nodeId ) { m_nodes.push_back( nodeId ); }
+    void addTag( const ConstTagString &k, const ConstTagString &v ) { m_tags.insert( tag_t( k, v ) ); }
+    void poolTags( const boost::shared_ptr<TagPool> &pool ) { m_tags.moveTo( pool ); }
+    void poolNodes( const boost::shared_ptr<WayNodePool> &pool ) { m_nodes.moveTo( pool ); }
+    // Use a set or row already in the pool, as when loading a snapshot
+    void setPooledTags( const boost::shared_ptr<TagPool> &pool, tagSetId_t set ) { m_tags.setPooled( pool, set ); }
+    void setPooledNodes( const boost::shared_ptr<WayNodePool> &pool, boost::uint32_t row ) { m_nodes.setPooled( pool, row ); }
+
     bool getVisible() const { return m_visible; }
 
-    const std::vector<dbId_t> &getNodes() const { return m_nodes; }
-    const tagMap_t &getTags() const { return m_tags; }
+    // Valid until the way is next changed
+    WayNodeList::nodeRange_t getNodes() const { return m_nodes.range(); }
+    const TagList &getTags() const { return m_tags; }
 };
 
 
 class OSMRelation : public OSMBase
 {
 private:
-    tagMap_t m_tags;
+    TagList m_tags;
     std::set<member_t> m_members;
 
 public:
-    OSMRelation( OSMFragment &frag, XMLNodeData &data );
+    OSMRelation();
+    OSMRelation( XMLNodeData &data );
+    void read( XMLNodeData &data, bool withMetadata = true );
     void readMember( XMLNodeData &data );
     void readTag( XMLNodeData &data );
 
-    const tagMap_t &getTags() const { return m_tags; }
+    void addMember( const member_t &member ) { m_members.insert( member ); }
+    void clear() { m_members.clear(); m_tags.clear(); }
+    void addTag( const ConstTagString &k, const ConstTagString &v ) { m_tags.insert( tag_t( k, v ) ); }
+    void poolTags( const boost::shared_ptr<TagPool> &pool ) { m_tags.moveTo( pool ); }
+    void setPooledTags( const boost::shared_ptr<TagPool> &pool, tagSetId_t set ) { m_tags.setPooled( pool, set ); }
+
+    const TagList &getTags() const { return m_tags; }
     const std::set<member_t> &getMembers() const { return m_members; }
 };
 
+// Owns its objects: the maps hold plain pointers into the fragment's arenas,
+// valid for the life of the fragment (or of the one it is merged into)
 class OSMFragment
 {
 public:
-    typedef std::map<dbId_t, boost::shared_ptr<OSMNode> >     nodeMap_t;
-    typedef std::map<dbId_t, boost::shared_ptr<OSMWay> >      wayMap_t;
-    typedef std::map<dbId_t, boost::shared_ptr<OSMRelation> > relationMap_t;
+    typedef IdMap<OSMNode *>                                  nodeMap_t;
+    typedef IdMap<OSMWay *>                                   wayMap_t;
+    typedef IdMap<OSMRelation *>                              relationMap_t;
     typedef std::map<dbId_t, std::string>                     userMap_t;
 
 private:
     std::string m_version;
     std::string m_generator;
 
+    ObjectArena<OSMNode>     m_nodeArena;
+    ObjectArena<OSMWay>      m_wayArena;
+    ObjectArena<OSMRelation> m_relationArena;
+
     nodeMap_t     m_nodes;
     wayMap_t      m_ways;
     relationMap_t m_relations;
     userMap_t     m_userDetails;
 
+    // Filtered reads only. Each object is read into a scratch object and
+    // only moved into the maps if the filter keeps it. Node locations are
+    // held back as plain records until the end of the file, when those the
+    // kept ways use become nodes.
+    struct DeferredNode
+    {
+        dbId_t  m_id;
+        coord_t m_lat;
+        coord_t m_lon;
+
+        bool operator<( const DeferredNode &other ) const { return m_id < other.m_id; }
+    };
+
+    boost::shared_ptr<IngestFilter> m_filter;
+    std::vector<DeferredNode>       m_deferredNodes;
+    bool                            m_deferredSorted;
+    boost::shared_ptr<OSMNode>      m_scratchNode;
+    boost::shared_ptr<OSMWay>       m_scratchWay;
+    boost::shared_ptr<OSMRelation>  m_scratchRelation;
+    size_t                          m_seenNodes;
+    size_t                          m_seenWays;
+    size_t                          m_seenRelations;
+
+    boost::shared_ptr<NodeLocationStore> m_nodeLocations;
+
+    // The tags of every object kept, and the nodes of every way, once the
+    // read has ended
+    boost::shared_ptr<TagPool>     m_tagPool;
+    boost::shared_ptr<WayNodePool> m_wayNodePool;
+
+    // Nodes go here rather than m_nodes if m_columnar
+    bool      m_columnar;
+    NodeStore m_nodeStore;
+
+    bool      m_dropMetadata;
+
 public:
-    OSMFragment() {}
+    OSMFragment();
+
+    // Drop objects the filter rejects as they are read. Set before reading.
+    void setFilter( const IngestFilter &filter );
+    const IngestFilter *getFilter() const { return m_filter.get(); }
+
+    // Record the location of every node read in the store, kept or not.
+    // Filtered reads then look way nodes up there rather than holding their
+    // locations back in memory. Set before reading.
+    void setNodeLocations( const boost::shared_ptr<NodeLocationStore> &nodeLocations );
+
+    // Declare each object type's ids to be in increasing order, as in planet
+    // dumps: an object out of order is then an error rather than slowing
+    // the maps down (see IdMap). Sorted input is fast either way.
+    void setSortedInput( bool sorted );
+    NodeLocationStore *getNodeLocations() const { return m_nodeLocations.get(); }
+
+    // Keep the nodes in a NodeStore (getNodeStore()) rather than the node
+    // map (getNodes(), then empty): a fraction of the memory, for users
+    // that don't need OSMNode objects. Set before reading.
+    void setColumnarNodes( bool columnar ) { m_columnar = columnar; }
+
+    // Keep no timestamps or users, for users such as routing that have no
+    // use for them: objects kept have none (see OSMBase::hasMetadata) and
+    // getUsers() stays empty. Set before reading.
+    void setDropMetadata( bool drop ) { m_dropMetadata = drop; }
+    bool dropsMetadata() const { return m_dropMetadata; }
+
     void build( XMLNodeData &data );
+    // The <osm> members alone, for reading part of a file with the <osm>
+    // element already open
+    void registerObjects( XMLNodeData &data );
     void readNode( XMLNodeData &data );
     void readWay( XMLNodeData &data );
     void readRelation( XMLNodeData &data );
     void readBounds( XMLNodeData &data );
 
+    // For readers that build the objects themselves, so can reuse one of
+    // each. Any filter is applied, and the object copied in if kept; false
+    // if it was rejected.
+    bool addNode( const OSMNode &node );
+    bool addWay( const OSMWay &way );
+    bool addRelation( const OSMRelation &relation );
+    // Where the filter rejected a node: its location alone, held for the
+    // kept ways as addNode would have (e.g. replaying a journal)
+    void addNodeLocation( dbId_t nodeId, coord_t lat, coord_t lon );
+    // Once every object has been added: merges any objects that arrived out
+    // of id order into the rest, and for filtered reads completes the ways
+    void endRead();
+
+    // Move all of other's objects into this fragment, e.g. the partial
+    // fragments of a parallel read. Objects already here win.
+    void merge( OSMFragment &other );
+
+    void setVersion( const std::string &version ) { m_version = version; }
+    void setGenerator( const std::string &generator ) { m_generator = generator; }
     void addUser( dbId_t userId, const std::string &userName );
+    // The object's user, if it has one
+    void addUserOf( const OSMBase &object );
 
     const std::string &getVersion() const { return m_version; }
     const std::string &getGenerator() const { return m_generator; }
@@ -132,6 +289,31 @@ public:
     const wayMap_t      &getWays() const { return m_ways; }
     const relationMap_t &getRelations() const { return m_relations; }
     const userMap_t     &getUsers() const { return m_userDetails; }
+    const NodeStore     &getNodeStore() const { return m_nodeStore; }
+    const TagPool       &getTagPool() const { return *m_tagPool; }
+    const WayNodePool   &getWayNodePool() const { return *m_wayNodePool; }
+
+    // From the nodes read, or the node location store if there is one
+    bool getNodeLocation( dbId_t nodeId, coord_t &lat, coord_t &lon ) const;
+
+private:
+    void endNode();
+    void endWay();
+    void endRelation();
+
+    void poolArrays();
+    void keepNode( const OSMNode &node );
+    void keepWay( const OSMWay &way );
+    void keepRelation( const OSMRelation &relation );
+    bool hasNode( dbId_t nodeId ) const;
+    const DeferredNode *findDeferredNode( dbId_t nodeId );
+    bool findNodeLocation( dbId_t nodeId, coord_t &lat, coord_t &lon );
+    bool isKept( const member_t &member ) const;
+    void storeLocation( const OSMNode &node );
+    void deferLocation( dbId_t nodeId, coord_t lat, coord_t lon );
+    void dropMetadataOf( OSMBase &object ) const;
+
+    friend class SnapshotLoader;
 };
 
 #endif // DATA_HPP
@@ -0,0 +1,71 @@
+#include <fstream>
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "osm_stream.hpp"
+#include "xml_reader.hpp"
+#include "xml_tokenizer.hpp"
+#include "pbf_reader.hpp"
+
+void OSMStreamReader::build( XMLNodeData &data )
+{
+    data.registerMembers()
+        ( ELEM_NODE, boost::bind( &OSMStreamReader::readNode, this, _1 ) )
+        ( ELEM_WAY, boost::bind( &OSMStreamReader::readWay, this, _1 ) )
+        ( ELEM_RELATION, boost::bind( &OSMStreamReader::readRelation, this, _1 ) );
+}
+
+void OSMStreamReader::readNode( XMLNodeData &data )
+{
+    m_node.read( data );
+    m_notifyUser( m_visitor, m_node );
+    data.registerEnd( boost::bind( &OSMStreamReader::endNode, this ) );
+}
+
+void OSMStreamReader::readWay( XMLNodeData &data )
+{
+    m_way.read( data );
+    m_notifyUser( m_visitor, m_way );
+    data.registerEnd( boost::bind( &OSMStreamReader::endWay, this ) );
+}
+
+void OSMStreamReader::readRelation( XMLNodeData &data )
+{
+    m_relation.read( data );
+    m_notifyUser( m_visitor, m_relation );
+    data.registerEnd( boost::bind( &OSMStreamReader::endRelation, this ) );
+}
+
+
+void streamOSMFile( const std::string &fileName, OSMVisitor &visitor, const ReadOptions &options )
+{
+    if ( isOSMPBF( fileName ) )
+    {
+        streamOSMPBF( fileName, visitor, options );
+        return;
+    }
+
+    std::cout << "Streaming XML file: " << fileName << std::endl;
+
+    OSMStreamReader reader( visitor );
+    boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+    startNdData->registerMembers()( ELEM_OSM, boost::bind( &OSMStreamReader::build, &reader, _1 ) );
+
+    RawXMLReader handler( startNdData );
+
+    std::ifstream is;
+    boost::iostreams::filtering_istream in;
+    openOSMInput( fileName, is, in, options );
+
+    RawXMLTokenizer tokenizer( in );
+    tokenizer.parse( handler );
+
+    if ( !handler.complete() )
+    {
+        throw XmlParseException( "Input ends before </osm>" );
+    }
+
+    std::cout << "Done..." << std::endl;
+}
@@ -0,0 +1,71 @@
+#ifndef OSM_STREAM_HPP
+#define OSM_STREAM_HPP
+
+#include <set>
+#include <string>
+
+#include "osm_data.hpp"
+
+// Receives each object of a file in turn. The objects passed in are reused
+// for the next object of the same type, so they are only valid for the
+// duration of the call; copy anything that needs to be kept.
+class OSMVisitor
+{
+public:
+    virtual ~OSMVisitor() {}
+
+    virtual void onNode( const OSMNode &node ) {}
+    virtual void onWay( const OSMWay &way ) {}
+    virtual void onRelation( const OSMRelation &relation ) {}
+    // Once per user id, before the first object by that user
+    virtual void onUser( dbId_t userId, const std::string &userName ) {}
+};
+
+// For readers: calls onUser the first time each user is seen
+class UserNotifier
+{
+private:
+    std::set<dbId_t> m_seen;
+
+public:
+    void operator()( OSMVisitor &visitor, const OSMBase &object )
+    {
+        if ( object.hasUser() && m_seen.insert( object.getUserId() ).second )
+        {
+            visitor.onUser( object.getUserId(), object.getUser() );
+        }
+    }
+};
+
+
+// Registers with XMLNodeData in place of OSMFragment::build, passing each
+// object to the visitor once its element has been read
+class OSMStreamReader
+{
+private:
+    OSMVisitor   &m_visitor;
+    UserNotifier  m_notifyUser;
+
+    OSMNode       m_node;
+    OSMWay        m_way;
+    OSMRelation   m_relation;
+
+public:
+    OSMStreamReader( OSMVisitor &visitor ) : m_visitor( visitor ) {}
+
+    void build( XMLNodeData &data );
+    void readNode( XMLNodeData &data );
+    void readWay( XMLNodeData &data );
+    void readRelation( XMLNodeData &data );
+
+private:
+    void endNode() { m_visitor.onNode( m_node ); }
+    void endWay() { m_visitor.onWay( m_way ); }
+    void endRelation() { m_visitor.onRelation( m_relation ); }
+};
+
+// Pass every object in an OSM XML (plain or bzip2) or PBF file to the
+// visitor. Nothing is kept, so memory use doesn't grow with the file.
+void streamOSMFile( const std::string &fileName, OSMVisitor &visitor, const ReadOptions &options = ReadOptions() );
+
+#endif // OSM_STREAM_HPP
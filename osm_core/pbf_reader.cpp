@@ -0,0 +1,997 @@
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <zlib.h>
+
+#include "pbf_reader.hpp"
+#include "timestamp.hpp"
+#include "osm_stream.hpp"
+
+namespace
+{
+    // Limits from the PBF format description
+    const boost::uint32_t maxBlobHeaderSize = 64 * 1024;
+    const boost::uint32_t maxBlobSize       = 32 * 1024 * 1024;
+
+    const char *memberTypes[] = { "node", "way", "relation" };
+
+    bool readExactly( std::istream &is, char *buffer, size_t count )
+    {
+        is.read( buffer, count );
+        return size_t( is.gcount() ) == count;
+    }
+
+    // PBF coordinates are offset + granularity * value in nanodegrees: the
+    // default granularity of 100 makes that an exact coord_t, and anything
+    // finer is rounded as toFixed does
+    coord_t nanoToFixed( boost::int64_t nanodegrees )
+    {
+        const boost::int64_t nanoPerFixed = 100;
+        return coord_t( nanodegrees < 0 ?
+            -((-nanodegrees + nanoPerFixed / 2) / nanoPerFixed) :
+            (nanodegrees + nanoPerFixed / 2) / nanoPerFixed );
+    }
+
+    // A block's user names, each interned once. As OSMBase::readBaseData, a
+    // missing user is "none"; without metadata only the ids are set.
+    class BlockUsers
+    {
+    private:
+        const std::vector<std::string> &m_strings;
+        const bool                      m_withMetadata;
+        std::vector<ConstTagString>     m_users;
+        std::vector<bool>               m_interned;
+
+        const ConstTagString &get( boost::uint32_t index )
+        {
+            static const ConstTagString none( "none" );
+            if ( index >= m_strings.size() || m_strings[index].empty() )
+            {
+                return none;
+            }
+
+            if ( !m_interned[index] )
+            {
+                m_users[index] = ConstTagString( m_strings[index] );
+                m_interned[index] = true;
+            }
+            return m_users[index];
+        }
+
+    public:
+        BlockUsers( const std::vector<std::string> &strings, bool withMetadata ) :
+            m_strings( strings ),
+            m_withMetadata( withMetadata ),
+            m_users( strings.size() ),
+            m_interned( strings.size(), false )
+        {
+        }
+
+        template<typename Decoded>
+        void setBaseData( OSMBase &object, const Decoded &decoded )
+        {
+            static const ConstTagString noUser;
+            if ( m_withMetadata )
+            {
+                object.setBaseData( decoded.m_id, decoded.m_timestamp, get( decoded.m_user ), decoded.m_userId );
+            }
+            else
+            {
+                object.setBaseData( decoded.m_id, 0, noUser, 0 );
+            }
+        }
+    };
+
+    // Where PBFReader::addBlock puts objects: one reused object of each type,
+    // copied into a fragment...
+    class FragmentSink
+    {
+    private:
+        OSMFragment &m_frag;
+        OSMNode      m_node;
+        OSMWay       m_way;
+        OSMRelation  m_relation;
+
+    public:
+        FragmentSink( OSMFragment &frag ) : m_frag( frag ) {}
+
+        bool withMetadata() const { return !m_frag.dropsMetadata(); }
+
+        OSMNode &node() { m_node.clear(); return m_node; }
+        OSMWay &way() { m_way.clear(); return m_way; }
+        OSMRelation &relation() { m_relation.clear(); return m_relation; }
+
+        void addNode() { m_frag.addUserOf( m_node ); m_frag.addNode( m_node ); }
+        void addWay() { m_frag.addUserOf( m_way ); m_frag.addWay( m_way ); }
+        void addRelation() { m_frag.addUserOf( m_relation ); m_frag.addRelation( m_relation ); }
+    };
+
+    // ...or handed to a visitor
+    class VisitorSink
+    {
+    private:
+        OSMVisitor   &m_visitor;
+        UserNotifier  m_notifyUser;
+        OSMNode       m_node;
+        OSMWay        m_way;
+        OSMRelation   m_relation;
+
+    public:
+        VisitorSink( OSMVisitor &visitor ) : m_visitor( visitor ) {}
+
+        bool withMetadata() const { return true; }
+
+        OSMNode &node() { m_node.clear(); return m_node; }
+        OSMWay &way() { m_way.clear(); return m_way; }
+        OSMRelation &relation() { m_relation.clear(); return m_relation; }
+
+        void addNode() { m_notifyUser( m_visitor, m_node ); m_visitor.onNode( m_node ); }
+        void addWay() { m_notifyUser( m_visitor, m_way ); m_visitor.onWay( m_way ); }
+        void addRelation() { m_notifyUser( m_visitor, m_relation ); m_visitor.onRelation( m_relation ); }
+    };
+}
+
+
+PBFReader::PBFReader( std::istream &is, size_t numThreads ) :
+    m_is( is ),
+    m_maxInFlight( 2 * numThreads + 2 ),
+    m_inputDone( false ),
+    m_stopping( false )
+{
+    if ( numThreads == 0 )
+    {
+        numThreads = 1;
+    }
+
+    m_threads.create_thread( boost::bind( &PBFReader::readBlobs, this ) );
+    for ( size_t i = 0; i < numThreads; i++ )
+    {
+        m_threads.create_thread( boost::bind( &PBFReader::decodeBlocks, this ) );
+    }
+}
+
+PBFReader::~PBFReader()
+{
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    m_spaceAvailable.notify_all();
+
+    m_threads.join_all();
+}
+
+void PBFReader::readBlobs()
+{
+    try
+    {
+        while ( true )
+        {
+            char lengthBytes[4];
+            m_is.read( lengthBytes, sizeof( lengthBytes ) );
+            if ( m_is.gcount() == 0 )
+            {
+                break;
+            }
+            if ( m_is.gcount() != sizeof( lengthBytes ) )
+            {
+                throw PbfFormatException( "Truncated blob header length" );
+            }
+
+            boost::uint32_t headerSize = 0;
+            for ( size_t i = 0; i < sizeof( lengthBytes ); i++ )
+            {
+                headerSize = (headerSize << 8) | static_cast<unsigned char>( lengthBytes[i] );
+            }
+            if ( headerSize > maxBlobHeaderSize )
+            {
+                throw PbfFormatException( "Blob header too large" );
+            }
+
+            std::vector<char> header( headerSize );
+            if ( !readExactly( m_is, &header[0], headerSize ) )
+            {
+                throw PbfFormatException( "Truncated blob header" );
+            }
+
+            blockPtr_t block( new Block() );
+            block->m_state = Block::BLOCK_PENDING;
+
+            boost::uint64_t dataSize = 0;
+            ProtobufMessage msg( &header[0], &header[0] + headerSize );
+            while ( msg.next() )
+            {
+                switch ( msg.field() )
+                {
+                case 1:
+                    block->m_type = msg.string();
+                    break;
+                case 3:
+                    dataSize = msg.varint();
+                    break;
+                default:
+                    msg.skip();
+                }
+            }
+            if ( dataSize > maxBlobSize )
+            {
+                throw PbfFormatException( "Blob too large" );
+            }
+
+            block->m_blob.resize( dataSize );
+            if ( dataSize && !readExactly( m_is, &block->m_blob[0], dataSize ) )
+            {
+                throw PbfFormatException( "Truncated blob" );
+            }
+
+            boost::mutex::scoped_lock lock( m_mutex );
+
+            // Back-pressure: don't run further ahead of the consumer than the window allows
+            while ( m_blocks.size() >= m_maxInFlight && !m_stopping )
+            {
+                m_spaceAvailable.wait( lock );
+            }
+            if ( m_stopping )
+            {
+                return;
+            }
+
+            m_blocks.push_back( block );
+            m_work.push_back( block );
+            m_workAvailable.notify_one();
+        }
+    }
+    catch ( const std::exception &e )
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        m_error = e.what();
+    }
+
+    boost::mutex::scoped_lock lock( m_mutex );
+    m_inputDone = true;
+    m_workAvailable.notify_all();
+    m_blockDone.notify_all();
+}
+
+void PBFReader::decodeBlocks()
+{
+    while ( true )
+    {
+        blockPtr_t block;
+        {
+            boost::mutex::scoped_lock lock( m_mutex );
+            while ( m_work.empty() && !m_inputDone && !m_stopping )
+            {
+                m_workAvailable.wait( lock );
+            }
+            if ( m_work.empty() || m_stopping )
+            {
+                return;
+            }
+
+            block = m_work.front();
+            m_work.pop_front();
+        }
+
+        Block::state_t state = Block::BLOCK_DONE;
+        try
+        {
+            decode( *block );
+        }
+        catch ( const std::exception &e )
+        {
+            block->m_error = e.what();
+            state = Block::BLOCK_FAILED;
+        }
+        std::vector<char>().swap( block->m_blob );
+
+        boost::mutex::scoped_lock lock( m_mutex );
+        block->m_state = state;
+        m_blockDone.notify_all();
+    }
+}
+
+PBFReader::blockPtr_t PBFReader::nextBlock()
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+
+    while ( true )
+    {
+        if ( !m_blocks.empty() )
+        {
+            blockPtr_t block = m_blocks.front();
+            if ( block->m_state == Block::BLOCK_FAILED )
+            {
+                throw PbfFormatException( "Failed to decode " + block->m_type + " block: " + block->m_error );
+            }
+            if ( block->m_state == Block::BLOCK_DONE )
+            {
+                m_blocks.pop_front();
+                m_spaceAvailable.notify_one();
+                return block;
+            }
+        }
+        else if ( m_inputDone )
+        {
+            if ( !m_error.empty() )
+            {
+                throw PbfFormatException( m_error );
+            }
+            return blockPtr_t();
+        }
+
+        m_blockDone.wait( lock );
+    }
+}
+
+void PBFReader::read( OSMFragment &frag )
+{
+    FragmentSink sink( frag );
+    while ( blockPtr_t block = nextBlock() )
+    {
+        if ( block->m_type == "OSMHeader" )
+        {
+            frag.setVersion( "0.6" );
+            frag.setGenerator( block->m_writingProgram );
+        }
+        else
+        {
+            addBlock( *block, sink );
+        }
+    }
+
+    frag.endRead();
+}
+
+void PBFReader::read( OSMVisitor &visitor )
+{
+    VisitorSink sink( visitor );
+    while ( blockPtr_t block = nextBlock() )
+    {
+        addBlock( *block, sink );
+    }
+}
+
+
+void PBFReader::decode( Block &block )
+{
+    // Unknown blob types are to be skipped
+    if ( block.m_type != "OSMHeader" && block.m_type != "OSMData" )
+    {
+        return;
+    }
+
+    std::vector<char> data;
+    inflateBlob( block.m_blob, data );
+    if ( data.empty() )
+    {
+        return;
+    }
+
+    ProtobufMessage msg( &data[0], &data[0] + data.size() );
+    if ( block.m_type == "OSMHeader" )
+    {
+        decodeHeader( block, msg );
+    }
+    else
+    {
+        decodePrimitiveBlock( block, msg );
+    }
+}
+
+void PBFReader::inflateBlob( const std::vector<char> &blob, std::vector<char> &data )
+{
+    if ( blob.empty() )
+    {
+        return;
+    }
+
+    const char *zlibBegin = 0, *zlibEnd = 0;
+    boost::uint64_t rawSize = 0;
+
+    ProtobufMessage msg( &blob[0], &blob[0] + blob.size() );
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 1:
+            {
+                const char *begin, *end;
+                msg.bytes( begin, end );
+                data.assign( begin, end );
+                return;
+            }
+        case 2:
+            rawSize = msg.varint();
+            break;
+        case 3:
+            msg.bytes( zlibBegin, zlibEnd );
+            break;
+        case 4:
+        case 5:
+        case 6:
+        case 7:
+            throw PbfFormatException( "Unsupported blob compression (only raw and zlib are read)" );
+        default:
+            msg.skip();
+        }
+    }
+
+    if ( !zlibBegin )
+    {
+        throw PbfFormatException( "Blob has no data" );
+    }
+    if ( rawSize > maxBlobSize )
+    {
+        throw PbfFormatException( "Blob too large" );
+    }
+
+    data.resize( rawSize );
+    uLongf outSize = rawSize;
+    int ret = uncompress(
+        reinterpret_cast<Bytef *>( data.empty() ? 0 : &data[0] ), &outSize,
+        reinterpret_cast<const Bytef *>( zlibBegin ), zlibEnd - zlibBegin );
+    if ( ret != Z_OK || outSize != rawSize )
+    {
+        throw PbfFormatException( "zlib error inflating blob: " + boost::lexical_cast<std::string>( ret ) );
+    }
+}
+
+void PBFReader::decodeHeader( Block &block, ProtobufMessage msg )
+{
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 4:
+            {
+                std::string feature = msg.string();
+                if ( feature != "OsmSchema-V0.6" && feature != "DenseNodes" )
+                {
+                    throw PbfFormatException( "Unsupported required feature: " + feature );
+                }
+            }
+            break;
+        case 16:
+            block.m_writingProgram = msg.string();
+            break;
+        default:
+            msg.skip();
+        }
+    }
+}
+
+void PBFReader::decodePrimitiveBlock( Block &block, ProtobufMessage msg )
+{
+    BlockScale scale;
+    scale.m_granularity     = 100;
+    scale.m_latOffset       = 0;
+    scale.m_lonOffset       = 0;
+    scale.m_dateGranularity = 1000;
+
+    // The scale fields follow the groups, so the groups are decoded second
+    std::vector<ProtobufMessage> groups;
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 1:
+            {
+                ProtobufMessage table = msg.message();
+                while ( table.next() )
+                {
+                    if ( table.field() == 1 )
+                    {
+                        block.m_strings.push_back( table.string() );
+                    }
+                    else
+                    {
+                        table.skip();
+                    }
+                }
+            }
+            break;
+        case 2:
+            groups.push_back( msg.message() );
+            break;
+        case 17:
+            scale.m_granularity = msg.varint();
+            break;
+        case 18:
+            scale.m_dateGranularity = msg.varint();
+            break;
+        case 19:
+            scale.m_latOffset = msg.varint();
+            break;
+        case 20:
+            scale.m_lonOffset = msg.varint();
+            break;
+        default:
+            msg.skip();
+        }
+    }
+
+    BOOST_FOREACH( ProtobufMessage &group, groups )
+    {
+        while ( group.next() )
+        {
+            switch ( group.field() )
+            {
+            case 1:
+                decodeNode( block, scale, group.message() );
+                break;
+            case 2:
+                decodeDenseNodes( block, scale, group.message() );
+                break;
+            case 3:
+                decodeWay( block, scale, group.message() );
+                break;
+            case 4:
+                decodeRelation( block, scale, group.message() );
+                break;
+            default:
+                group.skip();
+            }
+        }
+    }
+}
+
+void PBFReader::decodeNode( Block &block, const BlockScale &scale, ProtobufMessage msg )
+{
+    DecodedNode node;
+    node.m_id        = 0;
+    node.m_timestamp = 0;
+    node.m_userId    = 0;
+    node.m_user      = 0;
+    node.m_visible   = true;
+
+    boost::int64_t lat = 0, lon = 0;
+    PackedVarints keys, values;
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 1:
+            node.m_id = msg.svarint();
+            break;
+        case 2:
+            keys = PackedVarints( msg );
+            break;
+        case 3:
+            values = PackedVarints( msg );
+            break;
+        case 4:
+            decodeInfo( block, scale, msg.message(), node );
+            break;
+        case 8:
+            lat = msg.svarint();
+            break;
+        case 9:
+            lon = msg.svarint();
+            break;
+        default:
+            msg.skip();
+        }
+    }
+
+    node.m_lat = nanoToFixed( scale.m_latOffset + scale.m_granularity * lat );
+    node.m_lon = nanoToFixed( scale.m_lonOffset + scale.m_granularity * lon );
+    decodeTags( block, keys, values, node );
+    block.m_nodes.push_back( node );
+}
+
+void PBFReader::decodeDenseNodes( Block &block, const BlockScale &scale, ProtobufMessage msg )
+{
+    PackedVarints ids, lats, lons, keysVals;
+    PackedVarints timestamps, uids, users, visibles;
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 1:
+            ids = PackedVarints( msg );
+            break;
+        case 5:
+            {
+                ProtobufMessage info = msg.message();
+                while ( info.next() )
+                {
+                    switch ( info.field() )
+                    {
+                    case 2:
+                        timestamps = PackedVarints( info );
+                        break;
+                    case 4:
+                        uids = PackedVarints( info );
+                        break;
+                    case 5:
+                        users = PackedVarints( info );
+                        break;
+                    case 6:
+                        visibles = PackedVarints( info );
+                        break;
+                    default:
+                        info.skip();
+                    }
+                }
+            }
+            break;
+        case 8:
+            lats = PackedVarints( msg );
+            break;
+        case 9:
+            lons = PackedVarints( msg );
+            break;
+        case 10:
+            keysVals = PackedVarints( msg );
+            break;
+        default:
+            msg.skip();
+        }
+    }
+
+    // Everything but the tags and visible flags is delta coded
+    boost::int64_t id = 0, lat = 0, lon = 0, timestamp = 0, uid = 0, user = 0;
+    while ( !ids.empty() )
+    {
+        if ( lats.empty() || lons.empty() )
+        {
+            throw PbfFormatException( "DenseNodes arrays differ in length" );
+        }
+
+        id  += ids.nextSigned();
+        lat += lats.nextSigned();
+        lon += lons.nextSigned();
+
+        DecodedNode node;
+        node.m_id      = id;
+        node.m_lat     = nanoToFixed( scale.m_latOffset + scale.m_granularity * lat );
+        node.m_lon     = nanoToFixed( scale.m_lonOffset + scale.m_granularity * lon );
+        node.m_visible = visibles.empty() || visibles.next() != 0;
+
+        if ( !timestamps.empty() )
+        {
+            timestamp += timestamps.nextSigned();
+        }
+        if ( !uids.empty() )
+        {
+            uid += uids.nextSigned();
+        }
+        if ( !users.empty() )
+        {
+            user += users.nextSigned();
+        }
+        node.m_timestamp = timestamp * scale.m_dateGranularity / 1000;
+        node.m_userId    = uid > 0 ? uid : 0;
+        node.m_user      = stringIndex( block, user );
+
+        // Key, value, key, value... 0 for each node
+        node.m_tagBegin = block.m_tags.size();
+        while ( !keysVals.empty() )
+        {
+            boost::uint64_t key = keysVals.next();
+            if ( key == 0 )
+            {
+                break;
+            }
+            if ( keysVals.empty() )
+            {
+                throw PbfFormatException( "DenseNodes tag without a value" );
+            }
+
+            DecodedTag tag;
+            tag.m_key   = stringIndex( block, key );
+            tag.m_value = stringIndex( block, keysVals.next() );
+            block.m_tags.push_back( tag );
+        }
+        node.m_tagEnd = block.m_tags.size();
+
+        block.m_nodes.push_back( node );
+    }
+}
+
+void PBFReader::decodeWay( Block &block, const BlockScale &scale, ProtobufMessage msg )
+{
+    DecodedWay way;
+    way.m_id        = 0;
+    way.m_timestamp = 0;
+    way.m_userId    = 0;
+    way.m_user      = 0;
+    way.m_visible   = true;
+
+    PackedVarints keys, values, refs;
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 1:
+            way.m_id = msg.varint();
+            break;
+        case 2:
+            keys = PackedVarints( msg );
+            break;
+        case 3:
+            values = PackedVarints( msg );
+            break;
+        case 4:
+            decodeInfo( block, scale, msg.message(), way );
+            break;
+        case 8:
+            refs = PackedVarints( msg );
+            break;
+        default:
+            msg.skip();
+        }
+    }
+
+    decodeTags( block, keys, values, way );
+
+    way.m_refBegin = block.m_refs.size();
+    boost::int64_t ref = 0;
+    while ( !refs.empty() )
+    {
+        ref += refs.nextSigned();
+        block.m_refs.push_back( ref );
+    }
+    way.m_refEnd = block.m_refs.size();
+
+    block.m_ways.push_back( way );
+}
+
+void PBFReader::decodeRelation( Block &block, const BlockScale &scale, ProtobufMessage msg )
+{
+    DecodedRelation relation;
+    relation.m_id        = 0;
+    relation.m_timestamp = 0;
+    relation.m_userId    = 0;
+    relation.m_user      = 0;
+    relation.m_visible   = true;
+
+    PackedVarints keys, values, roles, memberIds, types;
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 1:
+            relation.m_id = msg.varint();
+            break;
+        case 2:
+            keys = PackedVarints( msg );
+            break;
+        case 3:
+            values = PackedVarints( msg );
+            break;
+        case 4:
+            decodeInfo( block, scale, msg.message(), relation );
+            break;
+        case 8:
+            roles = PackedVarints( msg );
+            break;
+        case 9:
+            memberIds = PackedVarints( msg );
+            break;
+        case 10:
+            types = PackedVarints( msg );
+            break;
+        default:
+            msg.skip();
+        }
+    }
+
+    decodeTags( block, keys, values, relation );
+
+    relation.m_memberBegin = block.m_members.size();
+    boost::int64_t ref = 0;
+    while ( !memberIds.empty() )
+    {
+        if ( roles.empty() || types.empty() )
+        {
+            throw PbfFormatException( "Relation member arrays differ in length" );
+        }
+
+        ref += memberIds.nextSigned();
+
+        DecodedMember member;
+        member.m_ref  = ref;
+        member.m_role = stringIndex( block, roles.next() );
+        member.m_type = static_cast<int>( types.next() );
+        if ( member.m_type < 0 || member.m_type > 2 )
+        {
+            throw PbfFormatException( "Unknown relation member type" );
+        }
+        block.m_members.push_back( member );
+    }
+    relation.m_memberEnd = block.m_members.size();
+
+    block.m_relations.push_back( relation );
+}
+
+void PBFReader::decodeInfo( const Block &block, const BlockScale &scale, ProtobufMessage msg, DecodedBase &base )
+{
+    while ( msg.next() )
+    {
+        switch ( msg.field() )
+        {
+        case 2:
+            base.m_timestamp = static_cast<boost::int64_t>( msg.varint() ) * scale.m_dateGranularity / 1000;
+            break;
+        case 4:
+            {
+                boost::int64_t uid = static_cast<boost::int32_t>( msg.varint() );
+                base.m_userId = uid > 0 ? uid : 0;
+            }
+            break;
+        case 5:
+            base.m_user = stringIndex( block, msg.varint() );
+            break;
+        case 6:
+            base.m_visible = msg.varint() != 0;
+            break;
+        default:
+            msg.skip();
+        }
+    }
+}
+
+void PBFReader::decodeTags( Block &block, PackedVarints keys, PackedVarints values, DecodedBase &base )
+{
+    base.m_tagBegin = block.m_tags.size();
+    while ( !keys.empty() )
+    {
+        if ( values.empty() )
+        {
+            throw PbfFormatException( "Tag key without a value" );
+        }
+
+        DecodedTag tag;
+        tag.m_key   = stringIndex( block, keys.next() );
+        tag.m_value = stringIndex( block, values.next() );
+        block.m_tags.push_back( tag );
+    }
+    base.m_tagEnd = block.m_tags.size();
+}
+
+boost::uint32_t PBFReader::stringIndex( const Block &block, boost::uint64_t index )
+{
+    // Index 0 is the empty string by convention, and may be left out of a
+    // table that is otherwise unused
+    if ( index >= block.m_strings.size() && index != 0 )
+    {
+        throw PbfFormatException( "String table index out of range" );
+    }
+    return static_cast<boost::uint32_t>( index );
+}
+
+
+template<typename Sink>
+void PBFReader::addBlock( const Block &block, Sink &sink )
+{
+    static const std::string noString;
+
+    // Only tag strings and user names are interned, and each only once per
+    // block. Index 0 is allowed without a string table (see stringIndex).
+    size_t stringCount = std::max( block.m_strings.size(), size_t( 1 ) );
+    std::vector<ConstTagString> tagStrings( stringCount );
+    std::vector<bool> interned( stringCount, false );
+    BOOST_FOREACH( const DecodedTag &tag, block.m_tags )
+    {
+        boost::uint32_t indexes[] = { tag.m_key, tag.m_value };
+        BOOST_FOREACH( boost::uint32_t index, indexes )
+        {
+            if ( !interned[index] )
+            {
+                tagStrings[index] = ConstTagString( block.m_strings.empty() ? noString : block.m_strings[index] );
+                interned[index] = true;
+            }
+        }
+    }
+
+    BlockUsers users( block.m_strings, sink.withMetadata() );
+    BOOST_FOREACH( const DecodedNode &decoded, block.m_nodes )
+    {
+        OSMNode &node = sink.node();
+        users.setBaseData( node, decoded );
+        node.setFixedLocation( decoded.m_lat, decoded.m_lon );
+        for ( size_t i = decoded.m_tagBegin; i < decoded.m_tagEnd; i++ )
+        {
+            node.addTag( tagStrings[block.m_tags[i].m_key], tagStrings[block.m_tags[i].m_value] );
+        }
+
+        sink.addNode();
+    }
+
+    BOOST_FOREACH( const DecodedWay &decoded, block.m_ways )
+    {
+        OSMWay &way = sink.way();
+        users.setBaseData( way, decoded );
+        way.setVisible( decoded.m_visible );
+        for ( size_t i = decoded.m_tagBegin; i < decoded.m_tagEnd; i++ )
+        {
+            way.addTag( tagStrings[block.m_tags[i].m_key], tagStrings[block.m_tags[i].m_value] );
+        }
+        for ( size_t i = decoded.m_refBegin; i < decoded.m_refEnd; i++ )
+        {
+            way.addNode( block.m_refs[i] );
+        }
+
+        sink.addWay();
+    }
+
+    BOOST_FOREACH( const DecodedRelation &decoded, block.m_relations )
+    {
+        OSMRelation &relation = sink.relation();
+        users.setBaseData( relation, decoded );
+        for ( size_t i = decoded.m_tagBegin; i < decoded.m_tagEnd; i++ )
+        {
+            relation.addTag( tagStrings[block.m_tags[i].m_key], tagStrings[block.m_tags[i].m_value] );
+        }
+        for ( size_t i = decoded.m_memberBegin; i < decoded.m_memberEnd; i++ )
+        {
+            const DecodedMember &member = block.m_members[i];
+            relation.addMember( boost::make_tuple(
+                std::string( memberTypes[member.m_type] ),
+                member.m_ref,
+                block.m_strings.empty() ? noString : block.m_strings[member.m_role] ) );
+        }
+
+        sink.addRelation();
+    }
+}
+
+
+bool isOSMPBF( const std::string &fileName )
+{
+    std::ifstream is( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+
+    // Length, then a BlobHeader whose first field is the type "OSMHeader"
+    char start[15];
+    if ( !readExactly( is, start, sizeof( start ) ) )
+    {
+        return false;
+    }
+    return start[4] == 0x0A && start[5] == 9 && memcmp( start + 6, "OSMHeader", 9 ) == 0;
+}
+
+void readOSMPBF( const std::string &fileName, OSMFragment &frag, const ReadOptions &options )
+{
+    std::cout << "Reading PBF file: " << fileName << std::endl;
+
+    std::ifstream is( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    if ( !is )
+    {
+        throw std::runtime_error( "Unable to open file: " + fileName );
+    }
+
+    PBFReader reader( is, std::max<size_t>( options.m_decompressThreads, 1 ) );
+    reader.read( frag );
+
+    std::cout << "Done..." << std::endl;
+}
+
+void readOSMPBF( const std::string &fileName, OSMFragment &frag )
+{
+    readOSMPBF( fileName, frag, ReadOptions() );
+}
+
+void streamOSMPBF( const std::string &fileName, OSMVisitor &visitor, const ReadOptions &options )
+{
+    std::cout << "Streaming PBF file: " << fileName << std::endl;
+
+    std::ifstream is( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    if ( !is )
+    {
+        throw std::runtime_error( "Unable to open file: " + fileName );
+    }
+
+    PBFReader reader( is, std::max<size_t>( options.m_decompressThreads, 1 ) );
+    reader.read( visitor );
+
+    std::cout << "Done..." << std::endl;
+}
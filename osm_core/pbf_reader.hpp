@@ -0,0 +1,163 @@
+#ifndef PBF_READER_HPP
+#define PBF_READER_HPP
+
+#include <iosfwd>
+#include <deque>
+#include <vector>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "osm_data.hpp"
+#include "pbf_wire.hpp"
+
+class OSMVisitor;
+
+// Reads an OSM PBF file (a sequence of zlib compressed protobuf blobs). A
+// reader thread splits the file into blobs, worker threads inflate them and
+// decode the PrimitiveBlocks into flat arrays, and the blocks are added to the
+// fragment in file order on the calling thread, which is the only one that
+// touches ConstTagString.
+class PBFReader
+{
+private:
+    struct DecodedTag
+    {
+        boost::uint32_t m_key;
+        boost::uint32_t m_value;
+    };
+
+    // Common to all three object types. String fields are string table indexes.
+    struct DecodedBase
+    {
+        dbId_t          m_id;
+        boost::int64_t  m_timestamp;
+        dbId_t          m_userId;
+        boost::uint32_t m_user;
+        bool            m_visible;
+        size_t          m_tagBegin;
+        size_t          m_tagEnd;
+    };
+
+    struct DecodedNode : public DecodedBase
+    {
+        coord_t         m_lat;
+        coord_t         m_lon;
+    };
+
+    struct DecodedWay : public DecodedBase
+    {
+        size_t          m_refBegin;
+        size_t          m_refEnd;
+    };
+
+    struct DecodedMember
+    {
+        int             m_type;
+        dbId_t          m_ref;
+        boost::uint32_t m_role;
+    };
+
+    struct DecodedRelation : public DecodedBase
+    {
+        size_t          m_memberBegin;
+        size_t          m_memberEnd;
+    };
+
+    struct Block
+    {
+        enum state_t
+        {
+            BLOCK_PENDING,
+            BLOCK_DONE,
+            BLOCK_FAILED
+        };
+
+        std::string                  m_type;
+        std::vector<char>            m_blob;
+        state_t                      m_state;
+        std::string                  m_error;
+
+        // OSMHeader
+        std::string                  m_writingProgram;
+
+        // OSMData
+        std::vector<std::string>     m_strings;
+        std::vector<DecodedNode>     m_nodes;
+        std::vector<DecodedWay>      m_ways;
+        std::vector<DecodedRelation> m_relations;
+        std::vector<DecodedTag>      m_tags;
+        std::vector<dbId_t>          m_refs;
+        std::vector<DecodedMember>   m_members;
+    };
+    typedef boost::shared_ptr<Block> blockPtr_t;
+
+    // How a PrimitiveBlock scales its coordinates and timestamps
+    struct BlockScale
+    {
+        boost::int64_t m_granularity;
+        boost::int64_t m_latOffset;
+        boost::int64_t m_lonOffset;
+        boost::int64_t m_dateGranularity;
+    };
+
+    std::istream                    &m_is;
+    size_t                           m_maxInFlight;
+
+    boost::mutex                     m_mutex;
+    boost::condition_variable        m_workAvailable;
+    boost::condition_variable        m_blockDone;
+    boost::condition_variable        m_spaceAvailable;
+
+    // Blocks in file order that have not been added to the fragment yet
+    std::deque<blockPtr_t>           m_blocks;
+    // Blocks waiting for a worker
+    std::deque<blockPtr_t>           m_work;
+    bool                             m_inputDone;
+    bool                             m_stopping;
+    std::string                      m_error;
+
+    boost::thread_group              m_threads;
+
+public:
+    PBFReader( std::istream &is, size_t numThreads );
+    ~PBFReader();
+
+    void read( OSMFragment &frag );
+    // Each object is passed to the visitor rather than kept
+    void read( OSMVisitor &visitor );
+
+private:
+    void readBlobs();
+    void decodeBlocks();
+    blockPtr_t nextBlock();
+
+    static void decode( Block &block );
+    static void inflateBlob( const std::vector<char> &blob, std::vector<char> &data );
+    static void decodeHeader( Block &block, ProtobufMessage msg );
+    static void decodePrimitiveBlock( Block &block, ProtobufMessage msg );
+    static void decodeNode( Block &block, const BlockScale &scale, ProtobufMessage msg );
+    static void decodeDenseNodes( Block &block, const BlockScale &scale, ProtobufMessage msg );
+    static void decodeWay( Block &block, const BlockScale &scale, ProtobufMessage msg );
+    static void decodeRelation( Block &block, const BlockScale &scale, ProtobufMessage msg );
+    static void decodeInfo( const Block &block, const BlockScale &scale, ProtobufMessage msg, DecodedBase &base );
+    static void decodeTags( Block &block, PackedVarints keys, PackedVarints values, DecodedBase &base );
+    static boost::uint32_t stringIndex( const Block &block, boost::uint64_t index );
+
+    // Sink: where the objects go (a fragment or a visitor, see pbf_reader.cpp)
+    template<typename Sink>
+    static void addBlock( const Block &block, Sink &sink );
+};
+
+// True if the file starts like an OSM PBF file
+bool isOSMPBF( const std::string &fileName );
+
+void readOSMPBF( const std::string &fileName, OSMFragment &frag, const ReadOptions &options );
+void readOSMPBF( const std::string &fileName, OSMFragment &frag );
+void streamOSMPBF( const std::string &fileName, OSMVisitor &visitor, const ReadOptions &options );
+
+#endif // PBF_READER_HPP
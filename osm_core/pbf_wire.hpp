@@ -0,0 +1,198 @@
+#ifndef PBF_WIRE_HPP
+#define PBF_WIRE_HPP
+
+#include <string>
+#include <exception>
+
+#include <boost/cstdint.hpp>
+
+class PbfFormatException : public std::exception
+{
+    std::string m_message;
+
+public:
+    PbfFormatException( const std::string &message ) : m_message( message ) { }
+    virtual ~PbfFormatException() throw () { }
+    virtual const char* what() const throw () { return m_message.c_str(); }
+};
+
+
+// Just enough of the protobuf wire format to read OSM PBF: walks the fields
+// of one encoded message in place, without a schema or generated code.
+//
+//   ProtobufMessage msg( begin, end );
+//   while ( msg.next() )
+//   {
+//       switch ( msg.field() ) { case 1: id = msg.varint(); break; default: msg.skip(); }
+//   }
+class ProtobufMessage
+{
+public:
+    enum wireType_t
+    {
+        WIRE_VARINT  = 0,
+        WIRE_FIXED64 = 1,
+        WIRE_BYTES   = 2,
+        WIRE_FIXED32 = 5
+    };
+
+private:
+    const char      *m_pos;
+    const char      *m_end;
+    boost::uint32_t  m_field;
+    int              m_wireType;
+
+public:
+    ProtobufMessage( const char *begin, const char *end ) :
+        m_pos( begin ), m_end( end ), m_field( 0 ), m_wireType( WIRE_VARINT )
+    {
+    }
+
+    // Move to the next field. Each field must be read or skipped before this
+    // is called again.
+    bool next()
+    {
+        if ( m_pos == m_end )
+        {
+            return false;
+        }
+
+        boost::uint64_t key = readVarint( m_pos, m_end );
+        m_field    = static_cast<boost::uint32_t>( key >> 3 );
+        m_wireType = static_cast<int>( key & 7 );
+        return true;
+    }
+
+    boost::uint32_t field() const { return m_field; }
+    int wireType() const { return m_wireType; }
+
+    boost::uint64_t varint()
+    {
+        expect( WIRE_VARINT );
+        return readVarint( m_pos, m_end );
+    }
+
+    // sint32/sint64 fields
+    boost::int64_t svarint()
+    {
+        return zigzag( varint() );
+    }
+
+    // Bytes, string, sub-message or packed repeated field
+    void bytes( const char *&begin, const char *&end )
+    {
+        expect( WIRE_BYTES );
+        boost::uint64_t length = readVarint( m_pos, m_end );
+        if ( length > boost::uint64_t( m_end - m_pos ) )
+        {
+            throw PbfFormatException( "Truncated length delimited field" );
+        }
+
+        begin = m_pos;
+        end   = m_pos + length;
+        m_pos = end;
+    }
+
+    std::string string()
+    {
+        const char *begin, *end;
+        bytes( begin, end );
+        return std::string( begin, end );
+    }
+
+    ProtobufMessage message()
+    {
+        const char *begin, *end;
+        bytes( begin, end );
+        return ProtobufMessage( begin, end );
+    }
+
+    void skip()
+    {
+        switch ( m_wireType )
+        {
+        case WIRE_VARINT:
+            readVarint( m_pos, m_end );
+            break;
+        case WIRE_FIXED64:
+            advance( 8 );
+            break;
+        case WIRE_FIXED32:
+            advance( 4 );
+            break;
+        case WIRE_BYTES:
+            {
+                const char *begin, *end;
+                bytes( begin, end );
+            }
+            break;
+        default:
+            throw PbfFormatException( "Unsupported protobuf wire type" );
+        }
+    }
+
+    static boost::int64_t zigzag( boost::uint64_t value )
+    {
+        return static_cast<boost::int64_t>( value >> 1 ) ^ -static_cast<boost::int64_t>( value & 1 );
+    }
+
+    static boost::uint64_t readVarint( const char *&pos, const char *end )
+    {
+        boost::uint64_t value = 0;
+        for ( int shift = 0; shift < 64; shift += 7 )
+        {
+            if ( pos == end )
+            {
+                throw PbfFormatException( "Truncated varint" );
+            }
+
+            unsigned char byte = static_cast<unsigned char>( *pos++ );
+            value |= boost::uint64_t( byte & 0x7F ) << shift;
+            if ( !(byte & 0x80) )
+            {
+                return value;
+            }
+        }
+        throw PbfFormatException( "Varint too long" );
+    }
+
+private:
+    void expect( int wireType ) const
+    {
+        if ( m_wireType != wireType )
+        {
+            throw PbfFormatException( "Unexpected protobuf wire type" );
+        }
+    }
+
+    void advance( size_t count )
+    {
+        if ( count > size_t( m_end - m_pos ) )
+        {
+            throw PbfFormatException( "Truncated fixed width field" );
+        }
+        m_pos += count;
+    }
+};
+
+
+// The values of a packed repeated varint field, in order
+class PackedVarints
+{
+private:
+    const char *m_pos;
+    const char *m_end;
+
+public:
+    PackedVarints() : m_pos( 0 ), m_end( 0 ) {}
+    PackedVarints( ProtobufMessage &msg )
+    {
+        msg.bytes( m_pos, m_end );
+    }
+
+    bool empty() const { return m_pos == m_end; }
+    boost::uint64_t next() { return ProtobufMessage::readVarint( m_pos, m_end ); }
+    boost::int64_t nextSigned() { return ProtobufMessage::zigzag( next() ); }
+};
+
+#endif // PBF_WIRE_HPP
@@ -8,8 +8,24 @@
 #include <vector>
 #include <limits>
 
+#include "coord.hpp"
+
 double distBetween( double, double, double, double );
 
+// Coordinates in degrees, for distBetween. coord_t coordinates are fixed
+// point; other types are taken to be degrees already.
+template<typename CoordType>
+struct CoordTraits
+{
+    static double toDegrees( CoordType c ) { return c; }
+};
+
+template<>
+struct CoordTraits<coord_t>
+{
+    static double toDegrees( coord_t c ) { return fromFixed( c ); }
+};
+
 template<typename CoordType>
 struct XYPoint
 {
@@ -1,3 +1,4 @@
+#include <algorithm>
 
 #include <boost/foreach.hpp>
 
@@ -50,8 +51,9 @@ std::ostream &operator<<( std::ostream &stream, const RectangularRegion<CoordTyp
 template<typename CoordType, typename ValueType>
 QuadTree<CoordType, ValueType>::QuadTree( size_t depth, CoordType xMin, CoordType xMax, CoordType yMin, CoordType yMax )
 {
-    CoordType width = (xMax - xMin) / 2.0;
-    CoordType height = (yMax - yMin) / 2.0;
+    // In double, as the span of a coord_t range can overflow it
+    CoordType width = CoordType( (double( xMax ) - xMin) / 2.0 );
+    CoordType height = CoordType( (double( yMax ) - yMin) / 2.0 );
     CoordType xMid = xMin + width;
     CoordType yMid = yMin + height;
     
@@ -90,22 +92,26 @@ private:
 
 public:
     ClosestPointSearchFunctor( const point_t &refPoint ) : m_found ( false ), m_refPoint( refPoint ),
-        m_closestDist( std::numeric_limits<CoordType>::quiet_NaN() )
+        m_closestDist( std::numeric_limits<double>::quiet_NaN() )
     {
     }
 
     bool found() { return m_found; }
     el_t closestPoint() { return m_closest; }
 
-    CoordType distBetween( const point_t &first, const point_t &second )
+    double distBetween( const point_t &first, const point_t &second )
     {
-        return ::distBetween( first.m_x, first.m_y, second.m_x, second.m_y );
+        return ::distBetween(
+            CoordTraits<CoordType>::toDegrees( first.m_x ),
+            CoordTraits<CoordType>::toDegrees( first.m_y ),
+            CoordTraits<CoordType>::toDegrees( second.m_x ),
+            CoordTraits<CoordType>::toDegrees( second.m_y ) );
     }
 
     void operator()( CoordType x, CoordType y, const ValueType &value )
     {
         point_t newCoord( x, y );
-        CoordType dist = distBetween( m_refPoint, newCoord );
+        double dist = distBetween( m_refPoint, newCoord );
 
         if ( !m_found || dist < m_closestDist )
         {
@@ -116,20 +122,28 @@ public:
     }
 };
 
+template<typename CoordType>
+CoordType clampCoord( double value )
+{
+    const double limit = std::numeric_limits<CoordType>::max();
+    return CoordType( std::max( -limit, std::min( limit, value ) ) );
+}
+
 template<typename CoordType, typename ValueType>
 typename QuadTree<CoordType, ValueType>::coordEl_t QuadTree<CoordType, ValueType>::closestPoint( const XYPoint<CoordType> &point )
 {
     // Somewhat crap iterative algo - but should be pretty efficient under most conditions
-    CoordType surveyWidth  = m_splitStruct.m_width / pow( 2.0, m_splitStruct.m_depthIter );
-    CoordType surveyHeight = m_splitStruct.m_height / pow( 2.0, m_splitStruct.m_depthIter );
+    // The survey is sized in double, as it grows past the range of an integer CoordType
+    double surveyWidth  = m_splitStruct.m_width / pow( 2.0, m_splitStruct.m_depthIter );
+    double surveyHeight = m_splitStruct.m_height / pow( 2.0, m_splitStruct.m_depthIter );
 
     ClosestPointSearchFunctor<CoordType, ValueType> f( point );
 
     do
     {
         RectangularRegion<CoordType> searchBounds(
-            XYPoint<CoordType>( point.m_x - surveyWidth, point.m_y - surveyHeight ),
-            XYPoint<CoordType>( point.m_x + surveyWidth, point.m_y + surveyHeight ) );
+            XYPoint<CoordType>( clampCoord<CoordType>( point.m_x - surveyWidth ), clampCoord<CoordType>( point.m_y - surveyHeight ) ),
+            XYPoint<CoordType>( clampCoord<CoordType>( point.m_x + surveyWidth ), clampCoord<CoordType>( point.m_y + surveyHeight ) ) );
 
         visitRegion( searchBounds, boost::ref( f ) );
 
@@ -0,0 +1,535 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <deque>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "read_ahead.hpp"
+
+class ReadAheadReader::Backend
+{
+public:
+    virtual ~Backend()
+    {
+    }
+
+    // Start filling m_buffers[index] from its m_offset
+    virtual void queue( size_t index ) = 0;
+    // Block until m_buffers[index] is done
+    virtual void wait( size_t index ) = 0;
+    virtual const char *name() const = 0;
+};
+
+namespace
+{
+    // Fills [offset, offset + size) or up to end of file. Bytes read or -errno.
+    long preadFully( int fd, char *buffer, size_t size, boost::uint64_t offset )
+    {
+        size_t total = 0;
+        while ( total < size )
+        {
+            ssize_t count = pread( fd, buffer + total, size - total, offset + total );
+            if ( count < 0 )
+            {
+                if ( errno == EINTR )
+                {
+                    continue;
+                }
+                return -errno;
+            }
+            if ( count == 0 )
+            {
+                break;
+            }
+            total += count;
+        }
+        return total;
+    }
+
+
+    class PreadBackend : public ReadAheadReader::Backend
+    {
+    private:
+        int                                   m_fd;
+        std::vector<ReadAheadReader::Buffer> &m_buffers;
+
+        boost::mutex                          m_mutex;
+        boost::condition_variable             m_workAvailable;
+        boost::condition_variable             m_bufferDone;
+        std::deque<size_t>                    m_work;
+        bool                                  m_stopping;
+
+        boost::thread                         m_thread;
+
+    public:
+        PreadBackend( int fd, std::vector<ReadAheadReader::Buffer> &buffers ) :
+            m_fd( fd ),
+            m_buffers( buffers ),
+            m_stopping( false ),
+            m_thread( boost::bind( &PreadBackend::fillBuffers, this ) )
+        {
+        }
+
+        virtual ~PreadBackend()
+        {
+            {
+                boost::mutex::scoped_lock lock( m_mutex );
+                m_stopping = true;
+            }
+            m_workAvailable.notify_all();
+            m_thread.join();
+        }
+
+        virtual void queue( size_t index )
+        {
+            {
+                boost::mutex::scoped_lock lock( m_mutex );
+                m_work.push_back( index );
+            }
+            m_workAvailable.notify_one();
+        }
+
+        virtual void wait( size_t index )
+        {
+            boost::mutex::scoped_lock lock( m_mutex );
+            while ( !m_buffers[index].m_done )
+            {
+                m_bufferDone.wait( lock );
+            }
+        }
+
+        virtual const char *name() const
+        {
+            return "pread";
+        }
+
+    private:
+        void fillBuffers()
+        {
+            while ( true )
+            {
+                size_t index;
+                {
+                    boost::mutex::scoped_lock lock( m_mutex );
+                    while ( m_work.empty() && !m_stopping )
+                    {
+                        m_workAvailable.wait( lock );
+                    }
+                    if ( m_stopping )
+                    {
+                        return;
+                    }
+                    index = m_work.front();
+                    m_work.pop_front();
+                }
+
+                // The consumer leaves a queued buffer alone until it is done
+                ReadAheadReader::Buffer &buffer = m_buffers[index];
+                long result = preadFully( m_fd, &buffer.m_data[0], buffer.m_data.size(), buffer.m_offset );
+
+                {
+                    boost::mutex::scoped_lock lock( m_mutex );
+                    buffer.m_result = result;
+                    buffer.m_done   = true;
+                }
+                m_bufferDone.notify_all();
+            }
+        }
+    };
+
+
+#if defined( __linux__ ) && defined( __NR_io_uring_setup )
+    // io_uring through the raw system calls, so as not to need liburing. The
+    // kernel's own workers do the reads; only the consumer touches the rings.
+    class UringBackend : public ReadAheadReader::Backend
+    {
+    private:
+        int                                   m_fd;
+        std::vector<ReadAheadReader::Buffer> &m_buffers;
+        std::vector<struct iovec>             m_iovecs;
+        size_t                                m_inFlight;
+
+        int                                   m_ringFd;
+        void                                 *m_sqRing;
+        size_t                                m_sqRingSize;
+        void                                 *m_cqRing;
+        size_t                                m_cqRingSize;
+        struct io_uring_sqe                  *m_sqes;
+        size_t                                m_sqesSize;
+
+        unsigned                             *m_sqTail;
+        unsigned                             *m_sqMask;
+        unsigned                             *m_sqArray;
+        unsigned                             *m_cqHead;
+        unsigned                             *m_cqTail;
+        unsigned                             *m_cqMask;
+        struct io_uring_cqe                  *m_cqes;
+
+    public:
+        // Throws if the kernel doesn't support io_uring or won't let us use it
+        UringBackend( int fd, std::vector<ReadAheadReader::Buffer> &buffers ) :
+            m_fd( fd ),
+            m_buffers( buffers ),
+            m_iovecs( buffers.size() ),
+            m_inFlight( 0 ),
+            m_ringFd( -1 ),
+            m_sqRing( MAP_FAILED ),
+            m_sqRingSize( 0 ),
+            m_cqRing( MAP_FAILED ),
+            m_cqRingSize( 0 ),
+            m_sqes( static_cast<struct io_uring_sqe *>( MAP_FAILED ) ),
+            m_sqesSize( 0 )
+        {
+            struct io_uring_params params;
+            memset( &params, 0, sizeof( params ) );
+            m_ringFd = syscall( __NR_io_uring_setup, unsigned( buffers.size() ), &params );
+            if ( m_ringFd < 0 )
+            {
+                throw std::runtime_error( std::string( "io_uring_setup: " ) + strerror( errno ) );
+            }
+
+            try
+            {
+                mapRings( params );
+            }
+            catch ( ... )
+            {
+                unmapRings();
+                throw;
+            }
+
+            for ( size_t i = 0; i < m_buffers.size(); i++ )
+            {
+                m_iovecs[i].iov_base = &m_buffers[i].m_data[0];
+                m_iovecs[i].iov_len  = m_buffers[i].m_data.size();
+            }
+        }
+
+        virtual ~UringBackend()
+        {
+            // The kernel writes into the buffers until the reads complete
+            while ( m_inFlight > 0 )
+            {
+                if ( reap() == 0 && !enter( 0, 1 ) )
+                {
+                    break;
+                }
+            }
+            unmapRings();
+        }
+
+        virtual void queue( size_t index )
+        {
+            ReadAheadReader::Buffer &buffer = m_buffers[index];
+
+            // We are the only producer, so the tail needs no atomic load
+            unsigned tail = *m_sqTail;
+            unsigned slot = tail & *m_sqMask;
+
+            struct io_uring_sqe &sqe = m_sqes[slot];
+            memset( &sqe, 0, sizeof( sqe ) );
+            sqe.opcode    = IORING_OP_READV;
+            sqe.fd        = m_fd;
+            sqe.addr      = reinterpret_cast<unsigned long>( &m_iovecs[index] );
+            sqe.len       = 1;
+            sqe.off       = buffer.m_offset;
+            sqe.user_data = index;
+
+            m_sqArray[slot] = slot;
+            __atomic_store_n( m_sqTail, tail + 1, __ATOMIC_RELEASE );
+
+            m_inFlight++;
+            if ( !enter( 1, 0 ) )
+            {
+                throw std::runtime_error( std::string( "io_uring_enter: " ) + strerror( errno ) );
+            }
+        }
+
+        virtual void wait( size_t index )
+        {
+            while ( !m_buffers[index].m_done )
+            {
+                if ( reap() == 0 && !enter( 0, 1 ) )
+                {
+                    throw std::runtime_error( std::string( "io_uring_enter: " ) + strerror( errno ) );
+                }
+            }
+        }
+
+        virtual const char *name() const
+        {
+            return "io_uring";
+        }
+
+    private:
+        template<typename T>
+        static T *ringField( void *ring, unsigned offset )
+        {
+            return reinterpret_cast<T *>( static_cast<char *>( ring ) + offset );
+        }
+
+        void mapRings( const struct io_uring_params &params )
+        {
+            m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+            m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+            bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if ( singleMap )
+            {
+                m_sqRingSize = m_cqRingSize = std::max( m_sqRingSize, m_cqRingSize );
+            }
+
+            m_sqRing = mmap( 0, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING );
+            if ( m_sqRing == MAP_FAILED )
+            {
+                throw std::runtime_error( std::string( "Mapping io_uring: " ) + strerror( errno ) );
+            }
+            if ( !singleMap )
+            {
+                m_cqRing = mmap( 0, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING );
+                if ( m_cqRing == MAP_FAILED )
+                {
+                    throw std::runtime_error( std::string( "Mapping io_uring: " ) + strerror( errno ) );
+                }
+            }
+            void *cqRing = singleMap ? m_sqRing : m_cqRing;
+
+            m_sqesSize = params.sq_entries * sizeof( struct io_uring_sqe );
+            m_sqes = static_cast<struct io_uring_sqe *>(
+                mmap( 0, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES ) );
+            if ( m_sqes == MAP_FAILED )
+            {
+                throw std::runtime_error( std::string( "Mapping io_uring: " ) + strerror( errno ) );
+            }
+
+            m_sqTail  = ringField<unsigned>( m_sqRing, params.sq_off.tail );
+            m_sqMask  = ringField<unsigned>( m_sqRing, params.sq_off.ring_mask );
+            m_sqArray = ringField<unsigned>( m_sqRing, params.sq_off.array );
+            m_cqHead  = ringField<unsigned>( cqRing, params.cq_off.head );
+            m_cqTail  = ringField<unsigned>( cqRing, params.cq_off.tail );
+            m_cqMask  = ringField<unsigned>( cqRing, params.cq_off.ring_mask );
+            m_cqes    = ringField<struct io_uring_cqe>( cqRing, params.cq_off.cqes );
+        }
+
+        void unmapRings()
+        {
+            if ( m_sqes != MAP_FAILED )
+            {
+                munmap( m_sqes, m_sqesSize );
+            }
+            if ( m_cqRing != MAP_FAILED )
+            {
+                munmap( m_cqRing, m_cqRingSize );
+            }
+            if ( m_sqRing != MAP_FAILED )
+            {
+                munmap( m_sqRing, m_sqRingSize );
+            }
+            if ( m_ringFd >= 0 )
+            {
+                close( m_ringFd );
+            }
+        }
+
+        // False (with errno set) on failure
+        bool enter( unsigned toSubmit, unsigned minComplete )
+        {
+            unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+            while ( syscall( __NR_io_uring_enter, m_ringFd, toSubmit, minComplete, flags, 0, 0 ) < 0 )
+            {
+                if ( errno != EINTR )
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Mark the buffers whose reads have completed. The number reaped.
+        size_t reap()
+        {
+            unsigned head = *m_cqHead;
+            unsigned tail = __atomic_load_n( m_cqTail, __ATOMIC_ACQUIRE );
+            size_t count = 0;
+
+            for ( ; head != tail; head++, count++ )
+            {
+                const struct io_uring_cqe &cqe = m_cqes[head & *m_cqMask];
+                ReadAheadReader::Buffer &buffer = m_buffers[cqe.user_data];
+                buffer.m_result = cqe.res;
+                buffer.m_done   = true;
+            }
+
+            __atomic_store_n( m_cqHead, head, __ATOMIC_RELEASE );
+            m_inFlight -= count;
+            return count;
+        }
+    };
+#endif
+}
+
+
+ReadAheadReader::ReadAheadReader( const std::string &fileName, size_t numBuffers, size_t bufferSize, bool allowUring ) :
+    m_fileName( fileName ),
+    m_fd( -1 ),
+    m_fileSize( 0 ),
+    m_buffers( std::max<size_t>( numBuffers, 1 ) ),
+    m_nextOffset( 0 ),
+    m_current( 0 ),
+    m_currentPos( 0 ),
+    m_currentLength( 0 ),
+    m_currentReady( false )
+{
+    m_fd = open( fileName.c_str(), O_RDONLY );
+    if ( m_fd < 0 )
+    {
+        throw std::runtime_error( "Unable to open file: " + fileName );
+    }
+
+    struct stat fileStat;
+    if ( fstat( m_fd, &fileStat ) != 0 || !S_ISREG( fileStat.st_mode ) )
+    {
+        close( m_fd );
+        throw std::runtime_error( "Can only read ahead in a regular file: " + fileName );
+    }
+    m_fileSize = fileStat.st_size;
+
+    for ( size_t i = 0; i < m_buffers.size(); i++ )
+    {
+        m_buffers[i].m_data.resize( std::max<size_t>( bufferSize, 1 ) );
+        m_buffers[i].m_offset = 0;
+        m_buffers[i].m_result = 0;
+        m_buffers[i].m_queued = false;
+        m_buffers[i].m_done   = false;
+    }
+
+#if defined( __linux__ ) && defined( __NR_io_uring_setup )
+    if ( allowUring )
+    {
+        try
+        {
+            m_backend.reset( new UringBackend( m_fd, m_buffers ) );
+        }
+        catch ( const std::exception & )
+        {
+            // Old kernel, or io_uring disabled: fall back to the thread
+        }
+    }
+#endif
+    if ( !m_backend )
+    {
+        m_backend.reset( new PreadBackend( m_fd, m_buffers ) );
+    }
+
+    for ( size_t i = 0; i < m_buffers.size(); i++ )
+    {
+        queue( i );
+    }
+}
+
+ReadAheadReader::~ReadAheadReader()
+{
+    m_backend.reset();
+    close( m_fd );
+}
+
+const char *ReadAheadReader::backendName() const
+{
+    return m_backend->name();
+}
+
+void ReadAheadReader::queue( size_t index )
+{
+    if ( m_nextOffset >= m_fileSize )
+    {
+        return;
+    }
+
+    Buffer &buffer = m_buffers[index];
+    buffer.m_offset = m_nextOffset;
+    buffer.m_result = 0;
+    buffer.m_queued = true;
+    buffer.m_done   = false;
+    m_nextOffset += buffer.m_data.size();
+
+    m_backend->queue( index );
+}
+
+// Wait for the current buffer. False at end of file.
+bool ReadAheadReader::fetch()
+{
+    Buffer &buffer = m_buffers[m_current];
+    if ( !buffer.m_queued )
+    {
+        return false;
+    }
+
+    m_backend->wait( m_current );
+    buffer.m_queued = false;
+    if ( buffer.m_result < 0 )
+    {
+        throw std::runtime_error( "Error reading " + m_fileName + ": " + strerror( -buffer.m_result ) );
+    }
+
+    // io_uring may return a short read; finish it here
+    size_t length = buffer.m_result;
+    size_t wanted = std::min<boost::uint64_t>( buffer.m_data.size(), m_fileSize - buffer.m_offset );
+    if ( length > 0 && length < wanted )
+    {
+        long rest = preadFully( m_fd, &buffer.m_data[length], wanted - length, buffer.m_offset + length );
+        if ( rest < 0 )
+        {
+            throw std::runtime_error( "Error reading " + m_fileName + ": " + strerror( -rest ) );
+        }
+        length += rest;
+    }
+
+    m_currentPos    = 0;
+    m_currentLength = length;
+    m_currentReady  = true;
+    return length > 0;
+}
+
+std::streamsize ReadAheadReader::read( char *s, std::streamsize n )
+{
+    std::streamsize total = 0;
+
+    while ( total < n )
+    {
+        if ( m_currentPos == m_currentLength )
+        {
+            if ( m_currentReady )
+            {
+                // Read out: reuse it for the next stretch of the file
+                m_currentReady = false;
+                queue( m_current );
+                m_current = (m_current + 1) % m_buffers.size();
+            }
+            if ( !fetch() )
+            {
+                break;
+            }
+        }
+
+        size_t count = std::min<size_t>( n - total, m_currentLength - m_currentPos );
+        memcpy( s + total, &m_buffers[m_current].m_data[m_currentPos], count );
+        m_currentPos += count;
+        total        += count;
+    }
+
+    return total == 0 && n > 0 ? -1 : total;
+}
@@ -0,0 +1,92 @@
+#ifndef READ_AHEAD_HPP
+#define READ_AHEAD_HPP
+
+#include <iosfwd>
+#include <vector>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
+#include <boost/iostreams/categories.hpp>
+
+// Reads a file ahead of the consumer. Several large buffers are kept in
+// flight, filled in file order and handed out as the consumer gets to them;
+// each buffer is queued again for the next stretch of the file as soon as it
+// has been read out. Where the kernel allows it the reads are queued with
+// io_uring, otherwise a dedicated thread fills the buffers with pread.
+class ReadAheadReader : boost::noncopyable
+{
+public:
+    class Backend;
+
+    struct Buffer
+    {
+        std::vector<char> m_data;
+        boost::uint64_t   m_offset;
+        // Bytes read, or -errno
+        long              m_result;
+        bool              m_queued;
+        bool              m_done;
+    };
+
+private:
+    std::string                 m_fileName;
+    int                         m_fd;
+    boost::uint64_t             m_fileSize;
+    std::vector<Buffer>         m_buffers;
+    boost::scoped_ptr<Backend>  m_backend;
+    // Where the next buffer queued starts
+    boost::uint64_t             m_nextOffset;
+
+    // Consumer side
+    size_t                      m_current;
+    size_t                      m_currentPos;
+    size_t                      m_currentLength;
+    bool                        m_currentReady;
+
+public:
+    // allowUring: false always uses the pread thread
+    ReadAheadReader( const std::string &fileName, size_t numBuffers = 4, size_t bufferSize = 1 << 20, bool allowUring = true );
+    ~ReadAheadReader();
+
+    std::streamsize read( char *s, std::streamsize n );
+
+    // "io_uring" or "pread"
+    const char *backendName() const;
+
+private:
+    void queue( size_t index );
+    bool fetch();
+};
+
+
+// boost::iostreams source wrapping the reader, so it can be pushed onto a
+// filtering_istream in place of a std::ifstream
+class ReadAheadSource
+{
+private:
+    boost::shared_ptr<ReadAheadReader> m_impl;
+
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    ReadAheadSource( const std::string &fileName, size_t numBuffers = 4, size_t bufferSize = 1 << 20, bool allowUring = true ) :
+        m_impl( new ReadAheadReader( fileName, numBuffers, bufferSize, allowUring ) )
+    {
+    }
+
+    std::streamsize read( char *s, std::streamsize n )
+    {
+        return m_impl->read( s, n );
+    }
+
+    const char *backendName() const
+    {
+        return m_impl->backendName();
+    }
+};
+
+#endif // READ_AHEAD_HPP
@@ -11,6 +11,7 @@
 
 #include <iostream>
 #include <map>
+#include <limits>
 #include <cmath>
 #include <iomanip>
 
@@ -22,12 +23,38 @@
 
 using namespace std;
 
+namespace
+{
+    // m_tagSetRoutable entries
+    const char unknownSet    = 0;
+    const char unroutableSet = 1;
+    const char routableSet   = 2;
+
+    // Interned once, rather than on every lookup. Built on first use, as the
+    // intern table in utils.cpp may not exist yet during static initialisation.
+    struct OnewayTags
+    {
+        ConstTagString oneway, junction, yes, trueValue, reverse, roundabout;
+
+        OnewayTags() :
+            oneway( "oneway" ), junction( "junction" ), yes( "yes" ),
+            trueValue( "true" ), reverse( "-1" ), roundabout( "roundabout" )
+        {
+        }
+    };
+
+    const OnewayTags &onewayTags()
+    {
+        static const OnewayTags tags;
+        return tags;
+    }
+}
+
 struct WeightMapLookup
 {
-    GraphType&                                     m_g;
-    const std::vector<boost::shared_ptr<OSMWay> >& m_edgeWays;
-    const std::vector<double>&                     m_lengths;
-    wayWeightings_t                                m_wayWeightings;
+    GraphType&                 m_g;
+    const std::vector<double>& m_lengths;
+    const std::vector<double>& m_weights;
 
 public:
     typedef EdgeType key_type;
@@ -37,27 +64,24 @@ public:
 
     WeightMapLookup(
         GraphType &g,
-        const std::vector<boost::shared_ptr<OSMWay> > &edgeWays,
         const std::vector<double>& lengths,
-        wayWeightings_t wayWeightings );
+        const std::vector<double>& weights );
     double get( EdgeType e ) const;
 };
 
 
-typedef std::map<boost::uint64_t, VertexType> nodeIdToVertexMap_t;
-
 class DistanceHeuristic : public boost::astar_heuristic<GraphType, double>
 {
 private:
-    const OSMFragment&         m_frag;
+    const NodeStore&           m_nodes;
     NodeIndexMapType           m_nodeIndexMap;
-    boost::shared_ptr<OSMNode> m_dest;
+    NodeStore::Node            m_dest;
     
 public:
     typedef VertexType Vertex;
 
-    DistanceHeuristic( const OSMFragment &frag, NodeIndexMapType nodeIndexMap, VertexType dest );
-    boost::shared_ptr<OSMNode> getNode( Vertex v );
+    DistanceHeuristic( const NodeStore &nodes, NodeIndexMapType nodeIndexMap, VertexType dest );
+    NodeStore::Node getNode( Vertex v );
     double operator()( Vertex v );
 };
 
@@ -77,19 +101,15 @@ public:
 
 WeightMapLookup::WeightMapLookup(
     GraphType &g,
-    const std::vector<boost::shared_ptr<OSMWay> > &edgeWays,
     const std::vector<double>& lengths,
-    wayWeightings_t wayWeightings ) :
-    m_g( g ), m_edgeWays( edgeWays ), m_lengths( lengths ), m_wayWeightings( wayWeightings )
+    const std::vector<double>& weights ) :
+    m_g( g ), m_lengths( lengths ), m_weights( weights )
 {
 }
 
 
-// TODO: This is really very inefficient. Probably want to pre-calculate a set of weights,
-//       perhaps on request in a queue
-double calculateWayWeight( boost::shared_ptr<OSMWay> theWay, const wayWeightings_t &wayWeightings )
+double calculateWayWeight( const TagList &wayTags, const wayWeightings_t &wayWeightings )
 {
-    const tagMap_t &wayTags = theWay->getTags();
     BOOST_FOREACH( const wayWeighting_t &weightTuple, wayWeightings )
     {
         ConstTagString key, value;
@@ -97,7 +117,7 @@ double calculateWayWeight( boost::shared_ptr<OSMWay> theWay, const wayWeightings
 
         boost::tie( key, value, weight ) = weightTuple;
 
-        tagMap_t::const_iterator findIt = wayTags.find( key );
+        TagList::const_iterator findIt = wayTags.find( key );
         if ( findIt != wayTags.end() )
         {
             if ( findIt->second == value )
@@ -117,11 +137,7 @@ double WeightMapLookup::get( EdgeType e ) const
     
     size_t edgeIndex = edgeIds[e];
 
-    boost::shared_ptr<OSMWay> theWay = m_edgeWays.at( edgeIndex );
-
-    double wayWeight = calculateWayWeight( theWay, m_wayWeightings );
-
-    return m_lengths.at(edgeIndex) * wayWeight;
+    return m_lengths.at(edgeIndex) * m_weights.at(edgeIndex);
 }
 
 double get( const WeightMapLookup &m, EdgeType e )
@@ -130,33 +146,25 @@ double get( const WeightMapLookup &m, EdgeType e )
 }
 
 DistanceHeuristic::DistanceHeuristic(
-    const OSMFragment &frag,
+    const NodeStore &nodes,
     NodeIndexMapType nodeIndexMap,
     VertexType dest ) :
-    m_frag( frag ),
+    m_nodes( nodes ),
     m_nodeIndexMap( nodeIndexMap )
 {
     m_dest = getNode( dest );
 }
 
-boost::shared_ptr<OSMNode> DistanceHeuristic::getNode( Vertex v )
+NodeStore::Node DistanceHeuristic::getNode( Vertex v )
 {
-    boost::uint64_t nodeId = m_nodeIndexMap[v];
-    
-    OSMFragment::nodeMap_t::const_iterator findIt = m_frag.getNodes().find( nodeId );
-    if ( findIt == m_frag.getNodes().end() )
-    {
-        throw modosmapi::ModException( "Node not found in node map" );
-    }
-    
-    return findIt->second;
+    return m_nodes.at( m_nodeIndexMap[v] );
 }
 
 double DistanceHeuristic::operator()( Vertex v )
 {
-    boost::shared_ptr<OSMNode> theNode = getNode( v );
+    NodeStore::Node theNode = getNode( v );
     
-    return distBetween( m_dest->getLat(), m_dest->getLon(), theNode->getLat(), theNode->getLon() );
+    return fixedDistBetween( m_dest.getFixedLat(), m_dest.getFixedLon(), theNode.getFixedLat(), theNode.getFixedLon() );
 }
 
 AStarVisitor::AStarVisitor( VertexType dest ) :m_dest( dest )
@@ -234,31 +242,26 @@ RoutingGraph::RoutingGraph( const OSMFragment &frag ) : m_frag( frag ), m_nextEd
     // TODO: We may want to fill these from a config file (not that likely to change though...)
     setCycleWeights();
     //setCarWeights();
+
+    m_routableWayKeyIds.assign( m_routableWayKeys.begin(), m_routableWayKeys.end() );
 }
 
-VertexType RoutingGraph::getVertex( boost::uint64_t nodeId )
+VertexType RoutingGraph::getVertex( boost::uint32_t nodeIndex )
 {
-    nodeIdToVertexMap_t::const_iterator findIt = m_nodeIdToVertexMap.find( nodeId );
-        
-    if ( findIt == m_nodeIdToVertexMap.end() )
+    VertexType &v = m_nodeVertices[nodeIndex];
+    if ( v == boost::graph_traits<GraphType>::null_vertex() )
     {
-        VertexType v = boost::add_vertex( m_graph );
-        m_nodeIdToVertexMap.insert( std::make_pair( nodeId, v ) );
+        v = boost::add_vertex( m_graph );
 
         NodeIndexMapType nodeIndexMap = boost::get( boost::vertex_name, m_graph );
-        nodeIndexMap[v] = nodeId;
-
-        return v;
-    }
-    else
-    {
-        return findIt->second;
+        nodeIndexMap[v] = nodeIndex;
     }
+    return v;
 }
 
-bool hasTag( const tagMap_t &tags, const std::string &key, const std::string &val )
+bool hasTag( const TagList &tags, const ConstTagString &key, const ConstTagString &val )
 {
-    tagMap_t::const_iterator findIt = tags.find( key );
+    TagList::const_iterator findIt = tags.find( key );
     if ( findIt == tags.end() )
     {
         return false;
@@ -266,25 +269,26 @@ bool hasTag( const tagMap_t &tags, const std::string &key, const std::string &va
     return findIt->second == val;
 }
 
-void RoutingGraph::addEdge( VertexType source, VertexType dest, double length, boost::shared_ptr<OSMWay> way )
+void RoutingGraph::addEdge( VertexType source, VertexType dest, double length, const OSMWay *way )
 {
     // Returns a pair: Edge descriptor, bool (true if edge added)
     EdgeType thisEdge;
     bool successfulInsert;
 
-    const tagMap_t &wayTags = way->getTags();
-    const tagMap_t::const_iterator findIt = wayTags.find( "oneway" );
+    const TagList &wayTags = way->getTags();
 
     bool forward = true;
     bool backward = true;
+    double weight = wayWeight( *way );
 
-    if ( hasTag( wayTags, "oneway", "yes" ) ||
-         hasTag( wayTags, "oneway", "true" ) ||
-         hasTag( wayTags, "junction", "roundabout" ) )
+    const OnewayTags &t = onewayTags();
+    if ( hasTag( wayTags, t.oneway, t.yes ) ||
+         hasTag( wayTags, t.oneway, t.trueValue ) ||
+         hasTag( wayTags, t.junction, t.roundabout ) )
     {
         backward = false;
     }
-    else if ( hasTag( wayTags, "oneway", "-1" ) )
+    else if ( hasTag( wayTags, t.oneway, t.reverse ) )
     {
         forward = false;
     }
@@ -293,6 +297,7 @@ void RoutingGraph::addEdge( VertexType source, VertexType dest, double length, b
     {
         boost::tie( thisEdge, successfulInsert ) = boost::add_edge( source, dest, m_nextEdgeId++, m_graph );
         m_edgeLengths.push_back( length );
+        m_edgeWeights.push_back( weight );
         m_edgeWays.push_back( way );
         m_edgeWayBackwards.push_back( false );
     }
@@ -301,16 +306,56 @@ void RoutingGraph::addEdge( VertexType source, VertexType dest, double length, b
     {
         boost::tie( thisEdge, successfulInsert ) = boost::add_edge( dest, source, m_nextEdgeId++, m_graph );
         m_edgeLengths.push_back( length );
+        m_edgeWeights.push_back( weight );
         m_edgeWays.push_back( way );
         m_edgeWayBackwards.push_back( true );
     }
 }
     
-bool RoutingGraph::validRoutingWay( const boost::shared_ptr<OSMWay> &way )
+bool RoutingGraph::validRoutingWay( const OSMWay *way )
+{
+    const TagList &tags = way->getTags();
+    if ( tags.getPool() != &m_frag.getTagPool() )
+    {
+        return routableTags( tags );
+    }
+
+    tagSetId_t set = tags.getSetId();
+    if ( set >= m_tagSetRoutable.size() )
+    {
+        m_tagSetRoutable.resize( m_frag.getTagPool().sets(), unknownSet );
+    }
+    if ( m_tagSetRoutable[set] == unknownSet )
+    {
+        m_tagSetRoutable[set] = routableTags( tags ) ? routableSet : unroutableSet;
+    }
+    return m_tagSetRoutable[set] == routableSet;
+}
+
+double RoutingGraph::wayWeight( const OSMWay &way )
 {
-    const tagMap_t &tags = way->getTags();
+    const TagList &tags = way.getTags();
+    if ( tags.getPool() != &m_frag.getTagPool() )
+    {
+        return calculateWayWeight( tags, m_wayWeightings );
+    }
 
-    BOOST_FOREACH( const std::string &routableWayKey, m_routableWayKeys )
+    // NaN until the set is first seen
+    tagSetId_t set = tags.getSetId();
+    if ( set >= m_tagSetWeights.size() )
+    {
+        m_tagSetWeights.resize( m_frag.getTagPool().sets(), std::numeric_limits<double>::quiet_NaN() );
+    }
+    if ( m_tagSetWeights[set] != m_tagSetWeights[set] )
+    {
+        m_tagSetWeights[set] = calculateWayWeight( tags, m_wayWeightings );
+    }
+    return m_tagSetWeights[set];
+}
+
+bool RoutingGraph::routableTags( const TagList &tags ) const
+{
+    BOOST_FOREACH( const ConstTagString &routableWayKey, m_routableWayKeyIds )
     {
         if ( tags.find( routableWayKey ) != tags.end() )
         {
@@ -321,73 +366,92 @@ bool RoutingGraph::validRoutingWay( const boost::shared_ptr<OSMWay> &way )
     return false;
 }
 
-boost::shared_ptr<OSMNode> RoutingGraph::getNodeById( dbId_t nodeId )
+NodeStore::Node RoutingGraph::getNodeById( dbId_t nodeId ) const
+{
+    return m_frag.getNodeStore().at( getNodeIndex( nodeId ) );
+}
+
+boost::uint32_t RoutingGraph::getNodeIndex( dbId_t nodeId ) const
 {
-    const OSMFragment::nodeMap_t &nodeMap = m_frag.getNodes();
-    OSMFragment::nodeMap_t::const_iterator nFindIt = nodeMap.find( nodeId );
-    if ( nFindIt == nodeMap.end() )
+    boost::uint32_t nodeIndex = m_frag.getNodeStore().indexOf( nodeId );
+    if ( nodeIndex == NodeStore::noIndex )
     {
-        throw modosmapi::ModException( "Node not found in node map" );
+        throw modosmapi::ModException( "Node not found in node store" );
     }
-    return nFindIt->second;
+    return nodeIndex;
 }
 
-void RoutingGraph::build( boost::function<void( double, double, dbId_t, bool )> routeNodeRegisterCallbackFn )
+void RoutingGraph::build( boost::function<void( coord_t, coord_t, dbId_t, bool )> routeNodeRegisterCallbackFn )
 {
-    // First pass: count the number of ways each node belongs to
-    typedef std::map<boost::uint64_t, size_t> nodeCountInWays_t;
-    nodeCountInWays_t nodeCountInWays;
+    const NodeStore &nodes = m_frag.getNodeStore();
+    m_nodeVertices.assign( nodes.size(), boost::graph_traits<GraphType>::null_vertex() );
+    m_nodeWays.assign( nodes.size(), 0 );
+
+    // First pass: count the number of ways each node belongs to. The index
+    // of each way node is kept for the second pass, which visits them in the
+    // same order, so each id is only searched for once.
+    std::vector<boost::uint32_t> nodeCountInWays( nodes.size(), 0 );
+    std::vector<boost::uint32_t> wayNodeIndices;
     BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, m_frag.getWays() )
     {
-        const boost::shared_ptr<OSMWay> &way = v.second;
+        const OSMWay *way = v.second;
         if ( validRoutingWay( way ) )
         {
+            size_t firstIndex = wayNodeIndices.size();
             BOOST_FOREACH( boost::uint64_t nodeId, way->getNodes() )
             {
-                nodeCountInWays[nodeId]++;
+                boost::uint32_t nodeIndex = getNodeIndex( nodeId );
+                wayNodeIndices.push_back( nodeIndex );
+                nodeCountInWays[nodeIndex]++;
             }
 
             // Add one to the start and end nodes as they must feature in the routing graph
-            nodeCountInWays[way->getNodes().front()]++;
-            nodeCountInWays[way->getNodes().back()]++;
+            if ( wayNodeIndices.size() > firstIndex )
+            {
+                nodeCountInWays[wayNodeIndices[firstIndex]]++;
+                nodeCountInWays[wayNodeIndices.back()]++;
+            }
         }
     }
 
-    BOOST_FOREACH( const nodeCountInWays_t::value_type &v, nodeCountInWays )
+    for ( size_t nodeIndex = 0; nodeIndex < nodeCountInWays.size(); nodeIndex++ )
     {
-        boost::shared_ptr<OSMNode> thisNode = getNodeById( v.first );
-        
-        routeNodeRegisterCallbackFn( thisNode->getLat(), thisNode->getLon(), v.first, v.second > 1 );
+        if ( nodeCountInWays[nodeIndex] > 0 )
+        {
+            NodeStore::Node node = nodes.at( nodeIndex );
+
+            routeNodeRegisterCallbackFn( node.getFixedLat(), node.getFixedLon(), node.getId(), nodeCountInWays[nodeIndex] > 1 );
+        }
     }
 
 
     //EdgeWeightMapType edgeWeightMap = boost::get( boost::edge_weight, m_graph );
     // Make a routing graph edge for each relevant section of each way
+    size_t nextWayNode = 0;
     BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, m_frag.getWays() )
     {
-        const boost::shared_ptr<OSMWay> &way = v.second;
+        const OSMWay *way = v.second;
         if ( validRoutingWay( way ) )
         {
             VertexType lastRouteVertex = VertexType();
-            boost::shared_ptr<OSMNode> lastNode;
+            bool haveLastNode = false;
+            coord_t lastLat = 0, lastLon = 0;
             double cumulativeDistance= 0.0;
-            BOOST_FOREACH( boost::uint64_t nodeId, way->getNodes() )
+            for ( size_t i = 0; i < size_t( way->getNodes().size() ); i++ )
             {
-                boost::shared_ptr<OSMNode> thisNode = getNodeById( nodeId );
+                boost::uint32_t nodeIndex = wayNodeIndices[nextWayNode++];
+                NodeStore::Node node = nodes.at( nodeIndex );
+                coord_t lat = node.getFixedLat(), lon = node.getFixedLon();
 
-                if ( lastNode )
+                if ( haveLastNode )
                 {
-                    cumulativeDistance += distBetween(
-                        lastNode->getLat(),
-                        lastNode->getLon(),
-                        thisNode->getLat(),
-                        thisNode->getLon() );
+                    cumulativeDistance += fixedDistBetween( lastLat, lastLon, lat, lon );
                 }
                     
-                if ( nodeCountInWays[nodeId] > 1 )
+                if ( nodeCountInWays[nodeIndex] > 1 )
                 {
                     // Make this vertex and add it to the map
-                    VertexType thisVertex = getVertex( nodeId );
+                    VertexType thisVertex = getVertex( nodeIndex );
                         
                     if ( lastRouteVertex )
                     {
@@ -399,10 +463,12 @@ void RoutingGraph::build( boost::function<void( double, double, dbId_t, bool )>
                 }
                 else
                 {
-                    m_nodeIdToWay.insert( std::make_pair( nodeId, way ) );
+                    m_nodeWays[nodeIndex] = way;
                 }
 
-                lastNode = thisNode;
+                haveLastNode = true;
+                lastLat = lat;
+                lastLon = lon;
             }
         }
     }
@@ -411,39 +477,42 @@ void RoutingGraph::build( boost::function<void( double, double, dbId_t, bool )>
 
 VertexType RoutingGraph::getRouteVertex( dbId_t nodeId )
 {
-    nodeIdToVertexMap_t::const_iterator vfindIt = m_nodeIdToVertexMap.find( nodeId );
-    if ( vfindIt != m_nodeIdToVertexMap.end() )
+    const VertexType noVertex = boost::graph_traits<GraphType>::null_vertex();
+
+    boost::uint32_t nodeIndex = getNodeIndex( nodeId );
+    if ( m_nodeVertices[nodeIndex] != noVertex )
     {
-        return vfindIt->second;
+        return m_nodeVertices[nodeIndex];
     }
 
-    nodeIdToWayMap_t::const_iterator nfindIt = m_nodeIdToWay.find( nodeId );
-    if ( nfindIt == m_nodeIdToWay.end() )
+    const OSMWay *theWay = m_nodeWays[nodeIndex];
+    if ( !theWay )
     {
         throw std::runtime_error( "Node not found..." );
     }
-    boost::shared_ptr<OSMWay> theWay = nfindIt->second;
 
     double cumulativeDistance = 0.0;
-    boost::shared_ptr<OSMNode> lastNode;
+    NodeStore::Node lastNode;
+    bool haveLastNode = false;
     VertexType lastRouteVertex = VertexType();
     bool lastIsNewVertex = false;
     VertexType theNewVertex = VertexType();
     BOOST_FOREACH( dbId_t wayNodeId, theWay->getNodes() )
     {
-        vfindIt = m_nodeIdToVertexMap.find( wayNodeId );
-        bool isRoutingVertex = vfindIt != m_nodeIdToVertexMap.end();
-        bool isNewVertex = wayNodeId == nodeId;
+        boost::uint32_t wayNodeIndex = getNodeIndex( wayNodeId );
+        VertexType wayNodeVertex = m_nodeVertices[wayNodeIndex];
+        bool isRoutingVertex = wayNodeVertex != noVertex;
+        bool isNewVertex = wayNodeIndex == nodeIndex;
 
-        boost::shared_ptr<OSMNode> thisNode = getNodeById( nodeId );
+        NodeStore::Node thisNode = m_frag.getNodeStore().at( wayNodeIndex );
 
-        if ( lastNode )
+        if ( haveLastNode )
         {
-            cumulativeDistance += distBetween(
-                lastNode->getLat(),
-                lastNode->getLon(),
-                thisNode->getLat(),
-                thisNode->getLon() );
+            cumulativeDistance += fixedDistBetween(
+                lastNode.getFixedLat(),
+                lastNode.getFixedLon(),
+                thisNode.getFixedLat(),
+                thisNode.getFixedLon() );
         }
 
         if ( isRoutingVertex || isNewVertex )
@@ -451,12 +520,12 @@ VertexType RoutingGraph::getRouteVertex( dbId_t nodeId )
             VertexType thisVertex;
             if ( isRoutingVertex )
             {
-                thisVertex = vfindIt->second;
+                thisVertex = wayNodeVertex;
             }
             else
             {
                 // Make this vertex and add it to the map
-                thisVertex = getVertex( nodeId );
+                thisVertex = getVertex( nodeIndex );
                 theNewVertex = thisVertex;
             }
 
@@ -471,24 +540,25 @@ VertexType RoutingGraph::getRouteVertex( dbId_t nodeId )
         }
 
         lastNode = thisNode;
+        haveLastNode = true;
     }
 
     return theNewVertex;
 }
 
-std::pair<boost::shared_ptr<OSMWay>, bool> RoutingGraph::wayFromEdge( EdgeType edge )
+std::pair<const OSMWay *, bool> RoutingGraph::wayFromEdge( EdgeType edge )
 {
     typedef boost::property_map<GraphType, boost::edge_index_t>::type EdgeIdMap_t;
     EdgeIdMap_t edgeIds = boost::get( boost::edge_index, m_graph );
     
     size_t edgeIndex = edgeIds[edge];
 
-    boost::shared_ptr<OSMWay> way = m_edgeWays.at( edgeIndex );
+    const OSMWay *way = m_edgeWays.at( edgeIndex );
     bool wayBackwards = m_edgeWayBackwards.at( edgeIndex );
     return std::make_pair( way, wayBackwards );
 }
 
-std::pair<boost::shared_ptr<OSMWay>, bool> RoutingGraph::getWayBetween( VertexType source, VertexType dest )
+std::pair<const OSMWay *, bool> RoutingGraph::getWayBetween( VertexType source, VertexType dest )
 {
     typedef boost::graph_traits<GraphType>::out_edge_iterator out_edge_iterator;
 
@@ -506,7 +576,7 @@ std::pair<boost::shared_ptr<OSMWay>, bool> RoutingGraph::getWayBetween( VertexTy
     throw std::runtime_error( "Failed to find edge" );
 }
 
-void RoutingGraph::getIntermediateNodes( boost::shared_ptr<OSMWay> theWay, bool wayBackwards, dbId_t fromNodeId, dbId_t toNodeId, route_t &intermediateNodes )
+void RoutingGraph::getIntermediateNodes( const OSMWay *theWay, bool wayBackwards, dbId_t fromNodeId, dbId_t toNodeId, route_t &intermediateNodes )
 {
     bool output = false;
     bool appendFront = false;
@@ -538,7 +608,7 @@ void RoutingGraph::getIntermediateNodes( boost::shared_ptr<OSMWay> theWay, bool
             {
                 return;
             }
-            boost::shared_ptr<OSMNode> theNode = getNodeById( nodeId );
+            NodeStore::Node theNode = getNodeById( nodeId );
             if ( appendFront )
             {
                 //std::cout << "  front: " << nodeId << std::endl;
@@ -565,12 +635,12 @@ void RoutingGraph::calculateRoute( dbId_t sourceNodeId, dbId_t destNodeId, route
     std::vector<VertexType> p( num_vertices( m_graph ) );
     std::vector<double> d( num_vertices( m_graph ) );        
 
-    WeightMapLookup wml( m_graph, m_edgeWays, m_edgeLengths, m_wayWeightings );
+    WeightMapLookup wml( m_graph, m_edgeLengths, m_edgeWeights );
 
     try
     {
         astar_search( m_graph, sourceVertex,
-                      DistanceHeuristic( m_frag, nodeIndexMap, destVertex ),
+                      DistanceHeuristic( m_frag.getNodeStore(), nodeIndexMap, destVertex ),
                       boost::predecessor_map( &p[0] ).
                       distance_map( &d[0] ).
                       weight_map( wml ).
@@ -581,21 +651,23 @@ void RoutingGraph::calculateRoute( dbId_t sourceNodeId, dbId_t destNodeId, route
         // End of route - we've reached the destination
         bool atStart = true;
         VertexType lastVertex = VertexType();
-        dbId_t lastNodeId = 0;
-        typedef boost::tuple<boost::shared_ptr<OSMWay>, bool, dbId_t, dbId_t> routeSeg_t;
+        boost::uint32_t lastNodeIndex = 0;
+        // The way, whether it is followed backwards, and the node indices
+        // at each end
+        typedef boost::tuple<const OSMWay *, bool, boost::uint32_t, boost::uint32_t> routeSeg_t;
         std::list<routeSeg_t> routeSegs;
         for ( VertexType v = destVertex; ; v = p[v] )
         {
             NodeIndexMapType nodeIndexMap = boost::get( boost::vertex_name, m_graph );
-            dbId_t nodeId = nodeIndexMap[v];
+            boost::uint32_t nodeIndex = nodeIndexMap[v];
 
             if ( !atStart )
             {
-                boost::shared_ptr<OSMWay> theWay;
+                const OSMWay *theWay;
                 bool wayBackwards;
                 boost::tie( theWay, wayBackwards ) = getWayBetween( v, lastVertex );
 
-                routeSegs.push_front( routeSeg_t( theWay, wayBackwards, nodeId, lastNodeId ) );
+                routeSegs.push_front( routeSeg_t( theWay, wayBackwards, nodeIndex, lastNodeIndex ) );
             }
             
             if ( p[v] == v )
@@ -603,33 +675,33 @@ void RoutingGraph::calculateRoute( dbId_t sourceNodeId, dbId_t destNodeId, route
                 break;
             }
             lastVertex = v;
-            lastNodeId = nodeId;
+            lastNodeIndex = nodeIndex;
             atStart = false;
         }
 
         BOOST_FOREACH( const routeSeg_t &routeSeg, routeSegs )
         {
-            boost::shared_ptr<OSMWay> theWay = routeSeg.get<0>();
+            const OSMWay *theWay = routeSeg.get<0>();
             bool wayBackwards = routeSeg.get<1>();
-            dbId_t nodeFromId = routeSeg.get<2>();
-            dbId_t nodeToId = routeSeg.get<3>();
+            NodeStore::Node nodeFrom = m_frag.getNodeStore().at( routeSeg.get<2>() );
+            NodeStore::Node nodeTo = m_frag.getNodeStore().at( routeSeg.get<3>() );
 
             //std::cout << "WAY" << std::endl;
-            //BOOST_FOREACH( const tagMap_t::value_type &v, theWay->getTags() )
+            //BOOST_FOREACH( const tag_t &v, theWay->getTags() )
             //{
             //    std::cout << "  " << v.first << ": " << v.second << std::endl;
             //}
             
-            route.push_back( getNodeById( nodeFromId ) );
+            route.push_back( nodeFrom );
 
             route_t intermediateNodes;
-            getIntermediateNodes( theWay, wayBackwards, nodeFromId, nodeToId, intermediateNodes );
-            BOOST_FOREACH( boost::shared_ptr<OSMNode> interNode, intermediateNodes )
+            getIntermediateNodes( theWay, wayBackwards, nodeFrom.getId(), nodeTo.getId(), intermediateNodes );
+            BOOST_FOREACH( const NodeStore::Node &interNode, intermediateNodes )
             {
                 route.push_back( interNode );
             }
 
-            route.push_back( getNodeById( nodeToId ) );
+            route.push_back( nodeTo );
         }
     }        
 }
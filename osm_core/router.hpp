@@ -21,57 +21,73 @@ typedef boost::adjacency_list<
     // Access to both input and output edges, in a directed graph
     boost::bidirectionalS,
     //boost::undirectedS,
-    boost::property<boost::vertex_name_t, int>,
+    // The vertex's node, by its NodeStore::indexOf()
+    boost::property<boost::vertex_name_t, boost::uint32_t>,
     boost::property<boost::edge_index_t, size_t> > GraphType;
 
 typedef boost::graph_traits<GraphType>::vertex_descriptor VertexType;
 typedef boost::graph_traits<GraphType>::edge_descriptor EdgeType;
 
-typedef boost::property_map<GraphType, boost::edge_weight_t>::type EdgeWeightMapType;
 typedef boost::property_map<GraphType, boost::vertex_name_t>::type NodeIndexMapType;
 
-
-typedef std::map<boost::uint64_t, VertexType> nodeIdToVertexMap_t;
-
+// Routes over the ways of a fragment read with setColumnarNodes( true ),
+// looking nodes up in its NodeStore. Once built, the graph refers to nodes
+// by their dense index in the store rather than by id, so per-node state is
+// kept in vectors rather than maps keyed by id.
 class RoutingGraph
 {
 public:
-    typedef std::list<boost::shared_ptr<OSMNode> > route_t;
+    typedef std::list<NodeStore::Node> route_t;
 
     /* Member data */
     /***************/
 private:
     const OSMFragment&                           m_frag;
-    nodeIdToVertexMap_t                          m_nodeIdToVertexMap;
+    // By node index: the node's vertex, or null_vertex() if it has none
+    std::vector<VertexType>                      m_nodeVertices;
     GraphType                                    m_graph;
 
     std::vector<std::string>                     m_routableWayKeys;
+    std::vector<ConstTagString>                  m_routableWayKeyIds;
     wayWeightings_t                              m_wayWeightings;
 
     size_t                                       m_nextEdgeId;
     std::vector<double>                          m_edgeLengths;
-    std::vector<boost::shared_ptr<OSMWay> >      m_edgeWays;
+    std::vector<double>                          m_edgeWeights;
+    std::vector<const OSMWay *>                  m_edgeWays;
     std::vector<bool>                            m_edgeWayBackwards;
 
-    // For nodes on only one (routing) way: get the way from the node id
-    typedef std::map<dbId_t, boost::shared_ptr<OSMWay> > nodeIdToWayMap_t;
-    nodeIdToWayMap_t m_nodeIdToWay;
+    // By node index, for nodes on only one (routing) way: that way
+    std::vector<const OSMWay *>                  m_nodeWays;
+
+    // By set id in the fragment's TagPool, worked out the first time a way
+    // with that set is seen: ways with equal tags share the result
+    std::vector<char>                            m_tagSetRoutable;
+    std::vector<double>                          m_tagSetWeights;
 
 public:
     RoutingGraph( const OSMFragment &frag );
-    VertexType getVertex( boost::uint64_t nodeId );
-    void addEdge( VertexType source, VertexType dest, double length, boost::shared_ptr<OSMWay> way );
-    bool validRoutingWay( const boost::shared_ptr<OSMWay> &way );
-    void build( boost::function<void( double, double, dbId_t, bool )> routeNodeRegisterCallback );
+    VertexType getVertex( boost::uint32_t nodeIndex );
+    void addEdge( VertexType source, VertexType dest, double length, const OSMWay *way );
+    bool validRoutingWay( const OSMWay *way );
+    // Multiplier on the way's length, from m_wayWeightings
+    double wayWeight( const OSMWay &way );
+    void build( boost::function<void( coord_t, coord_t, dbId_t, bool )> routeNodeRegisterCallback );
     void calculateRoute( dbId_t sourceNodeId, dbId_t destNodeId, route_t &route );
 
     VertexType getRouteVertex( dbId_t nodeId );
 
+    // Ways with any of these keys are the ones routed over
+    const std::vector<std::string> &getRoutableWayKeys() const { return m_routableWayKeys; }
+
 private:
-    boost::shared_ptr<OSMNode> getNodeById( dbId_t nodeId );
-    std::pair<boost::shared_ptr<OSMWay>, bool> wayFromEdge( EdgeType edge );
-    std::pair<boost::shared_ptr<OSMWay>, bool> getWayBetween( VertexType source, VertexType dest );
-    void getIntermediateNodes( boost::shared_ptr<OSMWay> theWay, bool wayBackwards, dbId_t lastNodeId, dbId_t nodeId, route_t &intermediateNodes );
+    NodeStore::Node getNodeById( dbId_t nodeId ) const;
+    boost::uint32_t getNodeIndex( dbId_t nodeId ) const;
+    std::pair<const OSMWay *, bool> wayFromEdge( EdgeType edge );
+    std::pair<const OSMWay *, bool> getWayBetween( VertexType source, VertexType dest );
+    void getIntermediateNodes( const OSMWay *theWay, bool wayBackwards, dbId_t lastNodeId, dbId_t nodeId, route_t &intermediateNodes );
+
+    bool routableTags( const TagList &tags ) const;
 
     void setCycleWeights();
     void setCarWeights();
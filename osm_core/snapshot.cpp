@@ -0,0 +1,1010 @@
+#include <map>
+#include <limits>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/crc.hpp>
+#include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "snapshot.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    const char snapshotMagic[8] = { 'O', 'S', 'M', 'S', 'N', 'A', 'P', 0 };
+    // Bump on any change to the layout
+    const boost::uint32_t snapshotVersion = 1;
+    // Reads back as 0x04030201 on a machine of the other byte order
+    const boost::uint32_t byteOrderMark = 0x01020304;
+
+    const boost::uint32_t noMeta = 0xFFFFFFFF;
+    const boost::uint32_t noId   = 0xFFFFFFFF;
+
+    // Every section, in the order of the section table. Arrays of starts
+    // have one more entry than there are objects, as in NodeStore and
+    // WayNodePool: object i's entries are [starts[i], starts[i + 1]).
+    enum section_t
+    {
+        SECTION_STRING_STARTS,      // uint64
+        SECTION_STRING_BYTES,       // char
+        SECTION_USERS,              // User
+        SECTION_FRAGMENT_USERS,     // uint32 index into SECTION_USERS
+        SECTION_TAGSET_STARTS,      // uint32. Set 0 is always empty.
+        SECTION_TAGSET_TAGS,        // Tag
+        SECTION_NODE_IDS,           // uint64, increasing
+        SECTION_NODE_LATS,          // coord_t
+        SECTION_NODE_LONS,          // coord_t
+        SECTION_NODE_TAG_STARTS,    // uint32
+        SECTION_NODE_TAGS,          // Tag
+        SECTION_NODE_META_INDICES,  // uint32 index into SECTION_NODE_META, or noMeta
+        SECTION_NODE_META,          // Meta
+        SECTION_WAY_IDS,            // uint64, increasing
+        SECTION_WAY_META,           // Meta
+        SECTION_WAY_TAGSETS,        // uint32 set id
+        SECTION_WAY_NODE_STARTS,    // uint64
+        SECTION_WAY_NODES,          // uint64
+        SECTION_RELATION_IDS,       // uint64, increasing
+        SECTION_RELATION_META,      // Meta
+        SECTION_RELATION_TAGSETS,   // uint32 set id
+        SECTION_MEMBER_STARTS,      // uint64
+        SECTION_MEMBERS,            // Member
+        SECTION_COUNT
+    };
+
+    struct Header
+    {
+        char            m_magic[8];
+        boost::uint32_t m_version;
+        boost::uint32_t m_byteOrder;
+        boost::uint32_t m_sections;
+        // Of the header, with this zero, and the section table
+        boost::uint32_t m_crc;
+        // String ids
+        boost::uint32_t m_osmVersion;
+        boost::uint32_t m_generator;
+    };
+
+    struct Section
+    {
+        boost::uint64_t m_offset;
+        boost::uint64_t m_size;
+        boost::uint32_t m_crc;
+        boost::uint32_t m_padding;
+    };
+
+    // Strings are by id
+    struct User
+    {
+        boost::uint64_t m_id;
+        boost::uint32_t m_name;
+        boost::uint32_t m_padding;
+    };
+
+    struct Tag
+    {
+        boost::uint32_t m_key;
+        boost::uint32_t m_value;
+    };
+
+    const boost::uint32_t FLAG_VISIBLE = 1;
+
+    struct Meta
+    {
+        // Seconds since the epoch, or noTime()
+        boost::int64_t  m_timestamp;
+        boost::uint32_t m_user;
+        boost::uint32_t m_flags;
+    };
+
+    struct Member
+    {
+        boost::uint64_t m_ref;
+        boost::uint32_t m_type;
+        boost::uint32_t m_role;
+    };
+
+    const size_t tableBytes = sizeof( Header ) + SECTION_COUNT * sizeof( Section );
+
+    // For objects with no timestamp (not_a_date_time)
+    boost::int64_t noTime() { return std::numeric_limits<boost::int64_t>::min(); }
+
+    boost::uint32_t headerChecksum( const Header &header, const Section *sections )
+    {
+        Header zeroed = header;
+        zeroed.m_crc = 0;
+
+        boost::crc_32_type crc;
+        crc.process_bytes( &zeroed, sizeof( zeroed ) );
+        crc.process_bytes( sections, SECTION_COUNT * sizeof( Section ) );
+        return crc.checksum();
+    }
+
+    // The node map's and the node store's elements, as one type of node
+    const OSMNode &nodeOf( const OSMFragment::nodeMap_t::value_type &v ) { return *v.second; }
+    NodeStore::Node nodeOf( const NodeStore::Node &node ) { return node; }
+
+    // As NodeStore::add: a node made from a location alone has no metadata
+    template<typename NodeType>
+    bool hasMeta( const NodeType &node )
+    {
+        return !(node.getTimeStamp().is_special() && node.getUserId() == 0 && node.getUser().empty());
+    }
+
+
+    class SnapshotWriter
+    {
+    private:
+        std::string        m_fileName;
+        std::ofstream      m_os;
+        boost::uint64_t    m_offset;
+        Section            m_sections[SECTION_COUNT];
+        section_t          m_current;
+        boost::crc_32_type m_crc;
+
+        // Every string written, in id order, and the ids of tag strings by
+        // ConstTagString index, so each is only looked up once
+        std::map<std::string, boost::uint32_t>     m_stringIds;
+        std::vector<const std::string *>           m_strings;
+        std::vector<boost::uint32_t>               m_tagStringIds;
+
+        typedef std::pair<dbId_t, std::string>     user_t;
+        std::map<user_t, boost::uint32_t>          m_userIds;
+        std::vector<const user_t *>                m_users;
+
+        // Tag sets, as pairs of string ids; those of lists in the fragment's
+        // pool also by pool set id
+        typedef std::pair<boost::uint32_t, boost::uint32_t> tagIds_t;
+        std::map<std::vector<tagIds_t>, boost::uint32_t>    m_tagSetIds;
+        std::vector<boost::uint32_t>                        m_tagSetStarts;
+        std::vector<tagIds_t>                               m_tagSetTags;
+        const TagPool                                      *m_pool;
+        std::vector<boost::uint32_t>                        m_poolSetIds;
+
+    public:
+        SnapshotWriter( const std::string &fileName ) :
+            m_fileName( fileName ),
+            m_os( fileName.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc ),
+            m_offset( 0 ),
+            m_current( SECTION_COUNT ),
+            m_tagSetStarts( 2, 0 ),
+            m_pool( 0 )
+        {
+            if ( !m_os )
+            {
+                throw std::runtime_error( "Unable to open snapshot: " + fileName );
+            }
+            memset( m_sections, 0, sizeof( m_sections ) );
+        }
+
+        void write( const OSMFragment &frag )
+        {
+            const OSMFragment::nodeMap_t &nodes = frag.getNodes();
+            const NodeStore &nodeStore = frag.getNodeStore();
+            if ( !nodes.empty() && !nodeStore.empty() )
+            {
+                throw std::logic_error( "Can't snapshot a fragment with nodes in both its map and its store" );
+            }
+
+            m_pool = &frag.getTagPool();
+            m_poolSetIds.assign( m_pool->sets(), noId );
+
+            // Filled in once the sections are written
+            const char zeros[tableBytes] = { 0 };
+            putRaw( zeros, sizeof( zeros ) );
+
+            Header header;
+            memset( &header, 0, sizeof( header ) );
+            memcpy( header.m_magic, snapshotMagic, sizeof( header.m_magic ) );
+            header.m_version    = snapshotVersion;
+            header.m_byteOrder  = byteOrderMark;
+            header.m_sections   = SECTION_COUNT;
+            header.m_osmVersion = stringId( frag.getVersion() );
+            header.m_generator  = stringId( frag.getGenerator() );
+
+            if ( nodes.empty() )
+            {
+                writeNodes( nodeStore.begin(), nodeStore.end() );
+            }
+            else
+            {
+                writeNodes( nodes.begin(), nodes.end() );
+            }
+            writeWays( frag.getWays() );
+            writeRelations( frag.getRelations() );
+
+            // Last, as the objects add to the users, tag sets and strings
+            begin( SECTION_FRAGMENT_USERS );
+            BOOST_FOREACH( const OSMFragment::userMap_t::value_type &v, frag.getUsers() )
+            {
+                put( userId( v.first, v.second ) );
+            }
+            end();
+
+            begin( SECTION_USERS );
+            BOOST_FOREACH( const user_t *user, m_users )
+            {
+                User entry = { user->first, stringId( user->second ), 0 };
+                put( entry );
+            }
+            end();
+
+            begin( SECTION_TAGSET_STARTS );
+            BOOST_FOREACH( boost::uint32_t start, m_tagSetStarts )
+            {
+                put( start );
+            }
+            end();
+
+            begin( SECTION_TAGSET_TAGS );
+            BOOST_FOREACH( const tagIds_t &tag, m_tagSetTags )
+            {
+                Tag entry = { tag.first, tag.second };
+                put( entry );
+            }
+            end();
+
+            begin( SECTION_STRING_STARTS );
+            boost::uint64_t stringStart = 0;
+            put( stringStart );
+            BOOST_FOREACH( const std::string *string, m_strings )
+            {
+                stringStart += string->size();
+                put( stringStart );
+            }
+            end();
+
+            begin( SECTION_STRING_BYTES );
+            BOOST_FOREACH( const std::string *string, m_strings )
+            {
+                putRaw( string->data(), string->size() );
+            }
+            end();
+
+            header.m_crc = headerChecksum( header, m_sections );
+            m_os.seekp( 0 );
+            m_os.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+            m_os.write( reinterpret_cast<const char *>( m_sections ), sizeof( m_sections ) );
+
+            m_os.close();
+            if ( !m_os )
+            {
+                throw std::runtime_error( "Error writing snapshot: " + m_fileName );
+            }
+        }
+
+    private:
+        template<typename Iterator>
+        void writeNodes( Iterator first, Iterator last )
+        {
+            begin( SECTION_NODE_IDS );
+            for ( Iterator it = first; it != last; ++it )
+            {
+                put( boost::uint64_t( nodeOf( *it ).getId() ) );
+            }
+            end();
+
+            begin( SECTION_NODE_LATS );
+            for ( Iterator it = first; it != last; ++it )
+            {
+                put( nodeOf( *it ).getFixedLat() );
+            }
+            end();
+
+            begin( SECTION_NODE_LONS );
+            for ( Iterator it = first; it != last; ++it )
+            {
+                put( nodeOf( *it ).getFixedLon() );
+            }
+            end();
+
+            begin( SECTION_NODE_TAG_STARTS );
+            boost::uint64_t tagStart = 0;
+            put( boost::uint32_t( tagStart ) );
+            for ( Iterator it = first; it != last; ++it )
+            {
+                tagStart += nodeOf( *it ).getTags().size();
+                if ( tagStart > 0xFFFFFFFFu )
+                {
+                    throw std::runtime_error( "Too many node tags for a snapshot" );
+                }
+                put( boost::uint32_t( tagStart ) );
+            }
+            end();
+
+            begin( SECTION_NODE_TAGS );
+            for ( Iterator it = first; it != last; ++it )
+            {
+                BOOST_FOREACH( const tag_t &tag, nodeOf( *it ).getTags() )
+                {
+                    Tag entry = { tagStringId( tag.first ), tagStringId( tag.second ) };
+                    put( entry );
+                }
+            }
+            end();
+
+            begin( SECTION_NODE_META_INDICES );
+            boost::uint32_t metaIndex = 0;
+            for ( Iterator it = first; it != last; ++it )
+            {
+                put( hasMeta( nodeOf( *it ) ) ? metaIndex++ : noMeta );
+            }
+            end();
+
+            begin( SECTION_NODE_META );
+            for ( Iterator it = first; it != last; ++it )
+            {
+                if ( hasMeta( nodeOf( *it ) ) )
+                {
+                    putMeta( nodeOf( *it ), 0 );
+                }
+            }
+            end();
+        }
+
+        void writeWays( const OSMFragment::wayMap_t &ways )
+        {
+            begin( SECTION_WAY_IDS );
+            BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, ways )
+            {
+                put( boost::uint64_t( v.first ) );
+            }
+            end();
+
+            begin( SECTION_WAY_META );
+            BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, ways )
+            {
+                putMeta( *v.second, v.second->getVisible() ? FLAG_VISIBLE : 0 );
+            }
+            end();
+
+            begin( SECTION_WAY_TAGSETS );
+            BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, ways )
+            {
+                put( tagSetId( v.second->getTags() ) );
+            }
+            end();
+
+            begin( SECTION_WAY_NODE_STARTS );
+            boost::uint64_t nodeStart = 0;
+            put( nodeStart );
+            BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, ways )
+            {
+                nodeStart += v.second->getNodes().size();
+                put( nodeStart );
+            }
+            end();
+
+            begin( SECTION_WAY_NODES );
+            BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, ways )
+            {
+                WayNodeList::nodeRange_t nodes = v.second->getNodes();
+                putRaw( nodes.begin(), nodes.size() * sizeof( WayNodeList::id_t ) );
+            }
+            end();
+        }
+
+        void writeRelations( const OSMFragment::relationMap_t &relations )
+        {
+            begin( SECTION_RELATION_IDS );
+            BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, relations )
+            {
+                put( boost::uint64_t( v.first ) );
+            }
+            end();
+
+            begin( SECTION_RELATION_META );
+            BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, relations )
+            {
+                putMeta( *v.second, 0 );
+            }
+            end();
+
+            begin( SECTION_RELATION_TAGSETS );
+            BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, relations )
+            {
+                put( tagSetId( v.second->getTags() ) );
+            }
+            end();
+
+            begin( SECTION_MEMBER_STARTS );
+            boost::uint64_t memberStart = 0;
+            put( memberStart );
+            BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, relations )
+            {
+                memberStart += v.second->getMembers().size();
+                put( memberStart );
+            }
+            end();
+
+            begin( SECTION_MEMBERS );
+            BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, relations )
+            {
+                BOOST_FOREACH( const member_t &member, v.second->getMembers() )
+                {
+                    Member entry = { member.get<1>(), stringId( member.get<0>() ), stringId( member.get<2>() ) };
+                    put( entry );
+                }
+            }
+            end();
+        }
+
+        boost::uint32_t stringId( const std::string &string )
+        {
+            std::map<std::string, boost::uint32_t>::iterator findIt = m_stringIds.find( string );
+            if ( findIt == m_stringIds.end() )
+            {
+                findIt = m_stringIds.insert( std::make_pair( string, boost::uint32_t( m_strings.size() ) ) ).first;
+                m_strings.push_back( &findIt->first );
+            }
+            return findIt->second;
+        }
+
+        boost::uint32_t tagStringId( const ConstTagString &string )
+        {
+            boost::uint32_t index = string.getIndex();
+            if ( index >= m_tagStringIds.size() )
+            {
+                m_tagStringIds.resize( std::max<size_t>( index + 1, m_tagStringIds.size() * 2 ), noId );
+            }
+            if ( m_tagStringIds[index] == noId )
+            {
+                m_tagStringIds[index] = stringId( string.toString() );
+            }
+            return m_tagStringIds[index];
+        }
+
+        boost::uint32_t userId( dbId_t id, const std::string &name )
+        {
+            user_t user( id, name );
+            std::map<user_t, boost::uint32_t>::iterator findIt = m_userIds.find( user );
+            if ( findIt == m_userIds.end() )
+            {
+                findIt = m_userIds.insert( std::make_pair( user, boost::uint32_t( m_users.size() ) ) ).first;
+                m_users.push_back( &findIt->first );
+            }
+            return findIt->second;
+        }
+
+        boost::uint32_t tagSetId( const TagList &tags )
+        {
+            if ( tags.empty() )
+            {
+                return 0;
+            }
+
+            bool pooled = tags.getPool() == m_pool;
+            if ( pooled && m_poolSetIds[tags.getSetId()] != noId )
+            {
+                return m_poolSetIds[tags.getSetId()];
+            }
+
+            std::vector<tagIds_t> key;
+            key.reserve( tags.size() );
+            BOOST_FOREACH( const tag_t &tag, tags )
+            {
+                key.push_back( tagIds_t( tagStringId( tag.first ), tagStringId( tag.second ) ) );
+            }
+
+            std::map<std::vector<tagIds_t>, boost::uint32_t>::iterator findIt = m_tagSetIds.find( key );
+            if ( findIt == m_tagSetIds.end() )
+            {
+                boost::uint32_t set = m_tagSetStarts.size() - 1;
+                m_tagSetTags.insert( m_tagSetTags.end(), key.begin(), key.end() );
+                m_tagSetStarts.push_back( m_tagSetTags.size() );
+                findIt = m_tagSetIds.insert( std::make_pair( key, set ) ).first;
+            }
+
+            if ( pooled )
+            {
+                m_poolSetIds[tags.getSetId()] = findIt->second;
+            }
+            return findIt->second;
+        }
+
+        template<typename ObjectType>
+        void putMeta( const ObjectType &object, boost::uint32_t flags )
+        {
+            const boost::posix_time::ptime &timestamp = object.getTimeStamp();
+            Meta meta =
+            {
+                timestamp.is_special() ? noTime() : ptimeToEpoch( timestamp ),
+                userId( object.getUserId(), object.getUser() ),
+                flags
+            };
+            put( meta );
+        }
+
+        void begin( section_t section )
+        {
+            m_current = section;
+            m_sections[section].m_offset = m_offset;
+            m_crc.reset();
+        }
+
+        // Each section is padded to 8 bytes, outside its checksum
+        void end()
+        {
+            Section &section = m_sections[m_current];
+            section.m_size = m_offset - section.m_offset;
+            section.m_crc  = m_crc.checksum();
+
+            const char zeros[8] = { 0 };
+            size_t padding = (8 - m_offset % 8) % 8;
+            m_os.write( zeros, padding );
+            m_offset += padding;
+        }
+
+        template<typename T>
+        void put( const T &value )
+        {
+            putRaw( &value, sizeof( value ) );
+        }
+
+        void putRaw( const void *data, size_t size )
+        {
+            m_os.write( static_cast<const char *>( data ), size );
+            m_crc.process_bytes( data, size );
+            m_offset += size;
+        }
+    };
+}
+
+
+// Fills a fragment from a mapped snapshot. A friend of the classes whose
+// columns it points into the mapping.
+class SnapshotLoader
+{
+private:
+    typedef boost::iostreams::mapped_file_source file_t;
+
+    std::string               m_fileName;
+    boost::shared_ptr<file_t> m_file;
+    const char               *m_data;
+    size_t                    m_size;
+    const Header             *m_header;
+    const Section            *m_sections;
+
+    const boost::uint64_t    *m_stringStarts;
+    const char               *m_stringBytes;
+    size_t                    m_strings;
+    // Made on first use, as most strings are only ever wanted by one
+    // object, or not as tags at all
+    std::vector<ConstTagString> m_tagStrings;
+    std::vector<char>           m_interned;
+
+    std::vector<dbId_t>         m_userIds;
+    std::vector<std::string>    m_userNames;
+    // As objects hold them
+    std::vector<ConstTagString> m_userStrings;
+    // The fragment pool set of each snapshot set
+    std::vector<tagSetId_t>   m_tagSets;
+
+public:
+    SnapshotLoader( const std::string &fileName );
+    void load( OSMFragment &frag, bool verify );
+
+private:
+    void loadStrings();
+    void loadUsers( OSMFragment &frag );
+    void loadTagSets( OSMFragment &frag );
+    void loadNodes( OSMFragment &frag, bool verify );
+    void loadWays( OSMFragment &frag, bool verify );
+    void loadRelations( OSMFragment &frag, bool verify );
+
+    template<typename T>
+    const T *section( section_t id, size_t &count ) const;
+    template<typename T>
+    const T *section( section_t id, size_t expected, const char *what ) const;
+    template<typename T>
+    void checkStarts( const T *starts, size_t count, boost::uint64_t total, const char *what ) const;
+    template<typename T>
+    void checkIds( const T *ids, size_t count, const char *what ) const;
+
+    std::string string( boost::uint32_t id ) const;
+    const ConstTagString &tagString( boost::uint32_t id );
+    tagSetId_t tagSet( boost::uint32_t id ) const;
+    template<typename ObjectType>
+    void setBaseData( ObjectType &object, dbId_t id, const Meta &meta ) const;
+
+    void fail( const std::string &what ) const
+    {
+        throw std::runtime_error( "Invalid snapshot " + m_fileName + ": " + what );
+    }
+};
+
+SnapshotLoader::SnapshotLoader( const std::string &fileName ) :
+    m_fileName( fileName ),
+    m_file( new file_t( fileName ) ),
+    m_data( m_file->data() ),
+    m_size( m_file->size() ),
+    m_header( reinterpret_cast<const Header *>( m_data ) ),
+    m_sections( reinterpret_cast<const Section *>( m_data + sizeof( Header ) ) ),
+    m_stringStarts( 0 ),
+    m_stringBytes( 0 ),
+    m_strings( 0 )
+{
+    if ( m_size < sizeof( Header ) || memcmp( m_header->m_magic, snapshotMagic, sizeof( snapshotMagic ) ) != 0 )
+    {
+        fail( "not a snapshot" );
+    }
+    if ( m_header->m_version != snapshotVersion )
+    {
+        fail( str( boost::format( "version %d, expected %d" ) % m_header->m_version % snapshotVersion ) );
+    }
+    if ( m_header->m_byteOrder != byteOrderMark )
+    {
+        fail( "written on a machine of the other byte order" );
+    }
+    if ( m_header->m_sections != SECTION_COUNT || m_size < tableBytes )
+    {
+        fail( "bad section table" );
+    }
+    if ( headerChecksum( *m_header, m_sections ) != m_header->m_crc )
+    {
+        fail( "header checksum mismatch" );
+    }
+}
+
+void SnapshotLoader::load( OSMFragment &frag, bool verify )
+{
+    if ( !frag.m_nodes.empty() || !frag.m_nodeStore.empty() || !frag.m_ways.empty() || !frag.m_relations.empty() )
+    {
+        throw std::logic_error( "Snapshots can only be loaded into an empty fragment" );
+    }
+
+    if ( verify )
+    {
+        for ( size_t i = 0; i < SECTION_COUNT; i++ )
+        {
+            size_t size;
+            const char *data = section<char>( section_t( i ), size );
+
+            boost::crc_32_type crc;
+            crc.process_bytes( data, size );
+            if ( crc.checksum() != m_sections[i].m_crc )
+            {
+                fail( str( boost::format( "checksum mismatch in section %d" ) % i ) );
+            }
+        }
+    }
+
+    loadStrings();
+    frag.setVersion( string( m_header->m_osmVersion ) );
+    frag.setGenerator( string( m_header->m_generator ) );
+
+    loadUsers( frag );
+    loadTagSets( frag );
+    loadNodes( frag, verify );
+    loadWays( frag, verify );
+    loadRelations( frag, verify );
+
+    frag.m_columnar = true;
+}
+
+void SnapshotLoader::loadStrings()
+{
+    size_t count, bytes;
+    m_stringStarts = section<boost::uint64_t>( SECTION_STRING_STARTS, count );
+    m_stringBytes  = section<char>( SECTION_STRING_BYTES, bytes );
+    if ( count == 0 )
+    {
+        fail( "no string table" );
+    }
+    checkStarts( m_stringStarts, count - 1, bytes, "string" );
+
+    m_strings = count - 1;
+    m_tagStrings.resize( m_strings );
+    m_interned.resize( m_strings, 0 );
+}
+
+void SnapshotLoader::loadUsers( OSMFragment &frag )
+{
+    size_t count;
+    const User *users = section<User>( SECTION_USERS, count );
+
+    NodeStore &nodeStore = frag.m_nodeStore;
+    for ( size_t i = 0; i < count; i++ )
+    {
+        m_userIds.push_back( users[i].m_id );
+        m_userNames.push_back( string( users[i].m_name ) );
+        m_userStrings.push_back( ConstTagString( m_userNames.back() ) );
+
+        NodeStore::user_t user( users[i].m_id, m_userNames.back() );
+        nodeStore.m_users.push_back( user );
+        nodeStore.m_userIndices.insert( std::make_pair( user, boost::uint32_t( i ) ) );
+    }
+
+    size_t fragmentCount;
+    const boost::uint32_t *fragmentUsers = section<boost::uint32_t>( SECTION_FRAGMENT_USERS, fragmentCount );
+    for ( size_t i = 0; i < fragmentCount; i++ )
+    {
+        if ( fragmentUsers[i] >= count )
+        {
+            fail( "user out of range" );
+        }
+        frag.addUser( m_userIds[fragmentUsers[i]], m_userNames[fragmentUsers[i]] );
+    }
+}
+
+void SnapshotLoader::loadTagSets( OSMFragment &frag )
+{
+    size_t count, tagCount;
+    const boost::uint32_t *starts = section<boost::uint32_t>( SECTION_TAGSET_STARTS, count );
+    const Tag *tags = section<Tag>( SECTION_TAGSET_TAGS, tagCount );
+    if ( count < 2 || starts[1] != 0 )
+    {
+        fail( "tag set 0 is not the empty set" );
+    }
+    checkStarts( starts, count - 1, tagCount, "tag set" );
+
+    // The pool wants its sets in TagList order, which is by string index so
+    // may differ from the writer's
+    m_tagSets.resize( count - 1, TagPool::emptySet );
+    std::vector<tag_t> set;
+    for ( size_t i = 1; i < count - 1; i++ )
+    {
+        set.clear();
+        for ( boost::uint32_t j = starts[i]; j < starts[i + 1]; j++ )
+        {
+            set.push_back( tag_t( tagString( tags[j].m_key ), tagString( tags[j].m_value ) ) );
+        }
+        if ( !set.empty() )
+        {
+            std::sort( set.begin(), set.end() );
+            m_tagSets[i] = frag.m_tagPool->intern( &set[0], &set[0] + set.size() );
+        }
+    }
+}
+
+void SnapshotLoader::loadNodes( OSMFragment &frag, bool verify )
+{
+    size_t count, tagCount, metaCount;
+    const NodeStore::id_t  *ids         = section<NodeStore::id_t>( SECTION_NODE_IDS, count );
+    const coord_t          *lats        = section<coord_t>( SECTION_NODE_LATS, count, "node latitudes" );
+    const coord_t          *lons        = section<coord_t>( SECTION_NODE_LONS, count, "node longitudes" );
+    const boost::uint32_t  *tagStarts   = section<boost::uint32_t>( SECTION_NODE_TAG_STARTS, count + 1, "node tag starts" );
+    const Tag              *tags        = section<Tag>( SECTION_NODE_TAGS, tagCount );
+    const boost::uint32_t  *metaIndices = section<boost::uint32_t>( SECTION_NODE_META_INDICES, count, "node metadata indices" );
+    const Meta             *meta        = section<Meta>( SECTION_NODE_META, metaCount );
+
+    // Every start is read anyway, to put each node's tags in order
+    checkStarts( tagStarts, count, tagCount, "node tag" );
+    if ( verify )
+    {
+        checkIds( ids, count, "node" );
+        for ( size_t i = 0; i < count; i++ )
+        {
+            if ( metaIndices[i] != noMeta && metaIndices[i] >= metaCount )
+            {
+                fail( "node metadata out of range" );
+            }
+        }
+    }
+
+    NodeStore &store = frag.m_nodeStore;
+
+    store.m_tags.reserve( tagCount );
+    for ( size_t i = 0; i < tagCount; i++ )
+    {
+        store.m_tags.push_back( tag_t( tagString( tags[i].m_key ), tagString( tags[i].m_value ) ) );
+    }
+    for ( size_t i = 0; i < count; i++ )
+    {
+        if ( tagStarts[i + 1] - tagStarts[i] > 1 )
+        {
+            std::sort( store.m_tags.begin() + tagStarts[i], store.m_tags.begin() + tagStarts[i + 1] );
+        }
+    }
+
+    store.m_meta.reserve( metaCount );
+    for ( size_t i = 0; i < metaCount; i++ )
+    {
+        if ( meta[i].m_user >= m_userIds.size() )
+        {
+            fail( "user out of range" );
+        }
+
+        NodeStore::Meta nodeMeta;
+        nodeMeta.m_timestamp = meta[i].m_timestamp == noTime() ? boost::posix_time::ptime() : epochToPtime( meta[i].m_timestamp );
+        nodeMeta.m_user      = meta[i].m_user;
+        store.m_meta.push_back( nodeMeta );
+    }
+
+    // The columns themselves stay in the file
+    store.m_mapping       = m_file;
+    store.m_idData        = ids;
+    store.m_latData       = lats;
+    store.m_lonData       = lons;
+    store.m_tagStartData  = tagStarts;
+    store.m_metaIndexData = metaIndices;
+    store.m_count         = count;
+    store.m_sorted        = true;
+}
+
+void SnapshotLoader::loadWays( OSMFragment &frag, bool verify )
+{
+    size_t count, nodeCount;
+    const dbId_t          *ids        = section<dbId_t>( SECTION_WAY_IDS, count );
+    const Meta            *meta       = section<Meta>( SECTION_WAY_META, count, "way metadata" );
+    const boost::uint32_t *tagSets    = section<boost::uint32_t>( SECTION_WAY_TAGSETS, count, "way tag sets" );
+    const boost::uint64_t *nodeStarts = section<boost::uint64_t>( SECTION_WAY_NODE_STARTS, count + 1, "way node starts" );
+    const dbId_t          *nodes      = section<dbId_t>( SECTION_WAY_NODES, nodeCount );
+
+    checkStarts( nodeStarts, count, nodeCount, "way node" );
+    if ( verify )
+    {
+        checkIds( ids, count, "way" );
+    }
+
+    WayNodePool &pool = *frag.m_wayNodePool;
+    pool.m_mapping   = m_file;
+    pool.m_startData = nodeStarts;
+    pool.m_idData    = nodes;
+    pool.m_rows      = count;
+
+    for ( size_t i = 0; i < count; i++ )
+    {
+        OSMWay *way = frag.m_wayArena.create();
+        setBaseData( *way, ids[i], meta[i] );
+        way->setVisible( (meta[i].m_flags & FLAG_VISIBLE) != 0 );
+        way->setPooledTags( frag.m_tagPool, tagSet( tagSets[i] ) );
+        way->setPooledNodes( frag.m_wayNodePool, i );
+        frag.m_ways.insert( std::make_pair( ids[i], way ) );
+    }
+    frag.m_ways.finalise();
+}
+
+void SnapshotLoader::loadRelations( OSMFragment &frag, bool verify )
+{
+    size_t count, memberCount;
+    const dbId_t          *ids          = section<dbId_t>( SECTION_RELATION_IDS, count );
+    const Meta            *meta         = section<Meta>( SECTION_RELATION_META, count, "relation metadata" );
+    const boost::uint32_t *tagSets      = section<boost::uint32_t>( SECTION_RELATION_TAGSETS, count, "relation tag sets" );
+    const boost::uint64_t *memberStarts = section<boost::uint64_t>( SECTION_MEMBER_STARTS, count + 1, "member starts" );
+    const Member          *members      = section<Member>( SECTION_MEMBERS, memberCount );
+
+    checkStarts( memberStarts, count, memberCount, "member" );
+    if ( verify )
+    {
+        checkIds( ids, count, "relation" );
+    }
+
+    for ( size_t i = 0; i < count; i++ )
+    {
+        OSMRelation *relation = frag.m_relationArena.create();
+        setBaseData( *relation, ids[i], meta[i] );
+        relation->setPooledTags( frag.m_tagPool, tagSet( tagSets[i] ) );
+        for ( boost::uint64_t j = memberStarts[i]; j < memberStarts[i + 1]; j++ )
+        {
+            relation->addMember( member_t( string( members[j].m_type ), members[j].m_ref, string( members[j].m_role ) ) );
+        }
+        frag.m_relations.insert( std::make_pair( ids[i], relation ) );
+    }
+    frag.m_relations.finalise();
+}
+
+template<typename T>
+const T *SnapshotLoader::section( section_t id, size_t &count ) const
+{
+    const Section &entry = m_sections[id];
+    if ( entry.m_offset % 8 != 0 || entry.m_offset < tableBytes || entry.m_offset > m_size ||
+        entry.m_size > m_size - entry.m_offset || entry.m_size % sizeof( T ) != 0 )
+    {
+        fail( str( boost::format( "section %d out of bounds" ) % id ) );
+    }
+
+    count = entry.m_size / sizeof( T );
+    return reinterpret_cast<const T *>( m_data + entry.m_offset );
+}
+
+template<typename T>
+const T *SnapshotLoader::section( section_t id, size_t expected, const char *what ) const
+{
+    size_t count;
+    const T *data = section<T>( id, count );
+    if ( count != expected )
+    {
+        fail( str( boost::format( "%d %s, expected %d" ) % count % what % expected ) );
+    }
+    return data;
+}
+
+// That starts[0, count] run from 0 to total without going backwards, so
+// every object's range is inside its array
+template<typename T>
+void SnapshotLoader::checkStarts( const T *starts, size_t count, boost::uint64_t total, const char *what ) const
+{
+    if ( starts[0] != 0 || starts[count] != total )
+    {
+        fail( std::string( what ) + " starts don't cover the array" );
+    }
+    for ( size_t i = 0; i < count; i++ )
+    {
+        if ( starts[i + 1] < starts[i] )
+        {
+            fail( std::string( what ) + " starts out of order" );
+        }
+    }
+}
+
+template<typename T>
+void SnapshotLoader::checkIds( const T *ids, size_t count, const char *what ) const
+{
+    for ( size_t i = 1; i < count; i++ )
+    {
+        if ( ids[i] <= ids[i - 1] )
+        {
+            fail( std::string( what ) + " ids out of order" );
+        }
+    }
+}
+
+std::string SnapshotLoader::string( boost::uint32_t id ) const
+{
+    if ( id >= m_strings )
+    {
+        fail( "string out of range" );
+    }
+    return std::string( m_stringBytes + m_stringStarts[id], m_stringBytes + m_stringStarts[id + 1] );
+}
+
+const ConstTagString &SnapshotLoader::tagString( boost::uint32_t id )
+{
+    if ( id >= m_strings )
+    {
+        fail( "string out of range" );
+    }
+    if ( !m_interned[id] )
+    {
+        m_tagStrings[id] = ConstTagString( string( id ) );
+        m_interned[id] = 1;
+    }
+    return m_tagStrings[id];
+}
+
+tagSetId_t SnapshotLoader::tagSet( boost::uint32_t id ) const
+{
+    if ( id >= m_tagSets.size() )
+    {
+        fail( "tag set out of range" );
+    }
+    return m_tagSets[id];
+}
+
+template<typename ObjectType>
+void SnapshotLoader::setBaseData( ObjectType &object, dbId_t id, const Meta &meta ) const
+{
+    if ( meta.m_user >= m_userIds.size() )
+    {
+        fail( "user out of range" );
+    }
+
+    epochTime_t timestamp = meta.m_timestamp == noTime() ? 0 : meta.m_timestamp;
+    object.setBaseData( id, timestamp, m_userStrings[meta.m_user], m_userIds[meta.m_user] );
+}
+
+
+void writeSnapshot( const OSMFragment &frag, const std::string &fileName )
+{
+    SnapshotWriter writer( fileName );
+    writer.write( frag );
+}
+
+bool isSnapshot( const std::string &fileName )
+{
+    std::ifstream is( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    char magic[sizeof( snapshotMagic )];
+    return is.read( magic, sizeof( magic ) ) && memcmp( magic, snapshotMagic, sizeof( magic ) ) == 0;
+}
+
+void loadSnapshot( const std::string &fileName, OSMFragment &frag, bool verify )
+{
+    SnapshotLoader loader( fileName );
+    loader.load( frag, verify );
+}
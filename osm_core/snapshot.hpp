@@ -0,0 +1,32 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <string>
+
+#include "osm_data.hpp"
+
+// A fragment saved as a binary file that is used in place once memory
+// mapped, rather than parsed: the node columns and the way node lists are
+// read straight from the mapping, so loading a planet takes seconds and
+// processes loading the same file share its pages. Strings, tag sets and
+// ways and relations themselves are still built at load, but from tables
+// (each string and tag set once) rather than from XML.
+//
+// The file is a header, a table of sections and the sections, each 8 byte
+// aligned with its own CRC-32. Values are in the byte order of the machine
+// that wrote it, which the loader checks.
+
+// Objects are written in id order. The fragment's nodes may be in its node
+// map or its node store, but not both.
+void writeSnapshot( const OSMFragment &frag, const std::string &fileName );
+
+// Whether the file starts as a snapshot does; false if it can't be opened
+bool isSnapshot( const std::string &fileName );
+
+// Into a newly made fragment, whose nodes are then columnar and mapped from
+// the file for as long as it lives. With verify, every section's checksum
+// and the ordering of the ids are checked, which reads the whole file once.
+// Throws std::runtime_error if the file isn't a valid snapshot.
+void loadSnapshot( const std::string &fileName, OSMFragment &frag, bool verify = true );
+
+#endif // SNAPSHOT_HPP
@@ -0,0 +1,194 @@
+#include <algorithm>
+
+#include "tag_list.hpp"
+
+namespace
+{
+    struct TagKeyLess
+    {
+        bool operator()( const tag_t &lhs, const ConstTagString &key ) const { return lhs.first < key; }
+        bool operator()( const ConstTagString &key, const tag_t &rhs ) const { return key < rhs.first; }
+    };
+
+    // Below this a linear scan beats the binary search
+    const size_t maxScan = 8;
+
+    const tagSetId_t noSet = 0xffffffff;
+    const size_t initialSlots = 1024;
+
+    // FNV-1a over the string ids
+    boost::uint32_t hashTags( const tag_t *begin, const tag_t *end )
+    {
+        boost::uint32_t hash = 2166136261u;
+        for ( ; begin != end; ++begin )
+        {
+            hash = (hash ^ begin->first.getIndex()) * 16777619u;
+            hash = (hash ^ begin->second.getIndex()) * 16777619u;
+        }
+        return hash;
+    }
+}
+
+
+const tagSetId_t TagPool::emptySet;
+
+TagPool::TagPool() : m_slots( initialSlots, noSet ), m_references( 0 )
+{
+    TagSet empty = { 0, 0 };
+    m_sets.push_back( empty );
+}
+
+size_t TagPool::bytes() const
+{
+    return m_tags.capacity() * sizeof( tag_t ) +
+        m_sets.capacity() * sizeof( TagSet ) +
+        m_slots.capacity() * sizeof( tagSetId_t );
+}
+
+const tag_t *TagPool::begin( tagSetId_t set ) const
+{
+    return m_tags.empty() ? 0 : &m_tags[0] + m_sets[set].m_offset;
+}
+
+tagSetId_t TagPool::intern( const tag_t *first, const tag_t *last )
+{
+    size_t length = last - first;
+    if ( length == 0 )
+    {
+        return emptySet;
+    }
+
+    size_t mask = m_slots.size() - 1;
+    size_t slot = hashTags( first, last ) & mask;
+    for ( ; m_slots[slot] != noSet; slot = (slot + 1) & mask )
+    {
+        tagSetId_t set = m_slots[slot];
+        if ( m_sets[set].m_length == length && std::equal( first, last, begin( set ) ) )
+        {
+            return set;
+        }
+    }
+
+    TagSet newSet = { boost::uint32_t( m_tags.size() ), boost::uint32_t( length ) };
+    m_tags.insert( m_tags.end(), first, last );
+
+    tagSetId_t id = m_sets.size();
+    m_sets.push_back( newSet );
+    m_slots[slot] = id;
+
+    if ( m_sets.size() * 2 > m_slots.size() )
+    {
+        rehash( m_slots.size() * 2 );
+    }
+    return id;
+}
+
+void TagPool::rehash( size_t slots )
+{
+    std::vector<tagSetId_t>( slots, noSet ).swap( m_slots );
+
+    size_t mask = slots - 1;
+    for ( tagSetId_t set = 1; set < m_sets.size(); set++ )
+    {
+        const tag_t *first = begin( set );
+        size_t slot = hashTags( first, first + m_sets[set].m_length ) & mask;
+        while ( m_slots[slot] != noSet )
+        {
+            slot = (slot + 1) & mask;
+        }
+        m_slots[slot] = set;
+    }
+}
+
+
+TagList::const_iterator TagList::begin() const
+{
+    if ( m_pool )
+    {
+        return m_pool->begin( m_setId );
+    }
+    return m_local.empty() ? 0 : &m_local[0];
+}
+
+bool TagList::insert( const tag_t &tag )
+{
+    unpool();
+
+    std::vector<tag_t>::iterator insertIt = std::lower_bound( m_local.begin(), m_local.end(), tag.first, TagKeyLess() );
+    if ( insertIt != m_local.end() && insertIt->first == tag.first )
+    {
+        return false;
+    }
+
+    m_local.insert( insertIt, tag );
+    return true;
+}
+
+void TagList::clear()
+{
+    m_local.clear();
+    m_pool.reset();
+    m_setId = TagPool::emptySet;
+}
+
+TagList::const_iterator TagList::find( const ConstTagString &key ) const
+{
+    const_iterator first = begin();
+    const_iterator last  = end();
+
+    if ( size() <= maxScan )
+    {
+        for ( ; first != last; ++first )
+        {
+            if ( first->first == key )
+            {
+                return first;
+            }
+        }
+        return last;
+    }
+
+    const_iterator findIt = std::lower_bound( first, last, key, TagKeyLess() );
+    return findIt != last && findIt->first == key ? findIt : last;
+}
+
+bool TagList::operator==( const TagList &other ) const
+{
+    if ( m_pool && m_pool == other.m_pool )
+    {
+        return m_setId == other.m_setId;
+    }
+    return size() == other.size() && std::equal( begin(), end(), other.begin() );
+}
+
+void TagList::moveTo( const boost::shared_ptr<TagPool> &pool )
+{
+    if ( m_pool == pool )
+    {
+        return;
+    }
+
+    // Interned before this list lets go of any other pool it is in
+    m_setId = pool->intern( begin(), end() );
+    pool->m_references += pool->length( m_setId );
+    m_pool  = pool;
+    std::vector<tag_t>().swap( m_local );
+}
+
+void TagList::setPooled( const boost::shared_ptr<TagPool> &pool, tagSetId_t set )
+{
+    pool->m_references += pool->length( set );
+    std::vector<tag_t>().swap( m_local );
+    m_pool  = pool;
+    m_setId = set;
+}
+
+void TagList::unpool()
+{
+    if ( m_pool )
+    {
+        std::vector<tag_t>( begin(), end() ).swap( m_local );
+        m_pool.reset();
+        m_setId = TagPool::emptySet;
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef TAG_LIST_HPP
+#define TAG_LIST_HPP
+
+#include <vector>
+#include <utility>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "utils.hpp"
+
+typedef std::pair<ConstTagString, ConstTagString> tag_t;
+typedef boost::uint32_t tagSetId_t;
+
+// The distinct tag sets of a fragment, each held once (see TagList::moveTo).
+// Most ways share their tags with thousands of others, e.g. highway=residential
+// alone or building=yes alone, so a set is looked up by hash before being
+// added. Ids are dense from 0, so per-set results can be kept in a vector.
+class TagPool
+{
+private:
+    friend class TagList;
+
+    struct TagSet
+    {
+        boost::uint32_t m_offset;
+        boost::uint32_t m_length;
+    };
+
+    std::vector<tag_t>      m_tags;
+    std::vector<TagSet>     m_sets;
+    // Open addressing into m_sets: a power of two long, never over half full
+    std::vector<tagSetId_t> m_slots;
+    size_t                  m_references;
+
+public:
+    // Always id 0
+    static const tagSetId_t emptySet = 0;
+
+    TagPool();
+
+    // Tags held, once per distinct set
+    size_t size() const { return m_tags.size(); }
+    size_t sets() const { return m_sets.size(); }
+    // Tags in all the lists moved here: what the pool would hold unshared
+    size_t references() const { return m_references; }
+    size_t bytes() const;
+
+    // The id of the set with these tags, which must be sorted as a TagList
+    // holds them, adding it if new
+    tagSetId_t intern( const tag_t *begin, const tag_t *end );
+
+private:
+    const tag_t *begin( tagSetId_t set ) const;
+    size_t length( tagSetId_t set ) const { return m_sets[set].m_length; }
+    void rehash( size_t slots );
+};
+
+// An object's tags: (key, value) pairs of interned string ids, sorted by key
+// in ConstTagString order and held in one flat array. The array is the
+// object's own while it is being read, and once the object is complete it
+// can be moved into a TagPool shared by the whole fragment, leaving just the
+// id of its set there. Most objects have a handful of tags, so lookups are a
+// scan of a few adjacent pairs rather than a walk down a tree.
+class TagList
+{
+public:
+    typedef tag_t         value_type;
+    typedef const tag_t  *const_iterator;
+    typedef const_iterator iterator;
+
+private:
+    std::vector<tag_t>               m_local;
+    boost::shared_ptr<const TagPool> m_pool;
+    tagSetId_t                       m_setId;
+
+public:
+    TagList() : m_setId( TagPool::emptySet ) {}
+
+    // As std::map::insert: false, and no change, if the key is already there
+    bool insert( const tag_t &tag );
+    void clear();
+
+    const_iterator begin() const;
+    const_iterator end() const { return begin() + size(); }
+    size_t size() const { return m_pool ? m_pool->length( m_setId ) : m_local.size(); }
+    bool empty() const { return size() == 0; }
+
+    // end() if the key isn't there
+    const_iterator find( const ConstTagString &key ) const;
+
+    bool operator==( const TagList &other ) const;
+    bool operator!=( const TagList &other ) const { return !(*this == other); }
+
+    // Share the pool's copy of these tags, adding them if they are new to it,
+    // and free this list's own array. Changing the list afterwards copies the
+    // tags back out first.
+    void moveTo( const boost::shared_ptr<TagPool> &pool );
+    bool isIn( const boost::shared_ptr<TagPool> &pool ) const { return m_pool == pool; }
+    // Refer to a set already interned in the pool
+    void setPooled( const boost::shared_ptr<TagPool> &pool, tagSetId_t set );
+
+    // Null if not moved to a pool. Lists in one pool with equal tags have the
+    // same set id.
+    const TagPool *getPool() const { return m_pool.get(); }
+    tagSetId_t getSetId() const { return m_setId; }
+
+private:
+    void unpool();
+};
+
+#endif // TAG_LIST_HPP
@@ -0,0 +1,138 @@
+#include "timestamp.hpp"
+
+namespace
+{
+    const boost::posix_time::ptime epochStart( boost::gregorian::date( 1970, 1, 1 ) );
+
+    // Read exactly 'digits' decimal digits
+    inline bool readNumber( const char *&p, const char *end, int digits, int &value )
+    {
+        if ( end - p < digits )
+        {
+            return false;
+        }
+
+        value = 0;
+        for ( int i = 0; i < digits; i++, p++ )
+        {
+            if ( *p < '0' || *p > '9' )
+            {
+                return false;
+            }
+            value = value * 10 + (*p - '0');
+        }
+
+        return true;
+    }
+
+    inline bool expect( const char *&p, const char *end, char c )
+    {
+        if ( p == end || *p != c )
+        {
+            return false;
+        }
+        p++;
+        return true;
+    }
+
+    inline bool isLeapYear( int year )
+    {
+        return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    }
+
+    int daysInMonth( int year, int month )
+    {
+        static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        return month == 2 && isLeapYear( year ) ? 29 : days[month - 1];
+    }
+
+    // Days since 1970-01-01 in the proleptic Gregorian calendar
+    boost::int64_t daysFromCivil( int year, int month, int day )
+    {
+        year -= month <= 2;
+        boost::int64_t era = (year >= 0 ? year : year - 399) / 400;
+        boost::int64_t yearOfEra = year - era * 400;
+        boost::int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        boost::int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+        return era * 146097 + dayOfEra - 719468;
+    }
+}
+
+bool parseTimestamp( const char *begin, const char *end, epochTime_t &epoch )
+{
+    const char *p = begin;
+    int year, month, day, hour, minute, second;
+
+    if ( !readNumber( p, end, 4, year ) || !expect( p, end, '-' )
+        || !readNumber( p, end, 2, month ) || !expect( p, end, '-' )
+        || !readNumber( p, end, 2, day ) || !expect( p, end, 'T' )
+        || !readNumber( p, end, 2, hour ) || !expect( p, end, ':' )
+        || !readNumber( p, end, 2, minute ) || !expect( p, end, ':' )
+        || !readNumber( p, end, 2, second ) )
+    {
+        return false;
+    }
+
+    if ( month < 1 || month > 12 || day < 1 || day > daysInMonth( year, month )
+        || hour > 23 || minute > 59 || second > 60 )
+    {
+        return false;
+    }
+
+    if ( p != end && *p == '.' )
+    {
+        for ( p++; p != end && *p >= '0' && *p <= '9'; p++ )
+        {
+        }
+    }
+
+    int offsetSeconds = 0;
+    if ( p != end && *p == 'Z' )
+    {
+        p++;
+    }
+    else if ( p != end && (*p == '+' || *p == '-') )
+    {
+        int sign = *p++ == '-' ? -1 : 1;
+        int offsetHours, offsetMinutes;
+        if ( !readNumber( p, end, 2, offsetHours ) )
+        {
+            return false;
+        }
+        expect( p, end, ':' );
+        if ( !readNumber( p, end, 2, offsetMinutes ) || offsetHours > 23 || offsetMinutes > 59 )
+        {
+            return false;
+        }
+        offsetSeconds = sign * (offsetHours * 3600 + offsetMinutes * 60);
+    }
+
+    if ( p != end )
+    {
+        return false;
+    }
+
+    // Local time minus its offset from UTC
+    epoch = daysFromCivil( year, month, day ) * 86400 + hour * 3600 + minute * 60 + second - offsetSeconds;
+    return true;
+}
+
+boost::posix_time::ptime epochToPtime( epochTime_t epoch )
+{
+    boost::int64_t days = epoch / 86400;
+    boost::int64_t seconds = epoch % 86400;
+    if ( seconds < 0 )
+    {
+        days--;
+        seconds += 86400;
+    }
+
+    return epochStart + boost::gregorian::days( long( days ) ) + boost::posix_time::seconds( long( seconds ) );
+}
+
+epochTime_t ptimeToEpoch( const boost::posix_time::ptime &time )
+{
+    return epochTime_t( (time.date() - epochStart.date()).days() ) * 86400
+        + time.time_of_day().total_seconds();
+}
@@ -0,0 +1,19 @@
+#ifndef TIMESTAMP_HPP
+#define TIMESTAMP_HPP
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Seconds since 1970-01-01T00:00:00Z
+typedef boost::int64_t epochTime_t;
+
+// Parse an OSM timestamp: YYYY-MM-DDTHH:MM:SS, optionally followed by
+// fractional seconds (dropped) and a zone of Z, +HH:MM, -HH:MM or +HHMM. The
+// result is in UTC; no zone is taken as UTC. Doesn't allocate. Returns false
+// if the text isn't in that form.
+bool parseTimestamp( const char *begin, const char *end, epochTime_t &epoch );
+
+boost::posix_time::ptime epochToPtime( epochTime_t epoch );
+epochTime_t ptimeToEpoch( const boost::posix_time::ptime &time );
+
+#endif // TIMESTAMP_HPP
@@ -1,5 +1,9 @@
 #include <cmath>
 #include <iostream>
+#include <algorithm>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <utils.hpp>
 
@@ -21,9 +25,107 @@ double distBetween( double lat1, double lon1, double lat2, double lon2 )
     return dist;
 }
 
-std::vector<std::string>    ConstTagString::m_theStrings;
-size_t                      ConstTagString::m_lastIndex = 0;
-ConstTagString::stringMap_t ConstTagString::m_stringIndexMap;
+namespace
+{
+    struct StringPtrLess
+    {
+        bool operator()( const std::string *lhs, const std::string *rhs ) const
+        {
+            return *lhs < *rhs;
+        }
+    };
+
+    // Keyed by the strings in the table itself, so each is held once
+    typedef std::map<const std::string *, boost::uint32_t, StringPtrLess> stringIndexMap_t;
+
+    // The interned strings, in chunks that are never moved or freed (the
+    // k'th holds firstChunkSize << k), so an index can be read back without
+    // the lock
+    class StringTable
+    {
+    private:
+        static const size_t firstChunkBits = 10;
+        static const size_t maxChunks = 23;
+
+        std::string      *m_chunks[maxChunks];
+        size_t            m_count;
+        stringIndexMap_t  m_indexes;
+
+        static void locate( size_t index, size_t &chunk, size_t &offset )
+        {
+            size_t n = (index >> firstChunkBits) + 1;
+            chunk = 0;
+            while ( n >> (chunk + 1) )
+            {
+                chunk++;
+            }
+            offset = index - (((size_t( 1 ) << chunk) - 1) << firstChunkBits);
+        }
+
+    public:
+        boost::mutex m_mutex;
+
+        StringTable() : m_count( 0 )
+        {
+            std::fill( m_chunks, m_chunks + maxChunks, static_cast<std::string *>( 0 ) );
+        }
+
+        // With m_mutex held
+        boost::uint32_t intern( const std::string &str )
+        {
+            stringIndexMap_t::const_iterator findIt = m_indexes.find( &str );
+            if ( findIt != m_indexes.end() )
+            {
+                return findIt->second;
+            }
+
+            size_t chunk, offset;
+            locate( m_count, chunk, offset );
+            if ( !m_chunks[chunk] )
+            {
+                m_chunks[chunk] = new std::string[size_t( 1 ) << (firstChunkBits + chunk)];
+            }
+
+            std::string &stored = m_chunks[chunk][offset];
+            stored = str;
+            boost::uint32_t index = boost::uint32_t( m_count++ );
+            m_indexes.insert( std::make_pair( &stored, index ) );
+            return index;
+        }
+
+        const std::string &get( size_t index ) const
+        {
+            size_t chunk, offset;
+            locate( index, chunk, offset );
+            return m_chunks[chunk][offset];
+        }
+
+        size_t size() const
+        {
+            return m_count;
+        }
+    };
+
+    // Function statics so that strings can be interned during static initialisation
+    StringTable &stringTable()
+    {
+        static StringTable theTable;
+        return theTable;
+    }
+
+    // Enough for the keys and common values, which are most lookups
+    const size_t maxCachedStrings = 4096;
+
+    stringIndexMap_t &threadStringCache()
+    {
+        static boost::thread_specific_ptr<stringIndexMap_t> theCache;
+        if ( !theCache.get() )
+        {
+            theCache.reset( new stringIndexMap_t() );
+        }
+        return *theCache;
+    }
+}
 
 ConstTagString::ConstTagString()
 {
@@ -53,17 +155,23 @@ ConstTagString &ConstTagString::operator=( const ConstTagString &rhs )
 
 void ConstTagString::assignString( const std::string &str )
 {
-    stringMap_t::iterator findIt = m_stringIndexMap.find( str );
-    
-    if ( findIt == m_stringIndexMap.end() )
+    stringIndexMap_t &cache = threadStringCache();
+    stringIndexMap_t::const_iterator cacheIt = cache.find( &str );
+    if ( cacheIt != cache.end() )
     {
-        m_theStrings.push_back( str );
-        m_stringIndex = m_lastIndex++;
-        m_stringIndexMap.insert( std::make_pair( str, m_stringIndex ) );            
+        m_stringIndex = cacheIt->second;
+        return;
     }
-    else
+
+    StringTable &table = stringTable();
     {
-        m_stringIndex = findIt->second;
+        boost::mutex::scoped_lock lock( table.m_mutex );
+        m_stringIndex = table.intern( str );
+    }
+
+    if ( cache.size() < maxCachedStrings )
+    {
+        cache.insert( std::make_pair( &table.get( m_stringIndex ), m_stringIndex ) );
     }
 }
 
@@ -82,7 +190,14 @@ bool ConstTagString::operator<( const ConstTagString &rhs ) const
 
 std::string ConstTagString::toString() const
 {
-    return m_theStrings[m_stringIndex];
+    return stringTable().get( m_stringIndex );
+}
+
+size_t ConstTagString::numStrings()
+{
+    StringTable &table = stringTable();
+    boost::mutex::scoped_lock lock( table.m_mutex );
+    return table.size();
 }
 
 std::ostream &operator<<( std::ostream &s, const ConstTagString &val )
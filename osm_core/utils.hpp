@@ -5,24 +5,23 @@
 #include <vector>
 #include <string>
 
+#include <boost/cstdint.hpp>
 #include <boost/operators.hpp>
 
 extern const double PI;
 double distBetween( double, double, double, double );
 
 
+// Interned string. Safe to create from several threads: each thread caches
+// a bounded number of the strings it has interned, so the shared table is
+// mostly only locked for new strings. Reading a string back takes no lock.
 class ConstTagString :
     boost::less_than_comparable<ConstTagString,
     boost::equality_comparable<ConstTagString> >
 {
 private:
-    typedef std::map<std::string, size_t> stringMap_t;
-
-    static std::vector<std::string> m_theStrings;
-    static size_t m_lastIndex;
-    static stringMap_t m_stringIndexMap;
-    
-    size_t m_stringIndex;
+    // 32 bits, so a (key, value) pair is 8 bytes
+    boost::uint32_t m_stringIndex;
 
 public:
     ConstTagString();
@@ -34,8 +33,10 @@ public:
     bool operator<( const ConstTagString &rhs ) const;
 
     std::string toString() const;
+    // Unique to the string for the life of the process, e.g. for hashing
+    boost::uint32_t getIndex() const { return m_stringIndex; }
 
-    static size_t numStrings() { return m_stringIndexMap.size(); }
+    static size_t numStrings();
 
 private:
     void assignString( const std::string &str );
@@ -0,0 +1,89 @@
+#include <stdexcept>
+
+#include "way_nodes.hpp"
+
+WayNodePool::WayNodePool() : m_starts( 1, 0 ), m_startData( &m_starts[0] ), m_idData( 0 ), m_rows( 0 )
+{
+}
+
+size_t WayNodePool::bytes() const
+{
+    return m_starts.capacity() * sizeof( boost::uint64_t ) + m_ids.capacity() * sizeof( id_t );
+}
+
+boost::uint32_t WayNodePool::add( const id_t *first, const id_t *last )
+{
+    if ( m_mapping )
+    {
+        throw std::logic_error( "Can't add to a way node pool mapped from a snapshot" );
+    }
+
+    boost::uint32_t newRow = rows();
+    m_ids.insert( m_ids.end(), first, last );
+    m_starts.push_back( m_ids.size() );
+
+    m_startData = &m_starts[0];
+    m_idData    = m_ids.empty() ? 0 : &m_ids[0];
+    m_rows      = m_starts.size() - 1;
+    return newRow;
+}
+
+WayNodePool::nodeRange_t WayNodePool::row( boost::uint32_t row ) const
+{
+    return nodeRange_t( m_idData + m_startData[row], m_idData + m_startData[row + 1] );
+}
+
+
+void WayNodeList::push_back( id_t nodeId )
+{
+    unpool();
+    m_local.push_back( nodeId );
+}
+
+void WayNodeList::clear()
+{
+    m_local.clear();
+    m_pool.reset();
+    m_row = 0;
+}
+
+WayNodeList::nodeRange_t WayNodeList::range() const
+{
+    if ( m_pool )
+    {
+        return m_pool->row( m_row );
+    }
+    const id_t *ids = m_local.empty() ? 0 : &m_local[0];
+    return nodeRange_t( ids, ids + m_local.size() );
+}
+
+void WayNodeList::moveTo( const boost::shared_ptr<WayNodePool> &pool )
+{
+    if ( m_pool == pool )
+    {
+        return;
+    }
+
+    nodeRange_t nodes = range();
+    m_row  = pool->add( nodes.begin(), nodes.end() );
+    m_pool = pool;
+    std::vector<id_t>().swap( m_local );
+}
+
+void WayNodeList::setPooled( const boost::shared_ptr<const WayNodePool> &pool, boost::uint32_t row )
+{
+    std::vector<id_t>().swap( m_local );
+    m_pool = pool;
+    m_row  = row;
+}
+
+void WayNodeList::unpool()
+{
+    if ( m_pool )
+    {
+        nodeRange_t nodes = range();
+        std::vector<id_t>( nodes.begin(), nodes.end() ).swap( m_local );
+        m_pool.reset();
+        m_row = 0;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef WAY_NODES_HPP
+#define WAY_NODES_HPP
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/range/iterator_range.hpp>
+
+// The node lists of every way in a fragment, in compressed sparse row form:
+// one array of node ids end to end and one of where each way's starts. Rows
+// are added in the order ways are pooled, which for a fragment is id order,
+// so building a routing graph or writing the ways out reads both arrays
+// front to back.
+class WayNodePool : boost::noncopyable
+{
+public:
+    typedef boost::uint64_t                       id_t;
+    typedef boost::iterator_range<const id_t *>   nodeRange_t;
+
+private:
+    friend class WayNodeList;
+    friend class SnapshotLoader;
+
+    // m_starts[row] to m_starts[row + 1]. 64 bit, as a planet has more
+    // way nodes than a 32 bit offset reaches.
+    std::vector<boost::uint64_t> m_starts;
+    std::vector<id_t>            m_ids;
+
+    // The arrays rows are read from: the vectors above, or the file of a
+    // snapshot the pool was loaded from, kept open by m_mapping
+    const boost::uint64_t         *m_startData;
+    const id_t                    *m_idData;
+    size_t                         m_rows;
+    boost::shared_ptr<const void>  m_mapping;
+
+public:
+    WayNodePool();
+
+    size_t rows() const { return m_rows; }
+    // Node ids held
+    size_t size() const { return m_startData[m_rows]; }
+    size_t bytes() const;
+
+private:
+    boost::uint32_t add( const id_t *first, const id_t *last );
+    nodeRange_t row( boost::uint32_t row ) const;
+};
+
+// A way's nodes, in order. Like TagList, the way's own array while it is
+// being read, then a row of a WayNodePool once moved there.
+class WayNodeList
+{
+public:
+    typedef WayNodePool::id_t        id_t;
+    typedef WayNodePool::nodeRange_t nodeRange_t;
+
+private:
+    std::vector<id_t>                    m_local;
+    boost::shared_ptr<const WayNodePool> m_pool;
+    boost::uint32_t                      m_row;
+
+public:
+    WayNodeList() : m_row( 0 ) {}
+
+    void push_back( id_t nodeId );
+    void clear();
+
+    nodeRange_t range() const;
+
+    // Append the nodes to the pool and free this list's own array. Changing
+    // the list afterwards copies the nodes back out first.
+    void moveTo( const boost::shared_ptr<WayNodePool> &pool );
+    bool isIn( const boost::shared_ptr<WayNodePool> &pool ) const { return m_pool == pool; }
+    // Refer to a row already in the pool, e.g. one loaded from a snapshot
+    void setPooled( const boost::shared_ptr<const WayNodePool> &pool, boost::uint32_t row );
+
+private:
+    void unpool();
+};
+
+#endif // WAY_NODES_HPP
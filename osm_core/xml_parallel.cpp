@@ -0,0 +1,295 @@
+#include <iostream>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "osm_data.hpp"
+#include "xml_reader.hpp"
+#include "xml_tokenizer.hpp"
+#include "xml_parallel.hpp"
+#include "ingest_filter.hpp"
+
+namespace
+{
+    // Smaller chunks even out the difference in parse speed between nodes and
+    // ways, so that no thread is left with all the slow ones
+    const size_t chunksPerThread = 4;
+
+    // p is at a '<'
+    bool isObjectStart( const char *p, const char *end )
+    {
+        static const char *const names[] = { "node", "way", "relation" };
+
+        for ( size_t i = 0; i < sizeof( names ) / sizeof( names[0] ); i++ )
+        {
+            size_t length = strlen( names[i] );
+            if ( size_t( end - p ) > length + 1 && memcmp( p + 1, names[i], length ) == 0 )
+            {
+                char next = p[length + 1];
+                if ( next == ' ' || next == '\t' || next == '\n' || next == '\r' || next == '/' || next == '>' )
+                {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    const char *findObjectStart( const char *p, const char *end )
+    {
+        while ( p < end )
+        {
+            p = static_cast<const char *>( memchr( p, '<', end - p ) );
+            if ( !p )
+            {
+                return end;
+            }
+            if ( isObjectStart( p, end ) )
+            {
+                return p;
+            }
+            p++;
+        }
+
+        return end;
+    }
+
+    // The </osm> end tag, normally a few bytes from the end
+    const char *findBodyEnd( const char *begin, const char *end )
+    {
+        static const char endTag[] = "</osm";
+        const size_t length = sizeof( endTag ) - 1;
+
+        for ( const char *p = end; size_t( p - begin ) >= length; )
+        {
+            p--;
+            if ( *p == '<' && size_t( end - p ) >= length && memcmp( p, endTag, length ) == 0 )
+            {
+                return p;
+            }
+        }
+
+        return end;
+    }
+
+
+    // Parses the chunks on a pool of threads, one partial fragment per chunk
+    class ChunkParser
+    {
+    private:
+        const char                                 *m_fileBegin;
+        const std::vector<const char *>            &m_boundaries;
+        const IngestFilter                         *m_filter;
+        std::vector<boost::shared_ptr<OSMFragment> > m_fragments;
+
+        boost::mutex                                m_mutex;
+        size_t                                      m_nextChunk;
+        std::string                                 m_error;
+
+    public:
+        ChunkParser( const char *fileBegin, const std::vector<const char *> &boundaries, const IngestFilter *filter, bool dropMetadata ) :
+            m_fileBegin( fileBegin ),
+            m_boundaries( boundaries ),
+            m_filter( filter ),
+            m_nextChunk( 0 )
+        {
+            for ( size_t i = 0; i + 1 < m_boundaries.size(); i++ )
+            {
+                m_fragments.push_back( boost::shared_ptr<OSMFragment>( new OSMFragment() ) );
+                m_fragments.back()->setDropMetadata( dropMetadata );
+            }
+        }
+
+        void run( size_t numThreads )
+        {
+            boost::thread_group threads;
+            for ( size_t i = 0; i < numThreads; i++ )
+            {
+                threads.create_thread( boost::bind( &ChunkParser::parseChunks, this ) );
+            }
+            threads.join_all();
+
+            if ( !m_error.empty() )
+            {
+                throw XmlParseException( m_error );
+            }
+        }
+
+        // In file order, freeing each partial as it goes
+        void mergeInto( OSMFragment &frag )
+        {
+            for ( size_t i = 0; i < m_fragments.size(); i++ )
+            {
+                frag.merge( *m_fragments[i] );
+                m_fragments[i].reset();
+            }
+        }
+
+    private:
+        void parseChunks()
+        {
+            while ( true )
+            {
+                size_t chunk;
+                {
+                    boost::mutex::scoped_lock lock( m_mutex );
+                    if ( m_nextChunk == m_fragments.size() || !m_error.empty() )
+                    {
+                        return;
+                    }
+                    chunk = m_nextChunk++;
+                }
+
+                try
+                {
+                    parseChunk( chunk );
+                }
+                catch ( const std::exception &e )
+                {
+                    boost::mutex::scoped_lock lock( m_mutex );
+                    if ( m_error.empty() )
+                    {
+                        m_error = boost::str( boost::format( "In chunk at byte %d: %s" )
+                            % (m_boundaries[chunk] - m_fileBegin) % e.what() );
+                    }
+                }
+            }
+        }
+
+        void parseChunk( size_t chunk )
+        {
+            OSMFragment &fragment = *m_fragments[chunk];
+            if ( m_filter )
+            {
+                fragment.setFilter( *m_filter );
+            }
+
+            // Stands in for the <osm> element, which is open for the whole chunk
+            boost::shared_ptr<XMLNodeData> osmNdData( new XMLNodeData() );
+            fragment.registerObjects( *osmNdData );
+
+            RawXMLReader handler( osmNdData );
+            RawXMLTokenizer tokenizer( m_boundaries[chunk], m_boundaries[chunk + 1] );
+            tokenizer.parse( handler );
+
+            if ( handler.depth() != 1 )
+            {
+                throw XmlParseException( "Chunk ends inside an element" );
+            }
+        }
+    };
+}
+
+
+void findChunkBoundaries( const char *begin, const char *end, size_t chunkCount, std::vector<const char *> &boundaries )
+{
+    boundaries.clear();
+
+    const char *bodyBegin = findObjectStart( begin, end );
+    const char *bodyEnd   = findBodyEnd( bodyBegin, end );
+    boundaries.push_back( bodyBegin );
+
+    size_t length = bodyEnd - bodyBegin;
+    for ( size_t i = 1; i < chunkCount; i++ )
+    {
+        const char *target = bodyBegin + length / chunkCount * i;
+        if ( target <= boundaries.back() )
+        {
+            continue;
+        }
+
+        const char *split = findObjectStart( target, bodyEnd );
+        if ( split == bodyEnd )
+        {
+            break;
+        }
+        boundaries.push_back( split );
+    }
+
+    boundaries.push_back( bodyEnd );
+}
+
+void readOSMXMLParallel( const std::string &fileName, OSMFragment &frag, const ReadOptions &options )
+{
+    ReadOptions sequential( options );
+    sequential.m_parseThreads = 1;
+
+    const IngestFilter *filter = frag.getFilter();
+    if ( filter && filter->hasBounds() )
+    {
+        std::cout << "Bounding box filter needs nodes before ways: reading on one thread" << std::endl;
+        readOSMXMLRaw( fileName, frag, sequential );
+        return;
+    }
+
+    if ( frag.getNodeLocations() )
+    {
+        std::cout << "Node location store is filled from one thread: reading on one thread" << std::endl;
+        readOSMXMLRaw( fileName, frag, sequential );
+        return;
+    }
+
+    struct stat fileStat;
+    if ( stat( fileName.c_str(), &fileStat ) != 0 )
+    {
+        throw std::runtime_error( "Unable to open file: " + fileName );
+    }
+    if ( fileStat.st_size == 0 )
+    {
+        readOSMXMLRaw( fileName, frag, sequential );
+        return;
+    }
+
+    boost::iostreams::mapped_file_source file( fileName );
+    const char *begin = file.data();
+    const char *end   = begin + file.size();
+
+    if ( file.size() >= 3 && begin[0] == 'B' && begin[1] == 'Z' && begin[2] == 'h' )
+    {
+        std::cout << "Compressed input can't be split: reading on one thread" << std::endl;
+        file.close();
+        readOSMXMLRaw( fileName, frag, sequential );
+        return;
+    }
+
+    std::cout << "Reading XML file (" << options.m_parseThreads << " threads): " << fileName << std::endl;
+
+    std::vector<const char *> boundaries;
+    findChunkBoundaries( begin, end, options.m_parseThreads * chunksPerThread, boundaries );
+
+    // The document up to the first object: the <osm> attributes and <bounds>.
+    // With no objects at all that is the whole document.
+    boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+    startNdData->registerMembers()( "osm", boost::bind( &OSMFragment::build, &frag, _1 ) );
+    RawXMLReader handler( startNdData );
+
+    bool emptyBody = boundaries.front() == boundaries.back();
+    RawXMLTokenizer header( begin, emptyBody ? end : boundaries.front() );
+    header.parse( handler );
+
+    if ( !emptyBody )
+    {
+        ChunkParser parser( begin, boundaries, filter, frag.dropsMetadata() );
+        parser.run( options.m_parseThreads );
+        parser.mergeInto( frag );
+
+        // The rest from </osm>, whose end finishes the fragment
+        RawXMLTokenizer trailer( boundaries.back(), end );
+        trailer.parse( handler );
+    }
+
+    if ( !handler.complete() )
+    {
+        throw XmlParseException( "Input ends before </osm>" );
+    }
+
+    std::cout << "Done..." << std::endl;
+}
@@ -0,0 +1,27 @@
+#ifndef XML_PARALLEL_HPP
+#define XML_PARALLEL_HPP
+
+#include <string>
+#include <vector>
+
+class OSMFragment;
+struct ReadOptions;
+
+// Split the body of an OSM XML document (everything after the <osm> start tag
+// up to </osm>) into about chunkCount ranges, each starting at a top level
+// <node, <way or <relation. As '<' can't appear unescaped in attribute values,
+// any '<node' etc. is the start of an element. Comments and CDATA containing
+// those are not expected in OSM files.
+//
+// boundaries gets the start of the first object, each split point and the end
+// of the body, so the chunks are [boundaries[i], boundaries[i+1]).
+void findChunkBoundaries( const char *begin, const char *end, size_t chunkCount, std::vector<const char *> &boundaries );
+
+// Read an uncompressed OSM XML file on options.m_parseThreads threads. The
+// file is mapped into memory and split with findChunkBoundaries; each thread
+// parses chunks into its own OSMFragment, and those are then merged into frag.
+// Compressed files, and filters with a bounding box (which need the nodes
+// before the ways), are read on one thread instead.
+void readOSMXMLParallel( const std::string &fileName, OSMFragment &frag, const ReadOptions &options );
+
+#endif // XML_PARALLEL_HPP
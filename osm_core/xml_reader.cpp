@@ -1,8 +1,10 @@
 #include <fstream>
+#include <stdexcept>
 #include <iostream>
 
+#include <sys/stat.h>
+
 #include <boost/format.hpp>
-#include <boost/regex.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -10,6 +12,7 @@
 
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <xercesc/util/PlatformUtils.hpp>
 #include <xercesc/sax2/DefaultHandler.hpp>
@@ -17,6 +20,11 @@
 #include <xercesc/sax2/XMLReaderFactory.hpp>
 
 #include "osm_data.hpp"
+#include "timestamp.hpp"
+#include "bzip2_parallel.hpp"
+#include "read_ahead.hpp"
+#include "pbf_reader.hpp"
+#include "xml_tokenizer.hpp"
 
 std::string escapeChars( std::string toEscape )
 {
@@ -56,36 +64,15 @@ void extended_lexical_cast( const std::string &val, bool &var )
     }
 }
 
-const boost::regex dateRegex( "(\\d{4})-(\\d{2})-(\\d{2})T(\\d{2}):(\\d{2}):(\\d{2})" );//([\\+-]\\d{2}):(\\d{2})?" );
-
 void extended_lexical_cast( const std::string &val, boost::posix_time::ptime &var )
 {
-    boost::smatch match;
-    if ( boost::regex_search( val, match, dateRegex ) )
-    {
-         var = boost::posix_time::ptime(
-             boost::gregorian::date(
-                 boost::lexical_cast<int>( match[1] ),
-                 boost::lexical_cast<int>( match[2] ),
-                 boost::lexical_cast<int>( match[3] ) ),
-             boost::posix_time::time_duration(
-                 boost::lexical_cast<int>( match[4] ),
-                 boost::lexical_cast<int>( match[5] ),
-                 boost::lexical_cast<int>( match[6] ) ) );
-
-//          boost::posix_time::time_duration offset(
-//              boost::lexical_cast<int>( match[7] ),
-//              boost::lexical_cast<int>( match[8] ),
-//              0 );
-
-         // TODO: Surely we should be adding this offset? But it doesn't seem to work...
-         //var += offset;
-    }
-    else
+    epochTime_t epoch;
+    if ( !parseTimestamp( val.data(), val.data() + val.size(), epoch ) )
     {
-        std::cout << "Match failed for "<< val << std::endl;
         throw boost::bad_lexical_cast();
     }
+
+    var = epochToPtime( epoch );
 }
 
 
@@ -107,19 +94,54 @@ xercesc::SAX2XMLReaderImpl &XercesInitWrapper::getParser()
     return *m_parser;
 }
 
-XMLMemberRegistration::XMLMemberRegistration( nodeBuildFnMap_t &nodeFnBuildMap ) : m_nodeFnBuildMap( nodeFnBuildMap )
+XMLMemberRegistration::XMLMemberRegistration( nodeBuildFnMap_t &nodeFnBuildMap, nodeBuildFn_t *elementFns ) :
+    m_nodeFnBuildMap( nodeFnBuildMap ),
+    m_elementFns( elementFns )
 {
 }
 
 XMLMemberRegistration &XMLMemberRegistration::operator()( const std::string &memberName, nodeBuildFn_t callBackFn )
 {
+    elementId_t member = lookupElement( memberName.data(), memberName.size() );
+    if ( member != ELEM_UNKNOWN )
+    {
+        return (*this)( member, callBackFn );
+    }
+
     m_nodeFnBuildMap.insert( std::make_pair( memberName, callBackFn ) );
 
     return *this;
 }
 
-XMLNodeAttributeMap::XMLNodeAttributeMap( const xercesc::Attributes &attributes )
+XMLMemberRegistration &XMLMemberRegistration::operator()( elementId_t member, nodeBuildFn_t callBackFn )
+{
+    if ( !m_elementFns[member] )
+    {
+        m_elementFns[member].swap( callBackFn );
+    }
+
+    return *this;
+}
+
+XMLNodeAttributeMap::XMLNodeAttributeMap( const xercesc::Attributes &attributes ) :
+    m_rawAttributes( 0 ),
+    m_schemaResolved( false )
+{
+    for ( size_t i = 0; i < attributes.getLength(); i++ )
+    {
+        std::string key   = transcodeString( attributes.getLocalName( i ) );
+        std::string value = transcodeString( attributes.getValue( i ) );
+
+        m_attributes.insert( std::make_pair( key, value ) );
+    }
+}
+
+void XMLNodeAttributeMap::reset( const xercesc::Attributes &attributes )
 {
+    m_attributes.clear();
+    m_rawAttributes = 0;
+    m_schemaResolved = false;
+
     for ( size_t i = 0; i < attributes.getLength(); i++ )
     {
         std::string key   = transcodeString( attributes.getLocalName( i ) );
@@ -129,15 +151,72 @@ XMLNodeAttributeMap::XMLNodeAttributeMap( const xercesc::Attributes &attributes
     }
 }
 
-XMLNodeData::XMLNodeData() : m_memberRegistration( m_nodeFnBuildMap )
+void XMLNodeAttributeMap::reset( const rawAttributes_t &attributes )
+{
+    m_attributes.clear();
+    m_rawAttributes = &attributes;
+    m_schemaResolved = false;
+}
+
+XMLNodeAttributeMap::XMLNodeAttributeMap( const rawAttributes_t &attributes ) :
+    m_rawAttributes( &attributes ),
+    m_schemaResolved( false )
+{
+}
+
+const SchemaAttributes *XMLNodeAttributeMap::schemaAttributes()
+{
+    if ( !m_rawAttributes )
+    {
+        return 0;
+    }
+
+    if ( !m_schemaResolved )
+    {
+        m_schemaAttributes.assign( *m_rawAttributes );
+        m_schemaResolved = true;
+    }
+
+    return &m_schemaAttributes;
+}
+
+XMLNodeData::XMLNodeData() : m_memberRegistration( m_nodeFnBuildMap, m_elementFns )
 {
 }
 
 
 XMLNodeData::XMLNodeData( const xercesc::Attributes &attributes ) :
     m_nodeAttributeMap( attributes ),
-    m_memberRegistration( m_nodeFnBuildMap )
+    m_memberRegistration( m_nodeFnBuildMap, m_elementFns )
+{
+}
+
+XMLNodeData::XMLNodeData( const rawAttributes_t &attributes ) :
+    m_nodeAttributeMap( attributes ),
+    m_memberRegistration( m_nodeFnBuildMap, m_elementFns )
+{
+}
+
+void XMLNodeData::reset( const xercesc::Attributes &attributes )
+{
+    m_nodeAttributeMap.reset( attributes );
+    clearMembers();
+}
+
+void XMLNodeData::reset( const rawAttributes_t &attributes )
 {
+    m_nodeAttributeMap.reset( attributes );
+    clearMembers();
+}
+
+void XMLNodeData::clearMembers()
+{
+    m_endFn.clear();
+    m_nodeFnBuildMap.clear();
+    for ( size_t i = 0; i < ELEM_COUNT; i++ )
+    {
+        m_elementFns[i].clear();
+    }
 }
 
 XMLNodeAttributeMap &XMLNodeData::readAttributes()
@@ -145,13 +224,36 @@ XMLNodeAttributeMap &XMLNodeData::readAttributes()
     return m_nodeAttributeMap;
 }
 
+const SchemaAttributes *XMLNodeData::schemaAttributes()
+{
+    return m_nodeAttributeMap.schemaAttributes();
+}
+
 XMLMemberRegistration &XMLNodeData::registerMembers()
 {
     return m_memberRegistration;
 }
 
+void XMLNodeData::registerEnd( nodeEndFn_t endFn )
+{
+    m_endFn.swap( endFn );
+}
+
+void XMLNodeData::end()
+{
+    if ( m_endFn )
+    {
+        m_endFn();
+    }
+}
+
 nodeBuildFn_t XMLNodeData::getBuildFnFor( const std::string &nodeName )
 {
+    if ( const nodeBuildFn_t *buildFn = findBuildFn( lookupElement( nodeName.data(), nodeName.size() ) ) )
+    {
+        return *buildFn;
+    }
+
     nodeBuildFnMap_t::iterator findIt = m_nodeFnBuildMap.find( nodeName );
         
     if ( findIt == m_nodeFnBuildMap.end() )
@@ -163,9 +265,8 @@ nodeBuildFn_t XMLNodeData::getBuildFnFor( const std::string &nodeName )
     return findIt->second;
 }
 
-XMLReader::XMLReader( boost::shared_ptr<XMLNodeData> startNode )
+XMLReader::XMLReader( boost::shared_ptr<XMLNodeData> startNode ) : m_buildStack( startNode )
 {
-    m_buildStack.push_back( startNode );
 }
     
 void XMLReader::startElement(
@@ -174,11 +275,20 @@ void XMLReader::startElement(
     const XMLCh *const qame,
     const xercesc::Attributes &attributes )
 {
-    std::string tagName = transcodeString( localname );
-    nodeBuildFn_t buildFn = m_buildStack.back()->getBuildFnFor( tagName );
+    const nodeBuildFn_t *buildFn = m_buildStack.top().findBuildFn(
+        lookupElement( localname, xercesc::XMLString::stringLen( localname ) ) );
 
-    m_buildStack.push_back( boost::shared_ptr<XMLNodeData>( new XMLNodeData( attributes ) ) );
-    buildFn( *(m_buildStack.back().get()) );
+    if ( !buildFn )
+    {
+        // Not one of the known elements: go by name
+        nodeBuildFn_t namedFn = m_buildStack.top().getBuildFnFor( transcodeString( localname ) );
+        namedFn( m_buildStack.push( attributes ) );
+        return;
+    }
+
+    // The parent frame stays put while the child is built, so the handler can
+    // be called where it is
+    (*buildFn)( m_buildStack.push( attributes ) );
 }
 
 void XMLReader::endElement(
@@ -186,7 +296,8 @@ void XMLReader::endElement(
     const XMLCh *const localname,
     const XMLCh *const qname )
 {
-    m_buildStack.pop_back();
+    m_buildStack.top().end();
+    m_buildStack.pop();
 }
 
 
@@ -226,8 +337,73 @@ void XMLReader::fatalError( const xercesc::SAXParseException &e )
 }
 
 
-void readOSMXML( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag )
+ReadOptions::ReadOptions() :
+    m_decompressThreads( boost::thread::hardware_concurrency() ),
+    m_useXerces( false ),
+    m_pipelined( false ),
+    m_parseThreads( 1 ),
+    m_readAheadBuffers( 4 )
+{
+}
+
+void openOSMInput(
+    const std::string &fileName,
+    std::ifstream &is,
+    boost::iostreams::filtering_istream &in,
+    const ReadOptions &options )
 {
+    is.open( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    if ( !is )
+    {
+        throw std::runtime_error( "Unable to open file: " + fileName );
+    }
+
+    // Sniff the bzip2 stream header so that plain XML can be read too
+    char magic[3] = { 0, 0, 0 };
+    is.read( magic, sizeof( magic ) );
+    is.clear();
+    is.seekg( 0 );
+
+    bool compressed = magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h';
+    if ( compressed && options.m_decompressThreads > 1 )
+    {
+        in.push( ParallelBzip2Source( is, options.m_decompressThreads ) );
+    }
+    else
+    {
+        if ( compressed )
+        {
+            in.push( boost::iostreams::bzip2_decompressor() );
+        }
+
+        // pread needs a regular file, not a pipe
+        struct stat fileStat;
+        if ( options.m_readAheadBuffers > 0 && stat( fileName.c_str(), &fileStat ) == 0 && S_ISREG( fileStat.st_mode ) )
+        {
+            is.close();
+            in.push( ReadAheadSource( fileName, options.m_readAheadBuffers ) );
+        }
+        else
+        {
+            in.push( is );
+        }
+    }
+
+    // Let decompression errors through rather than looking like end of file
+    in.exceptions( std::ios_base::badbit );
+}
+
+void readOSMXML( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag, const ReadOptions &options )
+{
+    if ( options.m_pipelined )
+    {
+        throw std::logic_error( "Only the raw XML reader can be pipelined" );
+    }
+    if ( options.m_parseThreads > 1 )
+    {
+        throw std::logic_error( "Only the raw XML reader can parse on several threads" );
+    }
+
     std::cout << "Reading XML file: " << fileName << std::endl;
 
     xercesc::SAX2XMLReaderImpl &parser = x.getParser();
@@ -241,10 +417,9 @@ void readOSMXML( XercesInitWrapper &x, const std::string &fileName, OSMFragment
     parser.setContentHandler( &handler );
     parser.setErrorHandler( &handler );
 
-    std::ifstream is( fileName.c_str(), std::ios_base::in | std::ios_base::binary );
+    std::ifstream is;
     boost::iostreams::filtering_istream in;
-    in.push( boost::iostreams::bzip2_decompressor() );
-    in.push( is );
+    openOSMInput( fileName, is, in, options );
 
     StreamIS sis( in );
     parser.parse( sis );
@@ -252,3 +427,19 @@ void readOSMXML( XercesInitWrapper &x, const std::string &fileName, OSMFragment
     std::cout << "Done..." << std::endl;
 }
 
+void readOSMFile( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag, const ReadOptions &options )
+{
+    if ( isOSMPBF( fileName ) )
+    {
+        readOSMPBF( fileName, frag, options );
+    }
+    else if ( options.m_useXerces )
+    {
+        readOSMXML( x, fileName, frag, options );
+    }
+    else
+    {
+        readOSMXMLRaw( fileName, frag, options );
+    }
+}
+
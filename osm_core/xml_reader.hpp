@@ -4,13 +4,16 @@
 #include <string>
 #include <map>
 #include <deque>
+#include <vector>
 #include <iostream>
+#include <fstream>
 
 #include <boost/function.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 
 #include <xercesc/sax2/Attributes.hpp>
 #include <xercesc/sax2/DefaultHandler.hpp>
@@ -18,6 +21,9 @@
 #include <xercesc/parsers/SAX2XMLReaderImpl.hpp>
 #include <xercesc/util/BinInputStream.hpp>
 
+#include "xml_tokenizer.hpp"
+#include "xml_schema.hpp"
+
 typedef std::map<std::string, std::string> attributeMap_t;
 
 std::string escapeChars( std::string toEscape );
@@ -37,16 +43,20 @@ public:
 class XMLNodeData;
 
 typedef boost::function<void(XMLNodeData &)> nodeBuildFn_t;
+typedef boost::function<void()> nodeEndFn_t;
 typedef std::map<std::string, nodeBuildFn_t> nodeBuildFnMap_t;
 
 class XMLMemberRegistration
 {
 private:
     nodeBuildFnMap_t &m_nodeFnBuildMap;
+    nodeBuildFn_t    *m_elementFns;
 
 public:
-    XMLMemberRegistration( nodeBuildFnMap_t &nodeFnBuildMap );
+    XMLMemberRegistration( nodeBuildFnMap_t &nodeFnBuildMap, nodeBuildFn_t *elementFns );
+    // Known element names are resolved here, once, to their elementId_t
     XMLMemberRegistration &operator()( const std::string &memberName, nodeBuildFn_t callBackFn );
+    XMLMemberRegistration &operator()( elementId_t member, nodeBuildFn_t callBackFn );
 };
 
 
@@ -55,9 +65,24 @@ class XMLNodeAttributeMap
 private:
     attributeMap_t m_attributes;
 
+    // Set when built from the raw tokenizer: the attributes are only valid
+    // while the build function for this element runs
+    const rawAttributes_t *m_rawAttributes;
+
+    // Raw attributes by id, filled on first use
+    SchemaAttributes       m_schemaAttributes;
+    bool                   m_schemaResolved;
+
 public:
-    XMLNodeAttributeMap() {}
+    XMLNodeAttributeMap() : m_rawAttributes( 0 ), m_schemaResolved( false ) {}
     XMLNodeAttributeMap( const xercesc::Attributes &attributes );
+    XMLNodeAttributeMap( const rawAttributes_t &attributes );
+
+    // Null unless built from the raw tokenizer
+    const SchemaAttributes *schemaAttributes();
+
+    void reset( const xercesc::Attributes &attributes );
+    void reset( const rawAttributes_t &attributes );
 
     template<typename T>
     XMLNodeAttributeMap &operator()( const std::string &tagName, T &var, bool optional=false, T defaultValue=T() );
@@ -70,16 +95,44 @@ private:
     XMLNodeAttributeMap   m_nodeAttributeMap;
     XMLMemberRegistration m_memberRegistration;
     nodeBuildFnMap_t      m_nodeFnBuildMap;
+    // Build functions for the known elements, indexed by elementId_t
+    nodeBuildFn_t         m_elementFns[ELEM_COUNT];
+    nodeEndFn_t           m_endFn;
 
 public:
     XMLNodeData();
     XMLNodeData( const xercesc::Attributes &attributes );
+    XMLNodeData( const rawAttributes_t &attributes );
+
+    // Reinitialise a pooled frame for a new element
+    void reset( const xercesc::Attributes &attributes );
+    void reset( const rawAttributes_t &attributes );
+
     XMLNodeAttributeMap &readAttributes();
+    // Fast path for the raw tokenizer: attributes by id, decoded without
+    // allocating. Null when the element came from Xerces.
+    const SchemaAttributes *schemaAttributes();
     XMLMemberRegistration &registerMembers();
+    // Called once the element and all its children have been read
+    void registerEnd( nodeEndFn_t endFn );
+    void end();
     nodeBuildFn_t getBuildFnFor( const std::string &nodeName );
+    // No string work and no copy. Null if nothing is registered for the id.
+    const nodeBuildFn_t *findBuildFn( elementId_t id ) const
+    {
+        return id < ELEM_COUNT && m_elementFns[id] ? &m_elementFns[id] : 0;
+    }
 
     void dumpRegMap()
     {
+        for ( size_t i = 0; i < ELEM_COUNT; i++ )
+        {
+            if ( m_elementFns[i] )
+            {
+                std::cout << "Member: " << elementName( elementId_t( i ) ) << std::endl;
+            }
+        }
+
         nodeBuildFnMap_t::iterator it;
         for ( it = m_nodeFnBuildMap.begin(); it != m_nodeFnBuildMap.end(); it++ )
         {
@@ -90,12 +143,56 @@ public:
     ~XMLNodeData()
     {
     }
+
+private:
+    void clearMembers();
+};
+
+
+// The open elements of a parse, innermost last. Frames are kept when an element
+// closes and reused for the next element at the same depth, so once the parse
+// has been to its deepest level no more are allocated.
+class XMLFrameStack
+{
+private:
+    std::vector<boost::shared_ptr<XMLNodeData> > m_frames;
+    size_t                                       m_depth;
+
+public:
+    XMLFrameStack( boost::shared_ptr<XMLNodeData> startNode ) : m_depth( 1 )
+    {
+        m_frames.push_back( startNode );
+    }
+
+    XMLNodeData &top() { return *m_frames[m_depth - 1]; }
+    size_t depth() const { return m_depth; }
+
+    template<typename AttributesT>
+    XMLNodeData &push( const AttributesT &attributes )
+    {
+        if ( m_depth == m_frames.size() )
+        {
+            m_frames.push_back( boost::shared_ptr<XMLNodeData>( new XMLNodeData( attributes ) ) );
+        }
+        else
+        {
+            m_frames[m_depth]->reset( attributes );
+        }
+        m_depth++;
+
+        return top();
+    }
+
+    void pop()
+    {
+        m_depth--;
+    }
 };
 
 class XMLReader : public xercesc::DefaultHandler
 {
 private:
-    std::deque<boost::shared_ptr<XMLNodeData> > m_buildStack;
+    XMLFrameStack m_buildStack;
 
 public:
     XMLReader( boost::shared_ptr<XMLNodeData> startNode );
@@ -145,6 +242,42 @@ void extended_lexical_cast( const std::string &val, boost::posix_time::ptime &va
 template<typename T>
 XMLNodeAttributeMap &XMLNodeAttributeMap::operator()( const std::string &tagName, T &var, bool optional, T defaultValue )
 {
+    if ( m_rawAttributes )
+    {
+        rawAttributes_t::const_iterator rawIt = m_rawAttributes->begin();
+        for ( ; rawIt != m_rawAttributes->end(); rawIt++ )
+        {
+            if ( rawIt->m_name == tagName )
+            {
+                break;
+            }
+        }
+
+        if ( rawIt == m_rawAttributes->end() )
+        {
+            if ( !optional )
+            {
+                throw XmlParseException( "Error: missing attribute: " + tagName );
+            }
+            var = defaultValue;
+        }
+        else
+        {
+            try
+            {
+                extended_lexical_cast( rawIt->m_value, var );
+            }
+            catch ( std::exception &e )
+            {
+                std::cerr << "Trying to cast tag: " << tagName << " with value " << rawIt->m_value;
+                std::cerr << " to type " << typeid( var ).name() << std::endl;
+                throw ;
+            }
+        }
+
+        return *this;
+    }
+
     attributeMap_t::iterator findIt = m_attributes.find( tagName );
     if ( findIt == m_attributes.end() )
     {
@@ -177,7 +310,40 @@ XMLNodeAttributeMap &XMLNodeAttributeMap::operator()( const std::string &tagName
 
 class OSMFragment;
 
-void readOSMXML( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag );
+// Tuning for the OSM file readers
+struct ReadOptions
+{
+    // Threads used to inflate bzip2 blocks. 0 or 1 uses the single threaded
+    // boost decompressor
+    size_t m_decompressThreads;
+    // Parse XML with Xerces rather than the raw tokenizer, e.g. for input
+    // in an encoding other than UTF-8
+    bool   m_useXerces;
+    // Decompress, tokenize and build on separate threads (raw reader only)
+    bool   m_pipelined;
+    // Threads parsing chunks of an uncompressed file at once (raw reader
+    // only). 0 or 1 parses the file as one stream.
+    size_t m_parseThreads;
+    // Buffers read ahead of the parser on an I/O thread, for plain XML and
+    // the single threaded decompressor (the parallel one reads ahead
+    // already). 0 reads the file synchronously.
+    size_t m_readAheadBuffers;
+
+    ReadOptions();
+};
+
+// Open an OSM XML file, adding a bzip2 decompressor if the file is compressed
+void openOSMInput(
+    const std::string &fileName,
+    std::ifstream &is,
+    boost::iostreams::filtering_istream &in,
+    const ReadOptions &options = ReadOptions() );
+// With Xerces. Throws std::logic_error if the options ask for what only the
+// raw reader does (m_pipelined, m_parseThreads).
+void readOSMXML( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag, const ReadOptions &options = ReadOptions() );
+// Reads OSM XML, with the raw tokenizer (readOSMXMLRaw) unless m_useXerces,
+// or OSM PBF (told apart by its content)
+void readOSMFile( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag, const ReadOptions &options = ReadOptions() );
 
 
 class StreamIS : public xercesc::InputSource
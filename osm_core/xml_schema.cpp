@@ -0,0 +1,379 @@
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "xml_reader.hpp"
+#include "xml_schema.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    const char *elementNames[ELEM_COUNT] =
+    {
+        "osm",
+        "bounds",
+        "node",
+        "way",
+        "relation",
+        "tag",
+        "nd",
+        "member"
+    };
+
+    const char *attributeNames[ATTR_COUNT] =
+    {
+        "id",
+        "lat",
+        "lon",
+        "timestamp",
+        "user",
+        "uid",
+        "visible",
+        "version",
+        "changeset",
+        "k",
+        "v",
+        "ref",
+        "type",
+        "role",
+        "generator",
+        "minlat",
+        "minlon",
+        "maxlat",
+        "maxlon"
+    };
+
+    const size_t hashTableSize = 32;
+
+    // Constants picked so that the names above don't collide
+    inline size_t attributeHash( const char *name, size_t length )
+    {
+        unsigned char first  = name[0];
+        unsigned char second = length > 1 ? name[1] : 0;
+        unsigned char last   = name[length - 1];
+
+        return (length * 5 + first * 2 + second * 17 + last) & (hashTableSize - 1);
+    }
+
+    class AttributeHashTable
+    {
+    private:
+        attributeId_t m_slots[hashTableSize];
+        size_t        m_lengths[ATTR_COUNT];
+
+    public:
+        AttributeHashTable()
+        {
+            for ( size_t i = 0; i < hashTableSize; i++ )
+            {
+                m_slots[i] = ATTR_UNKNOWN;
+            }
+
+            for ( size_t i = 0; i < ATTR_COUNT; i++ )
+            {
+                m_lengths[i] = strlen( attributeNames[i] );
+                size_t slot = attributeHash( attributeNames[i], m_lengths[i] );
+                if ( m_slots[slot] != ATTR_UNKNOWN )
+                {
+                    throw std::logic_error( std::string( "Attribute hash collision: " ) + attributeNames[i] );
+                }
+                m_slots[slot] = attributeId_t( i );
+            }
+        }
+
+        attributeId_t lookup( const char *name, size_t length ) const
+        {
+            if ( length == 0 )
+            {
+                return ATTR_UNKNOWN;
+            }
+
+            attributeId_t id = m_slots[attributeHash( name, length )];
+            // Lengths first, so the compare stays within the name
+            if ( id == ATTR_UNKNOWN
+                || m_lengths[id] != length
+                || memcmp( attributeNames[id], name, length ) != 0 )
+            {
+                return ATTR_UNKNOWN;
+            }
+
+            return id;
+        }
+    };
+
+    const AttributeHashTable attributeTable;
+
+    const double powersOf10[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+        1e21, 1e22
+    };
+
+    // Digits of a double's mantissa that can be held exactly
+    const int maxExactDigits = 15;
+    const int maxExactPower  = 22;
+
+    inline bool isDigit( char c )
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    bool parseMagnitude( const char *p, const char *end, boost::uint64_t limit, boost::uint64_t &value )
+    {
+        if ( p == end )
+        {
+            return false;
+        }
+
+        value = 0;
+        for ( ; p != end; ++p )
+        {
+            if ( !isDigit( *p ) )
+            {
+                return false;
+            }
+
+            boost::uint64_t digit = *p - '0';
+            if ( value > (limit - digit) / 10 )
+            {
+                return false;
+            }
+            value = value * 10 + digit;
+        }
+
+        return true;
+    }
+
+    bool equalsIgnoreCase( const RawString &value, const char *literal )
+    {
+        size_t length = strlen( literal );
+        if ( value.size() != length )
+        {
+            return false;
+        }
+
+        for ( size_t i = 0; i < length; i++ )
+        {
+            char c = value.begin()[i];
+            if ( c >= 'A' && c <= 'Z' )
+            {
+                c = c - 'A' + 'a';
+            }
+            if ( c != literal[i] )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+
+const char *elementName( elementId_t id )
+{
+    return id < ELEM_COUNT ? elementNames[id] : "unknown";
+}
+
+attributeId_t lookupAttribute( const char *name, size_t length )
+{
+    return attributeTable.lookup( name, length );
+}
+
+const char *attributeName( attributeId_t id )
+{
+    return id < ATTR_COUNT ? attributeNames[id] : "unknown";
+}
+
+bool parseInteger( const char *begin, const char *end, boost::uint64_t &value )
+{
+    if ( begin != end && *begin == '+' )
+    {
+        ++begin;
+    }
+
+    return parseMagnitude( begin, end, ~boost::uint64_t( 0 ), value );
+}
+
+bool parseInteger( const char *begin, const char *end, boost::int64_t &value )
+{
+    bool negative = false;
+    if ( begin != end && (*begin == '-' || *begin == '+') )
+    {
+        negative = *begin == '-';
+        ++begin;
+    }
+
+    boost::uint64_t limit = negative ? boost::uint64_t( 1 ) << 63 : (boost::uint64_t( 1 ) << 63) - 1;
+    boost::uint64_t magnitude;
+    if ( !parseMagnitude( begin, end, limit, magnitude ) )
+    {
+        return false;
+    }
+
+    value = negative ? -boost::int64_t( magnitude - 1 ) - 1 : boost::int64_t( magnitude );
+    return true;
+}
+
+bool parseDecimal( const char *begin, const char *end, double &value )
+{
+    const char *p = begin;
+    bool negative = false;
+    if ( p != end && (*p == '-' || *p == '+') )
+    {
+        negative = *p == '-';
+        ++p;
+    }
+
+    boost::uint64_t mantissa = 0;
+    int  significant = 0;
+    int  fractionDigits = 0;
+    bool anyDigits = false;
+    bool seenPoint = false;
+
+    for ( ; p != end; ++p )
+    {
+        if ( isDigit( *p ) )
+        {
+            anyDigits = true;
+            if ( mantissa != 0 || *p != '0' )
+            {
+                significant++;
+            }
+            if ( significant <= maxExactDigits )
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                fractionDigits += seenPoint ? 1 : 0;
+            }
+        }
+        else if ( *p == '.' && !seenPoint )
+        {
+            seenPoint = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if ( !anyDigits )
+    {
+        return false;
+    }
+
+    if ( p == end && significant <= maxExactDigits && fractionDigits <= maxExactPower )
+    {
+        // Both operands are exact doubles, so the one division rounds correctly
+        value = double( mantissa ) / powersOf10[fractionDigits];
+        if ( negative )
+        {
+            value = -value;
+        }
+        return true;
+    }
+
+    // Exponents and very long values
+    char buffer[64];
+    size_t length = end - begin;
+    if ( length >= sizeof( buffer ) )
+    {
+        return false;
+    }
+    memcpy( buffer, begin, length );
+    buffer[length] = '\0';
+
+    char *parsedEnd;
+    value = strtod( buffer, &parsedEnd );
+    return parsedEnd == buffer + length;
+}
+
+bool decodeAttribute( const RawString &value, boost::int64_t &var )
+{
+    return parseInteger( value.begin(), value.end(), var );
+}
+
+bool decodeAttribute( const RawString &value, boost::uint64_t &var )
+{
+    return parseInteger( value.begin(), value.end(), var );
+}
+
+bool decodeAttribute( const RawString &value, int &var )
+{
+    boost::int64_t wide;
+    if ( !parseInteger( value.begin(), value.end(), wide ) || wide != int( wide ) )
+    {
+        return false;
+    }
+
+    var = int( wide );
+    return true;
+}
+
+bool decodeAttribute( const RawString &value, double &var )
+{
+    return parseDecimal( value.begin(), value.end(), var );
+}
+
+bool decodeAttribute( const RawString &value, bool &var )
+{
+    if ( equalsIgnoreCase( value, "true" ) || value == "1" )
+    {
+        var = true;
+    }
+    else if ( equalsIgnoreCase( value, "false" ) || value == "0" )
+    {
+        var = false;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool decodeAttribute( const RawString &value, std::string &var )
+{
+    var = value.toString();
+    return true;
+}
+
+bool decodeAttribute( const RawString &value, boost::posix_time::ptime &var )
+{
+    epochTime_t epoch;
+    if ( !parseTimestamp( value.begin(), value.end(), epoch ) )
+    {
+        return false;
+    }
+
+    var = epochToPtime( epoch );
+    return true;
+}
+
+void throwMissingAttribute( attributeId_t id )
+{
+    throw XmlParseException( std::string( "Error: missing attribute: " ) + attributeName( id ) );
+}
+
+void throwBadAttribute( attributeId_t id, const RawString &value )
+{
+    throw XmlParseException( std::string( "Error: bad value for attribute " ) + attributeName( id ) + ": " + value.toString() );
+}
+
+
+void SchemaAttributes::assign( const rawAttributes_t &attributes )
+{
+    m_present = 0;
+
+    rawAttributes_t::const_iterator it = attributes.begin();
+    for ( ; it != attributes.end(); it++ )
+    {
+        attributeId_t id = lookupAttribute( it->m_name.begin(), it->m_name.size() );
+        if ( id != ATTR_UNKNOWN )
+        {
+            m_values[id] = it->m_value;
+            m_present |= 1u << id;
+        }
+    }
+}
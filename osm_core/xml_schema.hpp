@@ -0,0 +1,166 @@
+#ifndef XML_SCHEMA_HPP
+#define XML_SCHEMA_HPP
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "xml_tokenizer.hpp"
+
+// Every attribute the OSM readers look at. Each element type reads a fixed
+// subset of these (node: id/lat/lon/..., nd: ref, tag: k/v and so on), so the
+// names are resolved to ids once per attribute as the element is opened and
+// the builders then index straight into the values.
+enum attributeId_t
+{
+    ATTR_ID,
+    ATTR_LAT,
+    ATTR_LON,
+    ATTR_TIMESTAMP,
+    ATTR_USER,
+    ATTR_UID,
+    ATTR_VISIBLE,
+    ATTR_VERSION,
+    ATTR_CHANGESET,
+    ATTR_K,
+    ATTR_V,
+    ATTR_REF,
+    ATTR_TYPE,
+    ATTR_ROLE,
+    ATTR_GENERATOR,
+    ATTR_MINLAT,
+    ATTR_MINLON,
+    ATTR_MAXLAT,
+    ATTR_MAXLON,
+
+    ATTR_COUNT,
+    ATTR_UNKNOWN = ATTR_COUNT
+};
+
+// Elements the OSM readers know about. Build functions for these are kept in a
+// flat array on XMLNodeData rather than looked up by name.
+enum elementId_t
+{
+    ELEM_OSM,
+    ELEM_BOUNDS,
+    ELEM_NODE,
+    ELEM_WAY,
+    ELEM_RELATION,
+    ELEM_TAG,
+    ELEM_ND,
+    ELEM_MEMBER,
+
+    ELEM_COUNT,
+    ELEM_UNKNOWN = ELEM_COUNT
+};
+
+template<typename CharT>
+inline bool matchName( const CharT *name, const char *literal, size_t length )
+{
+    for ( size_t i = 0; i < length; i++ )
+    {
+        if ( name[i] != CharT( literal[i] ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Works on char or XMLCh names, so neither parser needs to transcode
+template<typename CharT>
+elementId_t lookupElement( const CharT *name, size_t length )
+{
+    switch ( length )
+    {
+    case 2:
+        return matchName( name, "nd", 2 ) ? ELEM_ND : ELEM_UNKNOWN;
+    case 3:
+        if ( matchName( name, "tag", 3 ) )
+        {
+            return ELEM_TAG;
+        }
+        if ( matchName( name, "way", 3 ) )
+        {
+            return ELEM_WAY;
+        }
+        return matchName( name, "osm", 3 ) ? ELEM_OSM : ELEM_UNKNOWN;
+    case 4:
+        return matchName( name, "node", 4 ) ? ELEM_NODE : ELEM_UNKNOWN;
+    case 6:
+        if ( matchName( name, "member", 6 ) )
+        {
+            return ELEM_MEMBER;
+        }
+        return matchName( name, "bounds", 6 ) ? ELEM_BOUNDS : ELEM_UNKNOWN;
+    case 8:
+        return matchName( name, "relation", 8 ) ? ELEM_RELATION : ELEM_UNKNOWN;
+    default:
+        return ELEM_UNKNOWN;
+    }
+}
+
+const char *elementName( elementId_t id );
+
+// Perfect hash lookup of an attribute name: one hash and one compare
+attributeId_t lookupAttribute( const char *name, size_t length );
+const char *attributeName( attributeId_t id );
+
+// Parsers working straight on the attribute bytes. No allocation, and no
+// locale. They return false on malformed input or overflow.
+bool parseInteger( const char *begin, const char *end, boost::int64_t &value );
+bool parseInteger( const char *begin, const char *end, boost::uint64_t &value );
+// Exact (correctly rounded) for up to 15 significant digits, which covers
+// OSM's 7 decimal place coordinates. Longer values go via strtod.
+bool parseDecimal( const char *begin, const char *end, double &value );
+
+bool decodeAttribute( const RawString &value, boost::int64_t &var );
+bool decodeAttribute( const RawString &value, boost::uint64_t &var );
+bool decodeAttribute( const RawString &value, int &var );
+bool decodeAttribute( const RawString &value, double &var );
+bool decodeAttribute( const RawString &value, bool &var );
+bool decodeAttribute( const RawString &value, std::string &var );
+bool decodeAttribute( const RawString &value, boost::posix_time::ptime &var );
+
+void throwMissingAttribute( attributeId_t id );
+void throwBadAttribute( attributeId_t id, const RawString &value );
+
+
+// The attributes of one element from the raw tokenizer, indexed by id
+class SchemaAttributes
+{
+private:
+    RawString       m_values[ATTR_COUNT];
+    boost::uint32_t m_present;
+
+public:
+    SchemaAttributes() : m_present( 0 ) {}
+
+    void assign( const rawAttributes_t &attributes );
+
+    bool has( attributeId_t id ) const { return (m_present & (1u << id)) != 0; }
+    const RawString &get( attributeId_t id ) const { return m_values[id]; }
+
+    // Same chaining style as XMLNodeAttributeMap
+    template<typename T>
+    const SchemaAttributes &operator()( attributeId_t id, T &var, bool optional=false, T defaultValue=T() ) const
+    {
+        if ( !has( id ) )
+        {
+            if ( !optional )
+            {
+                throwMissingAttribute( id );
+            }
+            var = defaultValue;
+        }
+        else if ( !decodeAttribute( m_values[id], var ) )
+        {
+            throwBadAttribute( id, m_values[id] );
+        }
+
+        return *this;
+    }
+};
+
+#endif // XML_SCHEMA_HPP
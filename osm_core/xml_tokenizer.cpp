@@ -0,0 +1,537 @@
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/bind.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "osm_data.hpp"
+#include "xml_reader.hpp"
+#include "xml_tokenizer.hpp"
+#include "ingest_pipeline.hpp"
+#include "xml_parallel.hpp"
+#include "timestamp.hpp"
+
+namespace
+{
+    inline bool isSpace( char c )
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    inline bool isNameEnd( char c )
+    {
+        return isSpace( c ) || c == '/' || c == '>' || c == '=';
+    }
+
+    inline bool startsWith( const char *p, const char *end, const char *literal )
+    {
+        size_t len = strlen( literal );
+        return size_t( end - p ) >= len && memcmp( p, literal, len ) == 0;
+    }
+
+    void appendUTF8( std::string &out, unsigned long cp )
+    {
+        if ( cp < 0x80 )
+        {
+            out += char( cp );
+        }
+        else if ( cp < 0x800 )
+        {
+            out += char( 0xC0 | (cp >> 6) );
+            out += char( 0x80 | (cp & 0x3F) );
+        }
+        else if ( cp < 0x10000 )
+        {
+            out += char( 0xE0 | (cp >> 12) );
+            out += char( 0x80 | ((cp >> 6) & 0x3F) );
+            out += char( 0x80 | (cp & 0x3F) );
+        }
+        else
+        {
+            out += char( 0xF0 | (cp >> 18) );
+            out += char( 0x80 | ((cp >> 12) & 0x3F) );
+            out += char( 0x80 | ((cp >> 6) & 0x3F) );
+            out += char( 0x80 | (cp & 0x3F) );
+        }
+    }
+}
+
+std::string RawString::toString() const
+{
+    const char *amp = static_cast<const char *>( memchr( m_begin, '&', m_length ) );
+    if ( amp == 0 )
+    {
+        return std::string( m_begin, m_length );
+    }
+
+    std::string result;
+    result.reserve( m_length );
+
+    const char *p = m_begin;
+    const char *e = end();
+    while ( amp != 0 )
+    {
+        result.append( p, amp );
+
+        const char *semi = static_cast<const char *>( memchr( amp, ';', e - amp ) );
+        if ( semi == 0 )
+        {
+            throw XmlParseException( "Unterminated entity reference in: " + std::string( m_begin, m_length ) );
+        }
+
+        RawString entity( amp + 1, semi - amp - 1 );
+        if ( entity == "lt" )        result += '<';
+        else if ( entity == "gt" )   result += '>';
+        else if ( entity == "amp" )  result += '&';
+        else if ( entity == "quot" ) result += '"';
+        else if ( entity == "apos" ) result += '\'';
+        else if ( entity.size() > 1 && entity.begin()[0] == '#' )
+        {
+            bool hex = entity.begin()[1] == 'x';
+            std::string digits( entity.begin() + (hex ? 2 : 1), entity.end() );
+            char *digitsEnd;
+            unsigned long cp = strtoul( digits.c_str(), &digitsEnd, hex ? 16 : 10 );
+            if ( digits.empty() || *digitsEnd != '\0' )
+            {
+                throw XmlParseException( "Bad character reference: " + std::string( entity.begin(), entity.size() ) );
+            }
+            appendUTF8( result, cp );
+        }
+        else
+        {
+            throw XmlParseException( "Unknown entity: " + std::string( entity.begin(), entity.size() ) );
+        }
+
+        p = semi + 1;
+        amp = static_cast<const char *>( memchr( p, '&', e - p ) );
+    }
+    result.append( p, e );
+
+    return result;
+}
+
+std::ostream &operator<<( std::ostream &s, const RawString &val )
+{
+    s.write( val.begin(), val.size() );
+    return s;
+}
+
+
+void extended_lexical_cast( const RawString &val, std::string &var )
+{
+    var = val.toString();
+}
+
+void extended_lexical_cast( const RawString &val, bool &var )
+{
+    if ( val == "true" || val == "1" )
+    {
+        var = true;
+    }
+    else if ( val == "false" || val == "0" )
+    {
+        var = false;
+    }
+    else
+    {
+        extended_lexical_cast( val.toString(), var );
+    }
+}
+
+void extended_lexical_cast( const RawString &val, boost::posix_time::ptime &var )
+{
+    epochTime_t epoch;
+    if ( !parseTimestamp( val.begin(), val.end(), epoch ) )
+    {
+        throw boost::bad_lexical_cast();
+    }
+
+    var = epochToPtime( epoch );
+}
+
+
+RawXMLTokenizer::RawXMLTokenizer( std::istream &is, size_t bufferSize ) :
+    m_is( &is ),
+    m_buffer( bufferSize ),
+    m_data( &m_buffer[0] ),
+    m_pos( 0 ),
+    m_filled( 0 ),
+    m_consumed( 0 ),
+    m_eof( false )
+{
+    m_attributes.reserve( 16 );
+}
+
+RawXMLTokenizer::RawXMLTokenizer( const char *begin, const char *end ) :
+    m_is( 0 ),
+    m_data( begin ),
+    m_pos( 0 ),
+    m_filled( end - begin ),
+    m_consumed( 0 ),
+    m_eof( true )
+{
+    m_attributes.reserve( 16 );
+}
+
+bool RawXMLTokenizer::refill()
+{
+    if ( m_eof )
+    {
+        return false;
+    }
+
+    // Keep any partially parsed markup, moving it to the front of the buffer
+    if ( m_pos > 0 )
+    {
+        memmove( &m_buffer[0], &m_buffer[m_pos], m_filled - m_pos );
+        m_filled -= m_pos;
+        m_consumed += m_pos;
+        m_pos = 0;
+    }
+
+    // A single piece of markup larger than the whole buffer
+    if ( m_filled == m_buffer.size() )
+    {
+        m_buffer.resize( m_buffer.size() * 2 );
+        m_data = &m_buffer[0];
+    }
+
+    m_is->read( &m_buffer[m_filled], m_buffer.size() - m_filled );
+    size_t readCount = m_is->gcount();
+    if ( readCount == 0 )
+    {
+        m_eof = true;
+        return false;
+    }
+    m_filled += readCount;
+
+    return true;
+}
+
+void RawXMLTokenizer::parse( RawXMLHandler &handler )
+{
+    while ( true )
+    {
+        const char *base = m_data;
+        const char *lt = static_cast<const char *>( memchr( base + m_pos, '<', m_filled - m_pos ) );
+
+        if ( lt == 0 )
+        {
+            // Only character data left in the buffer - drop it
+            m_pos = m_filled;
+            if ( !refill() )
+            {
+                break;
+            }
+            continue;
+        }
+
+        m_pos = lt - base;
+        if ( parseMarkup( handler ) == MARKUP_INCOMPLETE && !refill() )
+        {
+            throwError( "Unexpected end of input inside markup", m_data + m_pos );
+        }
+    }
+}
+
+RawXMLTokenizer::markupResult_t RawXMLTokenizer::parseMarkup( RawXMLHandler &handler )
+{
+    const char *p   = m_data + m_pos;
+    const char *end = m_data + m_filled;
+
+    if ( end - p < 2 )
+    {
+        return MARKUP_INCOMPLETE;
+    }
+
+    switch ( p[1] )
+    {
+    case '?':
+        return skipTo( p + 2, end, "?>" );
+
+    case '!':
+    {
+        // Need enough lookahead to tell the declaration types apart
+        if ( end - p < 9 && !m_eof )
+        {
+            return MARKUP_INCOMPLETE;
+        }
+        if ( startsWith( p, end, "<!--" ) )
+        {
+            return skipTo( p + 4, end, "-->" );
+        }
+        if ( startsWith( p, end, "<![CDATA[" ) )
+        {
+            return skipTo( p + 9, end, "]]>" );
+        }
+
+        // DOCTYPE or similar: skip to the closing '>', stepping over any internal subset
+        int depth = 0;
+        char quote = '\0';
+        for ( const char *q = p + 2; q != end; q++ )
+        {
+            if ( quote != '\0' )
+            {
+                if ( *q == quote ) quote = '\0';
+            }
+            else if ( *q == '"' || *q == '\'' ) quote = *q;
+            else if ( *q == '[' ) depth++;
+            else if ( *q == ']' ) depth--;
+            else if ( *q == '>' && depth == 0 )
+            {
+                m_pos = q + 1 - m_data;
+                return MARKUP_DONE;
+            }
+        }
+        return MARKUP_INCOMPLETE;
+    }
+
+    case '/':
+    {
+        const char *gt = static_cast<const char *>( memchr( p + 2, '>', end - p - 2 ) );
+        if ( gt == 0 )
+        {
+            return MARKUP_INCOMPLETE;
+        }
+
+        const char *nameEnd = gt;
+        while ( nameEnd != p + 2 && isSpace( nameEnd[-1] ) )
+        {
+            nameEnd--;
+        }
+
+        m_pos = gt + 1 - m_data;
+        handler.endElement( RawString( p + 2, nameEnd - p - 2 ) );
+        return MARKUP_DONE;
+    }
+
+    default:
+        return parseStartTag( handler, p, end );
+    }
+}
+
+RawXMLTokenizer::markupResult_t RawXMLTokenizer::parseStartTag( RawXMLHandler &handler, const char *p, const char *end )
+{
+    const char *q = p + 1;
+    while ( q != end && !isNameEnd( *q ) ) q++;
+    if ( q == end )
+    {
+        return MARKUP_INCOMPLETE;
+    }
+
+    RawString name( p + 1, q - p - 1 );
+    if ( name.empty() )
+    {
+        throwError( "Empty element name", p );
+    }
+
+    bool selfClosing = false;
+    m_attributes.clear();
+    while ( true )
+    {
+        while ( q != end && isSpace( *q ) ) q++;
+        if ( q == end )
+        {
+            return MARKUP_INCOMPLETE;
+        }
+
+        if ( *q == '>' )
+        {
+            q++;
+            break;
+        }
+
+        if ( *q == '/' )
+        {
+            if ( q + 1 == end )
+            {
+                return MARKUP_INCOMPLETE;
+            }
+            if ( q[1] != '>' )
+            {
+                throwError( "Expected '>' after '/'", q );
+            }
+            selfClosing = true;
+            q += 2;
+            break;
+        }
+
+        const char *attrBegin = q;
+        while ( q != end && !isNameEnd( *q ) ) q++;
+        const char *attrEnd = q;
+        while ( q != end && isSpace( *q ) ) q++;
+        if ( q == end )
+        {
+            return MARKUP_INCOMPLETE;
+        }
+        if ( attrBegin == attrEnd || *q != '=' )
+        {
+            throwError( "Malformed attribute", attrBegin );
+        }
+
+        q++;
+        while ( q != end && isSpace( *q ) ) q++;
+        if ( q == end )
+        {
+            return MARKUP_INCOMPLETE;
+        }
+
+        char quote = *q;
+        if ( quote != '"' && quote != '\'' )
+        {
+            throwError( "Expected quoted attribute value", q );
+        }
+
+        const char *valueBegin = q + 1;
+        const char *valueEnd = static_cast<const char *>( memchr( valueBegin, quote, end - valueBegin ) );
+        if ( valueEnd == 0 )
+        {
+            return MARKUP_INCOMPLETE;
+        }
+
+        RawAttribute attribute;
+        attribute.m_name  = RawString( attrBegin, attrEnd - attrBegin );
+        attribute.m_value = RawString( valueBegin, valueEnd - valueBegin );
+        m_attributes.push_back( attribute );
+
+        q = valueEnd + 1;
+    }
+
+    m_pos = q - m_data;
+    handler.startElement( name, m_attributes );
+    if ( selfClosing )
+    {
+        handler.endElement( name );
+    }
+
+    return MARKUP_DONE;
+}
+
+RawXMLTokenizer::markupResult_t RawXMLTokenizer::skipTo( const char *p, const char *end, const char *terminator )
+{
+    const char *termEnd = terminator + strlen( terminator );
+    const char *found = std::search( p, end, terminator, termEnd );
+    if ( found == end )
+    {
+        return MARKUP_INCOMPLETE;
+    }
+
+    m_pos = found + (termEnd - terminator) - m_data;
+    return MARKUP_DONE;
+}
+
+void RawXMLTokenizer::throwError( const std::string &message, const char *at ) const
+{
+    size_t offset = m_consumed + (at - m_data);
+
+    throw XmlParseException( boost::str( boost::format(
+        "XML parse error (byte: %d): %s" )
+        % offset % message ) );
+}
+
+
+RawXMLReader::RawXMLReader( boost::shared_ptr<XMLNodeData> startNode ) :
+    m_buildStack( new XMLFrameStack( startNode ) ),
+    m_rootClosed( false )
+{
+}
+
+void RawXMLReader::startElement( const RawString &name, const rawAttributes_t &attributes )
+{
+    size_t depth = m_buildStack->depth();
+    if ( m_names.size() <= depth )
+    {
+        m_names.resize( depth + 1 );
+    }
+    m_names[depth].assign( name.begin(), name.size() );
+
+    const nodeBuildFn_t *buildFn = m_buildStack->top().findBuildFn( lookupElement( name.begin(), name.size() ) );
+
+    if ( !buildFn )
+    {
+        // Not one of the known elements: go by name
+        nodeBuildFn_t namedFn = m_buildStack->top().getBuildFnFor( std::string( name.begin(), name.size() ) );
+        namedFn( m_buildStack->push( attributes ) );
+        return;
+    }
+
+    (*buildFn)( m_buildStack->push( attributes ) );
+}
+
+void RawXMLReader::endElement( const RawString &name )
+{
+    if ( m_buildStack->depth() <= 1 )
+    {
+        throw XmlParseException( "Unbalanced end tag: " + name.toString() );
+    }
+
+    const std::string &open = m_names[m_buildStack->depth() - 1];
+    if ( open.size() != name.size() || memcmp( open.data(), name.begin(), name.size() ) != 0 )
+    {
+        throw XmlParseException( "End tag " + name.toString() + " doesn't match " + open );
+    }
+
+    m_buildStack->top().end();
+    m_buildStack->pop();
+
+    if ( m_buildStack->depth() == 1 )
+    {
+        m_rootClosed = true;
+    }
+}
+
+
+size_t RawXMLReader::depth() const
+{
+    return m_buildStack->depth();
+}
+
+bool RawXMLReader::complete() const
+{
+    return m_rootClosed && m_buildStack->depth() == 1;
+}
+
+
+void readOSMXMLRaw( const std::string &fileName, OSMFragment &frag )
+{
+    readOSMXMLRaw( fileName, frag, ReadOptions() );
+}
+
+void readOSMXMLRaw( const std::string &fileName, OSMFragment &frag, const ReadOptions &options )
+{
+    if ( options.m_parseThreads > 1 )
+    {
+        readOSMXMLParallel( fileName, frag, options );
+        return;
+    }
+
+    if ( options.m_pipelined )
+    {
+        readOSMXMLPipelined( fileName, frag, options );
+        return;
+    }
+
+    std::cout << "Reading XML file: " << fileName << std::endl;
+
+    boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+
+    startNdData->registerMembers()( "osm", boost::bind( &OSMFragment::build, &frag, _1 ) );
+
+    RawXMLReader handler( startNdData );
+
+    std::ifstream is;
+    boost::iostreams::filtering_istream in;
+    openOSMInput( fileName, is, in, options );
+
+    RawXMLTokenizer tokenizer( in );
+    tokenizer.parse( handler );
+
+    if ( !handler.complete() )
+    {
+        throw XmlParseException( "Input ends before </osm>" );
+    }
+
+    std::cout << "Done..." << std::endl;
+}
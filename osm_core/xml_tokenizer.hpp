@@ -0,0 +1,155 @@
+#ifndef XML_TOKENIZER_HPP
+#define XML_TOKENIZER_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+class XMLNodeData;
+class XMLFrameStack;
+class OSMFragment;
+struct ReadOptions;
+
+// Pointer + length view onto bytes owned by the tokenizer buffer. Only valid for
+// the duration of the callback it was handed to.
+class RawString
+{
+private:
+    const char *m_begin;
+    size_t      m_length;
+
+public:
+    RawString() : m_begin( 0 ), m_length( 0 ) {}
+    RawString( const char *begin, size_t length ) : m_begin( begin ), m_length( length ) {}
+
+    const char *begin() const { return m_begin; }
+    const char *end() const { return m_begin + m_length; }
+    size_t size() const { return m_length; }
+    bool empty() const { return m_length == 0; }
+
+    bool operator==( const char *rhs ) const
+    {
+        return strncmp( m_begin, rhs, m_length ) == 0 && rhs[m_length] == '\0';
+    }
+
+    bool operator==( const std::string &rhs ) const
+    {
+        return rhs.size() == m_length && memcmp( m_begin, rhs.data(), m_length ) == 0;
+    }
+
+    // Copy out, decoding any character or entity references
+    std::string toString() const;
+};
+
+std::ostream &operator<<( std::ostream &s, const RawString &val );
+
+struct RawAttribute
+{
+    RawString m_name;
+    RawString m_value;
+};
+
+typedef std::vector<RawAttribute> rawAttributes_t;
+
+
+class RawXMLHandler
+{
+public:
+    virtual void startElement( const RawString &name, const rawAttributes_t &attributes ) = 0;
+    virtual void endElement( const RawString &name ) = 0;
+    virtual ~RawXMLHandler() {}
+};
+
+
+// Minimal non-validating tokenizer for OSM XML. Works directly on the raw (UTF-8)
+// bytes: element names and attribute values are handed to the handler as views
+// into the read buffer, so nothing is transcoded or copied unless the consumer
+// asks for a std::string. Comments, processing instructions, DOCTYPE and CDATA
+// sections are skipped; character data is ignored (OSM has none).
+class RawXMLTokenizer
+{
+private:
+    // Null when parsing a buffer in memory
+    std::istream     *m_is;
+    std::vector<char> m_buffer;
+    // The bytes being parsed: m_buffer, or the caller's memory
+    const char       *m_data;
+    size_t            m_pos;
+    size_t            m_filled;
+    size_t            m_consumed;
+    bool              m_eof;
+    rawAttributes_t   m_attributes;
+
+public:
+    RawXMLTokenizer( std::istream &is, size_t bufferSize = 1 << 20 );
+    // Parse the bytes in place (e.g. an mmapped file). They must outlive the tokenizer.
+    RawXMLTokenizer( const char *begin, const char *end );
+
+    void parse( RawXMLHandler &handler );
+
+    // Bytes of input fully processed so far
+    size_t bytesConsumed() const { return m_consumed + m_pos; }
+
+private:
+    bool refill();
+
+    enum markupResult_t
+    {
+        MARKUP_DONE,
+        MARKUP_INCOMPLETE
+    };
+
+    markupResult_t parseMarkup( RawXMLHandler &handler );
+    markupResult_t parseStartTag( RawXMLHandler &handler, const char *p, const char *end );
+    markupResult_t skipTo( const char *p, const char *end, const char *terminator );
+
+    void throwError( const std::string &message, const char *at ) const;
+};
+
+
+// Drives XMLNodeData build functions from the raw tokenizer, mirroring XMLReader
+class RawXMLReader : public RawXMLHandler
+{
+private:
+    boost::shared_ptr<XMLFrameStack> m_buildStack;
+    // The names of the open elements by depth, kept so end tags can be
+    // matched; the strings are reused rather than popped
+    std::vector<std::string>         m_names;
+    bool                             m_rootClosed;
+
+public:
+    RawXMLReader( boost::shared_ptr<XMLNodeData> startNode );
+
+    void startElement( const RawString &name, const rawAttributes_t &attributes );
+    void endElement( const RawString &name );
+
+    // Elements open, counting the start node
+    size_t depth() const;
+    // A top level element has been closed and nothing is left open: false
+    // for a document cut short
+    bool complete() const;
+};
+
+
+template<typename T>
+void extended_lexical_cast( const RawString &val, T &var )
+{
+    var = boost::lexical_cast<T>( boost::make_iterator_range( val.begin(), val.end() ) );
+}
+
+void extended_lexical_cast( const RawString &val, std::string &var );
+void extended_lexical_cast( const RawString &val, bool &var );
+void extended_lexical_cast( const RawString &val, boost::posix_time::ptime &var );
+
+// Read an OSM XML file (optionally bzip2 compressed) using the raw tokenizer
+// rather than Xerces. Throws XmlParseException if the file ends before </osm>.
+void readOSMXMLRaw( const std::string &fileName, OSMFragment &frag, const ReadOptions &options );
+void readOSMXMLRaw( const std::string &fileName, OSMFragment &frag );
+
+#endif // XML_TOKENIZER_HPP
@@ -19,6 +19,9 @@
 
 #include "xml_reader.hpp"
 #include "osm_data.hpp"
+#include "ingest_filter.hpp"
+#include "ingest_two_pass.hpp"
+#include "snapshot.hpp"
 #include "routeapp.hpp"
 
 #include <boost/format.hpp>
@@ -26,16 +29,21 @@
 #include <boost/asio.hpp>
 
 
-RouteApp::RouteApp( const std::string &mapFileName ) : m_nodeCoords( 12, -90, 90, -180, 180 )
+RouteApp::RouteApp( const std::string &mapFileName, bool twoPass ) :
+    m_nodeCoords( 12, -90 * fixedPerDegree, 90 * fixedPerDegree, -180 * fixedPerDegree, 180 * fixedPerDegree )
 {
+    // Made first, as it decides which ways are read
+    std::cout << "Making routing graph object" << std::endl;
+    m_routingGraph.reset( new RoutingGraph( m_fullOSMData ) );
+
     std::cout << "Reading map data for file: " << mapFileName << std::endl;
-    readMapData( mapFileName );
+    readMapData( mapFileName, twoPass );
     std::cout << "Reading map data complete" << std::endl;
     buildRoutingGraph();
     std::cout << "Routeapp object construction complete" << std::endl;
 }
 
-void RouteApp::registerRouteNode( double x, double y, dbId_t nodeId, bool /*inRouteGraph*/ )
+void RouteApp::registerRouteNode( coord_t x, coord_t y, dbId_t nodeId, bool /*inRouteGraph*/ )
 {
     m_nodeCoords.add( x, y, nodeId );
 }
@@ -43,21 +51,35 @@ void RouteApp::registerRouteNode( double x, double y, dbId_t nodeId, bool /*inRo
 
 void RouteApp::buildRoutingGraph()
 {
-    std::cout << "Making routing graph object" << std::endl;
-    m_routingGraph.reset( new RoutingGraph( m_fullOSMData ) );
-    
     std::cout << "Building routing graph from OSM map data" << std::endl;
-    boost::function<void( double, double, dbId_t, bool )> fn( boost::bind( &RouteApp::registerRouteNode, this, _1, _2, _3, _4 ) );
+    boost::function<void( coord_t, coord_t, dbId_t, bool )> fn( boost::bind( &RouteApp::registerRouteNode, this, _1, _2, _3, _4 ) );
     m_routingGraph->build( fn );
 }
 
-void RouteApp::readMapData( const std::string &mapFileName )
+void RouteApp::readMapData( const std::string &mapFileName, bool twoPass )
 {
     try
     {
+        // As written by osm2snapshot --routable
+        if ( isSnapshot( mapFileName ) )
+        {
+            loadSnapshot( mapFileName, m_fullOSMData );
+            return;
+        }
+
         XercesInitWrapper x;
-        
-        readOSMXML( x, mapFileName, m_fullOSMData );
+
+        m_fullOSMData.setFilter( IngestFilter::routableWays( m_routingGraph->getRoutableWayKeys() ) );
+        m_fullOSMData.setColumnarNodes( true );
+        m_fullOSMData.setDropMetadata( true );
+        if ( twoPass )
+        {
+            readOSMFileTwoPass( x, mapFileName, m_fullOSMData );
+        }
+        else
+        {
+            readOSMFile( x, mapFileName, m_fullOSMData );
+        }
     }
     catch ( const xercesc::XMLException &toCatch )
     {
@@ -72,24 +94,24 @@ void RouteApp::readMapData( const std::string &mapFileName )
 }
 
 
-boost::shared_ptr<OSMNode> RouteApp::getClosestNode( xyPoint_t point )
+NodeStore::Node RouteApp::getClosestNode( xyPoint_t point )
 {
     dbId_t idOfClosest = m_nodeCoords.closestPoint( point ).get<2>();
     
     return getNodeById( idOfClosest );
 }
 
-boost::shared_ptr<OSMNode> RouteApp::getNodeById( dbId_t nodeId )
+NodeStore::Node RouteApp::getNodeById( dbId_t nodeId )
 {
-    const OSMFragment::nodeMap_t &nodeMap= m_fullOSMData.getNodes();
-    OSMFragment::nodeMap_t::const_iterator findIt = nodeMap.find( nodeId );
+    const NodeStore &nodes = m_fullOSMData.getNodeStore();
+    NodeStore::const_iterator findIt = nodes.find( nodeId );
     
-    if ( findIt == nodeMap.end() )
+    if ( findIt == nodes.end() )
     {
         throw std::out_of_range( "Node not found in map" );
     }
     
-    return findIt->second;
+    return *findIt;
 }
 
 void RouteApp::calculateRoute( dbId_t sourceNodeId, dbId_t destNodeId, RoutingGraph::route_t &route )
@@ -165,13 +187,13 @@ std::string RouteSocketMon::parseRequest( const std::string &request )
         double lat = boost::lexical_cast<double>( coords[0] );
         double lon = boost::lexical_cast<double>( coords[1] );
 
-        boost::shared_ptr<OSMNode> nearest = m_routeApp.getClosestNode( xyPoint_t( lat, lon ) );
+        NodeStore::Node nearest = m_routeApp.getClosestNode( xyPoint_t( toFixed( lat ), toFixed( lon ) ) );
 
         // closest=<nodeid>,<lat>,<lon>
-        return boost::str( boost::format( "closest=%d,%f,%f" )
-                           % nearest->getId()
-                           % nearest->getLon()
-                           % nearest->getLat() );
+        return boost::str( boost::format( "closest=%d,%s,%s" )
+                           % nearest.getId()
+                           % formatFixed( nearest.getFixedLon() )
+                           % formatFixed( nearest.getFixedLat() ) );
 
     }
     else if ( requestType == "route" )
@@ -189,13 +211,13 @@ std::string RouteSocketMon::parseRequest( const std::string &request )
         std::stringstream ss;
         size_t count = 0;
         std::vector<std::string> routeEls;
-        BOOST_FOREACH( boost::shared_ptr<OSMNode> theNode, route )
+        BOOST_FOREACH( const NodeStore::Node &theNode, route )
         {
-            dbId_t id = theNode->getId();
-            double lat = theNode->getLat();
-            double lon = theNode->getLon();
+            dbId_t id = theNode.getId();
+            std::string lat = formatFixed( theNode.getFixedLat() );
+            std::string lon = formatFixed( theNode.getFixedLon() );
 
-            routeEls.push_back( boost::str( boost::format( "%06d=%d,%f,%f" )
+            routeEls.push_back( boost::str( boost::format( "%06d=%d,%s,%s" )
                                             % count++
                                             % id
                                             % lat
@@ -213,7 +235,8 @@ std::string RouteSocketMon::parseRequest( const std::string &request )
 
 int main( int argc, char **argv )
 {
-    RouteApp ra( argv[1] );
+    bool twoPass = !(argc > 2 && std::string( argv[2] ) == "--one-pass");
+    RouteApp ra( argv[1], twoPass );
 
     RouteSocketMon sm( ra );
 
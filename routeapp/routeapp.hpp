@@ -0,0 +1,41 @@
+#ifndef ROUTEAPP_HPP
+#define ROUTEAPP_HPP
+
+#include <string>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/array.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "osm_data.hpp"
+#include "quadtree.hpp"
+#include "router.hpp"
+
+typedef XYPoint<coord_t> xyPoint_t;
+
+class RouteApp
+{
+private:
+    OSMFragment                     m_fullOSMData;
+    QuadTree<coord_t, dbId_t>       m_nodeCoords;
+    boost::shared_ptr<RoutingGraph> m_routingGraph;
+
+public:
+    // twoPass: read the file twice rather than hold every node location
+    // back (see readOSMFileTwoPass)
+    RouteApp( const std::string &mapFileName, bool twoPass = true );
+
+    void registerRouteNode( coord_t x, coord_t y, dbId_t nodeId, bool inRouteGraph );
+    void buildRoutingGraph();
+    // Reads only the routable ways (and their nodes) from the file
+    void readMapData( const std::string &mapFileName, bool twoPass );
+
+    NodeStore::Node getClosestNode( xyPoint_t point );
+    NodeStore::Node getNodeById( dbId_t nodeId );
+    void calculateRoute( dbId_t sourceNodeId, dbId_t destNodeId, RoutingGraph::route_t &route );
+};
+
+#endif // ROUTEAPP_HPP
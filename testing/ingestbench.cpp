@@ -0,0 +1,158 @@
+#include "xml_reader.hpp"
+#include "xml_tokenizer.hpp"
+#include "osm_data.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+// Counts every heap allocation in the process, operator new's included,
+// without replacing the allocator: the executable's malloc is found before
+// the C library's and hands each call on to it
+extern "C" void *__libc_malloc( size_t size );
+
+static size_t allocationCount = 0;
+
+extern "C" void *malloc( size_t size ) throw ()
+{
+    allocationCount++;
+    return __libc_malloc( size );
+}
+
+
+struct ElementCounter : public RawXMLHandler
+{
+    size_t m_count;
+
+    ElementCounter() : m_count( 0 ) {}
+    void startElement( const RawString &name, const rawAttributes_t &attributes ) { m_count++; }
+    void endElement( const RawString &name ) {}
+};
+
+// Registers the OSM element structure but keeps nothing, so that only the
+// parse frame machinery is measured
+struct SkeletonBuilder
+{
+    void build( XMLNodeData &data )
+    {
+        data.registerMembers()
+            ( ELEM_NODE, boost::bind( &SkeletonBuilder::object, this, _1 ) )
+            ( ELEM_WAY, boost::bind( &SkeletonBuilder::object, this, _1 ) )
+            ( ELEM_RELATION, boost::bind( &SkeletonBuilder::object, this, _1 ) );
+    }
+
+    void object( XMLNodeData &data )
+    {
+        data.registerMembers()
+            ( ELEM_TAG, boost::bind( &SkeletonBuilder::leaf, this, _1 ) )
+            ( ELEM_ND, boost::bind( &SkeletonBuilder::leaf, this, _1 ) )
+            ( ELEM_MEMBER, boost::bind( &SkeletonBuilder::leaf, this, _1 ) );
+    }
+
+    void leaf( XMLNodeData &data )
+    {
+    }
+};
+
+std::string makeDocument( size_t objects )
+{
+    std::ostringstream os;
+    os << "<?xml version='1.0' encoding='UTF-8'?>\n<osm version='0.6' generator='ingestbench'>\n";
+    for ( size_t i = 1; i <= objects; i++ )
+    {
+        os << boost::format( "<node id='%d' lat='51.%07d' lon='-1.%07d' timestamp='2008-03-02T22:38:37+00:00' user='someone' uid='%d'>"
+            "<tag k='created_by' v='JOSM'/></node>\n" ) % i % (i * 7919 % 10000000) % (i * 104729 % 10000000) % (i % 100);
+    }
+    for ( size_t i = 1; i <= objects / 10; i++ )
+    {
+        os << boost::format( "<way id='%d' timestamp='2008-03-02T22:38:37+00:00' user='someone' uid='1'>" ) % i;
+        for ( size_t j = 0; j < 8; j++ )
+        {
+            os << boost::format( "<nd ref='%d'/>" ) % (i * 10 + j);
+        }
+        os << "<tag k='highway' v='residential'/><tag k='name' v='Some Street'/></way>\n";
+    }
+    os << "<relation id='1' timestamp='2008-03-02T22:38:37+00:00' user='someone' uid='1'>"
+        "<member type='way' ref='1' role='outer'/><tag k='type' v='multipolygon'/></relation>\n";
+    os << "</osm>\n";
+
+    return os.str();
+}
+
+void report( const std::string &name, size_t allocations, size_t elements )
+{
+    std::cout << boost::format( "%-10s %10d allocations  %8.3f per element" )
+        % name % allocations % (double( allocations ) / elements) << std::endl;
+}
+
+// How far sharing equal tag sets shrinks the tag pool
+void reportTags( const OSMFragment &frag )
+{
+    const TagPool &pool = frag.getTagPool();
+    std::cout << boost::format( "Tags: %d held as %d in %d distinct sets, %.2f:1" )
+        % pool.references() % pool.size() % pool.sets()
+        % (double( pool.references() ) / std::max<size_t>( pool.size(), 1 )) << std::endl;
+}
+
+int main( int argc, char *argv[] )
+{
+    // An OSM XML file rather than an object count: just report on its tags
+    if ( argc > 1 && !isdigit( argv[1][0] ) )
+    {
+        OSMFragment frag;
+        readOSMXMLRaw( argv[1], frag );
+        reportTags( frag );
+        return 0;
+    }
+
+    size_t objects = argc > 1 ? boost::lexical_cast<size_t>( argv[1] ) : 100000;
+    std::string document = makeDocument( objects );
+
+    size_t elements;
+    {
+        std::istringstream is( document );
+        RawXMLTokenizer tokenizer( is );
+        ElementCounter counter;
+        tokenizer.parse( counter );
+        elements = counter.m_count;
+    }
+    std::cout << "Elements: " << elements << std::endl;
+
+    {
+        SkeletonBuilder skeleton;
+        boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+        startNdData->registerMembers()( ELEM_OSM, boost::bind( &SkeletonBuilder::build, &skeleton, _1 ) );
+        RawXMLReader handler( startNdData );
+
+        std::istringstream is( document );
+        RawXMLTokenizer tokenizer( is );
+
+        size_t before = allocationCount;
+        tokenizer.parse( handler );
+        report( "frames", allocationCount - before, elements );
+    }
+
+    {
+        OSMFragment frag;
+        boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+        startNdData->registerMembers()( ELEM_OSM, boost::bind( &OSMFragment::build, &frag, _1 ) );
+        RawXMLReader handler( startNdData );
+
+        std::istringstream is( document );
+        RawXMLTokenizer tokenizer( is );
+
+        size_t before = allocationCount;
+        tokenizer.parse( handler );
+        report( "fragment", allocationCount - before, elements );
+        reportTags( frag );
+    }
+
+    return 0;
+}
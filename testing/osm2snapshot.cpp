@@ -0,0 +1,75 @@
+#include "xml_reader.hpp"
+#include "osm_data.hpp"
+#include "ingest_filter.hpp"
+#include "router.hpp"
+#include "snapshot.hpp"
+
+#include <string>
+#include <iostream>
+
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Converts an OSM file (.osm, .osm.bz2 or .osm.pbf) to a snapshot, which
+// loadSnapshot() then maps in place. With --routable only what routeapp
+// keeps is written: the routable ways and their nodes, without timestamps
+// or users, read as routeapp reads them, so routeapp can be pointed at the
+// snapshot instead.
+int main( int argc, char **argv )
+{
+    bool routable = argc == 4 && std::string( argv[1] ) == "--routable";
+    if ( argc != 3 && !routable )
+    {
+        std::cout << "Usage: osm2snapshot [--routable] <input file> <snapshot file>" << std::endl;
+        return -1;
+    }
+
+    std::string inputFileName    = argv[argc - 2];
+    std::string snapshotFileName = argv[argc - 1];
+
+    try
+    {
+        XercesInitWrapper x;
+
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+        OSMFragment frag;
+        frag.setColumnarNodes( true );
+        if ( routable )
+        {
+            RoutingGraph graph( frag );
+            frag.setFilter( IngestFilter::routableWays( graph.getRoutableWayKeys() ) );
+            frag.setDropMetadata( true );
+        }
+        readOSMFile( x, inputFileName, frag );
+
+        boost::posix_time::ptime read = boost::posix_time::microsec_clock::universal_time();
+        writeSnapshot( frag, snapshotFileName );
+
+        boost::posix_time::ptime written = boost::posix_time::microsec_clock::universal_time();
+        std::cout << boost::format( "%d nodes, %d ways, %d relations: read in %.2fs, written in %.2fs" )
+            % frag.getNodeStore().size() % frag.getWays().size() % frag.getRelations().size()
+            % ((read - start).total_milliseconds() / 1000.0)
+            % ((written - read).total_milliseconds() / 1000.0) << std::endl;
+
+        // Time a load, as routeapp would see it
+        OSMFragment loaded;
+        loadSnapshot( snapshotFileName, loaded );
+
+        boost::posix_time::ptime done = boost::posix_time::microsec_clock::universal_time();
+        std::cout << boost::format( "Snapshot loads and verifies in %.2fs" )
+            % ((done - written).total_milliseconds() / 1000.0) << std::endl;
+    }
+    catch ( const xercesc::XMLException &toCatch )
+    {
+        std::cerr << "Exception thrown in XML parse" << std::endl;
+        return -1;
+    }
+    catch ( const std::exception &e )
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -12,12 +12,12 @@
 #include <boost/format.hpp>
 #include <boost/date_time/gregorian/gregorian_types.hpp>
 
-void compareTags( const tagMap_t &lhs, const tagMap_t &rhs, const EqualityTester &tester )
+void compareTags( const TagList &lhs, const TagList &rhs, const EqualityTester &tester )
 {
     tester.requireEqual( lhs.size(), rhs.size(), "Number of tags do not match" );
-    BOOST_FOREACH( const tagMap_t::value_type &v, lhs )
+    BOOST_FOREACH( const tag_t &v, lhs )
     {
-        tagMap_t::const_iterator findIt = rhs.find( v.first );
+        TagList::const_iterator findIt = rhs.find( v.first );
 
         if ( findIt == rhs.end() )
         {
@@ -28,6 +28,21 @@ void compareTags( const tagMap_t &lhs, const tagMap_t &rhs, const EqualityTester
     }
 }
 
+void compareTags( const NodeStore::tagRange_t &lhs, const NodeStore::tagRange_t &rhs, const EqualityTester &tester )
+{
+    // Both in TagList order
+    tester.requireEqual( size_t( lhs.size() ), size_t( rhs.size() ), "Number of tags do not match" );
+    for ( const NodeStore::tag_t *l = lhs.begin(), *r = rhs.begin(); l != lhs.end(); ++l, ++r )
+    {
+        if ( l->first != r->first )
+        {
+            tester.error( boost::str( boost::format( "Tag %s missing in rhs" ) % l->first ) );
+        }
+        
+        tester.requireEqual( l->second, r->second, "Tag values do not match" );
+    }
+}
+
 void compareBase( const OSMBase &lhs, const OSMBase &rhs, const EqualityTester &tester )
 {
     tester.requireEqual( lhs.getId(), rhs.getId(), "Ids do not match" );
@@ -36,12 +51,15 @@ void compareBase( const OSMBase &lhs, const OSMBase &rhs, const EqualityTester &
     tester.requireEqual( lhs.getUserId(), rhs.getUserId(), "User ids do not match" );
 }
 
-void compare( const OSMNode &lhs, const OSMNode &rhs, const EqualityTester &tester )
+void compare( const NodeStore::Node &lhs, const NodeStore::Node &rhs, const EqualityTester &tester )
 {
-    compareBase( lhs, rhs, tester );
+    tester.requireEqual( lhs.getId(), rhs.getId(), "Ids do not match" );
+    tester.requireEqual( lhs.getTimeStamp(), rhs.getTimeStamp(), "Timestamps do not match" );
+    tester.requireEqual( lhs.getUser(), rhs.getUser(), "User names do not match" );
+    tester.requireEqual( lhs.getUserId(), rhs.getUserId(), "User ids do not match" );
 
-    tester.requireEqual( lhs.getLat(), rhs.getLat(), "Latitude does not match" );
-    tester.requireEqual( lhs.getLon(), rhs.getLon(), "Longitude does not match" );
+    tester.requireEqual( lhs.getFixedLat(), rhs.getFixedLat(), "Latitude does not match" );
+    tester.requireEqual( lhs.getFixedLon(), rhs.getFixedLon(), "Longitude does not match" );
 
     compareTags( lhs.getTags(), rhs.getTags(), tester );
 }
@@ -102,23 +120,24 @@ void compareOSMXML( const OSMFragment &frag1, const OSMFragment &frag2 )
 
     tester.requireEqual( frag1.getVersion(), frag2.getVersion(), "Versions do not match" );
     tester.requireEqual( frag1.getGenerator(), frag2.getGenerator(), "Generators do not match" );
-    tester.requireEqual( frag1.getNodes().size(), frag2.getNodes().size(), "Number of nodes does not match" );
+    tester.requireEqual( frag1.getNodeStore().size(), frag2.getNodeStore().size(), "Number of nodes does not match" );
     tester.requireEqual( frag1.getWays().size(), frag2.getWays().size(), "Number of ways does not match" );
     tester.requireEqual( frag1.getRelations().size(), frag2.getRelations().size(), "Number of relations does not match" );
 
-    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, frag1.getNodes() )
+    const NodeStore &nodes2 = frag2.getNodeStore();
+    BOOST_FOREACH( const NodeStore::Node &node, frag1.getNodeStore() )
     {
-        EqualityTester nodeTester = tester.context( boost::str( boost::format( "Node %d" ) % v.first ) );
+        EqualityTester nodeTester = tester.context( boost::str( boost::format( "Node %d" ) % node.getId() ) );
 
-        OSMFragment::nodeMap_t::const_iterator findIt = frag2.getNodes().find( v.first );
+        NodeStore::const_iterator findIt = nodes2.find( node.getId() );
 
-        if ( findIt == frag2.getNodes().end() )
+        if ( findIt == nodes2.end() )
         {
             nodeTester.error( "Missing in second file" );
         }
         else
         {
-            compare( *v.second, *findIt->second, nodeTester );
+            compare( node, *findIt, nodeTester );
         }
     }
   
@@ -172,9 +191,11 @@ int main( int argc, char **argv )
         XercesInitWrapper x;
 
         OSMFragment fragment1, fragment2;
+        fragment1.setColumnarNodes( true );
+        fragment2.setColumnarNodes( true );
          
-        readOSMXML( x, file1, fragment1 );
-        readOSMXML( x, file2, fragment2 );
+        readOSMFile( x, file1, fragment1 );
+        readOSMFile( x, file2, fragment2 );
 
         compareOSMXML( fragment1, fragment2 );
     }
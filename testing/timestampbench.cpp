@@ -0,0 +1,83 @@
+#include "timestamp.hpp"
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/regex.hpp>
+#include <boost/format.hpp>
+#include <boost/random.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// The timestamp parse as it was before parseTimestamp, for comparison
+const boost::regex dateRegex( "(\\d{4})-(\\d{2})-(\\d{2})T(\\d{2}):(\\d{2}):(\\d{2})" );
+
+boost::posix_time::ptime regexTimestamp( const std::string &val )
+{
+    boost::smatch match;
+    if ( !boost::regex_search( val, match, dateRegex ) )
+    {
+        throw boost::bad_lexical_cast();
+    }
+
+    return boost::posix_time::ptime(
+        boost::gregorian::date(
+            boost::lexical_cast<int>( match[1] ),
+            boost::lexical_cast<int>( match[2] ),
+            boost::lexical_cast<int>( match[3] ) ),
+        boost::posix_time::time_duration(
+            boost::lexical_cast<int>( match[4] ),
+            boost::lexical_cast<int>( match[5] ),
+            boost::lexical_cast<int>( match[6] ) ) );
+}
+
+boost::posix_time::ptime fixedTimestamp( const std::string &val )
+{
+    epochTime_t epoch;
+    if ( !parseTimestamp( val.data(), val.data() + val.size(), epoch ) )
+    {
+        throw boost::bad_lexical_cast();
+    }
+
+    return epochToPtime( epoch );
+}
+
+template<typename ParseFn>
+void runBench( const std::string &name, const std::vector<std::string> &samples, size_t rounds, ParseFn parse )
+{
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    long checksum = 0;
+    for ( size_t round = 0; round < rounds; round++ )
+    {
+        for ( size_t i = 0; i < samples.size(); i++ )
+        {
+            checksum += parse( samples[i] ).time_of_day().seconds();
+        }
+    }
+
+    boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+    double nsPerParse = elapsed.total_microseconds() * 1000.0 / (rounds * samples.size());
+
+    std::cout << boost::format( "%-8s %10.1f ns/timestamp  (checksum %d)" ) % name % nsPerParse % checksum << std::endl;
+}
+
+int main( int argc, char *argv[] )
+{
+    size_t rounds = argc > 1 ? boost::lexical_cast<size_t>( argv[1] ) : 100;
+
+    // A spread of planet-like timestamps in the +00:00 form the API writes
+    boost::mt19937 rng;
+    std::vector<std::string> samples;
+    for ( size_t i = 0; i < 10000; i++ )
+    {
+        epochTime_t epoch = 1104537600 + rng() % 400000000;
+        samples.push_back( boost::posix_time::to_iso_extended_string( epochToPtime( epoch ) ) + "+00:00" );
+    }
+
+    runBench( "regex", samples, rounds, regexTimestamp );
+    runBench( "fixed", samples, rounds, fixedTimestamp );
+
+    return 0;
+}
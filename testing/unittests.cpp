@@ -1,7 +1,25 @@
 #include "xml_reader.hpp"
+#include "xml_tokenizer.hpp"
 #include "osm_data.hpp"
 #include "dbhandler.hpp"
 #include "quadtree.hpp"
+#include "bzip2_parallel.hpp"
+#include "read_ahead.hpp"
+#include "ingest_pipeline.hpp"
+#include "xml_schema.hpp"
+#include "timestamp.hpp"
+#include "ingest_filter.hpp"
+#include "pbf_reader.hpp"
+#include "xml_parallel.hpp"
+#include "osm_stream.hpp"
+#include "id_set.hpp"
+#include "ingest_two_pass.hpp"
+#include "node_locations.hpp"
+#include "ingest_checkpoint.hpp"
+#include "id_map.hpp"
+#include "node_store.hpp"
+#include "snapshot.hpp"
+#include "id_search.hpp"
 
 //#include "engine.hpp"
 
@@ -17,6 +35,10 @@
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
 #include <boost/random.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 
 #include <boost/test/included/unit_test.hpp>
 #include <boost/test/floating_point_comparison.hpp>
@@ -159,18 +181,15 @@ void testDbHandler()
 }
 
 
-void testXMLRead( std::string fileName, XercesInitWrapper &x )
+void checkTestInputFragment( const OSMFragment &newFragment )
 {
-    OSMFragment newFragment;
-    readOSMXML( x, fileName.c_str(), newFragment );
-
     BOOST_CHECK_EQUAL( newFragment.getVersion(), "0.5" );
     BOOST_CHECK_EQUAL( newFragment.getGenerator(), "OpenStreetMap server" );
     BOOST_CHECK_EQUAL( newFragment.getNodes().size(), 5 );
     BOOST_CHECK_EQUAL( newFragment.getWays().size(), 1 );
     BOOST_CHECK_EQUAL( newFragment.getRelations().size(), 1 );
 
-    const boost::shared_ptr<OSMWay> &theWay = newFragment.getWays().begin()->second;
+    const OSMWay *theWay = newFragment.getWays().begin()->second;
 
     BOOST_CHECK_EQUAL( theWay->getId(), 3236218 );
     BOOST_CHECK_EQUAL( theWay->getVisible(), true );
@@ -186,6 +205,14 @@ void testXMLRead( std::string fileName, XercesInitWrapper &x )
 
 }
 
+void testXMLRead( std::string fileName, XercesInitWrapper &x )
+{
+    OSMFragment newFragment;
+    readOSMXML( x, fileName.c_str(), newFragment );
+
+    checkTestInputFragment( newFragment );
+}
+
 
 void xmlParseTestFn()
 {
@@ -207,6 +234,1179 @@ void xmlParseTestFn()
     }
 }
 
+void xmlRawParseTestFn()
+{
+    OSMFragment newFragment;
+    readOSMXMLRaw( "testing/testinput.xml", newFragment );
+
+    checkTestInputFragment( newFragment );
+
+    // readOSMFile's default XML path
+    XercesInitWrapper x;
+    OSMFragment fileFragment;
+    readOSMFile( x, "testing/testinput.xml", fileFragment );
+    checkTestInputFragment( fileFragment );
+}
+
+struct RawEventRecorder : public RawXMLHandler
+{
+    std::stringstream m_events;
+
+    void startElement( const RawString &name, const rawAttributes_t &attributes )
+    {
+        m_events << "<" << name;
+        BOOST_FOREACH( const RawAttribute &attribute, attributes )
+        {
+            m_events << " " << attribute.m_name << "=" << attribute.m_value.toString();
+        }
+        m_events << ">";
+    }
+
+    void endElement( const RawString &name )
+    {
+        m_events << "</" << name << ">";
+    }
+};
+
+void testRawTokenizer()
+{
+    const std::string document =
+        "<?xml version='1.0'?>\n<!DOCTYPE osm [ <!ENTITY x 'y>'> ]><!-- <skip/> -->"
+        "<osm a = 'x>y' b=\"&lt;&amp;&#65;&#x42;\"><nd ref=\"1\"/><![CDATA[<zz>]]><tag k='v' ></tag ></osm>";
+
+    // Small buffers force markup to straddle refills
+    for ( size_t bufferSize = 1; bufferSize < 64; bufferSize += 7 )
+    {
+        std::istringstream is( document );
+        RawXMLTokenizer tokenizer( is, bufferSize );
+        RawEventRecorder recorder;
+        tokenizer.parse( recorder );
+
+        BOOST_CHECK_EQUAL( recorder.m_events.str(), "<osm a=x>y b=<&AB><nd ref=1></nd><tag k=v></tag></osm>" );
+    }
+
+    std::istringstream truncated( "<osm><node id='1" );
+    RawXMLTokenizer tokenizer( truncated );
+    RawEventRecorder recorder;
+    BOOST_CHECK_THROW( tokenizer.parse( recorder ), XmlParseException );
+}
+
+epochTime_t parseTimestamp( const std::string &value )
+{
+    epochTime_t epoch;
+    BOOST_REQUIRE( parseTimestamp( value.data(), value.data() + value.size(), epoch ) );
+    return epoch;
+}
+
+void testTimestamp()
+{
+    BOOST_CHECK_EQUAL( parseTimestamp( "1970-01-01T00:00:00Z" ), 0 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "2008-03-02T22:38:37Z" ), 1204497517 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "2008-03-02T22:38:37" ), 1204497517 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "2008-03-02T22:38:37+00:00" ), 1204497517 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "2008-03-02T23:38:37+01:00" ), 1204497517 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "2008-03-02T18:08:37-0430" ), 1204497517 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "2008-03-02T22:38:37.125Z" ), 1204497517 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "1969-12-31T23:59:59Z" ), -1 );
+    BOOST_CHECK_EQUAL( parseTimestamp( "2000-02-29T00:00:00Z" ), 951782400 );
+
+    const char *bad[] = { "", "2008-03-02", "2008-03-02 22:38:37", "2008-13-02T22:38:37Z",
+        "2007-02-29T00:00:00Z", "2008-03-02T22:38:37+1", "2008-03-02T22:38:37Zx", "2008-03-02T24:00:00Z" };
+    BOOST_FOREACH( const char *value, bad )
+    {
+        epochTime_t epoch;
+        BOOST_CHECK( !parseTimestamp( value, value + strlen( value ), epoch ) );
+    }
+
+    // Round trip through ptime either side of the epoch
+    boost::mt19937 rng;
+    for ( size_t i = 0; i < 1000; i++ )
+    {
+        epochTime_t epoch = epochTime_t( rng() ) - (1LL << 31);
+        boost::posix_time::ptime time = epochToPtime( epoch );
+        BOOST_CHECK_EQUAL( ptimeToEpoch( time ), epoch );
+
+        std::string formatted = boost::posix_time::to_iso_extended_string( time ) + "Z";
+        BOOST_CHECK_EQUAL( parseTimestamp( formatted ), epoch );
+    }
+}
+
+void testAttributeSchema()
+{
+    for ( size_t i = 0; i < ATTR_COUNT; i++ )
+    {
+        const char *name = attributeName( attributeId_t( i ) );
+        BOOST_CHECK_EQUAL( lookupAttribute( name, strlen( name ) ), attributeId_t( i ) );
+    }
+    BOOST_CHECK_EQUAL( lookupAttribute( "ids", 3 ), ATTR_UNKNOWN );
+    BOOST_CHECK_EQUAL( lookupAttribute( "la", 2 ), ATTR_UNKNOWN );
+    // Longer than every name, so never compared past one's end
+    BOOST_CHECK_EQUAL( lookupAttribute( "timestamps_and_more", 19 ), ATTR_UNKNOWN );
+    BOOST_CHECK_EQUAL( lookupAttribute( "", 0 ), ATTR_UNKNOWN );
+
+    boost::int64_t sval;
+    boost::uint64_t uval;
+    std::string maxSigned( "9223372036854775807" ), minSigned( "-9223372036854775808" ), tooBig( "18446744073709551616" );
+    BOOST_CHECK( parseInteger( maxSigned.data(), maxSigned.data() + maxSigned.size(), sval ) && sval == 9223372036854775807LL );
+    BOOST_CHECK( parseInteger( minSigned.data(), minSigned.data() + minSigned.size(), sval ) && sval == -9223372036854775807LL - 1 );
+    BOOST_CHECK( !parseInteger( tooBig.data(), tooBig.data() + tooBig.size(), uval ) );
+    BOOST_CHECK( !parseInteger( tooBig.data(), tooBig.data(), uval ) );
+
+    // Must agree bit for bit with strtod
+    boost::mt19937 rng;
+    for ( size_t i = 0; i < 20000; i++ )
+    {
+        std::string value = boost::str( boost::format( "%s%d.%07d" ) % (rng() & 1 ? "-" : "") % (rng() % 180) % (rng() % 10000000) );
+        double parsed;
+        BOOST_CHECK( parseDecimal( value.data(), value.data() + value.size(), parsed ) );
+        BOOST_CHECK_EQUAL( parsed, strtod( value.c_str(), 0 ) );
+    }
+
+    const char *decimals[] = { "0", "-0.5", "12", ".25", "1e3", "51.12345678901234567", "+3.0" };
+    BOOST_FOREACH( const char *value, decimals )
+    {
+        double parsed;
+        BOOST_CHECK( parseDecimal( value, value + strlen( value ), parsed ) );
+        BOOST_CHECK_EQUAL( parsed, strtod( value, 0 ) );
+    }
+    const char *badDecimals[] = { "", "-", "1.2.3", "abc", "1x" };
+    BOOST_FOREACH( const char *value, badDecimals )
+    {
+        double parsed;
+        BOOST_CHECK( !parseDecimal( value, value + strlen( value ), parsed ) );
+    }
+
+    const std::string element = "<node id='42' lat='51.5' visible='False' extra='x'/>";
+    std::istringstream is( element );
+    struct Capture : public RawXMLHandler
+    {
+        void startElement( const RawString &name, const rawAttributes_t &attributes )
+        {
+            SchemaAttributes schema;
+            schema.assign( attributes );
+
+            dbId_t id;
+            double lat, lon;
+            bool visible;
+            schema( ATTR_ID, id )( ATTR_LAT, lat )( ATTR_LON, lon, true, -1.0 )( ATTR_VISIBLE, visible );
+            BOOST_CHECK_EQUAL( id, 42U );
+            BOOST_CHECK_EQUAL( lat, 51.5 );
+            BOOST_CHECK_EQUAL( lon, -1.0 );
+            BOOST_CHECK( !visible );
+            BOOST_CHECK_THROW( schema( ATTR_REF, id ), XmlParseException );
+            BOOST_CHECK_THROW( schema( ATTR_VISIBLE, id ), XmlParseException );
+        }
+        void endElement( const RawString &name ) {}
+    } capture;
+    RawXMLTokenizer tokenizer( is );
+    tokenizer.parse( capture );
+}
+
+void countCall( size_t &count, XMLNodeData &data )
+{
+    count++;
+}
+
+void testElementDispatch()
+{
+    for ( size_t i = 0; i < ELEM_COUNT; i++ )
+    {
+        std::string name = elementName( elementId_t( i ) );
+        BOOST_CHECK_EQUAL( lookupElement( name.data(), name.size() ), elementId_t( i ) );
+
+        // As the wide characters Xerces hands over
+        std::vector<XMLCh> wide( name.begin(), name.end() );
+        BOOST_CHECK_EQUAL( lookupElement( &wide[0], wide.size() ), elementId_t( i ) );
+    }
+    BOOST_CHECK_EQUAL( lookupElement( "ndx", 3 ), ELEM_UNKNOWN );
+    BOOST_CHECK_EQUAL( lookupElement( "changeset", 9 ), ELEM_UNKNOWN );
+
+    size_t tagCount = 0, ndCount = 0, otherCount = 0;
+    XMLNodeData data;
+    data.registerMembers()
+        ( "tag", boost::bind( &countCall, boost::ref( tagCount ), _1 ) )
+        ( ELEM_ND, boost::bind( &countCall, boost::ref( ndCount ), _1 ) )
+        ( "changeset", boost::bind( &countCall, boost::ref( otherCount ), _1 ) );
+
+    BOOST_REQUIRE( data.findBuildFn( ELEM_TAG ) );
+    (*data.findBuildFn( ELEM_TAG ))( data );
+    data.getBuildFnFor( "nd" )( data );
+    data.getBuildFnFor( "changeset" )( data );
+    BOOST_CHECK( !data.findBuildFn( ELEM_WAY ) );
+    BOOST_CHECK( !data.findBuildFn( ELEM_UNKNOWN ) );
+    BOOST_CHECK_THROW( data.getBuildFnFor( "way" ), XmlParseException );
+
+    BOOST_CHECK_EQUAL( tagCount, 1U );
+    BOOST_CHECK_EQUAL( ndCount, 1U );
+    BOOST_CHECK_EQUAL( otherCount, 1U );
+}
+
+void testFrameStack()
+{
+    size_t count = 0;
+    boost::shared_ptr<XMLNodeData> start( new XMLNodeData() );
+    XMLFrameStack frames( start );
+
+    rawAttributes_t attributes;
+    XMLNodeData &first = frames.push( attributes );
+    first.registerMembers()( ELEM_TAG, boost::bind( &countCall, boost::ref( count ), _1 ) );
+    BOOST_CHECK_EQUAL( frames.depth(), 2U );
+    frames.pop();
+
+    // The sibling gets the same frame back, without the old registrations
+    XMLNodeData &second = frames.push( attributes );
+    BOOST_CHECK_EQUAL( &first, &second );
+    BOOST_CHECK( !second.findBuildFn( ELEM_TAG ) );
+    XMLNodeData &child = frames.push( attributes );
+    BOOST_CHECK_EQUAL( &child, &frames.top() );
+    BOOST_CHECK( &child != &second );
+    BOOST_CHECK_EQUAL( frames.depth(), 3U );
+}
+
+void testIngestFilter()
+{
+    std::vector<std::string> routableWayKeys( 1, "highway" );
+
+    // Just the way, and the nodes it needs
+    OSMFragment routable;
+    routable.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+    readOSMXMLRaw( "testing/testinput.xml", routable );
+    BOOST_CHECK_EQUAL( routable.getWays().size(), 1U );
+    BOOST_CHECK_EQUAL( routable.getNodes().size(), 3U );
+    BOOST_CHECK_EQUAL( routable.getRelations().size(), 0U );
+    BOOST_CHECK_EQUAL( routable.getVersion(), "0.5" );
+    BOOST_CHECK_EQUAL( routable.getNodes().find( 336847 )->second->getFixedLat(), 517829936 );
+    BOOST_CHECK_EQUAL( routable.getNodes().find( 336847 )->second->getFixedLon(), -12944341 );
+
+    // The pub and the village: the way lies outside but the relation has the village
+    OSMFragment bounded;
+    bounded.setFilter( IngestFilter().setBounds( 51.7835, -1.2935, 51.784, -1.2925 ) );
+    readOSMXMLRaw( "testing/testinput.xml", bounded );
+    BOOST_CHECK_EQUAL( bounded.getNodes().size(), 2U );
+    BOOST_CHECK_EQUAL( bounded.getWays().size(), 0U );
+    BOOST_CHECK_EQUAL( bounded.getRelations().size(), 1U );
+    BOOST_CHECK_EQUAL( bounded.getNodes().find( 20965964 )->second->getTags().size(), 3U );
+
+    OSMFragment excluded;
+    excluded.setFilter( IngestFilter().excludeTag( "amenity", "pub" ) );
+    readOSMXMLRaw( "testing/testinput.xml", excluded );
+    BOOST_CHECK_EQUAL( excluded.getNodes().size(), 4U );
+    BOOST_CHECK( excluded.getNodes().find( 20965964 ) == excluded.getNodes().end() );
+    BOOST_CHECK_EQUAL( excluded.getWays().size(), 1U );
+    BOOST_CHECK_EQUAL( excluded.getRelations().size(), 1U );
+}
+
+void testPBFRead()
+{
+    // testinput.osm.pbf holds the same data as testinput.xml
+    OSMFragment xmlFragment, pbfFragment;
+    readOSMXMLRaw( "testing/testinput.xml", xmlFragment );
+    BOOST_CHECK( isOSMPBF( "testing/testinput.osm.pbf" ) );
+    BOOST_CHECK( !isOSMPBF( "testing/testinput.xml" ) );
+    readOSMPBF( "testing/testinput.osm.pbf", pbfFragment );
+
+    BOOST_CHECK_EQUAL( pbfFragment.getVersion(), "0.6" );
+    BOOST_CHECK_EQUAL( pbfFragment.getGenerator(), "OpenStreetMap server" );
+    BOOST_REQUIRE_EQUAL( pbfFragment.getNodes().size(), xmlFragment.getNodes().size() );
+    BOOST_REQUIRE_EQUAL( pbfFragment.getWays().size(), xmlFragment.getWays().size() );
+    BOOST_REQUIRE_EQUAL( pbfFragment.getRelations().size(), xmlFragment.getRelations().size() );
+    BOOST_CHECK( pbfFragment.getUsers() == xmlFragment.getUsers() );
+
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, xmlFragment.getNodes() )
+    {
+        const OSMNode &xmlNode = *v.second;
+        const OSMNode &pbfNode = *pbfFragment.getNodes().find( v.first )->second;
+        BOOST_CHECK_EQUAL( pbfNode.getFixedLat(), xmlNode.getFixedLat() );
+        BOOST_CHECK_EQUAL( pbfNode.getFixedLon(), xmlNode.getFixedLon() );
+        BOOST_CHECK_EQUAL( pbfNode.getTimeStamp(), xmlNode.getTimeStamp() );
+        BOOST_CHECK_EQUAL( pbfNode.getUser(), xmlNode.getUser() );
+        BOOST_CHECK( pbfNode.getTags() == xmlNode.getTags() );
+    }
+
+    const OSMWay &xmlWay = *xmlFragment.getWays().begin()->second;
+    const OSMWay &pbfWay = *pbfFragment.getWays().begin()->second;
+    BOOST_CHECK_EQUAL( pbfWay.getId(), xmlWay.getId() );
+    BOOST_CHECK_EQUAL( pbfWay.getTimeStamp(), xmlWay.getTimeStamp() );
+    BOOST_CHECK_EQUAL( pbfWay.getUser(), xmlWay.getUser() );
+    BOOST_CHECK( pbfWay.getNodes() == xmlWay.getNodes() );
+    BOOST_CHECK( pbfWay.getTags() == xmlWay.getTags() );
+
+    const OSMRelation &xmlRelation = *xmlFragment.getRelations().begin()->second;
+    const OSMRelation &pbfRelation = *pbfFragment.getRelations().begin()->second;
+    BOOST_CHECK_EQUAL( pbfRelation.getUserId(), 28U );
+    BOOST_CHECK( pbfRelation.getMembers() == xmlRelation.getMembers() );
+    BOOST_CHECK( pbfRelation.getTags() == xmlRelation.getTags() );
+
+    // Filters apply as they do to XML
+    std::vector<std::string> routableWayKeys( 1, "highway" );
+    OSMFragment routable;
+    routable.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+    readOSMPBF( "testing/testinput.osm.pbf", routable );
+    BOOST_CHECK_EQUAL( routable.getWays().size(), 1U );
+    BOOST_CHECK_EQUAL( routable.getNodes().size(), 3U );
+
+    // Truncated and corrupted files must be reported
+    std::ifstream pbf( "testing/testinput.osm.pbf", std::ios_base::in | std::ios_base::binary );
+    std::stringstream contents;
+    contents << pbf.rdbuf();
+    std::string data = contents.str();
+
+    std::istringstream truncated( data.substr( 0, data.size() - 10 ) );
+    OSMFragment truncatedFragment;
+    PBFReader truncatedReader( truncated, 2 );
+    BOOST_CHECK_THROW( truncatedReader.read( truncatedFragment ), PbfFormatException );
+
+    std::string corrupt = data;
+    corrupt[ data.size() / 2 ] ^= 0x55;
+    std::istringstream corrupted( corrupt );
+    OSMFragment corruptFragment;
+    PBFReader corruptReader( corrupted, 2 );
+    BOOST_CHECK_THROW( corruptReader.read( corruptFragment ), PbfFormatException );
+
+    // A raw block without a string table, whose node has a tag of index 0
+    // (the empty string) as key and value
+    const char noStrings[] =
+        "\x00\x00\x00\x0b"                                   // BlobHeader length
+        "\x0a\x07OSMData\x18\x14"                             // BlobHeader
+        "\x0a\x10\x12\x0e\x0a\x0c"                         // Blob, PrimitiveBlock, group, node
+        "\x08\x0a\x12\x01\x00\x1a\x01\x00\x40\x00\x48\x00" // id 5, keys, vals, lat, lon
+        "\x10\x10";                                           // Blob raw_size
+    std::istringstream noStringsIs( std::string( noStrings, sizeof( noStrings ) - 1 ) );
+    OSMFragment noStringsFragment;
+    PBFReader noStringsReader( noStringsIs, 2 );
+    noStringsReader.read( noStringsFragment );
+    BOOST_REQUIRE_EQUAL( noStringsFragment.getNodes().size(), 1U );
+    BOOST_CHECK_EQUAL( noStringsFragment.getNodes().begin()->first, 5U );
+}
+
+void internStrings( std::vector<ConstTagString> &interned )
+{
+    for ( size_t i = 0; i < interned.size(); i++ )
+    {
+        interned[i] = ConstTagString( "parallel" + boost::lexical_cast<std::string>( i % 200 ) );
+    }
+}
+
+void testParallelParse()
+{
+    // Every thread gets the same index for the same string
+    std::vector<std::vector<ConstTagString> > interned( 4, std::vector<ConstTagString>( 2000 ) );
+    boost::thread_group threads;
+    for ( size_t i = 0; i < interned.size(); i++ )
+    {
+        threads.create_thread( boost::bind( &internStrings, boost::ref( interned[i] ) ) );
+    }
+    threads.join_all();
+    for ( size_t i = 1; i < interned.size(); i++ )
+    {
+        BOOST_CHECK( interned[i] == interned[0] );
+    }
+    BOOST_CHECK_EQUAL( interned[0][1234].toString(), "parallel34" );
+
+    std::string document = "<?xml version='1.0'?>\n<osm version='0.6' generator='test'>\n<bounds minlat='51' minlon='-2' maxlat='52' maxlon='-1'/>\n";
+    for ( size_t i = 1; i <= 300; i++ )
+    {
+        document += boost::str( boost::format( "<node id='%d' lat='51.%d' lon='-1.%d' timestamp='2008-03-02T22:38:37Z' user='u%d' uid='%d'><tag k='n' v='%d'/></node>\n" )
+            % i % i % i % (i % 7) % (i % 7 + 1) % i );
+    }
+    for ( size_t i = 1; i <= 40; i++ )
+    {
+        document += boost::str( boost::format( "<way id='%d' timestamp='2008-03-02T22:38:37Z'><nd ref='%d'/><nd ref='%d'/><tag k='%s' v='x'/></way>\n" )
+            % i % i % (i + 1) % (i % 2 ? "highway" : "building") );
+    }
+    document += "<relation id='1' timestamp='2008-03-02T22:38:37Z'><member type='way' ref='1' role=''/></relation>\n</osm>\n";
+
+    std::vector<const char *> boundaries;
+    const char *begin = document.data();
+    findChunkBoundaries( begin, begin + document.size(), 16, boundaries );
+    BOOST_CHECK_EQUAL( boundaries.size(), 17U );
+    BOOST_CHECK( std::string( boundaries.front(), 6 ) == "<node " );
+    BOOST_CHECK( std::string( boundaries.back() ) == "</osm>\n" );
+    for ( size_t i = 1; i + 1 < boundaries.size(); i++ )
+    {
+        BOOST_CHECK( boundaries[i] > boundaries[i - 1] );
+        std::string start( boundaries[i], 4 );
+        BOOST_CHECK( start == "<nod" || start == "<way" || start == "<rel" );
+    }
+
+    {
+        std::ofstream ofs( "testing/parallel.xml" );
+        ofs << document;
+    }
+
+    ReadOptions options;
+    options.m_parseThreads = 3;
+
+    // Through readOSMFile, as the tools read files
+    XercesInitWrapper x;
+    OSMFragment sequentialFragment, parallelFragment;
+    readOSMXMLRaw( "testing/parallel.xml", sequentialFragment );
+    readOSMFile( x, "testing/parallel.xml", parallelFragment, options );
+
+    BOOST_CHECK_EQUAL( parallelFragment.getVersion(), "0.6" );
+    BOOST_CHECK_EQUAL( parallelFragment.getGenerator(), "test" );
+    BOOST_CHECK_EQUAL( parallelFragment.getNodes().size(), 300U );
+    BOOST_CHECK_EQUAL( parallelFragment.getWays().size(), 40U );
+    BOOST_CHECK_EQUAL( parallelFragment.getRelations().size(), 1U );
+    BOOST_CHECK( parallelFragment.getUsers() == sequentialFragment.getUsers() );
+    BOOST_CHECK( parallelFragment.getNodes().find( 123 )->second->getTags() ==
+                 sequentialFragment.getNodes().find( 123 )->second->getTags() );
+    BOOST_CHECK( parallelFragment.getWays().find( 7 )->second->getNodes() ==
+                 sequentialFragment.getWays().find( 7 )->second->getNodes() );
+
+    // Filters are applied per chunk, with way nodes completed after the merge
+    std::vector<std::string> routableWayKeys( 1, "highway" );
+    OSMFragment routable;
+    routable.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+    readOSMXMLRaw( "testing/parallel.xml", routable, options );
+    BOOST_CHECK_EQUAL( routable.getWays().size(), 20U );
+    BOOST_CHECK_EQUAL( routable.getNodes().size(), 40U );
+
+    // Xerces parses on one thread only
+    ReadOptions xercesOptions( options );
+    xercesOptions.m_useXerces = true;
+    OSMFragment xercesFragment;
+    BOOST_CHECK_THROW( readOSMFile( x, "testing/parallel.xml", xercesFragment, xercesOptions ), std::logic_error );
+
+    remove( "testing/parallel.xml" );
+
+    OSMFragment small;
+    readOSMXMLRaw( "testing/testinput.xml", small, options );
+    checkTestInputFragment( small );
+}
+
+struct CountingVisitor : public OSMVisitor
+{
+    size_t                      nodes, ways, relations;
+    size_t                      wayNodes, tags;
+    OSMFragment::userMap_t      users;
+    std::set<const OSMBase *>   objects;
+
+    CountingVisitor() : nodes( 0 ), ways( 0 ), relations( 0 ), wayNodes( 0 ), tags( 0 ) {}
+
+    void onNode( const OSMNode &node )
+    {
+        nodes++;
+        tags += node.getTags().size();
+        objects.insert( &node );
+    }
+
+    void onWay( const OSMWay &way )
+    {
+        ways++;
+        wayNodes += way.getNodes().size();
+        tags += way.getTags().size();
+        objects.insert( &way );
+    }
+
+    void onRelation( const OSMRelation &relation )
+    {
+        relations++;
+        tags += relation.getTags().size();
+        objects.insert( &relation );
+    }
+
+    void onUser( dbId_t userId, const std::string &userName )
+    {
+        BOOST_CHECK( users.insert( std::make_pair( userId, userName ) ).second );
+    }
+};
+
+void testOSMStream()
+{
+    OSMFragment fragment;
+    readOSMXMLRaw( "testing/testinput.xml", fragment );
+
+    size_t tags = 0;
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, fragment.getNodes() )
+    {
+        tags += v.second->getTags().size();
+    }
+    tags += fragment.getWays().begin()->second->getTags().size();
+    tags += fragment.getRelations().begin()->second->getTags().size();
+
+    const char *files[] = { "testing/testinput.xml", "testing/testinput.osm.pbf" };
+    BOOST_FOREACH( const char *file, files )
+    {
+        CountingVisitor visitor;
+        streamOSMFile( file, visitor );
+
+        BOOST_CHECK_EQUAL( visitor.nodes, fragment.getNodes().size() );
+        BOOST_CHECK_EQUAL( visitor.ways, 1U );
+        BOOST_CHECK_EQUAL( visitor.relations, 1U );
+        BOOST_CHECK_EQUAL( visitor.wayNodes, fragment.getWays().begin()->second->getNodes().size() );
+        BOOST_CHECK_EQUAL( visitor.tags, tags );
+        BOOST_CHECK( visitor.users == fragment.getUsers() );
+
+        // One object of each type, reused throughout
+        BOOST_CHECK_EQUAL( visitor.objects.size(), 3U );
+    }
+}
+
+void testTruncatedXML()
+{
+    std::string contents;
+    {
+        std::ifstream xml( "testing/testinput.xml" );
+        std::stringstream buffer;
+        buffer << xml.rdbuf();
+        contents = buffer.str();
+    }
+
+    // Cut between objects, so every element read is whole; and an end tag
+    // that doesn't match its element
+    std::string mismatched( contents );
+    mismatched.replace( mismatched.find( "</way>" ), 6, "</node>" );
+    std::string documents[] = { contents.substr( 0, contents.rfind( "</osm>" ) ), mismatched };
+
+    ReadOptions pipelined;
+    pipelined.m_pipelined = true;
+    ReadOptions parallel;
+    parallel.m_parseThreads = 3;
+    ReadOptions readerOptions[] = { ReadOptions(), pipelined, parallel };
+
+    BOOST_FOREACH( const std::string &document, documents )
+    {
+        {
+            std::ofstream ofs( "testing/truncated.xml", std::ios_base::out | std::ios_base::binary );
+            ofs << document;
+        }
+
+        BOOST_FOREACH( const ReadOptions &options, readerOptions )
+        {
+            OSMFragment fragment;
+            BOOST_CHECK_THROW( readOSMXMLRaw( "testing/truncated.xml", fragment, options ), XmlParseException );
+        }
+
+        CountingVisitor visitor;
+        BOOST_CHECK_THROW( streamOSMFile( "testing/truncated.xml", visitor ), XmlParseException );
+    }
+
+    remove( "testing/truncated.xml" );
+}
+
+void testTwoPassRead()
+{
+    IdSet ids;
+    for ( dbId_t i = 0; i < 3000000; i++ )
+    {
+        ids.add( (i * 7919) % 1000003 );
+    }
+    ids.finalise();
+    BOOST_CHECK_EQUAL( ids.size(), 1000003U );
+    BOOST_CHECK( ids.contains( 0 ) && ids.contains( 1000002 ) );
+    BOOST_CHECK( !ids.contains( 1000003 ) );
+    BOOST_CHECK_THROW( ids.add( 1 ), std::logic_error );
+
+    std::vector<std::string> routableWayKeys( 1, "highway" );
+    OSMFragment onePass, twoPass;
+    onePass.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+    twoPass.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+
+    XercesInitWrapper x;
+    readOSMFile( x, "testing/testinput.osm.pbf", onePass );
+    readOSMFileTwoPass( x, "testing/testinput.osm.pbf", twoPass );
+
+    BOOST_REQUIRE( twoPass.getFilter()->hasNodeIds() );
+    BOOST_CHECK_EQUAL( twoPass.getWays().size(), 1U );
+    BOOST_REQUIRE_EQUAL( twoPass.getNodes().size(), onePass.getNodes().size() );
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, onePass.getNodes() )
+    {
+        OSMFragment::nodeMap_t::const_iterator findIt = twoPass.getNodes().find( v.first );
+        BOOST_REQUIRE( findIt != twoPass.getNodes().end() );
+        BOOST_CHECK_EQUAL( findIt->second->getLat(), v.second->getLat() );
+        BOOST_CHECK_EQUAL( findIt->second->getLon(), v.second->getLon() );
+    }
+
+    // A node id set alone decides which nodes are kept
+    boost::shared_ptr<IdSet> nodeIds( new IdSet() );
+    nodeIds->add( twoPass.getNodes().begin()->first );
+    nodeIds->finalise();
+    OSMFragment listed;
+    listed.setFilter( IngestFilter().setNodeIds( nodeIds ) );
+    readOSMXMLRaw( "testing/testinput.xml", listed );
+    BOOST_CHECK_EQUAL( listed.getNodes().size(), 1U );
+    BOOST_CHECK_EQUAL( listed.getWays().size(), 1U );
+}
+
+void testNodeLocations()
+{
+    coord_t lat, lon;
+    {
+        DenseNodeLocations dense( "testing/nodelocations.bin" );
+        dense.set( 1, 0, 0 );
+        dense.set( 2, toFixed( -90.0 ), toFixed( -180.0 ) );
+        dense.set( 5000000, 517654321, -12345678 );
+        BOOST_CHECK( !dense.get( 0, lat, lon ) );
+        BOOST_CHECK( !dense.get( 3, lat, lon ) );
+        BOOST_CHECK( !dense.get( 50000000, lat, lon ) );
+        BOOST_REQUIRE( dense.get( 1, lat, lon ) );
+        BOOST_CHECK_EQUAL( lat, 0 );
+        BOOST_CHECK_EQUAL( lon, 0 );
+        BOOST_REQUIRE( dense.get( 2, lat, lon ) );
+        BOOST_CHECK_EQUAL( fromFixed( lat ), -90.0 );
+        BOOST_CHECK_EQUAL( fromFixed( lon ), -180.0 );
+        BOOST_REQUIRE( dense.get( 5000000, lat, lon ) );
+        BOOST_CHECK_EQUAL( lat, 517654321 );
+        BOOST_CHECK_EQUAL( lon, -12345678 );
+    }
+    remove( "testing/nodelocations.bin" );
+
+    SparseNodeLocations sparse;
+    sparse.set( 900, toFixed( 10.0 ), toFixed( 20.0 ) );
+    sparse.set( 12, toFixed( 30.0 ), toFixed( 40.0 ) );
+    sparse.set( 900, toFixed( 11.0 ), toFixed( 21.0 ) );
+    BOOST_CHECK( !sparse.get( 13, lat, lon ) );
+    BOOST_REQUIRE( sparse.get( 12, lat, lon ) );
+    BOOST_CHECK_EQUAL( fromFixed( lat ), 30.0 );
+    BOOST_REQUIRE( sparse.get( 900, lat, lon ) );
+    BOOST_CHECK_EQUAL( fromFixed( lon ), 21.0 );
+
+    // Way nodes come from the store rather than held back records
+    std::vector<std::string> routableWayKeys( 1, "highway" );
+    OSMFragment deferred, stored;
+    deferred.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+    stored.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+    stored.setNodeLocations( boost::shared_ptr<NodeLocationStore>( new SparseNodeLocations() ) );
+    readOSMXMLRaw( "testing/testinput.xml", deferred );
+    readOSMXMLRaw( "testing/testinput.xml", stored );
+
+    BOOST_REQUIRE_EQUAL( stored.getNodes().size(), deferred.getNodes().size() );
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, deferred.getNodes() )
+    {
+        BOOST_REQUIRE( stored.getNodeLocation( v.first, lat, lon ) );
+        BOOST_CHECK_EQUAL( lat, v.second->getFixedLat() );
+        BOOST_CHECK_EQUAL( lon, v.second->getFixedLon() );
+    }
+
+    // Every node read is in the store, including those the filter dropped
+    OSMFragment full;
+    readOSMXMLRaw( "testing/testinput.xml", full );
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, full.getNodes() )
+    {
+        BOOST_CHECK( stored.getNodeLocation( v.first, lat, lon ) );
+        BOOST_CHECK_EQUAL( deferred.getNodeLocation( v.first, lat, lon ), deferred.getNodes().count( v.first ) == 1 );
+    }
+}
+
+void testFixedCoords()
+{
+    const char *texts[] = { "51.7829936", "-1.2944341", "0", "-0.0000001", "180", "-90.5", "+3.25" };
+    const coord_t values[] = { 517829936, -12944341, 0, -1, 1800000000, -905000000, 32500000 };
+    for ( size_t i = 0; i < sizeof( values ) / sizeof( values[0] ); i++ )
+    {
+        coord_t value;
+        BOOST_REQUIRE( parseFixed( texts[i], texts[i] + strlen( texts[i] ), value ) );
+        BOOST_CHECK_EQUAL( value, values[i] );
+        BOOST_CHECK_EQUAL( toFixed( fromFixed( value ) ), value );
+    }
+
+    // Printed back as written, but without the sign of +3.25
+    BOOST_CHECK_EQUAL( formatFixed( 517829936 ), "51.7829936" );
+    BOOST_CHECK_EQUAL( formatFixed( -1 ), "-0.0000001" );
+    BOOST_CHECK_EQUAL( formatFixed( -905000000 ), "-90.5" );
+    BOOST_CHECK_EQUAL( formatFixed( 1800000000 ), "180" );
+    BOOST_CHECK_EQUAL( formatFixed( 0 ), "0" );
+
+    // Rounded past the 7th place, away from zero on a half
+    const char *longer[] = { "1.00000004", "1.00000005", "-1.00000005", "1.2e-6" };
+    const coord_t rounded[] = { 10000000, 10000001, -10000001, 12 };
+    for ( size_t i = 0; i < sizeof( rounded ) / sizeof( rounded[0] ); i++ )
+    {
+        coord_t value;
+        BOOST_REQUIRE( parseFixed( longer[i], longer[i] + strlen( longer[i] ), value ) );
+        BOOST_CHECK_EQUAL( value, rounded[i] );
+    }
+    BOOST_CHECK_EQUAL( toFixed( -0.00000005 ), -1 );
+
+    const char *bad[] = { "", "-", ".", "1.2.3", "51,5", "215", "1e10" };
+    for ( size_t i = 0; i < sizeof( bad ) / sizeof( bad[0] ); i++ )
+    {
+        coord_t value;
+        BOOST_CHECK( !parseFixed( bad[i], bad[i] + strlen( bad[i] ), value ) );
+    }
+
+    BOOST_CHECK_CLOSE( fixedDistBetween( 517829936, -12944341, 517840000, -12930000 ),
+        distBetween( 51.7829936, -1.2944341, 51.784, -1.293 ), 1e-9 );
+}
+
+void testIdMap()
+{
+    typedef IdMap<int> map_t;
+
+    map_t ids;
+    for ( int i = 10; i <= 100; i += 10 )
+    {
+        BOOST_CHECK( ids.insert( map_t::value_type( i, i ) ) );
+    }
+    BOOST_CHECK( ids.isSorted() );
+    BOOST_CHECK( !ids.insert( map_t::value_type( 50, 0 ) ) );
+
+    // Out of order: into the overflow, but found and iterated in id order
+    BOOST_CHECK( ids.insert( map_t::value_type( 55, 55 ) ) );
+    BOOST_CHECK( ids.insert( map_t::value_type( 5, 5 ) ) );
+    BOOST_CHECK( !ids.insert( map_t::value_type( 55, 0 ) ) );
+    BOOST_CHECK( !ids.isSorted() );
+    BOOST_CHECK_EQUAL( ids.size(), 12U );
+    BOOST_CHECK_EQUAL( ids.find( 50 )->second, 50 );
+    BOOST_CHECK_EQUAL( ids.find( 55 )->second, 55 );
+    BOOST_CHECK( ids.find( 56 ) == ids.end() );
+    BOOST_CHECK_EQUAL( ids.count( 5 ), 1U );
+
+    std::vector<map_t::key_type> order;
+    for ( map_t::const_iterator it = ids.find( 50 ); it != ids.end(); ++it )
+    {
+        order.push_back( it->first );
+    }
+    BOOST_REQUIRE_EQUAL( order.size(), 7U );
+    BOOST_CHECK_EQUAL( order[1], 55U );
+
+    std::vector<map_t::key_type> before;
+    BOOST_FOREACH( const map_t::value_type &v, ids )
+    {
+        BOOST_CHECK_EQUAL( map_t::key_type( v.second ), v.first );
+        before.push_back( v.first );
+    }
+    BOOST_CHECK( std::adjacent_find( before.begin(), before.end(), std::greater_equal<map_t::key_type>() ) == before.end() );
+
+    ids.finalise();
+    BOOST_CHECK( ids.isSorted() );
+    std::vector<map_t::key_type> after;
+    BOOST_FOREACH( const map_t::value_type &v, ids )
+    {
+        after.push_back( v.first );
+    }
+    BOOST_CHECK( after == before );
+
+    map_t strict;
+    strict.setAssertSorted( true );
+    strict.insert( map_t::value_type( 2, 2 ) );
+    BOOST_CHECK( !strict.insert( map_t::value_type( 2, 2 ) ) );
+    BOOST_CHECK_THROW( strict.insert( map_t::value_type( 1, 1 ) ), std::logic_error );
+
+    OSMFragment sorted;
+    sorted.setSortedInput( true );
+    readOSMXMLRaw( "testing/testinput.xml", sorted );
+    checkTestInputFragment( sorted );
+    BOOST_CHECK( sorted.getNodes().isSorted() );
+}
+
+void testNodeStore()
+{
+    NodeStore nodes;
+    nodes.add( 30, toFixed( 3.0 ), toFixed( -3.0 ) );
+    nodes.add( 10, toFixed( 1.0 ), toFixed( -1.0 ) );
+
+    OSMNode tagged( 20, toFixed( 2.0 ), toFixed( -2.0 ) );
+    tagged.setBaseData( 20, boost::posix_time::time_from_string( "2008-03-02 22:38:37" ), "someone", 7 );
+    tagged.addTag( "amenity", "pub" );
+    tagged.addTag( "name", "The Bear" );
+    nodes.add( tagged );
+
+    // A repeat is ignored, as with IdMap
+    nodes.add( 10, toFixed( 9.0 ), toFixed( 9.0 ) );
+
+    BOOST_REQUIRE_EQUAL( nodes.size(), 3U );
+    std::vector<dbId_t> ids;
+    BOOST_FOREACH( const NodeStore::Node &node, nodes )
+    {
+        ids.push_back( node.getId() );
+    }
+    BOOST_CHECK( std::adjacent_find( ids.begin(), ids.end(), std::greater_equal<dbId_t>() ) == ids.end() );
+
+    NodeStore::const_iterator findIt = nodes.find( 10 );
+    BOOST_REQUIRE( findIt != nodes.end() );
+    BOOST_CHECK_EQUAL( findIt->getLat(), 1.0 );
+    BOOST_CHECK_EQUAL( findIt->getTags().size(), 0 );
+    BOOST_CHECK( findIt->getTimeStamp().is_special() );
+    BOOST_CHECK_EQUAL( findIt->getUserId(), 0U );
+    BOOST_CHECK( nodes.find( 15 ) == nodes.end() );
+
+    NodeStore::Node pub = *nodes.find( 20 );
+    BOOST_CHECK_EQUAL( pub.getLon(), -2.0 );
+    BOOST_CHECK_EQUAL( pub.getTags().size(), 2 );
+    ConstTagString name;
+    BOOST_CHECK( pub.findTag( "name", name ) && name == "The Bear" );
+    BOOST_CHECK( !pub.findTag( "shop", name ) );
+    BOOST_CHECK_EQUAL( pub.getTimeStamp(), tagged.getTimeStamp() );
+    BOOST_CHECK_EQUAL( pub.getUser(), "someone" );
+    BOOST_CHECK_EQUAL( pub.getUserId(), 7U );
+
+    std::pair<NodeStore::const_iterator, NodeStore::const_iterator> range = nodes.range( 15, 30 );
+    BOOST_CHECK_EQUAL( range.second - range.first, 2 );
+    BOOST_CHECK_EQUAL( range.first->getId(), 20U );
+    range = nodes.range( 31, 40 );
+    BOOST_CHECK( range.first == range.second );
+
+    BOOST_CHECK_EQUAL( nodes.indexOf( 20 ), 1U );
+    BOOST_CHECK_EQUAL( nodes.at( nodes.indexOf( 30 ) ).getLat(), 3.0 );
+    BOOST_CHECK_EQUAL( nodes.indexOf( 15 ), NodeStore::noIndex );
+
+    // Merged nodes already present lose
+    NodeStore more;
+    more.add( 40, toFixed( 4.0 ), toFixed( -4.0 ) );
+    more.add( tagged );
+    nodes.add( 5, toFixed( 0.5 ), toFixed( -0.5 ) );
+    OSMNode other( 20, 0, 0 );
+    more.add( other );
+    nodes.merge( more );
+    BOOST_CHECK( more.empty() );
+    BOOST_CHECK_EQUAL( nodes.size(), 5U );
+    BOOST_CHECK_EQUAL( nodes.find( 20 )->getUser(), "someone" );
+    BOOST_CHECK_EQUAL( nodes.find( 40 )->getLon(), -4.0 );
+
+    // Through a fragment, against the node map
+    OSMFragment mapped, columnar;
+    columnar.setColumnarNodes( true );
+    readOSMXMLRaw( "testing/testinput.xml", mapped );
+    readOSMXMLRaw( "testing/testinput.xml", columnar );
+    BOOST_CHECK( columnar.getNodes().empty() );
+    BOOST_REQUIRE_EQUAL( columnar.getNodeStore().size(), mapped.getNodes().size() );
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, mapped.getNodes() )
+    {
+        NodeStore::const_iterator storeIt = columnar.getNodeStore().find( v.first );
+        BOOST_REQUIRE( storeIt != columnar.getNodeStore().end() );
+        BOOST_CHECK_EQUAL( storeIt->getFixedLat(), v.second->getFixedLat() );
+        BOOST_CHECK_EQUAL( storeIt->getFixedLon(), v.second->getFixedLon() );
+        BOOST_CHECK_EQUAL( storeIt->getTimeStamp(), v.second->getTimeStamp() );
+        BOOST_CHECK_EQUAL( storeIt->getUser(), v.second->getUser() );
+        const TagList &tags = v.second->getTags();
+        BOOST_REQUIRE_EQUAL( size_t( storeIt->getTags().size() ), tags.size() );
+        BOOST_CHECK( std::equal( tags.begin(), tags.end(), storeIt->getTags().begin() ) );
+    }
+
+    // Filtered, with the way nodes added at the end
+    std::vector<std::string> routableWayKeys( 1, "highway" );
+    OSMFragment routable;
+    routable.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+    routable.setColumnarNodes( true );
+    readOSMXMLRaw( "testing/testinput.xml", routable );
+    BOOST_CHECK_EQUAL( routable.getNodeStore().size(), 3U );
+    coord_t lat, lon;
+    BOOST_CHECK( routable.getNodeLocation( 336847, lat, lon ) );
+    BOOST_CHECK_EQUAL( lat, 517829936 );
+    BOOST_CHECK_EQUAL( lon, -12944341 );
+}
+
+void testIngestPipeline()
+{
+    std::string document = "<?xml version='1.0'?>\n<osm version='0.6'>";
+    for ( size_t i = 0; i < 500; i++ )
+    {
+        document += boost::str( boost::format( "<way id='%d'><nd ref='%d'/><tag k='name' v='&lt;%d&gt;'/></way>\n" ) % i % (i * 7) % i );
+    }
+    document += "</osm>";
+
+    std::istringstream directIs( document );
+    RawXMLTokenizer tokenizer( directIs );
+    RawEventRecorder direct;
+    tokenizer.parse( direct );
+
+    // Tiny buffers and batches so that every stage stalls on the others
+    std::istringstream is( document );
+    RawEventRecorder pipelined;
+    IngestPipeline pipeline( is, pipelined, 2, 13, 3 );
+    pipeline.run();
+
+    BOOST_CHECK_EQUAL( pipelined.m_events.str(), direct.m_events.str() );
+
+    std::istringstream truncated( "<osm><node id='1'/><node id='2" );
+    RawEventRecorder recorder;
+    IngestPipeline failing( truncated, recorder, 2, 4, 1 );
+    BOOST_CHECK_THROW( failing.run(), XmlParseException );
+
+    ReadOptions options;
+    options.m_pipelined = true;
+
+    OSMFragment newFragment;
+    readOSMXMLRaw( "testing/testinput.xml", newFragment, options );
+    checkTestInputFragment( newFragment );
+
+    // As the tools read files
+    XercesInitWrapper x;
+    OSMFragment fileFragment;
+    readOSMFile( x, "testing/testinput.xml", fileFragment, options );
+    checkTestInputFragment( fileFragment );
+
+    // Xerces can't be pipelined
+    options.m_useXerces = true;
+    OSMFragment xercesFragment;
+    BOOST_CHECK_THROW( readOSMFile( x, "testing/testinput.xml", xercesFragment, options ), std::logic_error );
+}
+
+std::string bzip2Compress( const std::string &data )
+{
+    std::string compressed;
+    boost::iostreams::filtering_ostream out;
+    out.push( boost::iostreams::bzip2_compressor( boost::iostreams::bzip2_params( 1 ) ) );
+    out.push( boost::iostreams::back_inserter( compressed ) );
+    out << data;
+    out.reset();
+
+    return compressed;
+}
+
+void testParallelBzip2()
+{
+    // Enough incompressible-ish data for several 100k blocks
+    boost::mt19937 rng;
+    std::string original;
+    for ( size_t i = 0; i < 40000; i++ )
+    {
+        original += boost::str( boost::format( "<node id=\"%d\" lat=\"%d\"/>\n" ) % i % rng() );
+    }
+
+    // Two concatenated streams, as produced by pbzip2 and friends
+    std::istringstream is( bzip2Compress( original ) + bzip2Compress( original ) );
+    boost::iostreams::filtering_istream in;
+    in.push( ParallelBzip2Source( is, 3 ) );
+
+    std::string decompressed;
+    boost::iostreams::copy( in, boost::iostreams::back_inserter( decompressed ) );
+    BOOST_CHECK( decompressed == original + original );
+
+    // Through the file readers
+    {
+        std::ifstream xml( "testing/testinput.xml" );
+        std::stringstream contents;
+        contents << xml.rdbuf();
+
+        std::ofstream ofs( "testing/testinput.xml.bz2", std::ios_base::out | std::ios_base::binary );
+        ofs << bzip2Compress( contents.str() );
+    }
+
+    ReadOptions options;
+    options.m_decompressThreads = 2;
+
+    OSMFragment newFragment;
+    readOSMXMLRaw( "testing/testinput.xml.bz2", newFragment, options );
+    checkTestInputFragment( newFragment );
+    remove( "testing/testinput.xml.bz2" );
+
+    // A truncated stream must be reported, not read as a short file
+    std::string compressed = bzip2Compress( original );
+    std::istringstream truncated( compressed.substr( 0, compressed.size() / 2 ) );
+    boost::iostreams::filtering_istream truncatedIn;
+    truncatedIn.push( ParallelBzip2Source( truncated, 2 ) );
+    truncatedIn.exceptions( std::ios_base::badbit );
+    BOOST_CHECK_THROW( boost::iostreams::copy( truncatedIn, boost::iostreams::back_inserter( decompressed ) ), std::exception );
+
+    // Each block's table of the byte values used has a 16 bit word per
+    // range of 16 values used. Data made of just these bytes puts the end of
+    // stream magic, 0x177245385090, inside every block.
+    const boost::uint16_t usedWords[] = { 0x1772, 0x4538, 0x5090 };
+    std::string alphabet;
+    for ( size_t range = 0; range < 3; range++ )
+    {
+        for ( size_t bit = 0; bit < 16; bit++ )
+        {
+            if ( usedWords[range] & (0x8000 >> bit) )
+            {
+                alphabet += char( 0x20 + 16 * range + bit );
+            }
+        }
+    }
+
+    std::string falseEnds;
+    for ( size_t i = 0; i < 250000; i++ )
+    {
+        falseEnds += alphabet[rng() % alphabet.size()];
+    }
+
+    std::istringstream falseEndsIs( bzip2Compress( falseEnds ) + bzip2Compress( original ) );
+    boost::iostreams::filtering_istream falseEndsIn;
+    falseEndsIn.push( ParallelBzip2Source( falseEndsIs, 2 ) );
+    falseEndsIn.exceptions( std::ios_base::badbit );
+
+    decompressed.clear();
+    boost::iostreams::copy( falseEndsIn, boost::iostreams::back_inserter( decompressed ) );
+    BOOST_CHECK( decompressed == falseEnds + original );
+
+    // Empty streams between and after others
+    std::string withEmpty[] = {
+        bzip2Compress( original ) + bzip2Compress( "" ) + bzip2Compress( original ),
+        bzip2Compress( original ) + bzip2Compress( "" ) + bzip2Compress( "" ) + bzip2Compress( original ) + bzip2Compress( "" ) };
+    BOOST_FOREACH( const std::string &compressed, withEmpty )
+    {
+        std::istringstream emptyIs( compressed );
+        boost::iostreams::filtering_istream emptyIn;
+        emptyIn.push( ParallelBzip2Source( emptyIs, 2 ) );
+        emptyIn.exceptions( std::ios_base::badbit );
+
+        decompressed.clear();
+        boost::iostreams::copy( emptyIn, boost::iostreams::back_inserter( decompressed ) );
+        BOOST_CHECK( decompressed == original + original );
+    }
+}
+
+void testReadAhead()
+{
+    // Not a whole number of buffers
+    boost::mt19937 rng;
+    std::string original;
+    for ( size_t i = 0; i < 10000; i++ )
+    {
+        original += boost::str( boost::format( "<node id=\"%d\" lat=\"%d\"/>\n" ) % i % rng() );
+    }
+    {
+        std::ofstream ofs( "testing/readahead.dat", std::ios_base::out | std::ios_base::binary );
+        ofs << original;
+        std::ofstream empty( "testing/readahead.empty", std::ios_base::out | std::ios_base::binary );
+    }
+
+    // Both backends (io_uring falls back to pread where it isn't allowed)
+    for ( int allowUring = 0; allowUring < 2; allowUring++ )
+    {
+        ReadAheadReader reader( "testing/readahead.dat", 3, 4096, allowUring != 0 );
+        BOOST_CHECK( allowUring || std::string( reader.backendName() ) == "pread" );
+
+        // Reads that straddle buffers
+        std::string contents;
+        char buffer[3000];
+        std::streamsize count;
+        while ( (count = reader.read( buffer, sizeof( buffer ) )) > 0 )
+        {
+            contents.append( buffer, count );
+        }
+        BOOST_CHECK_EQUAL( count, -1 );
+        BOOST_CHECK( contents == original );
+
+        ReadAheadReader empty( "testing/readahead.empty", 3, 4096, allowUring != 0 );
+        BOOST_CHECK_EQUAL( empty.read( buffer, sizeof( buffer ) ), -1 );
+    }
+
+    // Dropped part way through, with reads still in flight
+    {
+        ReadAheadReader reader( "testing/readahead.dat", 4, 1024 );
+        char buffer[100];
+        BOOST_CHECK_EQUAL( reader.read( buffer, sizeof( buffer ) ), 100 );
+        BOOST_CHECK( std::string( buffer, 100 ) == original.substr( 0, 100 ) );
+    }
+
+    BOOST_CHECK_THROW( ReadAheadReader( "testing/nonexistent.dat" ), std::runtime_error );
+    remove( "testing/readahead.dat" );
+    remove( "testing/readahead.empty" );
+
+    // Through the file readers, plain and compressed
+    OSMFragment plainFragment;
+    readOSMXMLRaw( "testing/testinput.xml", plainFragment );
+    checkTestInputFragment( plainFragment );
+
+    {
+        std::ifstream xml( "testing/testinput.xml" );
+        std::stringstream contents;
+        contents << xml.rdbuf();
+
+        std::ofstream ofs( "testing/testinput.xml.bz2", std::ios_base::out | std::ios_base::binary );
+        ofs << bzip2Compress( contents.str() );
+    }
+
+    ReadOptions options;
+    options.m_decompressThreads = 1;
+    OSMFragment compressedFragment;
+    readOSMXMLRaw( "testing/testinput.xml.bz2", compressedFragment, options );
+    checkTestInputFragment( compressedFragment );
+    remove( "testing/testinput.xml.bz2" );
+}
+
+void testCheckpointedRead()
+{
+    // Several MB, so that the reads fail after some checkpoints rather than
+    // in the tokenizer's first refill
+    boost::mt19937 rng;
+    std::string document = "<?xml version='1.0'?>\n<osm version='0.6' generator='test'>\n";
+    for ( size_t i = 1; i <= 30000; i++ )
+    {
+        document += boost::str( boost::format( "<node id='%d' lat='%d.%07d' lon='-1.%07d' timestamp='2008-03-02T22:38:37Z' user='u%d' uid='%d'><tag k='n' v='%d'/></node>\n" )
+            % i % (rng() % 80) % (rng() % 10000000) % (rng() % 10000000) % (i % 11) % (i % 11 + 1) % rng() );
+    }
+    for ( size_t i = 1; i <= 3000; i++ )
+    {
+        document += boost::str( boost::format( "<way id='%d' timestamp='2008-03-02T22:38:37Z' user='u1' uid='2'><nd ref='%d'/><nd ref='%d'/><nd ref='%d'/><tag k='%s' v='x'/></way>\n" )
+            % i % (i * 7) % (i * 7 + 1) % (i * 9) % (i % 2 ? "highway" : "building") );
+    }
+    document += "<relation id='1' timestamp='2008-03-02T22:38:37Z'><member type='way' ref='1' role='outer'/></relation>\n</osm>\n";
+
+    std::string compressed = bzip2Compress( document );
+    const std::string fileNames[] = { "testing/checkpointed.xml", "testing/checkpointed.xml.bz2" };
+    const std::string contents[] = { document, compressed };
+
+    std::vector<std::string> routableWayKeys( 1, "highway" );
+    ReadOptions options;
+    options.m_decompressThreads = 2;
+
+    remove( "testing/checkpoint" );
+    remove( "testing/checkpoint.journal" );
+
+    for ( size_t i = 0; i < 2; i++ )
+    {
+        {
+            std::ofstream ofs( fileNames[i].c_str(), std::ios_base::out | std::ios_base::binary );
+            ofs << contents[i];
+        }
+
+        // Plain, then filtered, which journals the locations of the nodes it drops
+        OSMFragment reference;
+        if ( i == 1 )
+        {
+            reference.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+        }
+        readOSMXMLRaw( fileNames[i], reference, options );
+
+        // Cut short, as by a failure part way through
+        {
+            std::ofstream ofs( fileNames[i].c_str(), std::ios_base::out | std::ios_base::binary );
+            ofs << contents[i].substr( 0, contents[i].size() * 7 / 10 );
+        }
+
+        OSMFragment failed;
+        if ( i == 1 )
+        {
+            failed.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+        }
+        BOOST_CHECK_THROW( readOSMXMLCheckpointed( fileNames[i], failed, "testing/checkpoint", options, 1000 ), std::exception );
+
+        IngestCheckpoint checkpoint;
+        BOOST_REQUIRE( checkpoint.load( "testing/checkpoint" ) );
+        BOOST_CHECK_EQUAL( checkpoint.m_fileName, fileNames[i] );
+        BOOST_CHECK( checkpoint.m_nodes > 0 );
+        BOOST_CHECK( checkpoint.m_offset < document.size() );
+
+        {
+            std::ofstream ofs( fileNames[i].c_str(), std::ios_base::out | std::ios_base::binary );
+            ofs << contents[i];
+        }
+
+        OSMFragment resumed;
+        if ( i == 1 )
+        {
+            resumed.setFilter( IngestFilter::routableWays( routableWayKeys ) );
+        }
+        readOSMXMLCheckpointed( fileNames[i], resumed, "testing/checkpoint", options, 1000 );
+
+        BOOST_CHECK( !checkpoint.load( "testing/checkpoint" ) );
+        BOOST_CHECK_EQUAL( resumed.getVersion(), "0.6" );
+        BOOST_CHECK_EQUAL( resumed.getGenerator(), "test" );
+        BOOST_REQUIRE_EQUAL( resumed.getNodes().size(), reference.getNodes().size() );
+        BOOST_REQUIRE_EQUAL( resumed.getWays().size(), reference.getWays().size() );
+        BOOST_CHECK_EQUAL( resumed.getRelations().size(), reference.getRelations().size() );
+        BOOST_CHECK( resumed.getUsers() == reference.getUsers() );
+        BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, reference.getNodes() )
+        {
+            const OSMNode &node = *resumed.getNodes().find( v.first )->second;
+            BOOST_CHECK_EQUAL( node.getFixedLat(), v.second->getFixedLat() );
+            BOOST_CHECK_EQUAL( node.getFixedLon(), v.second->getFixedLon() );
+            BOOST_CHECK( node.getTags() == v.second->getTags() );
+        }
+        BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, reference.getWays() )
+        {
+            BOOST_CHECK( resumed.getWays().find( v.first )->second->getNodes() == v.second->getNodes() );
+        }
+
+        remove( fileNames[i].c_str() );
+    }
+}
+
 void tempMapQuery()
 {
     //std::ofstream ofs( "temp.txt" );
@@ -366,8 +1566,440 @@ void testQuadTree()
         BOOST_CHECK_CLOSE( nearest.m_x, qtPoint.get<0>(), 1e-14 );
         BOOST_CHECK_CLOSE( nearest.m_y, qtPoint.get<1>(), 1e-14 );
     }
+
+    // Fixed point: the same answers as the same points in degrees
+    typedef QuadTree<coord_t, std::string> fixedQt_t;
+    fixedQt_t fixedQt( 7, toFixed( -10.0 ), toFixed( 10.0 ), toFixed( -10.0 ), toFixed( 10.0 ) );
+    qt_t degreesQt( 7, -10.0, 10.0, -10.0, 10.0 );
+    boost::uniform_int<coord_t> uFixed( toFixed( -10.0 ), toFixed( 10.0 ) );
+    for ( int i = 0; i < 2000; i++ )
+    {
+        XYPoint<coord_t> point( uFixed( rng ), uFixed( rng ) );
+        std::string name = boost::str( boost::format( "insertion %d" ) % i );
+        fixedQt.add( point.m_x, point.m_y, name );
+        degreesQt.add( fromFixed( point.m_x ), fromFixed( point.m_y ), name );
+    }
+    for ( int i = 0; i < 100; i++ )
+    {
+        XYPoint<coord_t> point( uFixed( rng ), uFixed( rng ) );
+        XYPoint<double> degrees( fromFixed( point.m_x ), fromFixed( point.m_y ) );
+        BOOST_CHECK_EQUAL( fixedQt.closestPoint( point ).get<2>(), degreesQt.closestPoint( degrees ).get<2>() );
+    }
+
+    // Over the whole globe, whose width overflows a coord_t
+    fixedQt_t globe( 12, toFixed( -90.0 ), toFixed( 90.0 ), toFixed( -180.0 ), toFixed( 180.0 ) );
+    boost::uniform_int<coord_t> uLat( toFixed( -89.0 ), toFixed( 89.0 ) );
+    boost::uniform_int<coord_t> uLon( toFixed( -179.0 ), toFixed( 179.0 ) );
+    std::vector<XYPoint<coord_t> > globePoints;
+    for ( int i = 0; i < 2000; i++ )
+    {
+        XYPoint<coord_t> point( uLat( rng ), uLon( rng ) );
+        globe.add( point.m_x, point.m_y, boost::str( boost::format( "insertion %d" ) % i ) );
+        globePoints.push_back( point );
+    }
+    for ( int i = 0; i < 2000; i += 40 )
+    {
+        fixedQt_t::coordEl_t found = globe.closestPoint( globePoints[i] );
+        BOOST_CHECK_EQUAL( found.get<0>(), globePoints[i].m_x );
+        BOOST_CHECK_EQUAL( found.get<1>(), globePoints[i].m_y );
+    }
+}
+
+
+void testWayNodes()
+{
+    WayNodeList first, second, empty;
+    for ( dbId_t nodeId = 10; nodeId < 15; nodeId++ )
+    {
+        first.push_back( nodeId );
+    }
+    second.push_back( 20 );
+    second.push_back( 10 );
+
+    boost::shared_ptr<WayNodePool> pool( new WayNodePool() );
+    first.moveTo( pool );
+    empty.moveTo( pool );
+    second.moveTo( pool );
+    BOOST_CHECK( first.isIn( pool ) );
+    BOOST_CHECK_EQUAL( pool->rows(), 3U );
+    BOOST_CHECK_EQUAL( pool->size(), 7U );
+
+    // Rows end to end, in the order moved
+    BOOST_REQUIRE_EQUAL( first.range().size(), 5 );
+    BOOST_CHECK_EQUAL( first.range().front(), 10U );
+    BOOST_CHECK_EQUAL( first.range().back(), 14U );
+    BOOST_CHECK( empty.range().empty() );
+    BOOST_CHECK( second.range().begin() == first.range().end() );
+    BOOST_CHECK_EQUAL( second.range()[1], 10U );
+
+    // Moving again is a no-op, and a change takes the nodes back out
+    first.moveTo( pool );
+    BOOST_CHECK_EQUAL( pool->rows(), 3U );
+    second.push_back( 30 );
+    BOOST_CHECK( !second.isIn( pool ) );
+    BOOST_REQUIRE_EQUAL( second.range().size(), 3 );
+    BOOST_CHECK_EQUAL( second.range()[0], 20U );
+    BOOST_CHECK_EQUAL( second.range()[2], 30U );
+
+    // A fragment pools the nodes of every way it kept when the read ends
+    OSMFragment fragment;
+    readOSMXMLRaw( "testing/testinput.xml", fragment );
+    const OSMWay &way = *fragment.getWays().find( 3236218 )->second;
+    BOOST_CHECK_EQUAL( fragment.getWayNodePool().rows(), fragment.getWays().size() );
+    BOOST_CHECK_EQUAL( fragment.getWayNodePool().size(), way.getNodes().size() );
+    BOOST_CHECK_EQUAL( way.getNodes().front(), 336846U );
+    BOOST_CHECK_EQUAL( way.getNodes().back(), 336848U );
+}
+
+struct ArenaCounted
+{
+    static int live;
+    int m_value;
+
+    ArenaCounted() : m_value( 0 ) { live++; }
+    ArenaCounted( const ArenaCounted &other ) : m_value( other.m_value ) { live++; }
+    ~ArenaCounted() { live--; }
+};
+int ArenaCounted::live = 0;
+
+void testObjectArena()
+{
+    {
+        ObjectArena<ArenaCounted> arena, other;
+
+        // Enough for several blocks: earlier objects must not move
+        std::vector<ArenaCounted *> made;
+        for ( int i = 0; i < 50000; i++ )
+        {
+            ArenaCounted *object = arena.create();
+            object->m_value = i;
+            made.push_back( object );
+        }
+        BOOST_CHECK_EQUAL( arena.size(), 50000U );
+        BOOST_CHECK_EQUAL( ArenaCounted::live, 50000 );
+        BOOST_CHECK_EQUAL( made[0]->m_value, 0 );
+        BOOST_CHECK_EQUAL( made[49999]->m_value, 49999 );
+
+        ArenaCounted *copy = other.create( *made[123] );
+        BOOST_CHECK_EQUAL( copy->m_value, 123 );
+
+        arena.splice( other );
+        BOOST_CHECK_EQUAL( arena.size(), 50001U );
+        BOOST_CHECK_EQUAL( other.size(), 0U );
+        BOOST_CHECK_EQUAL( copy->m_value, 123 );
+        BOOST_CHECK_EQUAL( arena.create()->m_value, 0 );
+        BOOST_CHECK_EQUAL( ArenaCounted::live, 50002 );
+    }
+
+    // Every object destroyed with the arenas
+    BOOST_CHECK_EQUAL( ArenaCounted::live, 0 );
+
+    // A merged fragment's objects outlive the fragment they were read into
+    OSMFragment merged;
+    {
+        OSMFragment part;
+        readOSMXMLRaw( "testing/testinput.xml", part );
+        merged.merge( part );
+    }
+    BOOST_REQUIRE_EQUAL( merged.getWays().size(), 1U );
+    BOOST_CHECK_EQUAL( merged.getWays().begin()->second->getNodes().size(), 3 );
+    BOOST_CHECK_EQUAL( merged.getWays().begin()->second->getTags().find( "highway" )->second, "tertiary" );
+}
+
+void testInterpolationSearch()
+{
+    // Against std::lower_bound, for ids spread evenly, in clusters (where
+    // the guesses are poor) and repeated
+    boost::mt19937 rng( 42 );
+    std::vector<std::vector<boost::uint64_t> > idSets( 3 );
+    for ( boost::uint64_t id = 1; idSets[0].size() < 10000; id += 1 + rng() % 8 )
+    {
+        idSets[0].push_back( id );
+    }
+    for ( size_t i = 0; i < 10000; i++ )
+    {
+        idSets[1].push_back( i < 9000 ? i : 4000000000ULL + i * 1000 );
+    }
+    for ( size_t i = 0; i < 100; i++ )
+    {
+        idSets[2].push_back( i / 10 );
+    }
+
+    BOOST_FOREACH( const std::vector<boost::uint64_t> &ids, idSets )
+    {
+        for ( size_t i = 0; i < 2000; i++ )
+        {
+            boost::uint64_t id = i % 2 ? ids[rng() % ids.size()] : rng() % (ids.back() + 2);
+            BOOST_CHECK( interpolationLowerBound( ids.begin(), ids.end(), id ) == std::lower_bound( ids.begin(), ids.end(), id ) );
+        }
+    }
+
+    std::vector<boost::uint64_t> empty;
+    BOOST_CHECK( interpolationLowerBound( empty.begin(), empty.end(), 5 ) == empty.end() );
+
+    // IdMap finds through it too
+    IdMap<int> map;
+    BOOST_FOREACH( boost::uint64_t id, idSets[1] )
+    {
+        map.insert( std::make_pair( id, int( id % 1000 ) ) );
+    }
+    BOOST_CHECK( map.find( 4009500000ULL ) != map.end() );
+    BOOST_CHECK( map.find( 9000 ) == map.end() );
+}
+
+void testCompactMetadata()
+{
+    OSMWay way;
+    BOOST_CHECK( !way.hasMetadata() );
+    BOOST_CHECK( way.getTimeStamp().is_special() );
+
+    way.setBaseData( 5, boost::posix_time::time_from_string( "2008-03-02 22:38:37" ), "someone", 7 );
+    BOOST_CHECK( way.hasMetadata() && way.hasUser() );
+    BOOST_CHECK_EQUAL( way.getTimeStamp(), boost::posix_time::time_from_string( "2008-03-02 22:38:37" ) );
+    BOOST_CHECK_EQUAL( way.getEpochTimeStamp(), ptimeToEpoch( way.getTimeStamp() ) );
+    BOOST_CHECK_EQUAL( way.getUser(), "someone" );
+    BOOST_CHECK_EQUAL( way.getUserId(), 7U );
+
+    // Past 2038 still fits, as the count is unsigned
+    way.setBaseData( 5, boost::posix_time::time_from_string( "2100-01-01 00:00:00" ), "none", 0 );
+    BOOST_CHECK_EQUAL( way.getTimeStamp(), boost::posix_time::time_from_string( "2100-01-01 00:00:00" ) );
+    BOOST_CHECK( !way.hasUser() );
+
+    // Out of range timestamps are clamped rather than failing the load
+    way.setBaseData( 5, boost::posix_time::time_from_string( "1969-12-31 23:59:59" ), "someone", 7 );
+    BOOST_CHECK( way.getTimeStamp().is_special() );
+    BOOST_CHECK_EQUAL( way.getUser(), "someone" );
+    way.setBaseData( 5, epochTime_t( 1 ) << 32, ConstTagString( "someone" ), 7 );
+    BOOST_CHECK_EQUAL( way.getEpochTimeStamp(), epochTime_t( 0xFFFFFFFF ) );
+
+    way.clearMetadata();
+    BOOST_CHECK_EQUAL( way.getId(), 5U );
+    BOOST_CHECK( !way.hasMetadata() );
+    BOOST_CHECK( way.getTimeStamp().is_special() );
+    BOOST_CHECK_EQUAL( way.getUser(), "" );
+
+    // Dropped while reading, from each reader
+    OSMFragment full, dropped, droppedPbf, droppedColumnar;
+    dropped.setDropMetadata( true );
+    droppedPbf.setDropMetadata( true );
+    droppedColumnar.setDropMetadata( true );
+    droppedColumnar.setColumnarNodes( true );
+    readOSMXMLRaw( "testing/testinput.xml", full );
+    readOSMXMLRaw( "testing/testinput.xml", dropped );
+    readOSMPBF( "testing/testinput.osm.pbf", droppedPbf );
+    readOSMXMLRaw( "testing/testinput.xml", droppedColumnar );
+
+    BOOST_CHECK( !full.getUsers().empty() );
+    OSMFragment *droppedFragments[] = { &dropped, &droppedPbf, &droppedColumnar };
+    BOOST_FOREACH( OSMFragment *frag, droppedFragments )
+    {
+        BOOST_CHECK( frag->getUsers().empty() );
+        BOOST_CHECK_EQUAL( frag->getWays().size(), full.getWays().size() );
+        BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, frag->getWays() )
+        {
+            BOOST_CHECK( !v.second->hasMetadata() );
+            BOOST_CHECK( v.second->getNodes() == full.getWays().find( v.first )->second->getNodes() );
+        }
+        BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, frag->getRelations() )
+        {
+            BOOST_CHECK( !v.second->hasMetadata() );
+        }
+        BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, frag->getNodes() )
+        {
+            BOOST_CHECK( !v.second->hasMetadata() );
+        }
+    }
+    BOOST_REQUIRE_EQUAL( droppedColumnar.getNodeStore().size(), full.getNodes().size() );
+    BOOST_FOREACH( const NodeStore::Node &node, droppedColumnar.getNodeStore() )
+    {
+        BOOST_CHECK( node.getTimeStamp().is_special() );
+        BOOST_CHECK_EQUAL( node.getUserId(), 0U );
+    }
+
+    // A fragment read with metadata merged into one without
+    OSMFragment merged;
+    merged.setDropMetadata( true );
+    merged.merge( full );
+    BOOST_CHECK( merged.getUsers().empty() );
+    BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, merged.getWays() )
+    {
+        BOOST_CHECK( !v.second->hasMetadata() );
+    }
 }
 
+void testSnapshot()
+{
+    OSMFragment original;
+    readOSMXMLRaw( "testing/testinput.xml", original );
+    writeSnapshot( original, "testing/snapshot.bin" );
+    BOOST_CHECK( isSnapshot( "testing/snapshot.bin" ) );
+    BOOST_CHECK( !isSnapshot( "testing/testinput.xml" ) );
+
+    OSMFragment loaded;
+    loadSnapshot( "testing/snapshot.bin", loaded );
+    BOOST_CHECK_EQUAL( loaded.getVersion(), original.getVersion() );
+    BOOST_CHECK_EQUAL( loaded.getGenerator(), original.getGenerator() );
+    BOOST_CHECK( loaded.getUsers() == original.getUsers() );
+
+    // Nodes come back columnar
+    BOOST_CHECK( loaded.getNodes().empty() );
+    BOOST_REQUIRE_EQUAL( loaded.getNodeStore().size(), original.getNodes().size() );
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, original.getNodes() )
+    {
+        NodeStore::const_iterator storeIt = loaded.getNodeStore().find( v.first );
+        BOOST_REQUIRE( storeIt != loaded.getNodeStore().end() );
+        BOOST_CHECK_EQUAL( storeIt->getFixedLat(), v.second->getFixedLat() );
+        BOOST_CHECK_EQUAL( storeIt->getFixedLon(), v.second->getFixedLon() );
+        BOOST_CHECK_EQUAL( storeIt->getTimeStamp(), v.second->getTimeStamp() );
+        BOOST_CHECK_EQUAL( storeIt->getUser(), v.second->getUser() );
+        BOOST_CHECK_EQUAL( storeIt->getUserId(), v.second->getUserId() );
+        const TagList &tags = v.second->getTags();
+        BOOST_REQUIRE_EQUAL( size_t( storeIt->getTags().size() ), tags.size() );
+        BOOST_CHECK( std::equal( tags.begin(), tags.end(), storeIt->getTags().begin() ) );
+    }
+
+    BOOST_REQUIRE_EQUAL( loaded.getWays().size(), original.getWays().size() );
+    BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, original.getWays() )
+    {
+        OSMFragment::wayMap_t::const_iterator findIt = loaded.getWays().find( v.first );
+        BOOST_REQUIRE( findIt != loaded.getWays().end() );
+        const OSMWay &way = *findIt->second;
+        BOOST_CHECK_EQUAL( way.getTimeStamp(), v.second->getTimeStamp() );
+        BOOST_CHECK_EQUAL( way.getUser(), v.second->getUser() );
+        BOOST_CHECK_EQUAL( way.getVisible(), v.second->getVisible() );
+        BOOST_CHECK( way.getTags() == v.second->getTags() );
+        BOOST_CHECK( std::equal( way.getNodes().begin(), way.getNodes().end(), v.second->getNodes().begin() ) );
+        BOOST_CHECK_EQUAL( way.getNodes().size(), v.second->getNodes().size() );
+    }
+
+    BOOST_REQUIRE_EQUAL( loaded.getRelations().size(), original.getRelations().size() );
+    BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, original.getRelations() )
+    {
+        OSMFragment::relationMap_t::const_iterator findIt = loaded.getRelations().find( v.first );
+        BOOST_REQUIRE( findIt != loaded.getRelations().end() );
+        BOOST_CHECK( findIt->second->getTags() == v.second->getTags() );
+        BOOST_CHECK( findIt->second->getMembers() == v.second->getMembers() );
+    }
+
+    // A columnar fragment writes the same file
+    OSMFragment columnar;
+    columnar.setColumnarNodes( true );
+    readOSMXMLRaw( "testing/testinput.xml", columnar );
+    writeSnapshot( columnar, "testing/snapshot2.bin" );
+    OSMFragment reloaded;
+    loadSnapshot( "testing/snapshot2.bin", reloaded );
+    BOOST_CHECK_EQUAL( reloaded.getNodeStore().size(), loaded.getNodeStore().size() );
+    BOOST_CHECK_EQUAL( reloaded.getWays().size(), loaded.getWays().size() );
+    // Equal tag sets are still shared once loaded
+    BOOST_CHECK_EQUAL( reloaded.getTagPool().sets(), columnar.getTagPool().sets() );
+    remove( "testing/snapshot2.bin" );
+
+    // Only into a fragment with nothing in it
+    BOOST_CHECK_THROW( loadSnapshot( "testing/snapshot.bin", original ), std::logic_error );
+
+    // A damaged byte fails its section's checksum: this one is the first
+    // node id, just after the header and section table
+    {
+        std::fstream file( "testing/snapshot.bin", std::ios_base::in | std::ios_base::out | std::ios_base::binary );
+        file.seekp( 584 );
+        file.put( 0x55 );
+    }
+    OSMFragment damaged;
+    BOOST_CHECK_THROW( loadSnapshot( "testing/snapshot.bin", damaged ), std::runtime_error );
+    remove( "testing/snapshot.bin" );
+}
+
+void testTagList()
+{
+    TagList tags;
+    BOOST_CHECK( tags.empty() );
+    BOOST_CHECK( tags.find( "highway" ) == tags.end() );
+
+    // Kept in key order, and as with a map the first value for a key wins
+    BOOST_CHECK( tags.insert( tag_t( "name", "Meadow Prospect" ) ) );
+    BOOST_CHECK( tags.insert( tag_t( "highway", "tertiary" ) ) );
+    BOOST_CHECK( !tags.insert( tag_t( "highway", "primary" ) ) );
+    BOOST_REQUIRE_EQUAL( tags.size(), 2U );
+    BOOST_CHECK( tags.begin()->first < (tags.begin() + 1)->first );
+    BOOST_CHECK_EQUAL( tags.find( "highway" )->second, "tertiary" );
+    BOOST_CHECK_EQUAL( tags.find( "name" )->second, "Meadow Prospect" );
+
+    // Past the scan limit lookups are a binary search
+    TagList many;
+    for ( int i = 0; i < 20; i++ )
+    {
+        many.insert( tag_t( "key" + boost::lexical_cast<std::string>( i ), boost::lexical_cast<std::string>( i ) ) );
+    }
+    BOOST_CHECK_EQUAL( many.find( "key13" )->second, "13" );
+    BOOST_CHECK( many.find( "key20" ) == many.end() );
+
+    boost::shared_ptr<TagPool> pool( new TagPool() );
+    TagList copy( tags );
+    tags.moveTo( pool );
+    many.moveTo( pool );
+    BOOST_CHECK( tags.isIn( pool ) );
+    BOOST_CHECK_EQUAL( pool->size(), 22U );
+    BOOST_CHECK( tags == copy );
+    BOOST_CHECK_EQUAL( many.find( "key13" )->second, "13" );
+
+    // Moving again is a no-op, and equal tags are held once with one set id
+    tags.moveTo( pool );
+    BOOST_CHECK_EQUAL( pool->size(), 22U );
+    TagList same( copy ), none;
+    same.moveTo( pool );
+    none.moveTo( pool );
+    BOOST_CHECK_EQUAL( same.getSetId(), tags.getSetId() );
+    BOOST_CHECK( same.getSetId() != many.getSetId() );
+    BOOST_CHECK_EQUAL( none.getSetId(), TagPool::emptySet );
+    BOOST_CHECK( none.begin() == none.end() );
+    BOOST_CHECK_EQUAL( pool->size(), 22U );
+    BOOST_CHECK_EQUAL( pool->sets(), 3U );
+    BOOST_CHECK_EQUAL( pool->references(), 24U );
+
+    // Still found once the hash table has grown
+    std::vector<TagList> refs( 2000 );
+    for ( size_t i = 0; i < refs.size(); i++ )
+    {
+        refs[i].insert( tag_t( "ref", boost::lexical_cast<std::string>( i ) ) );
+        refs[i].moveTo( pool );
+    }
+    for ( size_t i = 0; i < refs.size(); i += 7 )
+    {
+        TagList again;
+        again.insert( tag_t( "ref", boost::lexical_cast<std::string>( i ) ) );
+        again.moveTo( pool );
+        BOOST_CHECK_EQUAL( again.getSetId(), refs[i].getSetId() );
+    }
+    BOOST_CHECK_EQUAL( pool->sets(), 2003U );
+    BOOST_CHECK_EQUAL( same.find( "name" )->second, "Meadow Prospect" );
+
+    // A change takes the tags back out
+    BOOST_CHECK( tags.insert( tag_t( "created_by", "Potlatch 0.7b" ) ) );
+    BOOST_CHECK( !tags.isIn( pool ) );
+    BOOST_CHECK_EQUAL( tags.size(), 3U );
+    BOOST_CHECK( tags != copy );
+    BOOST_CHECK_EQUAL( tags.find( "highway" )->second, "tertiary" );
+
+    // A fragment pools the tags of everything it kept when the read ends
+    OSMFragment fragment;
+    readOSMXMLRaw( "testing/testinput.xml", fragment );
+    size_t total = 0;
+    BOOST_FOREACH( const OSMFragment::nodeMap_t::value_type &v, fragment.getNodes() )
+    {
+        total += v.second->getTags().size();
+    }
+    BOOST_FOREACH( const OSMFragment::wayMap_t::value_type &v, fragment.getWays() )
+    {
+        total += v.second->getTags().size();
+    }
+    BOOST_FOREACH( const OSMFragment::relationMap_t::value_type &v, fragment.getRelations() )
+    {
+        total += v.second->getTags().size();
+    }
+    BOOST_CHECK_EQUAL( fragment.getTagPool().references(), total );
+    BOOST_CHECK( fragment.getTagPool().size() <= total );
+    BOOST_CHECK_EQUAL( fragment.getWays().find( 3236218 )->second->getTags().find( "highway" )->second, "tertiary" );
+}
 
 void testConstTagString()
 {
@@ -393,6 +2025,21 @@ void testConstTagString()
     BOOST_ASSERT( a != "Twelve" );
 
     BOOST_CHECK_EQUAL( ConstTagString::numStrings(), 5 );
+
+    // Across several of the table's chunks, and past the per-thread cache
+    std::vector<ConstTagString> many;
+    for ( size_t i = 0; i < 10000; i++ )
+    {
+        many.push_back( ConstTagString( boost::lexical_cast<std::string>( i ) + "th" ) );
+    }
+    BOOST_CHECK_EQUAL( ConstTagString::numStrings(), 10005U );
+    for ( size_t i = 0; i < many.size(); i++ )
+    {
+        BOOST_CHECK_EQUAL( many[i].toString(), boost::lexical_cast<std::string>( i ) + "th" );
+        BOOST_CHECK( ConstTagString( boost::lexical_cast<std::string>( i ) + "th" ) == many[i] );
+    }
+    BOOST_CHECK_EQUAL( ConstTagString::numStrings(), 10005U );
+    BOOST_CHECK_EQUAL( ConstTagString( "Four" ), d );
 }
 
 boost::unit_test::test_suite* init_unit_test_suite( int argc, char **argv )
@@ -406,6 +2053,32 @@ boost::unit_test::test_suite* init_unit_test_suite( int argc, char **argv )
     test->add( BOOST_TEST_CASE( &testConstTagString ) );
 
     test->add( BOOST_TEST_CASE( &xmlParseTestFn ) );
+    test->add( BOOST_TEST_CASE( &xmlRawParseTestFn ) );
+    test->add( BOOST_TEST_CASE( &testRawTokenizer ) );
+    test->add( BOOST_TEST_CASE( &testParallelBzip2 ) );
+    test->add( BOOST_TEST_CASE( &testReadAhead ) );
+    test->add( BOOST_TEST_CASE( &testCheckpointedRead ) );
+    test->add( BOOST_TEST_CASE( &testIngestPipeline ) );
+    test->add( BOOST_TEST_CASE( &testAttributeSchema ) );
+    test->add( BOOST_TEST_CASE( &testTimestamp ) );
+    test->add( BOOST_TEST_CASE( &testElementDispatch ) );
+    test->add( BOOST_TEST_CASE( &testFrameStack ) );
+    test->add( BOOST_TEST_CASE( &testIngestFilter ) );
+    test->add( BOOST_TEST_CASE( &testPBFRead ) );
+    test->add( BOOST_TEST_CASE( &testParallelParse ) );
+    test->add( BOOST_TEST_CASE( &testOSMStream ) );
+    test->add( BOOST_TEST_CASE( &testTruncatedXML ) );
+    test->add( BOOST_TEST_CASE( &testTwoPassRead ) );
+    test->add( BOOST_TEST_CASE( &testNodeLocations ) );
+    test->add( BOOST_TEST_CASE( &testFixedCoords ) );
+    test->add( BOOST_TEST_CASE( &testIdMap ) );
+    test->add( BOOST_TEST_CASE( &testNodeStore ) );
+    test->add( BOOST_TEST_CASE( &testTagList ) );
+    test->add( BOOST_TEST_CASE( &testWayNodes ) );
+    test->add( BOOST_TEST_CASE( &testObjectArena ) );
+    test->add( BOOST_TEST_CASE( &testSnapshot ) );
+    test->add( BOOST_TEST_CASE( &testInterpolationSearch ) );
+    test->add( BOOST_TEST_CASE( &testCompactMetadata ) );
     //test->add( BOOST_TEST_CASE( &tempMapQuery ) );
     return test;
 }
@@ -1,8 +1,10 @@
 #include "xml_reader.hpp"
 #include "osm_data.hpp"
+#include "osm_stream.hpp"
 #include "dbhandler.hpp"
 
 #include <string>
+#include <vector>
 #include <iostream>
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
@@ -10,21 +12,51 @@
 #include <boost/date_time/gregorian/gregorian_types.hpp>
 
 
-// void readOSMXML( XercesInitWrapper &x, const std::string &fileName, OSMFragment &frag )
-// {
-//     xercesc::SAX2XMLReaderImpl &parser = x.getParser();
-
-//     boost::shared_ptr<XMLNodeData> startNdData( new XMLNodeData() );
+typedef boost::tuples::cons<
+    std::string,              boost::tuples::cons<
+    dbId_t,                   boost::tuples::cons<
+    int,                      boost::tuples::cons<
+    std::string,              boost::tuples::cons<
+    boost::posix_time::ptime, boost::tuples::cons<
+    std::string,              boost::tuples::cons<
+    int,                      boost::tuples::cons<
+    std::string,              boost::tuples::cons<
+    double,                   boost::tuples::cons<
+    double,                   boost::tuples::cons<
+    int,                      boost::tuples::cons<
+    int,                      boost::tuples::cons<
+    std::string,              boost::tuples::cons<
+    std::string,              boost::tuples::null_type> > > > > > > > > > > > > > userRow_t;
+
+
+// Only the users are wanted, so nothing else from the file is kept
+class UserCollector : public OSMVisitor
+{
+private:
+    boost::posix_time::ptime  m_now;
+    std::vector<userRow_t>   &m_userRows;
+
+public:
+    UserCollector( const boost::posix_time::ptime &now, std::vector<userRow_t> &userRows ) :
+        m_now( now ),
+        m_userRows( userRows )
+    {
+    }
 
-//     startNdData->registerMembers()( "osm", boost::bind( &OSMFragment::build, &frag, _1 ) );
+    void onUser( dbId_t userId, const std::string &userName )
+    {
+        userRow_t newUser;
 
-//     XMLReader handler( startNdData );
+        newUser.get<0>() = userName + "@blah.com";
+        newUser.get<1>() = userId;
+        newUser.get<4>() = m_now;
+        newUser.get<5>() = userName;
 
-//     parser.setContentHandler( &handler );
-//     parser.setErrorHandler( &handler );
+        m_userRows.push_back( newUser );
 
-//     parser.parse( fileName.c_str() );
-// }
+        std::cout << "User id: " << userId << ", with name: " << userName << std::endl;
+    }
+};
 
 
 int main( int argc, char **argv )
@@ -39,47 +71,13 @@ int main( int argc, char **argv )
 
     try
     {
-        XercesInitWrapper x;
-
-        OSMFragment fragment;
-         
-        readOSMXML( x, fileName, fragment );
-
         boost::posix_time::ptime now(
             boost::gregorian::date( 2008, 06, 13 ),
             boost::posix_time::time_duration( 17, 0, 0 ) );
 
-        typedef boost::tuples::cons<
-            std::string,              boost::tuples::cons<
-            dbId_t,                   boost::tuples::cons<
-            int,                      boost::tuples::cons<
-            std::string,              boost::tuples::cons<
-            boost::posix_time::ptime, boost::tuples::cons<
-            std::string,              boost::tuples::cons<
-            int,                      boost::tuples::cons<
-            std::string,              boost::tuples::cons<
-            double,                   boost::tuples::cons<
-            double,                   boost::tuples::cons<
-            int,                      boost::tuples::cons<
-            int,                      boost::tuples::cons<
-            std::string,              boost::tuples::cons<
-            std::string,              boost::tuples::null_type> > > > > > > > > > > > > > userRow_t;
-
-
         std::vector<userRow_t> userRows;
-        BOOST_FOREACH( const OSMFragment::userMap_t::value_type &v, fragment.getUsers() )
-        {
-            userRow_t newUser;
-
-            newUser.get<0>() = v.second + "@blah.com";
-            newUser.get<1>() = v.first;
-            newUser.get<4>() = now;
-            newUser.get<5>() = v.second;
-            
-            userRows.push_back( newUser );
-
-            std::cout << "User id: " << v.first << ", with name: " << v.second << std::endl;
-        }
+        UserCollector collector( now, userRows );
+        streamOSMFile( fileName, collector );
 
         std::string insertQuery = "INSERT INTO users VALUES( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ? )";
         modosmapi::DbConnection db("localhost", "openstreetmap", "openstreetmap", "openstreetmap" );
@@ -88,11 +86,6 @@ int main( int argc, char **argv )
         db.executeBulkInsert( insertQuery, userRows );
                                                                                   
     }
-    catch ( const xercesc::XMLException &toCatch )
-    {
-        std::cerr << "Exception thrown in XML parse" << std::endl;
-        throw;
-    }
     catch ( const std::exception &e )
     {
         std::cerr << "Exception thrown in XML parse: " << e.what() << std::endl;